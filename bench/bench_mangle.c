@@ -0,0 +1,530 @@
+/*
+ * Benchmarks for the C mask engine.
+ *
+ * A synthetic mask is written to a temporary file and read back, or a real
+ * mask is read with --file.  The synthetic polygons are cells of an equal
+ * area grid in cos(theta) and phi, starting at the equator, each bounded by
+ * four caps plus --ncaps-4 redundant caps that contain the cell.  The grid is
+ * a subdivision of the simple pixelization, so with --pixelres each polygon
+ * lies in a single pixel.
+ *
+ * Timed are the read, single point and batch searches, the simple scheme
+ * pixel calculations and random point generation.  Results are written to
+ * stdout as JSON, with points/sec and ns/point for each workload and the
+ * peak resident set size.
+ *
+ * usage
+ *   mangle_bench [--npoly N] [--ncaps C] [--pixelres R] [--npoints M]
+ *                [--file mask.ply] [--repeat K] [--seed S] [--quick]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/resource.h>
+
+#include "mangle.h"
+#include "pixel.h"
+#include "point.h"
+#include "rand.h"
+#include "cap.h"
+
+struct BenchConfig {
+    long npoly;
+    long ncaps;
+    long pixelres;
+    long npoints;
+    long repeat;
+    long seed;
+    const char* file;
+
+    // range of the points, in cos(theta) and phi
+    double zmin, zmax, phimax;
+};
+
+struct BenchResult {
+    const char* name;
+    long n;
+    double seconds;
+};
+
+#define BENCH_MAX_RESULTS 32
+
+struct BenchResults {
+    size_t size;
+    struct BenchResult data[BENCH_MAX_RESULTS];
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+static void bench_add(struct BenchResults* self,
+                      const char* name,
+                      long n,
+                      double seconds)
+{
+    if (self->size < BENCH_MAX_RESULTS) {
+        self->data[self->size].name = name;
+        self->data[self->size].n = n;
+        self->data[self->size].seconds = seconds;
+        self->size++;
+    }
+}
+
+/*
+ * the finest simple pixelization level used for the grid: fine enough for
+ * npoly cells in the southern half of the sky, and no coarser than pixelres
+ */
+static long bench_grid_level(const struct BenchConfig* conf)
+{
+    long level=1;
+    while ( (1L<<(2*level-1)) < conf->npoly ) {
+        level++;
+    }
+    if (level < conf->pixelres) {
+        level = conf->pixelres;
+    }
+    return level;
+}
+
+static void bench_write_cap(FILE* fptr,
+                            double x, double y, double z, double cm)
+{
+    fprintf(fptr, " %.19g %.19g %.19g %.19g\n", x, y, z, cm);
+}
+
+/*
+ * write the synthetic mask and set the range of the points to cover it
+ * with some margin
+ */
+static int bench_write_mask(struct BenchConfig* conf, const char* fname)
+{
+    FILE* fptr=NULL;
+    long level=0, ngrid=0, ipoly=0, row=0, col=0, icap=0, nrow=0;
+    double z1, z2, p1, p2, zc, pc, sthc, area;
+    int64 pix=0;
+    struct Point pt;
+
+    if (!(fptr = fopen(fname, "w"))) {
+        fprintf(stderr, "could not open %s for writing\n", fname);
+        return 0;
+    }
+
+    level = bench_grid_level(conf);
+    ngrid = 1L<<level;
+
+    fprintf(fptr, "%ld polygons\n", conf->npoly);
+    if (conf->pixelres >= 0) {
+        fprintf(fptr, "pixelization %lds\n", conf->pixelres);
+    }
+    fprintf(fptr, "snapped\nbalkanized\n");
+
+    for (ipoly=0; ipoly<conf->npoly; ipoly++) {
+        // rows run from the equator toward the south pole
+        row = ngrid/2 + ipoly/ngrid;
+        col = ipoly % ngrid;
+
+        z2 = 1.0 - 2.0*row/ngrid;
+        z1 = 1.0 - 2.0*(row+1)/ngrid;
+        p1 = 2*M_PI*col/ngrid;
+        p2 = 2*M_PI*(col+1)/ngrid;
+        area = (z2-z1)*(p2-p1);
+
+        zc = 0.5*(z1+z2);
+        pc = 0.5*(p1+p2);
+        sthc = sqrt(1.0-zc*zc);
+
+        pix = 0;
+        if (conf->pixelres >= 0) {
+            point_set_from_thetaphi(&pt, acos(zc), pc);
+            pix = get_pixel_simple(conf->pixelres, &pt);
+        }
+
+        fprintf(fptr,
+                "polygon %ld ( %ld caps, 1 weight, %ld pixel, %.19g str):\n",
+                ipoly, conf->ncaps, pix, area);
+
+        bench_write_cap(fptr, 0, 0, 1, 1.0 - z1);
+        bench_write_cap(fptr, 0, 0, 1, -(1.0 - z2));
+        bench_write_cap(fptr, -sin(p1), cos(p1), 0, 1.0);
+        bench_write_cap(fptr, sin(p2), -cos(p2), 0, 1.0);
+
+        // redundant hemispheres centered on the cell
+        for (icap=4; icap<conf->ncaps; icap++) {
+            bench_write_cap(fptr, sthc*cos(pc), sthc*sin(pc), zc, 1.0);
+        }
+    }
+    fclose(fptr);
+
+    nrow = (conf->npoly + ngrid - 1)/ngrid;
+    conf->zmax = 1.0 - 2.0*(ngrid/2)/ngrid;
+    conf->zmin = 1.0 - 2.0*(ngrid/2 + nrow)/ngrid;
+    conf->phimax = (nrow > 1) ? 2*M_PI : 2*M_PI*conf->npoly/ngrid;
+
+    // a margin so some points fall outside
+    conf->zmin = fmax(conf->zmin - 0.1*(conf->zmax-conf->zmin), -1.0);
+    conf->phimax = fmin(conf->phimax*1.1, 2*M_PI);
+    return 1;
+}
+
+static void bench_make_points(const struct BenchConfig* conf,
+                              unsigned short* rng,
+                              long double* ra,
+                              long double* dec)
+{
+    long i=0;
+    long double theta=0, phi=0;
+
+    for (i=0; i<conf->npoints; i++) {
+        genrand_theta_phi_r(rng, conf->zmin, conf->zmax, 0, conf->phimax,
+                            &theta, &phi);
+        ra[i] = phi*R2D;
+        dec[i] = 90.0 - theta*R2D;
+    }
+}
+
+static long bench_peak_rss_kb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // kilobytes on linux
+    return usage.ru_maxrss;
+}
+
+static void bench_print_json(const struct BenchConfig* conf,
+                             const struct MangleMask* mask,
+                             const struct BenchResults* results,
+                             long found)
+{
+    size_t i=0;
+    const struct BenchResult* res=NULL;
+
+    printf("{\n");
+    printf("  \"config\": {\n");
+    printf("    \"file\": %s%s%s,\n",
+           conf->file ? "\"" : "", conf->file ? conf->file : "null",
+           conf->file ? "\"" : "");
+    printf("    \"npoly\": %ld,\n", (long) mask->npoly);
+    printf("    \"ncaps\": %ld,\n", conf->file ? -1 : conf->ncaps);
+    printf("    \"pixelres\": %ld,\n", (long) mask->pixelres);
+    printf("    \"pixeltype\": \"%c\",\n", mask->pixeltype);
+    printf("    \"npoints\": %ld,\n", conf->npoints);
+    printf("    \"repeat\": %ld,\n", conf->repeat);
+    printf("    \"seed\": %ld\n", conf->seed);
+    printf("  },\n");
+    printf("  \"found_fraction\": %.6f,\n",
+           conf->npoints > 0 ? ((double) found)/conf->npoints : 0.0);
+    printf("  \"results\": [\n");
+    for (i=0; i<results->size; i++) {
+        res = &results->data[i];
+        printf("    {\"name\": \"%s\", \"n\": %ld, \"seconds\": %.9g, "
+               "\"points_per_sec\": %.6g, \"ns_per_point\": %.6g}%s\n",
+               res->name, res->n, res->seconds,
+               res->seconds > 0 ? res->n/res->seconds : 0.0,
+               res->n > 0 ? 1.0e9*res->seconds/res->n : 0.0,
+               i+1 < results->size ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"peak_rss_kb\": %ld\n", bench_peak_rss_kb());
+    printf("}\n");
+}
+
+static void bench_usage(void)
+{
+    fprintf(stderr,
+        "usage: mangle_bench [options]\n"
+        "  --npoly N      polygons in the synthetic mask, default 10000\n"
+        "  --ncaps C      caps per polygon, at least 4, default 4\n"
+        "  --pixelres R   simple pixelization resolution, -1 for none,\n"
+        "                 default 6\n"
+        "  --npoints M    points to search, default 1000000\n"
+        "  --file F       read this mask instead of a synthetic one\n"
+        "  --repeat K     report the best of K runs, default 3\n"
+        "  --seed S       random seed, default 4721\n"
+        "  --quick        small sizes, for testing the harness\n");
+}
+
+static int bench_parse_args(struct BenchConfig* conf, int argc, char** argv)
+{
+    int opt=0;
+    static struct option options[] = {
+        {"npoly",    required_argument, 0, 'n'},
+        {"ncaps",    required_argument, 0, 'c'},
+        {"pixelres", required_argument, 0, 'r'},
+        {"npoints",  required_argument, 0, 'p'},
+        {"file",     required_argument, 0, 'f'},
+        {"repeat",   required_argument, 0, 'k'},
+        {"seed",     required_argument, 0, 's'},
+        {"quick",    no_argument,       0, 'q'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    conf->npoly = 10000;
+    conf->ncaps = 4;
+    conf->pixelres = 6;
+    conf->npoints = 1000000;
+    conf->repeat = 3;
+    conf->seed = 4721;
+    conf->file = NULL;
+    conf->zmin = -1;
+    conf->zmax = 1;
+    conf->phimax = 2*M_PI;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': conf->npoly = atol(optarg); break;
+            case 'c': conf->ncaps = atol(optarg); break;
+            case 'r': conf->pixelres = atol(optarg); break;
+            case 'p': conf->npoints = atol(optarg); break;
+            case 'f': conf->file = optarg; break;
+            case 'k': conf->repeat = atol(optarg); break;
+            case 's': conf->seed = atol(optarg); break;
+            case 'q':
+                conf->npoly = 500;
+                conf->npoints = 20000;
+                conf->repeat = 1;
+                break;
+            default:
+                bench_usage();
+                return 0;
+        }
+    }
+
+    if (conf->npoly < 1 || conf->ncaps < 4 || conf->npoints < 1
+            || conf->repeat < 1 || conf->pixelres > 20) {
+        bench_usage();
+        return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    int status=EXIT_SUCCESS;
+    struct BenchConfig conf;
+    struct BenchResults results = {0};
+    struct MangleMask* mask=NULL;
+    struct MangleQueryState state;
+    struct Point pt;
+    struct SimplePixel simplepix;
+    char fname[] = "/tmp/mangle_bench_XXXXXX";
+    const char* mask_file=NULL;
+    unsigned short rng[3];
+    long double *ra=NULL, *dec=NULL, *weight=NULL, theta=0, phi=0;
+    int64 *poly_id=NULL, *pix=NULL;
+    double *z=NULL, *phid=NULL;
+    double t0=0, best=0, dt=0;
+    long i=0, irep=0, found=0;
+    int fd=-1;
+
+    if (!bench_parse_args(&conf, argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    seed_random_state_from(rng, conf.seed);
+
+    if (conf.file) {
+        mask_file = conf.file;
+    } else {
+        if ((fd = mkstemp(fname)) < 0) {
+            fprintf(stderr, "could not create a temporary file\n");
+            return EXIT_FAILURE;
+        }
+        close(fd);
+        if (!bench_write_mask(&conf, fname)) {
+            status=EXIT_FAILURE;
+            goto _bench_bail;
+        }
+        mask_file = fname;
+    }
+
+    ra = malloc(conf.npoints*sizeof(long double));
+    dec = malloc(conf.npoints*sizeof(long double));
+    weight = malloc(conf.npoints*sizeof(long double));
+    poly_id = malloc(conf.npoints*sizeof(int64));
+    pix = malloc(conf.npoints*sizeof(int64));
+    z = malloc(conf.npoints*sizeof(double));
+    phid = malloc(conf.npoints*sizeof(double));
+    if (!ra || !dec || !weight || !poly_id || !pix || !z || !phid) {
+        fprintf(stderr, "could not allocate %ld points\n", conf.npoints);
+        status=EXIT_FAILURE;
+        goto _bench_bail;
+    }
+
+    // read
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        mask = mangle_free(mask);
+        mask = mangle_new();
+        t0 = bench_now();
+        if (!mangle_read(mask, mask_file)) {
+            fprintf(stderr, "could not read %s\n", mask_file);
+            status=EXIT_FAILURE;
+            goto _bench_bail;
+        }
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "read", (long) mask->npoly, best);
+
+    bench_make_points(&conf, rng, ra, dec);
+
+    // single point searches
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        t0 = bench_now();
+        for (i=0; i<conf.npoints; i++) {
+            point_set_from_radec(&pt, ra[i], dec[i]);
+            MANGLE_POLYID_AND_WEIGHT(mask, &pt, &poly_id[i], &weight[i]);
+        }
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "polyid_and_weight", conf.npoints, best);
+
+    for (i=0; i<conf.npoints; i++) {
+        found += (poly_id[i] >= 0);
+    }
+
+#define BENCH_BATCH(name, call) do {                                  \
+    best=-1;                                                          \
+    for (irep=0; irep<conf.repeat; irep++) {                          \
+        t0 = bench_now();                                             \
+        if (!(call)) {                                                \
+            fprintf(stderr, "%s failed: %s\n", name, state.err);      \
+            status=EXIT_FAILURE;                                      \
+            goto _bench_bail;                                         \
+        }                                                             \
+        dt = bench_now()-t0;                                          \
+        best = (best < 0 || dt < best) ? dt : best;                   \
+    }                                                                 \
+    bench_add(&results, name, conf.npoints, best);                    \
+} while (0)
+
+    mangle_query_state_init(&state, 0);
+    BENCH_BATCH("polyid_and_weight_many",
+                mangle_polyid_and_weight_many(mask, &state, conf.npoints,
+                                              ra, dec, poly_id, weight));
+    BENCH_BATCH("polyid_and_weight_sorted",
+                mangle_polyid_and_weight_sorted(mask, &state, conf.npoints,
+                                                ra, dec, poly_id, weight));
+    mangle_query_state_init(&state, 1);
+    BENCH_BATCH("polyid_and_weight_many_cached",
+                mangle_polyid_and_weight_many(mask, &state, conf.npoints,
+                                              ra, dec, poly_id, weight));
+
+    // simple scheme pixels; the resolution of the mask if pixelized
+    simplepix_init(&simplepix, mask->pixelres >= 0 ? mask->pixelres : 6);
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        t0 = bench_now();
+        for (i=0; i<conf.npoints; i++) {
+            point_set_from_radec(&pt, ra[i], dec[i]);
+            pix[i] = get_pixel_simple(simplepix.pixelres, &pt);
+        }
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "get_pixel_simple", conf.npoints, best);
+
+    for (i=0; i<conf.npoints; i++) {
+        point_set_from_radec(&pt, ra[i], dec[i]);
+        z[i] = pt.z;
+        phid[i] = pt.phi;
+    }
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        t0 = bench_now();
+        get_pixel_simple_many(&simplepix, conf.npoints, z, phid, pix);
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "get_pixel_simple_many", conf.npoints, best);
+
+    // randoms over the full sky, and randoms kept if in the mask
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        t0 = bench_now();
+        for (i=0; i<conf.npoints; i++) {
+            genrand_theta_phi_allsky_r(rng, &theta, &phi);
+            z[i] = theta;
+        }
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "genrand_allsky", conf.npoints, best);
+
+    best=-1;
+    for (irep=0; irep<conf.repeat; irep++) {
+        long ngood=0;
+        int64 id=0;
+        long double wt=0;
+
+        t0 = bench_now();
+        while (ngood < conf.npoints) {
+            genrand_theta_phi_r(rng, conf.zmin, conf.zmax, 0, conf.phimax,
+                                &theta, &phi);
+            point_set_from_thetaphi(&pt, theta, phi);
+            MANGLE_POLYID_AND_WEIGHT(mask, &pt, &id, &wt);
+            if (id >= 0) {
+                ngood++;
+            }
+        }
+        dt = bench_now()-t0;
+        best = (best < 0 || dt < best) ? dt : best;
+    }
+    bench_add(&results, "genrand_mask", conf.npoints, best);
+
+    // randoms in a cap, one at a time and in a batch
+    {
+        struct CapForRand rcap;
+        long double cra=0, cdec=0;
+
+        CapForRand_from_radec(&rcap, 200.0, 10.0, 1.0);
+
+        best=-1;
+        for (irep=0; irep<conf.repeat; irep++) {
+            t0 = bench_now();
+            for (i=0; i<conf.npoints; i++) {
+                genrand_cap_radec_r(rng, &rcap, -1, &cra, &cdec);
+                z[i] = cdec;
+            }
+            dt = bench_now()-t0;
+            best = (best < 0 || dt < best) ? dt : best;
+        }
+        bench_add(&results, "genrand_cap", conf.npoints, best);
+
+        best=-1;
+        for (irep=0; irep<conf.repeat; irep++) {
+            t0 = bench_now();
+            genrand_cap_radec_many(rng, &rcap, -1, conf.npoints, phid, z);
+            dt = bench_now()-t0;
+            best = (best < 0 || dt < best) ? dt : best;
+        }
+        bench_add(&results, "genrand_cap_many", conf.npoints, best);
+    }
+
+    bench_print_json(&conf, mask, &results, found);
+
+_bench_bail:
+    mask = mangle_free(mask);
+    free(ra);
+    free(dec);
+    free(weight);
+    free(poly_id);
+    free(pix);
+    free(z);
+    free(phid);
+    if (mask_file == fname) {
+        unlink(fname);
+    }
+    return status;
+}
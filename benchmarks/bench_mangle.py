@@ -0,0 +1,147 @@
+"""
+Benchmarks of the python interface, for use with asv
+
+    asv run
+    asv continuous master HEAD
+
+Each benchmark is run on a pixelized and an unpixelized version of the same
+synthetic mask, see masks.py
+"""
+import os
+import tempfile
+
+import numpy as np
+import pymangle
+
+from .masks import write_grid_mask, random_points
+
+PIXELRES = 6
+MASK_TYPES = ['pixelized', 'unpixelized']
+
+# polygons in the masks used for searches and randoms
+SEARCH_NPOLY = 2000
+
+# searches of unpixelized masks check every polygon, so the largest sizes are
+# skipped for them
+MAX_UNPIXELIZED = 10**5
+
+
+def _pixelres(mask_type):
+    if mask_type == 'pixelized':
+        return PIXELRES
+    return -1
+
+
+class _MaskFiles(object):
+    """
+    writes the masks in setup and removes them in teardown
+    """
+    def _write_mask(self, npoly, mask_type, npoints=0):
+        if mask_type == 'unpixelized' and npoints > MAX_UNPIXELIZED:
+            # tells asv to skip this combination
+            raise NotImplementedError('too slow for an unpixelized mask')
+
+        self._tmpdir = tempfile.TemporaryDirectory()
+        fname = os.path.join(self._tmpdir.name, 'mask.ply')
+        box = write_grid_mask(fname, npoly, pixelres=_pixelres(mask_type))
+        return fname, box
+
+    def teardown(self, *args):
+        if hasattr(self, '_tmpdir'):
+            self._tmpdir.cleanup()
+
+
+class TimeRead(_MaskFiles):
+    """
+    Mangle.__init__ for masks of several sizes
+    """
+    params = ([1000, 10000, 100000], MASK_TYPES)
+    param_names = ['npoly', 'mask_type']
+    timeout = 300
+
+    def setup(self, npoly, mask_type):
+        self.fname, _ = self._write_mask(npoly, mask_type)
+
+    def time_read(self, npoly, mask_type):
+        pymangle.Mangle(self.fname)
+
+    def peakmem_read(self, npoly, mask_type):
+        pymangle.Mangle(self.fname)
+
+
+class TimeSearch(_MaskFiles):
+    """
+    point searches, from 10^4 to 10^7 points
+    """
+    params = ([10**4, 10**5, 10**6, 10**7], MASK_TYPES)
+    param_names = ['npoints', 'mask_type']
+    timeout = 600
+
+    def setup(self, npoints, mask_type):
+        fname, box = self._write_mask(SEARCH_NPOLY, mask_type, npoints)
+        self.mask = pymangle.Mangle(fname)
+        self.ra, self.dec = random_points(npoints, box)
+
+    def time_contains(self, npoints, mask_type):
+        self.mask.contains(self.ra, self.dec)
+
+    def time_polyid_and_weight(self, npoints, mask_type):
+        self.mask.polyid_and_weight(self.ra, self.dec)
+
+    def time_weight(self, npoints, mask_type):
+        self.mask.weight(self.ra, self.dec)
+
+    def time_contains_float64(self, npoints, mask_type):
+        # includes the conversion to long double in the bindings
+        self.mask.contains(self.ra.astype('f8'), self.dec.astype('f8'))
+
+
+class TimeRandoms(_MaskFiles):
+    """
+    random points from the mask and in caps
+    """
+    params = ([10**4, 10**5, 10**6], MASK_TYPES)
+    param_names = ['nrand', 'mask_type']
+    timeout = 600
+
+    def setup(self, nrand, mask_type):
+        fname, box = self._write_mask(SEARCH_NPOLY, mask_type, nrand)
+        self.mask = pymangle.Mangle(fname)
+        self.box = box
+
+    def time_genrand(self, nrand, mask_type):
+        self.mask.genrand(nrand)
+
+    def time_genrand_range(self, nrand, mask_type):
+        self.mask.genrand_range(nrand, *self.box)
+
+    def time_genrand_cap(self, nrand, mask_type):
+        pymangle.genrand_cap(nrand, 200.0, 10.0, 1.0)
+
+    def time_genrand_cap_f8(self, nrand, mask_type):
+        pymangle.genrand_cap(nrand, 200.0, 10.0, 1.0, dtype='f8')
+
+
+class TimeCheckQuadrants(_MaskFiles):
+    """
+    check_quadrants for a set of caps, at the default random density
+    """
+    params = ([100, 1000], MASK_TYPES)
+    param_names = ['ncaps', 'mask_type']
+    timeout = 600
+
+    def setup(self, ncaps, mask_type):
+        fname, box = self._write_mask(SEARCH_NPOLY, mask_type)
+        self.mask = pymangle.Mangle(fname)
+        self.ra, self.dec = random_points(ncaps, box, seed=9)
+        self.angle = np.zeros(ncaps, dtype=np.longdouble) + 0.05
+
+    def time_check_quadrants(self, ncaps, mask_type):
+        self.mask.check_quadrants(self.ra, self.dec, self.angle)
+
+    def time_check_quadrants_exact(self, ncaps, mask_type):
+        self.mask.check_quadrants(self.ra, self.dec, self.angle, exact=True)
+
+    def time_check_quadrants_early_stop(self, ncaps, mask_type):
+        self.mask.check_quadrants(self.ra, self.dec, self.angle,
+                                  error_rate=0.01)
@@ -0,0 +1,115 @@
+"""
+Synthetic masks for the benchmarks
+
+The polygons are cells of an equal area grid in cos(theta) and phi,
+starting at the equator, each bounded by four caps.  The grid is a
+subdivision of the simple pixelization, so for a pixelized mask each polygon
+lies in a single pixel.  This is the same layout used by the C benchmark in
+bench/bench_mangle.c
+"""
+import numpy as np
+
+
+def _grid_level(npoly, pixelres):
+    level = 1
+    while 2**(2*level-1) < npoly:
+        level += 1
+    return max(level, pixelres)
+
+
+def _simple_pixel(pixelres, z, phi):
+    """
+    simple scheme pixel of a point, see get_pixel_simple in pixel.c
+    """
+    if pixelres <= 0:
+        return 0
+    p2 = 2**pixelres
+    nrow = max(int(np.ceil((1.0 - z)/2*p2)) - 1, 0)
+    mcol = int(np.floor(phi/2/np.pi*p2))
+    # pixels at all coarser resolutions come first
+    ps = (p2**2 - 1)//3
+    return ps + p2*nrow + mcol
+
+
+def write_grid_mask(fname, npoly, pixelres=-1):
+    """
+    write a synthetic mask and return the box in ra, dec that covers it,
+    with some margin
+
+    parameters
+    ----------
+    fname: string
+        The file to write
+    npoly: int
+        Number of polygons
+    pixelres: int, optional
+        Resolution of the simple pixelization, -1 for none
+
+    returns
+    -------
+    ramin, ramax, decmin, decmax
+    """
+    level = _grid_level(npoly, pixelres)
+    ngrid = 2**level
+
+    with open(fname, 'w') as fobj:
+        fobj.write('%d polygons\n' % npoly)
+        if pixelres >= 0:
+            fobj.write('pixelization %ds\n' % pixelres)
+        fobj.write('snapped\nbalkanized\n')
+
+        for ipoly in range(npoly):
+            row = ngrid//2 + ipoly//ngrid
+            col = ipoly % ngrid
+
+            z2 = 1.0 - 2.0*row/ngrid
+            z1 = 1.0 - 2.0*(row+1)/ngrid
+            p1 = 2*np.pi*col/ngrid
+            p2 = 2*np.pi*(col+1)/ngrid
+            area = (z2-z1)*(p2-p1)
+
+            pix = 0
+            if pixelres >= 0:
+                pix = _simple_pixel(pixelres, 0.5*(z1+z2), 0.5*(p1+p2))
+
+            fobj.write(
+                'polygon %d ( 4 caps, 1 weight, %d pixel, %.17g str):\n'
+                % (ipoly, pix, area)
+            )
+            caps = [
+                (0.0, 0.0, 1.0, 1.0 - z1),
+                (0.0, 0.0, 1.0, -(1.0 - z2)),
+                (-np.sin(p1), np.cos(p1), 0.0, 1.0),
+                (np.sin(p2), -np.cos(p2), 0.0, 1.0),
+            ]
+            for cap in caps:
+                fobj.write(' %.17g %.17g %.17g %.17g\n' % cap)
+
+    nrow = (npoly + ngrid - 1)//ngrid
+    zmax = 1.0 - 2.0*(ngrid//2)/ngrid
+    zmin = 1.0 - 2.0*(ngrid//2 + nrow)/ngrid
+    if nrow > 1:
+        phimax = 2*np.pi
+    else:
+        phimax = 2*np.pi*npoly/ngrid
+
+    zmin = max(zmin - 0.1*(zmax-zmin), -1.0)
+    phimax = min(phimax*1.1, 2*np.pi)
+
+    ramax = np.degrees(phimax)
+    decmin = 90.0 - np.degrees(np.arccos(zmin))
+    decmax = 90.0 - np.degrees(np.arccos(zmax))
+    return 0.0, ramax, decmin, decmax
+
+
+def random_points(n, box, seed=31415):
+    """
+    points uniform on the sphere within the ra, dec box, as long doubles
+    """
+    ramin, ramax, decmin, decmax = box
+    rng = np.random.RandomState(seed)
+    ra = rng.uniform(ramin, ramax, n)
+    zmin = np.sin(np.radians(decmin))
+    zmax = np.sin(np.radians(decmax))
+    dec = np.degrees(np.arcsin(rng.uniform(zmin, zmax, n)))
+    return ra.astype(np.longdouble), dec.astype(np.longdouble)
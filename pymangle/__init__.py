@@ -1,6 +1,7 @@
 # flake8: noqa
 
 from . import mangle
+from . import stream
 from .mangle import Mangle, genrand_cap
 from .version import __version__
 
@@ -471,15 +471,18 @@ PyManglePolygon_init(struct PyManglePolygon* self, PyObject *args, PyObject *kwd
     self->poly.pixel_id = pixel_id;
     self->poly.weight   = wt_data[0];
 
-    // we need garea to calculate this
-    self->poly.area = -1.0;
-
     self->poly.caps = capvec_copy(caps_st->caps);
     if (self->poly.caps == NULL) {
         PyErr_SetString(PyExc_MemoryError, "out of memory allocating CapVec");
         return -1;
     }
 
+    if (!polygon_calc_area(self->poly.caps, &self->poly.area)) {
+        PyErr_SetString(PyExc_MemoryError, "out of memory computing area");
+        return -1;
+    }
+    self->poly.area_set = 1;
+
     return 0;
 }
 
@@ -680,8 +683,27 @@ struct PyMangleMask {
     PyObject_HEAD
 
     struct MangleMask* mask;
+
+    // number of searches running without the GIL.  Only changed while
+    // holding the GIL
+    int nquery;
 };
 
+/*
+ * searches release the GIL, so the mask must not be changed while any are
+ * running in other threads
+ */
+static int
+check_mask_not_in_use(struct PyMangleMask* self)
+{
+    if (self->nquery > 0) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "mask cannot be changed while it is being searched");
+        return 0;
+    }
+    return 1;
+}
+
 
 
 /*
@@ -719,6 +741,9 @@ PyMangleMask_read_weights(struct PyMangleMask* self, PyObject *args, PyObject *k
     if (!PyArg_ParseTuple(args, (char*)"s", &weightfile)) {
         Py_RETURN_FALSE;
     }
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
 
     if (!mangle_read_weights(self->mask, weightfile)) {
         PyErr_Format(PyExc_IOError,"Error reading weight file %s",weightfile);
@@ -738,6 +763,9 @@ PyMangleMask_set_weights(struct PyMangleMask* self, PyObject *args, PyObject *kw
         PyErr_SetString(PyExc_TypeError,"Failed to parse args to set_weights");
         Py_RETURN_FALSE;
     }
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
 
     if (PyArray_NDIM((PyArrayObject *)weight_obj) != 1) {
         PyErr_SetString(PyExc_ValueError,"Input to set_weights must be 1D array");
@@ -976,6 +1004,27 @@ make_longdouble_array(npy_intp size, const char* name, long double** ptr)
     *ptr = PyArray_DATA((PyArrayObject*)array);
     return array;
 }
+static PyObject*
+make_double_array(npy_intp size, const char* name, double** ptr)
+{
+    PyObject* array=NULL;
+    npy_intp dims[1];
+    int ndims=1;
+    if (size <= 0) {
+        PyErr_Format(PyExc_ValueError, "size of %s array must be > 0",name);
+        return NULL;
+    }
+
+    dims[0] = size;
+    array = PyArray_ZEROS(ndims, dims, NPY_FLOAT64, 0);
+    if (array==NULL) {
+        PyErr_Format(PyExc_MemoryError, "could not create %s array",name);
+        return NULL;
+    }
+
+    *ptr = PyArray_DATA((PyArrayObject*)array);
+    return array;
+}
 static long double* 
 check_longdouble_array(PyObject* array, const char* name, npy_intp* size)
 {
@@ -1015,6 +1064,41 @@ check_ra_dec_arrays(PyObject* ra_obj, PyObject* dec_obj,
     return 1;
 }
 
+/*
+ * search the mask for n points, in order of pixel number if sort is set.
+ * The GIL is released during the search
+ */
+static int
+search_mask(struct PyMangleMask* self, struct MangleQueryState* state,
+            int sort, npy_intp n,
+            const long double* ra, const long double* dec,
+            int64* poly_id, long double* weight)
+{
+    int status=0;
+    const struct MangleMask* mask=self->mask;
+
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    if (sort) {
+        status=mangle_polyid_and_weight_sorted(mask, state, n, ra, dec,
+                                               poly_id, weight);
+    } else {
+        status=mangle_polyid_and_weight_many(mask, state, n, ra, dec,
+                                             poly_id, weight);
+    }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (status != 1) {
+        if (state->status == MANGLE_ERR_NOMEM) {
+            PyErr_SetString(PyExc_MemoryError, state->err);
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, state->err);
+        }
+    }
+    return status;
+}
+
 /*
  * check ra,dec points, returning both poly_id and weight
  * in a tuple
@@ -1024,7 +1108,6 @@ static PyObject*
 PyMangleMask_polyid_and_weight(struct PyMangleMask* self, PyObject* args)
 {
     int status=1;
-    struct Point pt;
     PyObject* ra_obj=NULL;
     PyObject* dec_obj=NULL;
     PyObject* poly_id_obj=NULL;
@@ -1033,13 +1116,17 @@ PyMangleMask_polyid_and_weight(struct PyMangleMask* self, PyObject* args)
     long double* dec_ptr=NULL;
     long double* weight_ptr=NULL;
     npy_intp* poly_id_ptr=NULL;
-    npy_intp nra=0, ndec=0, i=0;
+    npy_intp nra=0, ndec=0;
+    int sort=0, cache=0;
+    struct MangleQueryState state;
 
     PyObject* tuple=NULL;
 
-    if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"OO|ii",
+                          &ra_obj, &dec_obj, &sort, &cache)) {
         return NULL;
     }
+    mangle_query_state_init(&state, cache);
 
     if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
         return NULL;
@@ -1054,23 +1141,8 @@ PyMangleMask_polyid_and_weight(struct PyMangleMask* self, PyObject* args)
         goto _poly_id_and_weight_cleanup;
     }
 
-    for (i=0; i<nra; i++) {
-        point_set_from_radec(&pt, *ra_ptr, *dec_ptr);
-
-        //status=mangle_polyid_and_weight_nopix(self->mask,
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask,
-                                        &pt, 
-                                        poly_id_ptr, 
-                                        weight_ptr);
-
-        if (status != 1) {
-            goto _poly_id_and_weight_cleanup;
-        }
-        ra_ptr++;
-        dec_ptr++;
-        poly_id_ptr++;
-        weight_ptr++;
-    }
+    status=search_mask(self, &state, sort, nra, ra_ptr, dec_ptr,
+                       (int64*) poly_id_ptr, weight_ptr);
 
 _poly_id_and_weight_cleanup:
     if (status != 1) {
@@ -1094,20 +1166,22 @@ static PyObject*
 PyMangleMask_polyid(struct PyMangleMask* self, PyObject* args)
 {
     int status=1;
-    struct Point pt;
     PyObject* ra_obj=NULL;
     PyObject* dec_obj=NULL;
     PyObject* poly_id_obj=NULL;
 
     long double* ra_ptr=NULL;
     long double* dec_ptr=NULL;
-    long double weight=0;
     npy_intp* poly_id_ptr=NULL;
-    npy_intp nra=0, ndec=0, i=0;
+    npy_intp nra=0, ndec=0;
+    int sort=0, cache=0;
+    struct MangleQueryState state;
 
-    if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"OO|ii",
+                          &ra_obj, &dec_obj, &sort, &cache)) {
         return NULL;
     }
+    mangle_query_state_init(&state, cache);
 
     if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
         return NULL;
@@ -1116,24 +1190,8 @@ PyMangleMask_polyid(struct PyMangleMask* self, PyObject* args)
         return NULL;
     }
 
-    for (i=0; i<nra; i++) {
-        point_set_from_radec(&pt, *ra_ptr, *dec_ptr);
-
-        //status=mangle_polyid_and_weight(self->mask, 
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask, 
-                                        &pt, 
-                                        poly_id_ptr, 
-                                        &weight);
-
-        if (status != 1) {
-            goto _poly_id_cleanup;
-        }
-        ra_ptr++;
-        dec_ptr++;
-        poly_id_ptr++;
-    }
-
-_poly_id_cleanup:
+    status=search_mask(self, &state, sort, nra, ra_ptr, dec_ptr,
+                       (int64*) poly_id_ptr, NULL);
     if (status != 1) {
         Py_XDECREF(poly_id_obj);
         return NULL;
@@ -1149,19 +1207,21 @@ static PyObject*
 PyMangleMask_weight(struct PyMangleMask* self, PyObject* args)
 {
     int status=1;
-    struct Point pt;
     PyObject* ra_obj=NULL;
     PyObject* dec_obj=NULL;
     PyObject* weight_obj=NULL;
     long double* ra_ptr=NULL;
     long double* dec_ptr=NULL;
     long double* weight_ptr=NULL;
-    npy_intp poly_id=0;
-    npy_intp nra=0, ndec=0, i=0;
+    npy_intp nra=0, ndec=0;
+    int sort=0, cache=0;
+    struct MangleQueryState state;
 
-    if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
+    if (!PyArg_ParseTuple(args, (char*)"OO|ii",
+                          &ra_obj, &dec_obj, &sort, &cache)) {
         return NULL;
     }
+    mangle_query_state_init(&state, cache);
 
     if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
         return NULL;
@@ -1169,24 +1229,8 @@ PyMangleMask_weight(struct PyMangleMask* self, PyObject* args)
     if (!(weight_obj=make_longdouble_array(nra, "weight", &weight_ptr))) {
         return NULL;
     }
-    for (i=0; i<nra; i++) {
-        point_set_from_radec(&pt, *ra_ptr, *dec_ptr);
-
-        //status=mangle_polyid_and_weight(self->mask, 
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask, 
-                                        &pt, 
-                                        &poly_id, 
-                                        weight_ptr);
-
-        if (status != 1) {
-            goto _weight_cleanup;
-        }
-        ra_ptr++;
-        dec_ptr++;
-        weight_ptr++;
-    }
-
-_weight_cleanup:
+    status=search_mask(self, &state, sort, nra, ra_ptr, dec_ptr,
+                       NULL, weight_ptr);
     if (status != 1) {
         Py_XDECREF(weight_obj);
         return NULL;
@@ -1194,6 +1238,24 @@ _weight_cleanup:
     return weight_obj;
 }
 
+/*
+ * set the min_weight of the state, if the object is not None
+ */
+static int
+parse_min_weight(PyObject* min_weight_obj, struct MangleQueryState* state)
+{
+    double min_weight=0;
+
+    if (min_weight_obj != Py_None) {
+        min_weight = PyFloat_AsDouble(min_weight_obj);
+        if (min_weight == -1 && PyErr_Occurred()) {
+            return 0;
+        }
+        mangle_query_state_set_min_weight(state, min_weight);
+    }
+    return 1;
+}
+
 /*
  * check if ra,dec points are contained
  */
@@ -1202,18 +1264,25 @@ static PyObject*
 PyMangleMask_contains(struct PyMangleMask* self, PyObject* args)
 {
     int status=1;
-    struct Point pt;
     PyObject* ra_obj=NULL;
     PyObject* dec_obj=NULL;
     PyObject* contained_obj=NULL;
     npy_bool* cont_ptr=NULL;
     long double* ra_ptr=NULL;
     long double* dec_ptr=NULL;
-    long double weight=0;
-    npy_intp poly_id=0;
-    npy_intp nra=0, ndec=0, i=0;
-
-    if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
+    int64 poly_id_buff[MANGLE_BATCH_SIZE];
+    int64* poly_id=poly_id_buff;
+    npy_intp nra=0, ndec=0, i=0, start=0, nb=0, block_size=MANGLE_BATCH_SIZE;
+    int sort=0, cache=0;
+    PyObject* min_weight_obj=Py_None;
+    struct MangleQueryState state;
+
+    if (!PyArg_ParseTuple(args, (char*)"OO|iiO",
+                          &ra_obj, &dec_obj, &sort, &cache, &min_weight_obj)) {
+        return NULL;
+    }
+    mangle_query_state_init(&state, cache);
+    if (!parse_min_weight(min_weight_obj, &state)) {
         return NULL;
     }
 
@@ -1224,28 +1293,37 @@ PyMangleMask_contains(struct PyMangleMask* self, PyObject* args)
         return NULL;
     }
 
-    for (i=0; i<nra; i++) {
-        point_set_from_radec(&pt, *ra_ptr, *dec_ptr);
-
-        //status=mangle_polyid_and_weight(self->mask, 
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask, 
-                                        &pt, 
-                                        &poly_id, 
-                                        &weight);
+    // the sorted search must see all points at once
+    if (sort && nra > MANGLE_BATCH_SIZE) {
+        poly_id=malloc(nra*sizeof(int64));
+        if (poly_id == NULL) {
+            Py_XDECREF(contained_obj);
+            return PyErr_NoMemory();
+        }
+        block_size=nra;
+    }
 
+    for (start=0; start<nra; start += block_size) {
+        nb = nra-start;
+        if (nb > block_size) {
+            nb = block_size;
+        }
+        status=search_mask(self, &state, sort, nb,
+                           &ra_ptr[start], &dec_ptr[start],
+                           poly_id, NULL);
         if (status != 1) {
-            goto _weight_cleanup;
+            goto _contains_cleanup;
         }
 
-        if (poly_id >= 0) {
-            *cont_ptr = 1;
+        for (i=0; i<nb; i++) {
+            cont_ptr[start+i] = (poly_id[i] >= 0);
         }
-        ra_ptr++;
-        dec_ptr++;
-        cont_ptr++;
     }
 
-_weight_cleanup:
+_contains_cleanup:
+    if (poly_id != poly_id_buff) {
+        free(poly_id);
+    }
     if (status != 1) {
         Py_XDECREF(contained_obj);
         return NULL;
@@ -1254,175 +1332,502 @@ _weight_cleanup:
 }
 
 /*
-   check the quadrants in the specified cap against the mask
-   using a monte-carlo approach
-
-   The quadrant is considered "good" if the fraction of masked
-   points is less than pmax
-
-   parameters
-   ----------
-   ra
-       center of cap in degrees
-   dec
-       center of cap in degrees
-   angle_degrees
-       the opening angle of cap in degrees
-   amin
-       minimum solid angle to probe in degrees.  holes larger than this area
-       will not be missed with probability greater than pmax
-   pmax
-       holes of size amin will be missed with probability less than pmax
-
-   returns
-   -------
-   maskflags
-       2**0 is set if central point is inside the map
-       2**1 is set if first quadrant is OK
-       2**2 is set if second quadrant is OK
-       2**3 is set if third quadrant is OK
-       2**4 is set if fourth quadrant is OK
-*/
-
-// number of randoms do guarantee amin is missed with probability less than
-// pmax
-/*
-static long get_check_quad_nrand(double area, double amin, double pmax)
+ * count the contained points and, if packed, set bits for them in a uint8
+ * array in the order of numpy.packbits.  Returns the count, or a tuple
+ * (count, bits) if packed
+ */
+static PyObject*
+contains_many(struct PyMangleMask* self, PyObject* args, int packed)
 {
-    long nrand;
-    double pmiss;
+    int status=0;
+    PyObject* ra_obj=NULL;
+    PyObject* dec_obj=NULL;
+    PyObject* bits_obj=NULL;
+    long double* ra_ptr=NULL;
+    long double* dec_ptr=NULL;
+    unsigned char* bits=NULL;
+    npy_intp nra=0, ndec=0;
+    npy_intp dims[1];
+    size_t ncontained=0;
+    int sort=0, cache=0;
+    PyObject* min_weight_obj=Py_None;
+    struct MangleQueryState state;
 
-    pmiss = 1.0 - amin/area;
-    if (pmiss > 1.e-10) {
-        // how many points do we need in order for the
-        // probability of missing the hole to be pmax?
-        //      We need n such that (1-amin/a)^n = pmax
-        double tmp = log10(pmax)/log10(pmiss);
-        if (tmp < 20) tmp = 20;
-        if (tmp > 20000) tmp = 20000;
-        nrand = lround(tmp);
-    } else {
-        // we reach here often because the search area is very
-        // close to or smaller than our minimum resolvable area
-        // We don't want nrand to be less than say 20
-        nrand = 20;
+    if (!PyArg_ParseTuple(args, (char*)"OO|iiO",
+                          &ra_obj, &dec_obj, &sort, &cache, &min_weight_obj)) {
+        return NULL;
+    }
+    mangle_query_state_init(&state, cache);
+    if (!parse_min_weight(min_weight_obj, &state)) {
+        return NULL;
     }
 
-    return nrand;
-}
-*/
-
-// generate random points, return the fraction that were masked
-static double get_quad_frac_masked(struct PyMangleMask* self,
-                                   long nrand,
-                                   const struct CapForRand *rcap,
-                                   int quadrant)
-{
-    int status=1;
-    long nmasked=0, i;
-    double frac_masked=0;
-    long double ra=0, dec=0, weight=0;
-    int64 poly_id=0;
-    struct Point pt={0};
-
-    for (i=0; i<nrand; i++) {
-        genrand_cap_radec(rcap, quadrant, &ra, &dec);
-        point_set_from_radec(&pt, ra, dec);
+    if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
+        return NULL;
+    }
+    if (packed) {
+        dims[0] = (nra+7)/8;
+        if (!(bits_obj = PyArray_ZEROS(1, dims, NPY_UINT8, 0))) {
+            return NULL;
+        }
+        bits = PyArray_DATA((PyArrayObject*) bits_obj);
+    }
 
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask, 
-                                        &pt, 
-                                        &poly_id, 
-                                        &weight);
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    status=mangle_contains_many(self->mask, &state, sort, nra, ra_ptr, dec_ptr,
+                                bits, &ncontained);
+    Py_END_ALLOW_THREADS
+    self->nquery--;
 
-        if (poly_id < 0 || weight <= 0.) {
-            nmasked += 1;
+    if (status != 1) {
+        if (state.status == MANGLE_ERR_NOMEM) {
+            PyErr_SetString(PyExc_MemoryError, state.err);
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, state.err);
         }
+        Py_XDECREF(bits_obj);
+        return NULL;
     }
 
-    frac_masked = ( (double)nmasked )/( (double)nrand );
-    return frac_masked;
+    if (packed) {
+        return Py_BuildValue("nN", (Py_ssize_t) ncontained, bits_obj);
+    }
+    return PyLong_FromSize_t(ncontained);
 }
 
 static PyObject*
-PyMangleMask_check_quadrants(struct PyMangleMask* self, PyObject* args)
+PyMangleMask_count_contained(struct PyMangleMask* self, PyObject* args)
 {
-    int status=1;
-
-    PyObject* ra_obj=NULL;
-    PyObject* dec_obj=NULL;
-    PyObject* angle_degrees_obj=NULL;
-    PyObject* maskflags_obj=NULL;
-    npy_intp nra=0, ndec=0, nang=0, i=0, *maskflags_ptr=NULL;
-
-    long double* ra_ptr=NULL;
-    long double* dec_ptr=NULL;
-    long double* ang_ptr=NULL;
-
-    double density_degrees,
-           max_masked_fraction, frac_masked;
-    double area;
-    struct Point pt;
-    long double weight;
-    int64 poly_id;
-    struct CapForRand rcap;
+    return contains_many(self, args, 0);
+}
 
-    long nrand;
-    int mask_flags=0;
+static PyObject*
+PyMangleMask_contains_packed(struct PyMangleMask* self, PyObject* args)
+{
+    return contains_many(self, args, 1);
+}
 
-    if (!PyArg_ParseTuple(args, (char*)"OOOdd",
-                          &ra_obj,
-                          &dec_obj,
-                          &angle_degrees_obj,
-                          &density_degrees, // number of randoms/square degree
-                          &max_masked_fraction)) {
+/*
+ * masked area and weighted area, in steradians, in caps (3 arrays ra, dec,
+ * radius) or boxes (4 arrays ramin, ramax, decmin, decmax)
+ */
+static PyObject*
+region_areas(struct PyMangleMask* self,
+             int is_box,
+             PyObject** objs,
+             PyObject* min_weight_obj,
+             int nthreads)
+{
+    static const char* cap_names[] = {"ra", "dec", "radius"};
+    static const char* box_names[] = {"ramin", "ramax", "decmin", "decmax"};
+    const char** names = is_box ? box_names : cap_names;
+    int narr = is_box ? 4 : 3;
+    int i=0, status=0;
+    long double* ptrs[4];
+    long double *area_ptr=NULL, *warea_ptr=NULL;
+    npy_intp n=0, ni=0;
+    PyObject* area_obj=NULL;
+    PyObject* warea_obj=NULL;
+    struct MangleQueryState state;
+
+    mangle_query_state_init(&state, 0);
+    if (!parse_min_weight(min_weight_obj, &state)) {
         return NULL;
     }
 
-    if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
-        return NULL;
+    for (i=0; i<narr; i++) {
+        if (!(ptrs[i]=check_longdouble_array(objs[i], names[i], &ni))) {
+            return NULL;
+        }
+        if (i == 0) {
+            n = ni;
+        } else if (ni != n) {
+            PyErr_Format(PyExc_ValueError,
+                         "%s and %s must be the same length, got (%ld,%ld)",
+                         names[0], names[i], n, ni);
+            return NULL;
+        }
     }
-    if (!check_ra_dec_arrays(ra_obj,angle_degrees_obj,&ra_ptr,&nra,&ang_ptr,&nang)) {
+
+    if (!(area_obj=make_longdouble_array(n, "area", &area_ptr))) {
         return NULL;
     }
-    if (!(maskflags_obj=make_intp_array(nra, "maskflags", &maskflags_ptr))) {
+    if (!(warea_obj=make_longdouble_array(n, "weighted_area", &warea_ptr))) {
+        Py_XDECREF(area_obj);
         return NULL;
     }
 
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    if (is_box) {
+        status=mangle_box_areas(self->mask, &state, nthreads, n,
+                                ptrs[0], ptrs[1], ptrs[2], ptrs[3],
+                                area_ptr, warea_ptr);
+    } else {
+        status=mangle_cap_areas(self->mask, &state, nthreads, n,
+                                ptrs[0], ptrs[1], ptrs[2],
+                                area_ptr, warea_ptr);
+    }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
 
-    // area of a quadrant = 1/4 pi r^2
-    for (i=0; i<nra; i++) {
-        double dec_cen=dec_ptr[i];
-        double ra_cen=ra_ptr[i];
-        double ang=ang_ptr[i];
-        mask_flags=0;
-
-        area = 0.25*M_PI*ang*ang;
-        nrand = (long) (area*density_degrees);
+    if (status != 1) {
+        PyErr_SetString(PyExc_MemoryError, state.err);
+        Py_XDECREF(area_obj);
+        Py_XDECREF(warea_obj);
+        return NULL;
+    }
+    return Py_BuildValue("NN", area_obj, warea_obj);
+}
 
+static PyObject*
+PyMangleMask_cap_areas(struct PyMangleMask* self, PyObject* args)
+{
+    PyObject* objs[3];
+    PyObject* min_weight_obj=Py_None;
+    int nthreads=0;
 
-        // first check if the center itself is contained
-        point_set_from_radec(&pt, ra_ptr[i], dec_ptr[i]);
-        status=MANGLE_POLYID_AND_WEIGHT(self->mask, 
-                                        &pt, 
-                                        &poly_id, 
-                                        &weight);
+    if (!PyArg_ParseTuple(args, (char*)"OOO|Oi",
+                          &objs[0], &objs[1], &objs[2],
+                          &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+    return region_areas(self, 0, objs, min_weight_obj, nthreads);
+}
 
-        if (poly_id >= 0) {
-            int quadrant;
-            mask_flags |= 1;
+static PyObject*
+PyMangleMask_box_areas(struct PyMangleMask* self, PyObject* args)
+{
+    PyObject* objs[4];
+    PyObject* min_weight_obj=Py_None;
+    int nthreads=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOO|Oi",
+                          &objs[0], &objs[1], &objs[2], &objs[3],
+                          &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+    return region_areas(self, 1, objs, min_weight_obj, nthreads);
+}
 
-            CapForRand_from_radec(&rcap, ra_cen, dec_cen, ang);
+/*
+ * the polygons overlapping caps or boxes, as offsets into an array of
+ * polygon numbers
+ */
+static PyObject*
+region_polygons(struct PyMangleMask* self,
+                int is_box,
+                PyObject** objs,
+                PyObject* min_weight_obj,
+                int nthreads)
+{
+    static const char* cap_names[] = {"ra", "dec", "radius"};
+    static const char* box_names[] = {"ramin", "ramax", "decmin", "decmax"};
+    const char** names = is_box ? box_names : cap_names;
+    int narr = is_box ? 4 : 3;
+    int i=0, status=0;
+    long double* ptrs[4];
+    int64* offsets=NULL;
+    npy_intp n=0, ni=0, dims[1];
+    PyObject* offsets_obj=NULL;
+    PyObject* polys_obj=NULL;
+    struct i64stack* polys=NULL;
+    struct MangleQueryState state;
+
+    mangle_query_state_init(&state, 0);
+    if (!parse_min_weight(min_weight_obj, &state)) {
+        return NULL;
+    }
 
-            for (quadrant=1; quadrant <= 4; quadrant++) {
-                frac_masked = get_quad_frac_masked(self, nrand, &rcap, quadrant);
-                if (frac_masked < max_masked_fraction) {
-                    mask_flags |= (1<<quadrant);
-                }
-            }
+    for (i=0; i<narr; i++) {
+        if (!(ptrs[i]=check_longdouble_array(objs[i], names[i], &ni))) {
+            return NULL;
+        }
+        if (i == 0) {
+            n = ni;
+        } else if (ni != n) {
+            PyErr_Format(PyExc_ValueError,
+                         "%s and %s must be the same length, got (%ld,%ld)",
+                         names[0], names[i], n, ni);
+            return NULL;
         }
-        maskflags_ptr[i] = mask_flags;
     }
 
+    dims[0] = n+1;
+    if (!(offsets_obj = PyArray_ZEROS(1, dims, NPY_INT64, 0))) {
+        return NULL;
+    }
+    offsets = PyArray_DATA((PyArrayObject*) offsets_obj);
+
+    if (!(polys = i64stack_new(0))) {
+        PyErr_SetString(PyExc_MemoryError, "could not create polygon stack");
+        goto _region_polygons_bail;
+    }
+
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    if (is_box) {
+        status=mangle_box_polygons(self->mask, &state, nthreads, n,
+                                   ptrs[0], ptrs[1], ptrs[2], ptrs[3],
+                                   offsets, polys);
+    } else {
+        status=mangle_cap_polygons(self->mask, &state, nthreads, n,
+                                   ptrs[0], ptrs[1], ptrs[2],
+                                   offsets, polys);
+    }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (status != 1) {
+        PyErr_SetString(PyExc_MemoryError, state.err);
+        goto _region_polygons_bail;
+    }
+
+    dims[0] = (npy_intp) polys->size;
+    if (!(polys_obj = PyArray_ZEROS(1, dims, NPY_INT64, 0))) {
+        goto _region_polygons_bail;
+    }
+    if (polys->size > 0) {
+        memcpy(PyArray_DATA((PyArrayObject*) polys_obj), polys->data,
+               polys->size*sizeof(int64));
+    }
+    i64stack_delete(polys);
+    return Py_BuildValue("NN", polys_obj, offsets_obj);
+
+_region_polygons_bail:
+    i64stack_delete(polys);
+    Py_XDECREF(offsets_obj);
+    return NULL;
+}
+
+static PyObject*
+PyMangleMask_cap_polygons(struct PyMangleMask* self, PyObject* args)
+{
+    PyObject* objs[3];
+    PyObject* min_weight_obj=Py_None;
+    int nthreads=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOO|Oi",
+                          &objs[0], &objs[1], &objs[2],
+                          &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+    return region_polygons(self, 0, objs, min_weight_obj, nthreads);
+}
+
+static PyObject*
+PyMangleMask_box_polygons(struct PyMangleMask* self, PyObject* args)
+{
+    PyObject* objs[4];
+    PyObject* min_weight_obj=Py_None;
+    int nthreads=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOO|Oi",
+                          &objs[0], &objs[1], &objs[2], &objs[3],
+                          &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+    return region_polygons(self, 1, objs, min_weight_obj, nthreads);
+}
+
+static PyObject*
+PyMangleMask_boundary_distance(struct PyMangleMask* self, PyObject* args)
+{
+    PyObject* ra_obj=NULL;
+    PyObject* dec_obj=NULL;
+    PyObject* min_weight_obj=Py_None;
+    PyObject* dist_obj=NULL;
+    double max_radius=0;
+    int nthreads=0, status=0;
+    long double *ra_ptr=NULL, *dec_ptr=NULL, *dist_ptr=NULL;
+    npy_intp nra=0, ndec=0;
+    struct MangleQueryState state;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOd|Oi",
+                          &ra_obj, &dec_obj, &max_radius,
+                          &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+
+    mangle_query_state_init(&state, 0);
+    if (!parse_min_weight(min_weight_obj, &state)) {
+        return NULL;
+    }
+    if (!(ra_ptr=check_longdouble_array(ra_obj, "ra", &nra))) {
+        return NULL;
+    }
+    if (!(dec_ptr=check_longdouble_array(dec_obj, "dec", &ndec))) {
+        return NULL;
+    }
+    if (nra != ndec) {
+        PyErr_Format(PyExc_ValueError,
+                     "ra,dec must same length, got (%ld,%ld)", nra, ndec);
+        return NULL;
+    }
+    if (!(dist_obj=make_longdouble_array(nra, "distance", &dist_ptr))) {
+        return NULL;
+    }
+
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    status=mangle_boundary_distance(self->mask, &state, nthreads, nra,
+                                    ra_ptr, dec_ptr, max_radius, dist_ptr);
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (status != 1) {
+        PyErr_SetString(PyExc_MemoryError, state.err);
+        Py_XDECREF(dist_obj);
+        return NULL;
+    }
+    return dist_obj;
+}
+
+/*
+   check the quadrants in the specified cap against the mask
+   using a monte-carlo approach, or with exact areas if exact is set
+
+   The quadrant is considered "good" if the fraction of masked
+   points is less than pmax
+
+   parameters
+   ----------
+   ra
+       center of cap in degrees
+   dec
+       center of cap in degrees
+   angle_degrees
+       the opening angle of cap in degrees
+   amin
+       minimum solid angle to probe in degrees.  holes larger than this area
+       will not be missed with probability greater than pmax
+   pmax
+       holes of size amin will be missed with probability less than pmax
+
+   returns
+   -------
+   maskflags
+       2**0 is set if central point is inside the map
+       2**1 is set if first quadrant is OK
+       2**2 is set if second quadrant is OK
+       2**3 is set if third quadrant is OK
+       2**4 is set if fourth quadrant is OK
+*/
+
+// number of randoms do guarantee amin is missed with probability less than
+// pmax
+/*
+static long get_check_quad_nrand(double area, double amin, double pmax)
+{
+    long nrand;
+    double pmiss;
+
+    pmiss = 1.0 - amin/area;
+    if (pmiss > 1.e-10) {
+        // how many points do we need in order for the
+        // probability of missing the hole to be pmax?
+        //      We need n such that (1-amin/a)^n = pmax
+        double tmp = log10(pmax)/log10(pmiss);
+        if (tmp < 20) tmp = 20;
+        if (tmp > 20000) tmp = 20000;
+        nrand = lround(tmp);
+    } else {
+        // we reach here often because the search area is very
+        // close to or smaller than our minimum resolvable area
+        // We don't want nrand to be less than say 20
+        nrand = 20;
+    }
+
+    return nrand;
+}
+*/
+
+static PyObject*
+PyMangleMask_check_quadrants(struct PyMangleMask* self, PyObject* args)
+{
+    int status=1;
+
+    PyObject* ra_obj=NULL;
+    PyObject* dec_obj=NULL;
+    PyObject* angle_degrees_obj=NULL;
+    PyObject* maskflags_obj=NULL;
+    npy_intp nra=0, ndec=0, nang=0, i=0, *maskflags_ptr=NULL;
+
+    long double* ra_ptr=NULL;
+    long double* dec_ptr=NULL;
+    long double* ang_ptr=NULL;
+
+    double density_degrees, max_masked_fraction, error_rate=0;
+    struct MangleQueryState state;
+
+    int exact=0, nthreads=0;
+    long seed=-1;
+    int* flags=NULL;
+
+    if (!PyArg_ParseTuple(args, (char*)"OOOdd|iild",
+                          &ra_obj,
+                          &dec_obj,
+                          &angle_degrees_obj,
+                          &density_degrees, // number of randoms/square degree
+                          &max_masked_fraction,
+                          &exact,
+                          &nthreads,
+                          &seed,
+                          &error_rate)) {
+        return NULL;
+    }
+
+    if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
+        return NULL;
+    }
+    if (!check_ra_dec_arrays(ra_obj,angle_degrees_obj,&ra_ptr,&nra,&ang_ptr,&nang)) {
+        return NULL;
+    }
+    if (!(maskflags_obj=make_intp_array(nra, "maskflags", &maskflags_ptr))) {
+        return NULL;
+    }
+
+    flags = calloc(nra, sizeof(int));
+    if (flags == NULL) {
+        Py_XDECREF(maskflags_obj);
+        PyErr_Format(PyExc_MemoryError,
+                     "could not allocate %ld flags", nra);
+        return NULL;
+    }
+
+    mangle_query_state_init(&state, 0);
+
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    if (exact) {
+        status=mangle_check_quadrants(self->mask, &state, nthreads, nra,
+                                      ra_ptr, dec_ptr, ang_ptr,
+                                      max_masked_fraction, flags, NULL);
+    } else {
+        status=mangle_check_quadrants_random(self->mask, &state, nthreads,
+                                             nra, ra_ptr, dec_ptr, ang_ptr,
+                                             density_degrees,
+                                             max_masked_fraction, error_rate,
+                                             seed, flags, NULL);
+    }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    for (i=0; i<nra; i++) {
+        maskflags_ptr[i] = flags[i];
+    }
+    free(flags);
+
+    if (status != 1) {
+        Py_XDECREF(maskflags_obj);
+        if (state.status == MANGLE_ERR_NOMEM) {
+            PyErr_SetString(PyExc_MemoryError, state.err);
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, state.err);
+        }
+        return NULL;
+    }
     return maskflags_obj;
 }
 
@@ -1451,6 +1856,7 @@ PyMangleMask_genrand(struct PyMangleMask* self, PyObject* args)
     npy_intp poly_id=0;
     npy_intp ngood=0;
     long double theta=0, phi=0;
+    struct MangleQueryState state;
 
 
     if (!PyArg_ParseTuple(args, (char*)"L", &nrand)) {
@@ -1473,10 +1879,12 @@ PyMangleMask_genrand(struct PyMangleMask* self, PyObject* args)
         goto _genrand_cleanup;
     }
 
-    seed_random();
+    mangle_query_state_init(&state, 0);
 
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
     while (ngood < nrand) {
-        genrand_theta_phi_allsky(&theta, &phi);
+        genrand_theta_phi_allsky_r(state.rng, &theta, &phi);
         point_set_from_thetaphi(&pt, theta, phi);
 
         //status=mangle_polyid_and_weight(self->mask, 
@@ -1486,12 +1894,12 @@ PyMangleMask_genrand(struct PyMangleMask* self, PyObject* args)
                                         &weight);
 
         if (status != 1) {
-            goto _genrand_cleanup;
+            break;
         }
 
         if (poly_id >= 0) {
             // rely on short circuiting
-            if (weight < 1.0 || drand48() < weight) {
+            if (weight < 1.0 || rand_uniform(state.rng) < weight) {
                 ngood++;
                 radec_from_point(&pt, ra_ptr, dec_ptr);
                 ra_ptr++;
@@ -1499,6 +1907,12 @@ PyMangleMask_genrand(struct PyMangleMask* self, PyObject* args)
             }
         }
     }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (status != 1) {
+        PyErr_SetString(PyExc_RuntimeError, "Error searching mask");
+    }
 
 _genrand_cleanup:
     if (status != 1) {
@@ -1542,6 +1956,7 @@ PyMangleMask_genrand_range(struct PyMangleMask* self, PyObject* args)
     npy_intp ngood=0;
     int num_contained=0;
     long double theta=0, phi=0;
+    struct MangleQueryState state;
 
 
     if (!PyArg_ParseTuple(args, (char*)"Ldddd", 
@@ -1576,22 +1991,24 @@ PyMangleMask_genrand_range(struct PyMangleMask* self, PyObject* args)
         goto _genrand_range_cleanup;
     }
 
-    seed_random();
+    mangle_query_state_init(&state, 0);
 
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
     while (ngood < nrand) {
-        genrand_theta_phi(cthmin,cthmax,phimin,phimax,&theta, &phi);
+        genrand_theta_phi_r(state.rng, cthmin,cthmax,phimin,phimax,&theta, &phi);
         point_set_from_thetaphi(&pt, theta, phi);
 
         //status=mangle_polyid_and_weight(self->mask, &pt, &poly_id, &weight);
         status=MANGLE_POLYID_AND_WEIGHT(self->mask, &pt, &poly_id, &weight);
 
         if (status != 1) {
-            goto _genrand_range_cleanup;
+            break;
         }
 
         if (poly_id >= 0) {
             // rely on short circuiting
-            if (weight < 1.0 || drand48() < weight) {
+            if (weight < 1.0 || rand_uniform(state.rng) < weight) {
                 ngood++;
                 radec_from_point(&pt, ra_ptr, dec_ptr);
                 ra_ptr++;
@@ -1599,6 +2016,12 @@ PyMangleMask_genrand_range(struct PyMangleMask* self, PyObject* args)
             }
         }
     }
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (status != 1) {
+        PyErr_SetString(PyExc_RuntimeError, "Error searching mask");
+    }
 
 _genrand_range_cleanup:
     if (status != 1) {
@@ -1713,15 +2136,18 @@ PyMangleMask_calc_simplepix(struct PyMangleMask *self, PyObject *args) {
     long double *ra_ptr=NULL;
     long double *dec_ptr=NULL;
     npy_intp *simplepix_ptr=NULL;
-    npy_intp nra=0, ndec=0, i=0;
+    npy_intp nra=0, ndec=0, i=0, start=0, nb=0;
+    double z[MANGLE_BATCH_SIZE], phi[MANGLE_BATCH_SIZE];
 
     if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
         return NULL;
     }
 
-    if (self->mask->pixeltype == 'u') {
-        // not pixelized!
-        PyErr_SetString(PyExc_ValueError,"Must be a pixelized file");
+    if (self->mask->pixeltype != 's') {
+        // the level of the simple scheme comes from the mask
+        PyErr_Format(PyExc_ValueError,
+                     "Must be a simple 's' pixelized file, got '%c'",
+                     self->mask->pixeltype);
         return NULL;
     }
 
@@ -1732,23 +2158,455 @@ PyMangleMask_calc_simplepix(struct PyMangleMask *self, PyObject *args) {
         return NULL;
     }
 
+    for (start=0; start<nra; start += MANGLE_BATCH_SIZE) {
+        nb = nra-start;
+        if (nb > MANGLE_BATCH_SIZE) {
+            nb = MANGLE_BATCH_SIZE;
+        }
+        for (i=0; i<nb; i++) {
+            point_set_from_radec(&pt, ra_ptr[start+i], dec_ptr[start+i]);
+            z[i] = pt.z;
+            phi[i] = pt.phi;
+        }
+        get_pixel_simple_many(&self->mask->simplepix, nb, z, phi,
+                              (int64*) &simplepix_ptr[start]);
+    }
+
+    return simplepix_obj;
+}
+
+static PyObject *
+PyMangleMask_calc_healpix(struct PyMangleMask *self, PyObject *args) {
+    struct Point pt;
+    struct PixelListVec *plv=NULL;
+    PyObject *ra_obj=NULL;
+    PyObject *dec_obj=NULL;
+    PyObject *pix_obj=NULL;
+    
+    long double *ra_ptr=NULL;
+    long double *dec_ptr=NULL;
+    npy_intp *pix_ptr=NULL;
+    npy_intp nra=0, ndec=0, i=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"OO", &ra_obj, &dec_obj)) {
+        return NULL;
+    }
+
+    plv = self->mask->pixel_list_vec;
+    if (plv == NULL || (plv->pixeltype != 'h' && plv->pixeltype != 'n')) {
+        PyErr_SetString(PyExc_ValueError,"Must have a HEALPix index");
+        return NULL;
+    }
+
+    if (!check_ra_dec_arrays(ra_obj,dec_obj,&ra_ptr,&nra,&dec_ptr,&ndec)) {
+        return NULL;
+    }
+    if (!(pix_obj=make_intp_array(nra, "healpix", &pix_ptr))) {
+        return NULL;
+    }
+
     for (i=0; i<nra; i++) {
         point_set_from_radec(&pt, *ra_ptr, *dec_ptr);
 
-        *simplepix_ptr = get_pixel_simple(self->mask->pixelres,&pt);
+        *pix_ptr = get_pixel(plv->pixeltype, plv->pixelres, &pt);
 
         ra_ptr++;
         dec_ptr++;
-        simplepix_ptr++;
+        pix_ptr++;
     }
 
-    return simplepix_obj;
+    return pix_obj;
+}
+
+static PyObject *
+PyMangleMask_build_healpix_index(struct PyMangleMask *self, PyObject *args) {
+    PY_LONG_LONG nside=0;
+    int nest=1;
+
+    if (!PyArg_ParseTuple(args, (char*)"Li", &nside, &nest)) {
+        return NULL;
+    }
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
+
+    if (!mangle_build_healpix_index(self->mask,
+                                    (int64) nside,
+                                    nest ? 'n' : 'h')) {
+        PyErr_Format(PyExc_ValueError,
+                     "Error building HEALPix index with nside %lld", nside);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+PyMangleMask_coverage_map(struct PyMangleMask *self, PyObject *args) {
+    PY_LONG_LONG pixelres=0;
+    char* scheme=NULL;
+    int weighted=1, maxdepth=0, nthreads=0, status=0;
+    PyObject* min_weight_obj=Py_None;
+    PyObject* map_obj=NULL;
+    int64 first=0, npix=0;
+    npy_intp dims[1];
+    struct MangleQueryState state;
+
+    if (!PyArg_ParseTuple(args, (char*)"Lsii|Oi", &pixelres, &scheme,
+                          &weighted, &maxdepth, &min_weight_obj, &nthreads)) {
+        return NULL;
+    }
+    mangle_query_state_init(&state, 0);
+    if (!parse_min_weight(min_weight_obj, &state)) {
+        return NULL;
+    }
+
+    if (strlen(scheme) != 1) {
+        PyErr_Format(PyExc_ValueError, "bad pixel scheme: '%s'", scheme);
+        return NULL;
+    }
+    // validate before sizing the map, which overflows for bad resolutions
+    if (!mangle_coverage_check(&state, scheme[0], (int64) pixelres)) {
+        PyErr_SetString(PyExc_ValueError, state.err);
+        return NULL;
+    }
+    pixel_level_range(scheme[0], pixelres, &first, &npix);
+    dims[0] = npix;
+    if (!(map_obj = PyArray_ZEROS(1, dims, NPY_FLOAT64, 0))) {
+        return NULL;
+    }
+
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    status = mangle_coverage_map(self->mask, &state, scheme[0],
+                                 (int64) pixelres, weighted, maxdepth,
+                                 nthreads,
+                                 PyArray_DATA((PyArrayObject*) map_obj));
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (!status) {
+        if (state.status == MANGLE_ERR_NOMEM) {
+            PyErr_SetString(PyExc_MemoryError, state.err);
+        } else {
+            PyErr_SetString(PyExc_ValueError, state.err);
+        }
+        Py_XDECREF(map_obj);
+        return NULL;
+    }
+    return map_obj;
+}
+
+static PyObject *
+PyMangleMask_compute_areas(struct PyMangleMask *self, PyObject *args) {
+    int all=1, nthreads=0, status=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"|ii", &all, &nthreads)) {
+        return NULL;
+    }
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
+
+    // the areas are written without the GIL, so the mask is in use
+    self->nquery++;
+    Py_BEGIN_ALLOW_THREADS
+    status = mangle_compute_areas(self->mask, all, nthreads);
+    Py_END_ALLOW_THREADS
+    self->nquery--;
+
+    if (!status) {
+        PyErr_SetString(PyExc_MemoryError, "could not compute areas");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+PyMangleMask_set_stats(struct PyMangleMask *self, PyObject *args) {
+    int enable=0;
+
+    if (!PyArg_ParseTuple(args, (char*)"i", &enable)) {
+        return NULL;
+    }
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
+
+    if (!mangle_stats_enable(self->mask, enable)) {
+        PyErr_SetString(PyExc_MemoryError, "could not allocate stats");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+PyMangleMask_reset_stats(struct PyMangleMask *self) {
+    if (!check_mask_not_in_use(self)) {
+        return NULL;
+    }
+    if (!mangle_stats_reset(self->mask)) {
+        PyErr_SetString(PyExc_MemoryError, "could not allocate stats");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static int
+stats_dict_set(PyObject* dict, const char* name, int64 value) {
+    int status=0;
+    PyObject* obj=PyLong_FromLongLong( (PY_LONG_LONG) value);
+
+    if (obj == NULL) {
+        return 0;
+    }
+    status = (PyDict_SetItemString(dict, name, obj) == 0);
+    Py_DECREF(obj);
+    return status;
+}
+
+static PyObject *
+PyMangleMask_get_stats(struct PyMangleMask *self) {
+    const struct MangleStats* stats=self->mask->stats;
+    const struct MangleCounts* counts=NULL;
+    PyObject* dict=NULL;
+    PyObject* pixel_hits=NULL;
+    npy_intp dims[1];
+
+    if (stats == NULL) {
+        Py_RETURN_NONE;
+    }
+    counts = &stats->counts;
+
+    if (!(dict = PyDict_New())) {
+        return NULL;
+    }
+
+    if (!stats_dict_set(dict, "npoints", counts->npoints)
+            || !stats_dict_set(dict, "pixel_lookups", counts->pixel_lookups)
+            || !stats_dict_set(dict, "last_hit_checks",
+                               counts->last_hit_checks)
+            || !stats_dict_set(dict, "polys_scanned", counts->polys_scanned)
+            || !stats_dict_set(dict, "caps_tested", counts->caps_tested)
+            || !stats_dict_set(dict, "hits", counts->hits)
+            || !stats_dict_set(dict, "misses", counts->misses)) {
+        goto _get_stats_bail;
+    }
+
+    dims[0] = (npy_intp) stats->npix;
+    if (!(pixel_hits = PyArray_ZEROS(1, dims, NPY_INT64, 0))) {
+        goto _get_stats_bail;
+    }
+    if (stats->npix > 0) {
+        memcpy(PyArray_DATA((PyArrayObject*) pixel_hits),
+               stats->pixel_hits,
+               stats->npix*sizeof(int64));
+    }
+    if (PyDict_SetItemString(dict, "pixel_hits", pixel_hits) != 0) {
+        goto _get_stats_bail;
+    }
+    Py_DECREF(pixel_hits);
+    return dict;
+
+_get_stats_bail:
+    Py_XDECREF(pixel_hits);
+    Py_XDECREF(dict);
+    return NULL;
+}
+
+// a new 1-d array holding a copy of the data, which can be empty
+static PyObject *
+copy_to_array(npy_intp n, int typenum, const void* data) {
+    PyObject* array=NULL;
+    npy_intp dims[1];
+
+    dims[0] = n;
+    if (!(array = PyArray_ZEROS(1, dims, typenum, 0))) {
+        return NULL;
+    }
+    if (n > 0) {
+        memcpy(PyArray_DATA((PyArrayObject*) array), data,
+               n*PyArray_ITEMSIZE((PyArrayObject*) array));
+    }
+    return array;
+}
+
+// set dict[name] = obj, stealing the reference to obj
+static int
+dict_set_steal(PyObject* dict, const char* name, PyObject* obj) {
+    int status=0;
+
+    if (obj == NULL) {
+        return 0;
+    }
+    status = (PyDict_SetItemString(dict, name, obj) == 0);
+    Py_DECREF(obj);
+    return status;
+}
+
+static PyObject *
+PyMangleMask_get_pixel_stats(struct PyMangleMask *self, PyObject *args) {
+    PY_LONG_LONG ntop=0;
+    struct MangleIndexStats stats;
+    PyObject* dict=NULL;
+    char ptype[2];
+
+    if (!PyArg_ParseTuple(args, (char*)"L", &ntop)) {
+        return NULL;
+    }
+    if (ntop < 0) {
+        PyErr_Format(PyExc_ValueError, "ntop must be >= 0, got %lld", ntop);
+        return NULL;
+    }
+    if (self->mask->pixel_list_vec == NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "the mask has no pixel index; "
+                        "build one with build_healpix_index");
+        return NULL;
+    }
+
+    if (!mangle_index_stats(self->mask, (size_t) ntop, &stats)) {
+        PyErr_SetString(PyExc_RuntimeError, "could not get pixel stats");
+        return NULL;
+    }
+
+    ptype[0] = stats.pixeltype;
+    ptype[1] = '\0';
+
+    if (!(dict = PyDict_New())
+            || !dict_set_steal(dict, "pixeltype", PyUnicode_FromString(ptype))
+            || !dict_set_steal(dict, "pixelres",
+                               PyLong_FromLongLong(stats.pixelres))
+            || !dict_set_steal(dict, "npix", PyLong_FromLongLong(stats.npix))
+            || !dict_set_steal(dict, "nempty",
+                               PyLong_FromLongLong(stats.nempty))
+            || !dict_set_steal(dict, "max", PyLong_FromLongLong(stats.max))
+            || !dict_set_steal(dict, "mean", PyFloat_FromDouble(stats.mean))
+            || !dict_set_steal(dict, "mean_nonempty",
+                               PyFloat_FromDouble(stats.mean_nonempty))
+            || !dict_set_steal(dict, "hist",
+                               copy_to_array(stats.hist->size, NPY_INT64,
+                                             stats.hist->data))
+            || !dict_set_steal(dict, "top_pixels",
+                               copy_to_array(stats.ntop, NPY_INT64,
+                                             stats.top_pix))
+            || !dict_set_steal(dict, "top_counts",
+                               copy_to_array(stats.ntop, NPY_INT64,
+                                             stats.top_count))
+            || !dict_set_steal(dict, "top_ra",
+                               copy_to_array(stats.ntop, NPY_LONGDOUBLE,
+                                             stats.top_ra))
+            || !dict_set_steal(dict, "top_dec",
+                               copy_to_array(stats.ntop, NPY_LONGDOUBLE,
+                                             stats.top_dec))) {
+        Py_CLEAR(dict);
+    }
+
+    mangle_index_stats_free(&stats);
+    return dict;
+}
+
+static PyObject *
+size_dict_item(PyObject* dict, const char* name, size_t value) {
+    int status=0;
+    PyObject* obj=PyLong_FromSize_t(value);
+
+    if (obj == NULL) {
+        return NULL;
+    }
+    status = PyDict_SetItemString(dict, name, obj);
+    Py_DECREF(obj);
+    return (status == 0) ? dict : NULL;
+}
+
+static PyObject *
+PyMangleMask_get_load_report(struct PyMangleMask *self) {
+    const struct MangleLoadReport* report=&self->mask->load_report;
+    struct MangleMemory mem;
+    PyObject* dict=NULL;
+    PyObject* phases=NULL;
+    PyObject* memory=NULL;
+    PyObject* phase_dict=NULL;
+    PyObject* seconds=NULL;
+    int phase=0;
+
+    if (!(dict = PyDict_New())
+            || !(phases = PyDict_New())
+            || !(memory = PyDict_New())) {
+        goto _get_load_report_bail;
+    }
+
+    for (phase=0; phase<MANGLE_LOAD_NPHASE; phase++) {
+        if (!(phase_dict = PyDict_New())) {
+            goto _get_load_report_bail;
+        }
+        if (!(seconds = PyFloat_FromDouble(report->seconds[phase]))
+                || PyDict_SetItemString(phase_dict, "seconds", seconds) != 0
+                || (mangle_load_phase_has_nbytes(phase)
+                    && !size_dict_item(phase_dict, "nbytes",
+                                       report->nbytes[phase]))
+                || PyDict_SetItemString(phases,
+                                        mangle_load_phase_name(phase),
+                                        phase_dict) != 0) {
+            goto _get_load_report_bail;
+        }
+        Py_CLEAR(seconds);
+        Py_CLEAR(phase_dict);
+    }
+
+    mangle_memory(self->mask, &mem);
+    if (!size_dict_item(memory, "mask", mem.mask)
+            || !size_dict_item(memory, "polygons", mem.polygons)
+            || !size_dict_item(memory, "caps", mem.caps)
+            || !size_dict_item(memory, "pixel_index", mem.pixel_index)
+            || !size_dict_item(memory, "weight_index", mem.weight_index)
+            || !size_dict_item(memory, "stats", mem.stats)
+            || !size_dict_item(memory, "total", mem.total)) {
+        goto _get_load_report_bail;
+    }
+
+    if (PyDict_SetItemString(dict, "phases", phases) != 0
+            || PyDict_SetItemString(dict, "memory", memory) != 0) {
+        goto _get_load_report_bail;
+    }
+    Py_DECREF(phases);
+    Py_DECREF(memory);
+    return dict;
+
+_get_load_report_bail:
+    Py_XDECREF(seconds);
+    Py_XDECREF(phase_dict);
+    Py_XDECREF(phases);
+    Py_XDECREF(memory);
+    Py_XDECREF(dict);
+    return NULL;
+}
+
+static PyObject *
+PyMangleMask_index_pixeltype(struct PyMangleMask* self) {
+    char ptype[2];
+    ptype[0] = (self->mask->pixel_list_vec != NULL)
+        ? self->mask->pixel_list_vec->pixeltype : 'u';
+    ptype[1] = '\0';
+#if PY_MAJOR_VERSION >= 3
+    return PyUnicode_FromString((const char*) ptype);
+#else
+    return PyString_FromString((const char* ) ptype);
+#endif
+}
+static PyObject *
+PyMangleMask_index_pixelres(struct PyMangleMask* self) {
+    int64 res=-1;
+    if (self->mask->pixel_list_vec != NULL) {
+        res = self->mask->pixel_list_vec->pixelres;
+    }
+    return PyLong_FromLongLong( (PY_LONG_LONG) res);
 }
 
 
 static PyMethodDef PyMangleMask_methods[] = {
     {"polyid_and_weight", (PyCFunction)PyMangleMask_polyid_and_weight, METH_VARARGS, 
-        "polyid_and_weight(ra,dec)\n"
+        "polyid_and_weight(ra,dec,sort=0,cache=0)\n"
         "\n"
         "Check points against mask, returning (poly_id,weight).\n"
         "\n"
@@ -1757,9 +2615,13 @@ static PyMethodDef PyMangleMask_methods[] = {
         "ra:  array\n"
         "    A numpy array of type 'f16'\n"
         "dec: array\n"
-        "    A numpy array of type 'f16'\n"},
+        "    A numpy array of type 'f16'\n"
+        "sort: int, optional\n"
+        "    If non-zero, search the points in order of pixel number\n"
+        "cache: int, optional\n"
+        "    If non-zero, check the polygon holding the previous point first\n"},
     {"polyid",            (PyCFunction)PyMangleMask_polyid,            METH_VARARGS, 
-        "polyid(ra,dec)\n"
+        "polyid(ra,dec,sort=0,cache=0)\n"
         "\n"
         "Check points against mask, returning the polygon id or -1.\n"
         "\n"
@@ -1768,9 +2630,13 @@ static PyMethodDef PyMangleMask_methods[] = {
         "ra:  array\n"
         "    A numpy array of type 'f16'\n"
         "dec: array\n"
-        "    A numpy array of type 'f16'\n"},
+        "    A numpy array of type 'f16'\n"
+        "sort: int, optional\n"
+        "    If non-zero, search the points in order of pixel number\n"
+        "cache: int, optional\n"
+        "    If non-zero, check the polygon holding the previous point first\n"},
     {"weight",            (PyCFunction)PyMangleMask_weight,            METH_VARARGS, 
-        "weight(ra,dec)\n"
+        "weight(ra,dec,sort=0,cache=0)\n"
         "\n"
         "Check points against mask, returning the weight or 0.0\n"
         "\n"
@@ -1779,9 +2645,13 @@ static PyMethodDef PyMangleMask_methods[] = {
         "ra:  array\n"
         "    A numpy array of type 'f16'\n"
         "dec: array\n"
-        "    A numpy array of type 'f16'\n"},
+        "    A numpy array of type 'f16'\n"
+        "sort: int, optional\n"
+        "    If non-zero, search the points in order of pixel number\n"
+        "cache: int, optional\n"
+        "    If non-zero, check the polygon holding the previous point first\n"},
     {"contains",          (PyCFunction)PyMangleMask_contains,          METH_VARARGS, 
-        "contains(ra,dec)\n"
+        "contains(ra,dec,sort=0,cache=0,min_weight=None)\n"
         "\n"
         "Check points against mask, returning 1 if contained 0 if not\n"
         "\n"
@@ -1790,10 +2660,30 @@ static PyMethodDef PyMangleMask_methods[] = {
         "ra:  array\n"
         "    A numpy array of type 'f16'\n"
         "dec: array\n"
-        "    A numpy array of type 'f16'\n"},
+        "    A numpy array of type 'f16'\n"
+        "sort: int, optional\n"
+        "    If non-zero, search the points in order of pixel number\n"
+        "cache: int, optional\n"
+        "    If non-zero, check the polygon holding the previous point first\n"
+        "min_weight: float, optional\n"
+        "    If sent, points in polygons with weight <= min_weight are not\n"
+        "    contained\n"},
+
+    {"count_contained",   (PyCFunction)PyMangleMask_count_contained,   METH_VARARGS,
+        "count_contained(ra,dec,sort=0,cache=0,min_weight=None)\n"
+        "\n"
+        "Return the number of points contained in the mask, without\n"
+        "making an array of results.  The parameters are as for contains\n"},
+
+    {"contains_packed",   (PyCFunction)PyMangleMask_contains_packed,   METH_VARARGS,
+        "contains_packed(ra,dec,sort=0,cache=0,min_weight=None)\n"
+        "\n"
+        "Check points against the mask, returning (count, bits) where bits\n"
+        "is a uint8 array with a bit set for each contained point, in the\n"
+        "order of numpy.packbits.  The parameters are as for contains\n"},
 
     {"check_quadrants",   (PyCFunction)PyMangleMask_check_quadrants,          METH_VARARGS, 
-        "check_quadrants(ra,dec)\n"
+        "check_quadrants(ra, dec, angle_degrees, density, max_masked_fraction, exact=0, nthreads=0, seed=-1, error_rate=0)\n"
         "\n"
         "check quadrants of a cap against the mask\n"},
 
@@ -1837,6 +2727,28 @@ static PyMethodDef PyMangleMask_methods[] = {
         "------\n"
         "ra,dec arrays"},
 
+    {"get_pixel_stats", (PyCFunction)PyMangleMask_get_pixel_stats, METH_VARARGS,
+     "get_pixel_stats(ntop)\n"
+     "\n"
+     "Return a dict describing the number of polygons listed per pixel of\n"
+     "the index, with the ntop fullest pixels.\n"},
+    {"get_load_report", (PyCFunction)PyMangleMask_get_load_report, METH_VARARGS,
+     "get_load_report()\n"
+     "\n"
+     "Return a dict with the time and bytes allocated for each phase of\n"
+     "reading the mask, and the current memory footprint.\n"},
+    {"set_stats", (PyCFunction)PyMangleMask_set_stats, METH_VARARGS,
+     "set_stats(enable)\n"
+     "\n"
+     "Enable or disable counting the work done in searches.\n"},
+    {"get_stats", (PyCFunction)PyMangleMask_get_stats, METH_VARARGS,
+     "get_stats()\n"
+     "\n"
+     "Return a dict of search counts, or None if stats are not enabled.\n"},
+    {"reset_stats", (PyCFunction)PyMangleMask_reset_stats, METH_VARARGS,
+     "reset_stats()\n"
+     "\n"
+     "Zero the search counts.\n"},
     {"read_weights", (PyCFunction)PyMangleMask_read_weights, METH_VARARGS,
      "read_weights(weightfile)\n"
      "\n"
@@ -1916,6 +2828,65 @@ static PyMethodDef PyMangleMask_methods[] = {
      "    A numpy array of type 'f16'\n"
      "dec: array\n"
      "    A numpy array of type 'f16'\n"},
+    {"calc_healpix", (PyCFunction)PyMangleMask_calc_healpix, METH_VARARGS,
+     "calc_healpix(ra,dec)\n"
+     "\n"
+     "Calculate HEALPix pixel numbers, using the nside and ordering\n"
+     "of the HEALPix index.\n"
+     "\n"
+     "parameters\n"
+     "----------\n"
+     "ra:  array\n"
+     "    A numpy array of type 'f16'\n"
+     "dec: array\n"
+     "    A numpy array of type 'f16'\n"},
+    {"build_healpix_index", (PyCFunction)PyMangleMask_build_healpix_index, METH_VARARGS,
+     "build_healpix_index(nside, nest)\n"
+     "\n"
+     "Replace the pixel index with one keyed by HEALPix pixel.\n"},
+    {"compute_areas", (PyCFunction)PyMangleMask_compute_areas, METH_VARARGS,
+     "compute_areas(all=1, nthreads=0)\n"
+     "\n"
+     "Compute the polygon areas from their caps, for all polygons or only\n"
+     "those without an area in the file, using nthreads threads, 0 for\n"
+     "all cpus.  The total area is updated.\n"},
+    {"cap_areas", (PyCFunction)PyMangleMask_cap_areas, METH_VARARGS,
+     "cap_areas(ra, dec, radius, min_weight=None, nthreads=0)\n"
+     "\n"
+     "Return the masked area and weighted area, in steradians, inside caps\n"
+     "of the given radius around ra,dec, all in degrees and 'f16'.\n"},
+    {"box_areas", (PyCFunction)PyMangleMask_box_areas, METH_VARARGS,
+     "box_areas(ramin, ramax, decmin, decmax, min_weight=None, nthreads=0)\n"
+     "\n"
+     "Return the masked area and weighted area, in steradians, inside ra,dec\n"
+     "boxes, all in degrees and 'f16'.\n"},
+    {"cap_polygons", (PyCFunction)PyMangleMask_cap_polygons, METH_VARARGS,
+     "cap_polygons(ra, dec, radius, min_weight=None, nthreads=0)\n"
+     "\n"
+     "Return (polys, offsets): the numbers of the polygons overlapping cap i\n"
+     "are polys[offsets[i]:offsets[i+1]].\n"},
+    {"box_polygons", (PyCFunction)PyMangleMask_box_polygons, METH_VARARGS,
+     "box_polygons(ramin, ramax, decmin, decmax, min_weight=None, nthreads=0)\n"
+     "\n"
+     "The same as cap_polygons, for ra,dec boxes.\n"},
+    {"boundary_distance", (PyCFunction)PyMangleMask_boundary_distance, METH_VARARGS,
+     "boundary_distance(ra, dec, max_radius, min_weight=None, nthreads=0)\n"
+     "\n"
+     "Return the distance in degrees from each point to the nearest mask\n"
+     "boundary, up to max_radius.  ra,dec are 'f16' arrays.\n"},
+    {"coverage_map", (PyCFunction)PyMangleMask_coverage_map, METH_VARARGS,
+     "coverage_map(pixelres, scheme, weighted, maxdepth, min_weight=None, nthreads=0)\n"
+     "\n"
+     "Return the fraction of each pixel covered by the mask, for scheme 'h'\n"
+     "(HEALPix RING), 'n' (NESTED) or 's' (simple) at resolution pixelres.\n"},
+    {"get_index_pixeltype", (PyCFunction)PyMangleMask_index_pixeltype, METH_VARARGS,
+     "get_index_pixeltype()\n"
+     "\n"
+     "Return the pixel type of the index as a string. 'u' if no index.\n"},
+    {"get_index_pixelres", (PyCFunction)PyMangleMask_index_pixelres, METH_VARARGS,
+     "get_index_pixelres()\n"
+     "\n"
+     "Return the resolution of the index, -1 if no index.\n"},
     {NULL}  /* Sentinel */
 };
 
@@ -1962,6 +2933,8 @@ static PyTypeObject PyMangleMaskType = {
         "    is_pixelized\n"
         "    pixeltype\n"
         "    pixelres\n"
+        "    index_pixeltype\n"
+        "    index_pixelres\n"
         "    maxpix\n"
         "    is_snapped\n"
         "    is_balkanized\n"
@@ -1975,10 +2948,18 @@ static PyTypeObject PyMangleMaskType = {
         "    weight(ra,dec)\n"
         "    polyid_and_weight(ra,dec)\n"
         "    contains(ra,dec)\n"
+        "    count_contained(ra,dec)\n"
         "    genrand(nrand)\n"
         "    genrand_range(nrand,ramin,ramax,decmin,decmax)\n"
         "    calc_simplepix(ra,dec)\n"
+        "    calc_healpix(ra,dec)\n"
+        "    build_healpix_index(nside, nest)\n"
         "    read_weights(weightfile)\n"
+        "    pixel_stats(ntop=10)\n"
+        "    load_report()\n"
+        "    enable_stats(enable=True)\n"
+        "    stats()\n"
+        "    reset_stats()\n"
         "\n"
         "getters (correspond to properties above)\n"
         "----------------------------------------\n"
@@ -1989,6 +2970,8 @@ static PyTypeObject PyMangleMaskType = {
         "    get_is_pixelized()\n"
         "    get_pixeltype()\n"
         "    get_pixelres()\n"
+        "    get_index_pixeltype()\n"
+        "    get_index_pixelres()\n"
         "    get_maxpix()\n"
         "    get_is_snapped()\n"
         "    get_is_balkanized()\n"
@@ -2037,18 +3020,23 @@ static PyObject*
 PyMangle_genrand_cap(PyObject* self, PyObject* args)
 {
     int status=1;
-    PY_LONG_LONG nrand=0, i=0;
+    PY_LONG_LONG nrand=0, i=0, j=0, nb=0;
     double ra_cen=0,dec_cen=0,angle_degrees=0;
-    int quadrant;
+    int quadrant, as_double=0;
     PyObject* ra_obj=NULL;
     PyObject* dec_obj=NULL;
     PyObject* tuple=NULL;
     long double* ra_ptr=NULL;
     long double* dec_ptr=NULL;
+    double* ra_dptr=NULL;
+    double* dec_dptr=NULL;
+    double ra_buff[GENRAND_CAP_BLOCK], dec_buff[GENRAND_CAP_BLOCK];
     struct CapForRand rcap;
+    unsigned short rng[3];
 
-    if (!PyArg_ParseTuple(args, (char*)"Ldddi", 
-                          &nrand, &ra_cen, &dec_cen, &angle_degrees, &quadrant)) {
+    if (!PyArg_ParseTuple(args, (char*)"Ldddi|i", 
+                          &nrand, &ra_cen, &dec_cen, &angle_degrees, &quadrant,
+                          &as_double)) {
         return NULL;
     }
 
@@ -2066,22 +3054,50 @@ PyMangle_genrand_cap(PyObject* self, PyObject* args)
     }
 
 
-    if (!(ra_obj=make_longdouble_array(nrand, "ra", &ra_ptr))) {
-        status=0;
-        goto genrand_cap_cleanup;
-    }
-    if (!(dec_obj=make_longdouble_array(nrand, "dec", &dec_ptr))) {
-        status=0;
-        goto genrand_cap_cleanup;
+    if (as_double) {
+        if (!(ra_obj=make_double_array(nrand, "ra", &ra_dptr))) {
+            status=0;
+            goto genrand_cap_cleanup;
+        }
+        if (!(dec_obj=make_double_array(nrand, "dec", &dec_dptr))) {
+            status=0;
+            goto genrand_cap_cleanup;
+        }
+    } else {
+        if (!(ra_obj=make_longdouble_array(nrand, "ra", &ra_ptr))) {
+            status=0;
+            goto genrand_cap_cleanup;
+        }
+        if (!(dec_obj=make_longdouble_array(nrand, "dec", &dec_ptr))) {
+            status=0;
+            goto genrand_cap_cleanup;
+        }
     }
 
-    seed_random();
+    seed_random_state(rng);
 
     CapForRand_from_radec(&rcap, ra_cen, dec_cen, angle_degrees);
 
-    for (i=0; i<nrand; i++) {
-        genrand_cap_radec(&rcap, quadrant, &ra_ptr[i], &dec_ptr[i]);
+    // the points are generated in double precision either way
+    Py_BEGIN_ALLOW_THREADS
+    if (as_double) {
+        genrand_cap_radec_many(rng, &rcap, quadrant, nrand,
+                               ra_dptr, dec_dptr);
+    } else {
+        for (i=0; i<nrand; i += nb) {
+            nb = nrand-i;
+            if (nb > GENRAND_CAP_BLOCK) {
+                nb = GENRAND_CAP_BLOCK;
+            }
+            genrand_cap_radec_many(rng, &rcap, quadrant, nb,
+                                   ra_buff, dec_buff);
+            for (j=0; j<nb; j++) {
+                ra_ptr[i+j] = ra_buff[j];
+                dec_ptr[i+j] = dec_buff[j];
+            }
+        }
     }
+    Py_END_ALLOW_THREADS
 
 genrand_cap_cleanup:
     if (status != 1) {
@@ -2102,7 +3118,7 @@ genrand_cap_cleanup:
 static PyMethodDef mangle_methods[] = {
 
     {"genrand_cap",       (PyCFunction)PyMangle_genrand_cap,         METH_VARARGS, 
-        "genrand_cap(ra, dec, angle_degrees)\n"
+        "genrand_cap(nrand, ra, dec, angle_degrees, quadrant, as_double=0)\n"
         "\n"
         "get random points in the specified cap.\n"},
 
@@ -4,6 +4,7 @@
 #include <string.h>
 #include "cap.h"
 #include "point.h"
+#include "rand.h"
 #include "defs.h"
 
 /*
@@ -63,7 +64,7 @@ void snprint_cap(const struct Cap* self, char *buff, size_t n)
 
 
 
-int is_in_cap(struct Cap* cap, struct Point* pt)
+int is_in_cap(const struct Cap* cap, const struct Point* pt)
 {
     int incap=0;
     long double cdotm=0;
@@ -255,6 +256,14 @@ struct Cap capvec_pop(struct CapVec* self)
     return self->data[index];
 }
 
+size_t capvec_nbytes(const struct CapVec* self)
+{
+    if (self == NULL) {
+        return 0;
+    }
+    return sizeof(struct CapVec) + self->capacity*sizeof(struct Cap);
+}
+
 struct CapVec* capvec_copy(const struct CapVec* self)
 {
     struct CapVec * cap_vec=NULL;
@@ -315,6 +324,24 @@ void CapForRand_from_thetaphi(struct CapForRand *rcap,
     rcap->cos_phi = cosl(phi);
     rcap->sin_phi = sinl(phi);
     rcap->angle = angle_radians;
+
+    // 2 sin^2(angle/2) keeps the precision of small caps
+    rcap->cm = 2*sinl(0.5*angle_radians)*sinl(0.5*angle_radians);
+
+    // east
+    rcap->rot[0][0] = -rcap->sin_phi;
+    rcap->rot[1][0] = rcap->cos_phi;
+    rcap->rot[2][0] = 0;
+
+    // north
+    rcap->rot[0][1] = -rcap->cos_theta*rcap->cos_phi;
+    rcap->rot[1][1] = -rcap->cos_theta*rcap->sin_phi;
+    rcap->rot[2][1] = rcap->sin_theta;
+
+    // center
+    rcap->rot[0][2] = rcap->sin_theta*rcap->cos_phi;
+    rcap->rot[1][2] = rcap->sin_theta*rcap->sin_phi;
+    rcap->rot[2][2] = rcap->cos_theta;
 }
 void CapForRand_from_radec(struct CapForRand *rcap,
                            long double ra,
@@ -331,15 +358,24 @@ void genrand_cap_thetaphi(const struct CapForRand *rcap,
                           int quadrant,
                           long double *theta,
                           long double *phi)
+{
+    genrand_cap_thetaphi_r(NULL, rcap, quadrant, theta, phi);
+}
+
+void genrand_cap_thetaphi_r(unsigned short *rng,
+                            const struct CapForRand *rcap,
+                            int quadrant,
+                            long double *theta,
+                            long double *phi)
 {
     long double rand_r, rand_posangle, 
         sinr, cosr, cospsi, sintheta, costheta,
         cosDphi, Dphi;
 
     // uniform in opening angle squared
-    rand_r = (long double) ( sqrt(drand48())*rcap->angle );
+    rand_r = (long double) ( sqrt(rand_uniform(rng))*rcap->angle );
 
-    rand_posangle = (long double) ( drand48()*2*M_PI );
+    rand_posangle = (long double) ( rand_uniform(rng)*2*M_PI );
     switch (quadrant) {
         case 1: 
             rand_posangle *= 0.25; // scale back to range pi/2
@@ -395,6 +431,15 @@ void genrand_cap_radec(const struct CapForRand *rcap,
                        int quadrant,
                        long double *ra,
                        long double *dec)
+{
+    genrand_cap_radec_r(NULL, rcap, quadrant, ra, dec);
+}
+
+void genrand_cap_radec_r(unsigned short *rng,
+                         const struct CapForRand *rcap,
+                         int quadrant,
+                         long double *ra,
+                         long double *dec)
 {
     long double theta, phi;
     int quadrant_thetaphi;
@@ -418,6 +463,84 @@ void genrand_cap_radec(const struct CapForRand *rcap,
     }
 
 
-    genrand_cap_thetaphi(rcap, quadrant_thetaphi, &theta, &phi);
+    genrand_cap_thetaphi_r(rng, rcap, quadrant_thetaphi, &theta, &phi);
     radec_from_thetaphi(theta, phi, ra, dec);
 }
+
+/*
+   place n points, from the uniform deviates u for the distance and v for
+   the position angle.  The sin and cos of the position angle, and the
+   angles of the result, are library calls that are only vectorized with a
+   vector math library, so they are kept out of the loop for the rest
+*/
+static void genrand_cap_place(const struct CapForRand *rcap,
+                              double psi0,
+                              double dpsi,
+                              size_t n,
+                              const double* restrict u,
+                              const double* restrict v,
+                              double* restrict ra,
+                              double* restrict dec)
+{
+    size_t i=0;
+    double cm=rcap->cm;
+    double r00=rcap->rot[0][0], r01=rcap->rot[0][1], r02=rcap->rot[0][2];
+    double r10=rcap->rot[1][0], r11=rcap->rot[1][1], r12=rcap->rot[1][2];
+    double r20=rcap->rot[2][0], r21=rcap->rot[2][1], r22=rcap->rot[2][2];
+    double cpsi[GENRAND_CAP_BLOCK], spsi[GENRAND_CAP_BLOCK];
+    double x[GENRAND_CAP_BLOCK], y[GENRAND_CAP_BLOCK], z[GENRAND_CAP_BLOCK];
+    double w=0, cr=0, sr=0, phi=0;
+
+    for (i=0; i<n; i++) {
+        cpsi[i] = cos(psi0 + dpsi*v[i]);
+        spsi[i] = sin(psi0 + dpsi*v[i]);
+    }
+
+    for (i=0; i<n; i++) {
+        w = u[i]*cm;
+        cr = 1 - w;
+        sr = sqrt(w*(2 - w));
+
+        x[i] = sr*(r00*cpsi[i] + r01*spsi[i]) + r02*cr;
+        y[i] = sr*(r10*cpsi[i] + r11*spsi[i]) + r12*cr;
+        z[i] = sr*(r20*cpsi[i] + r21*spsi[i]) + r22*cr;
+    }
+
+    for (i=0; i<n; i++) {
+        phi = atan2(y[i], x[i])*R2D;
+        ra[i] = phi + 360.0*(phi < 0);
+        dec[i] = asin(fmin(fmax(z[i], -1.0), 1.0))*R2D;
+    }
+}
+
+void genrand_cap_radec_many(unsigned short *rng,
+                            const struct CapForRand *rcap,
+                            int quadrant,
+                            size_t n,
+                            double *ra,
+                            double *dec)
+{
+    size_t start=0, nb=0, i=0;
+    double u[GENRAND_CAP_BLOCK], v[GENRAND_CAP_BLOCK];
+    double psi0=0, dpsi=2*M_PI;
+
+    // position angle is from east toward north, so quadrant 1, higher ra
+    // and dec, is the first
+    if (quadrant >= 1 && quadrant <= 4) {
+        psi0 = 0.5*M_PI*(quadrant-1);
+        dpsi = 0.5*M_PI;
+    }
+
+    for (start=0; start<n; start += nb) {
+        nb = n-start;
+        if (nb > GENRAND_CAP_BLOCK) {
+            nb = GENRAND_CAP_BLOCK;
+        }
+        for (i=0; i<nb; i++) {
+            u[i] = rand_uniform(rng);
+            v[i] = rand_uniform(rng);
+        }
+        genrand_cap_place(rcap, psi0, dpsi, nb, u, v,
+                          &ra[start], &dec[start]);
+    }
+}
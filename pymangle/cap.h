@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "point.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct Cap {
     long double x;
     long double y;
@@ -39,6 +43,12 @@ struct CapForRand {
 
     long double angle; // angular "radius" of cap in radians
                        // can calculate from a Cap with acosl(1-cm)
+
+    // for the batch generator: 1-cos(angle), and the rotation taking the
+    // pole to the center, with columns the east, north and center
+    // directions, so position angle zero is east and pi/2 north
+    double cm;
+    double rot[3][3];
 };
 
 // new capvec with the default capacity (CAPVEC_INITCAP) but size 0
@@ -84,6 +94,9 @@ struct CapVec* capvec_free(struct CapVec* self);
 // get a full copy of the vector in new CapVec
 struct CapVec* capvec_copy(const struct CapVec* self);
 
+// bytes allocated for the vector, including unused capacity
+size_t capvec_nbytes(const struct CapVec* self);
+
 /*
    Find the smallest cap in the cap vector
 
@@ -104,7 +117,7 @@ int read_cap(FILE* fptr, struct Cap* self);
 void print_cap(FILE* fptr, struct Cap* self);
 void snprint_cap(const struct Cap* self, char *buff, size_t n);
 
-int is_in_cap(struct Cap* cap, struct Point* pt);
+int is_in_cap(const struct Cap* cap, const struct Point* pt);
 
 /*
    generating random points in a cap.
@@ -139,4 +152,41 @@ void genrand_cap_radec(const struct CapForRand *rcap,
                        long double *ra,
                        long double *dec);
 
+// versions with a caller-owned erand48 state, see rand.h
+void genrand_cap_thetaphi_r(unsigned short *rng,
+                            const struct CapForRand *rcap,
+                            int quadrant,
+                            long double *theta,
+                            long double *phi);
+void genrand_cap_radec_r(unsigned short *rng,
+                         const struct CapForRand *rcap,
+                         int quadrant,
+                         long double *ra,
+                         long double *dec);
+
+/*
+   n random points in the cap, or the quadrant as for genrand_cap_radec,
+   as ra,dec in degrees.  The points are uniform in area: the distance from
+   the center has 1-cos(r) uniform in [0,cm), and they are placed about the
+   pole in closed form and rotated to the center with rcap->rot.
+
+   This is done in double precision, in blocks of GENRAND_CAP_BLOCK.  The
+   uniform deviates of a block are drawn first, and the trig calls are kept
+   in loops of their own, so the rest, the square root and rotation, is a
+   loop without branches over restrict arrays that the compiler vectorizes.
+*/
+
+#define GENRAND_CAP_BLOCK 256
+
+void genrand_cap_radec_many(unsigned short *rng,
+                            const struct CapForRand *rcap,
+                            int quadrant,
+                            size_t n,
+                            double *ra,
+                            double *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -1,8 +1,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
 #include "mangle.h"
 #include "polygon.h"
+#include "parallel.h"
+#include "sort.h"
+#include "rand.h"
 #include "defs.h"
 
 
@@ -40,10 +46,14 @@ void mangle_clear(struct MangleMask* self)
 
         self->poly_vec = polyvec_free(self->poly_vec);
         self->pixel_list_vec = PixelListVec_free(self->pixel_list_vec);
+        self->weight_list_vec = PixelListVec_free(self->weight_list_vec);
+        mangle_stats_enable(self, 0);
 
         self->pixelres=-1;
         self->maxpix=-1;
         self->pixeltype='u';
+
+        memset(&self->load_report, 0, sizeof(self->load_report));
     }
 }
 void mangle_set_verbosity(struct MangleMask* self, int verbosity)
@@ -81,19 +91,108 @@ void mangle_print(FILE* fptr, struct MangleMask* self, int verbosity)
             self->snapped, self->balkanized, self->weightfile,
             self->verbose);
 
+    mangle_print_load_report(fptr, self);
+
     if (verbosity > 1) {
         print_polygons(fptr,self->poly_vec);
     }
 }
 
+static const char* mangle_load_phase_names[MANGLE_LOAD_NPHASE] = {
+    "header",
+    "polygons",
+    "area",
+    "pixel_map",
+    "weight_index",
+};
+
+const char* mangle_load_phase_name(int phase)
+{
+    if (phase < 0 || phase >= MANGLE_LOAD_NPHASE) {
+        return "unknown";
+    }
+    return mangle_load_phase_names[phase];
+}
+
+int mangle_load_phase_has_nbytes(int phase)
+{
+    return (phase >= 0 && phase < MANGLE_LOAD_NPHASE
+            && phase != MANGLE_LOAD_AREA);
+}
+
+void mangle_memory(const struct MangleMask* self, struct MangleMemory* mem)
+{
+    memset(mem, 0, sizeof(struct MangleMemory));
+
+    mem->mask = sizeof(struct MangleMask);
+    if (self->filename != NULL) {
+        mem->mask += strlen(self->filename)+1;
+    }
+    mem->polygons = polyvec_nbytes(self->poly_vec);
+    mem->caps = polyvec_caps_nbytes(self->poly_vec);
+    mem->pixel_index = PixelListVec_nbytes(self->pixel_list_vec);
+    mem->weight_index = PixelListVec_nbytes(self->weight_list_vec);
+    if (self->stats != NULL) {
+        mem->stats = sizeof(struct MangleStats)
+                     + self->stats->npix*sizeof(int64);
+    }
+
+    mem->total = mem->mask + mem->polygons + mem->caps
+                 + mem->pixel_index + mem->weight_index + mem->stats;
+}
+
+void mangle_print_load_report(FILE* fptr, const struct MangleMask* self)
+{
+    int phase=0;
+    double seconds=0;
+    struct MangleMemory mem;
+
+    fprintf(fptr, "\tload phases:\n");
+    for (phase=0; phase<MANGLE_LOAD_NPHASE; phase++) {
+        fprintf(fptr, "\t    %-13s %10.6f s",
+                mangle_load_phase_name(phase),
+                self->load_report.seconds[phase]);
+        if (mangle_load_phase_has_nbytes(phase)) {
+            fprintf(fptr, " %12ld bytes", self->load_report.nbytes[phase]);
+        }
+        fprintf(fptr, "\n");
+        seconds += self->load_report.seconds[phase];
+    }
+    fprintf(fptr, "\t    %-13s %10.6f s\n", "total", seconds);
+
+    mangle_memory(self, &mem);
+    fprintf(fptr,
+            "\tmemory:\n"
+            "\t    mask          %12ld bytes\n"
+            "\t    polygons      %12ld bytes\n"
+            "\t    caps          %12ld bytes\n"
+            "\t    pixel_index   %12ld bytes\n"
+            "\t    weight_index  %12ld bytes\n"
+            "\t    stats         %12ld bytes\n"
+            "\t    total         %12ld bytes\n",
+            mem.mask, mem.polygons, mem.caps, mem.pixel_index,
+            mem.weight_index, mem.stats, mem.total);
+}
+
+static double mangle_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
 
 int mangle_read(struct MangleMask* self, const char* filename)
 {
     int status=1;
     FILE *fptr=NULL;
+    struct MangleLoadReport* report=&self->load_report;
+    double tm=0;
 
     mangle_clear(self);
     self->real = 10;  // default
+
+    tm = mangle_now();
     self->filename=strdup(filename);
 
     fptr = fopen(filename,"r");
@@ -107,21 +206,49 @@ int mangle_read(struct MangleMask* self, const char* filename)
         status=0;
         goto _mangle_read_bail;
     }
+    report->seconds[MANGLE_LOAD_HEADER] = mangle_now() - tm;
+    report->nbytes[MANGLE_LOAD_HEADER] = strlen(filename)+1;
 
     if (self->verbose)
         wlog("reading %ld polygons\n", self->npoly);
+    tm = mangle_now();
     self->poly_vec = read_polygons(fptr, self->npoly);
     if (!self->poly_vec) {
         status=0;
         goto _mangle_read_bail;
     }
+    report->seconds[MANGLE_LOAD_POLYGONS] = mangle_now() - tm;
+    report->nbytes[MANGLE_LOAD_POLYGONS] =
+        polyvec_nbytes(self->poly_vec) + polyvec_caps_nbytes(self->poly_vec);
 
-    mangle_calc_area_and_maxpix(self);
+    tm = mangle_now();
+    if (!mangle_compute_areas(self, 0, 0)) {
+        status=0;
+        goto _mangle_read_bail;
+    }
+    report->seconds[MANGLE_LOAD_AREA] = mangle_now() - tm;
 
+    tm = mangle_now();
     if (!set_pixel_map(self)) {
         status=0;
         goto _mangle_read_bail;
     }
+    report->seconds[MANGLE_LOAD_PIXEL_MAP] = mangle_now() - tm;
+    report->nbytes[MANGLE_LOAD_PIXEL_MAP] =
+        PixelListVec_nbytes(self->pixel_list_vec);
+
+    tm = mangle_now();
+    if (!mangle_build_weight_index(self)) {
+        status=0;
+        goto _mangle_read_bail;
+    }
+    report->seconds[MANGLE_LOAD_WEIGHT_INDEX] = mangle_now() - tm;
+    report->nbytes[MANGLE_LOAD_WEIGHT_INDEX] =
+        PixelListVec_nbytes(self->weight_list_vec);
+
+    if (self->verbose) {
+        mangle_print_load_report(stderr, self);
+    }
 
 _mangle_read_bail:
     if (fptr != NULL) {
@@ -233,6 +360,7 @@ int mangle_read_header(struct MangleMask* self, FILE* fptr)
 
 
             if (!pixel_parse_scheme(self->buff, &self->pixelres, &self->pixeltype)) {
+                status=0;
                 goto _read_header_bail;
             }
             if (self->verbose) {
@@ -318,6 +446,8 @@ int mangle_read_weights(struct MangleMask* self, const char* weightfile)
     // and because it all worked we can set the filename
     snprintf(self->weightfile,_MANGLE_MAX_FILELEN,"%s",weightfile);
 
+    status=mangle_build_weight_index(self);
+
 _mangle_readweight_bail:
     if (wfptr != NULL) {
         fclose(wfptr);
@@ -337,9 +467,68 @@ int mangle_set_weights(struct MangleMask* self, long double *weights) {
 
     memset(self->weightfile, 0, sizeof(self->weightfile));
 
+    status=mangle_build_weight_index(self);
+
     return status;
 }
 
+struct MangleAreaWork {
+    struct PolyVec* poly_vec;
+    int all;
+    int failed;
+};
+
+static void mangle_area_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleAreaWork* work=ctx;
+    struct Polygon* ply=NULL;
+    long double area=0;
+    size_t i=0;
+
+    for (i=begin; i<end; i++) {
+        ply = &work->poly_vec->data[i];
+        if (!work->all && ply->area_set) {
+            continue;
+        }
+        if (!polygon_calc_area(ply->caps, &area)) {
+            __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        ply->area = area;
+        ply->area_set = 1;
+    }
+}
+
+int mangle_compute_areas(struct MangleMask* self, int all, int nthreads)
+{
+    struct MangleAreaWork work;
+    size_t i=0, nneed=0;
+
+    if (!self->poly_vec) {
+        return 1;
+    }
+
+    for (i=0; i<self->poly_vec->size; i++) {
+        if (all || !self->poly_vec->data[i].area_set) {
+            nneed++;
+        }
+    }
+
+    work.poly_vec = self->poly_vec;
+    work.all = all;
+    work.failed = 0;
+    if (nneed > 0) {
+        if (self->verbose) {
+            wlog("computing areas for %lu polygons\n", nneed);
+        }
+        mangle_parallel_for(self->poly_vec->size, nthreads, 256,
+                            mangle_area_range, &work);
+    }
+
+    mangle_calc_area_and_maxpix(self);
+    return !work.failed;
+}
+
 void mangle_calc_area_and_maxpix(struct MangleMask* self)
 {
     struct Polygon* ply=NULL;
@@ -365,7 +554,14 @@ int set_pixel_map(struct MangleMask *self)
 {
     int status=1;
     struct Polygon* ply=NULL;
-    int64 ipoly=0;
+    size_t ipoly=0;
+
+    // only the simple scheme has a level; for HEALPix pixelres is nside
+    if (self->pixeltype == 's') {
+        simplepix_init(&self->simplepix, self->pixelres);
+    } else {
+        memset(&self->simplepix, 0, sizeof(self->simplepix));
+    }
 
     if (self->pixelres >= 0) {
         if (self->verbose) {
@@ -377,16 +573,19 @@ int set_pixel_map(struct MangleMask *self)
             status = 0;
             goto _set_pixel_map_errout;
         } else {
+            self->pixel_list_vec->pixeltype = self->pixeltype;
+            self->pixel_list_vec->pixelres = self->pixelres;
 
             if (self->verbose)
                 fprintf(stderr,"Filling pixel map\n");
 
             for (ipoly=0; ipoly<self->poly_vec->size; ipoly++) {
                 ply=&self->poly_vec->data[ipoly];
-                i64stack_push(self->pixel_list_vec->data[ply->pixel_id], ipoly);
+                i64stack_push(self->pixel_list_vec->data[ply->pixel_id],
+                              (int64) ipoly);
                 if (self->verbose > 2) {
                     fprintf(stderr,
-                            "Adding poly %ld to pixel map at %ld (%ld)\n",
+                            "Adding poly %lu to pixel map at %ld (%ld)\n",
                             ipoly,ply->pixel_id,
                             self->pixel_list_vec->data[ply->pixel_id]->size);
                 }
@@ -399,75 +598,3148 @@ _set_pixel_map_errout:
 
 }
 
-int mangle_polyid_and_weight(struct MangleMask *self, 
-                             struct Point *pt, 
-                             int64 *poly_id,
-                             long double *weight)
+/*
+ * whether a pixel, given by its center and the cosine and sine of the radius
+ * of a cap holding it, is clear of one of the polygon's caps.  The bounding
+ * cap of a long stripe reaches pixels far from it, which are clear of the
+ * caps cutting the stripe
+ */
+static int index_pixel_clear(const struct Polygon* ply,
+                             const struct Point* center,
+                             long double cosr,
+                             long double sinr)
 {
-    if (self->pixeltype == 'u') {
-        return mangle_polyid_and_weight_nopix(self,pt,poly_id,weight);
-    } else {
-        return mangle_polyid_and_weight_pix(self,pt,poly_id,weight);
+    const struct Cap* cap=NULL;
+    long double cm=0, sign=1, ccos=0, csin=0, dot=0;
+    size_t i=0;
+
+    for (i=0; i<ply->caps->size; i++) {
+        cap = &ply->caps->data[i];
+        cm = cap->cm;
+        sign = 1;
+        if (cm < 0) {
+            sign = -1;
+            cm = 2 + cm;
+        }
+        if (cm >= 2 || cm <= 0) {
+            continue;
+        }
+        ccos = 1 - cm;
+        csin = sqrtl(cm*(2 - cm));
+
+        dot = sign*(cap->x*center->x + cap->y*center->y + cap->z*center->z);
+
+        // radius sum below pi, and separation at least the sum
+        if (csin*cosr + ccos*sinr > 0
+                && dot < ccos*cosr - csin*sinr - 1.0e-15) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-int mangle_polyid_and_weight_nopix(struct MangleMask *self, 
-                                   struct Point *pt, 
-                                   int64 *poly_id,
-                                   long double *weight)
+int mangle_build_healpix_index(struct MangleMask *self,
+                               int64 nside,
+                               char pixeltype)
 {
-    size_t i=0;
+    int status=1;
+    struct PixelListVec* pixel_list_vec=NULL;
+    struct i64stack* pixels=NULL;
     struct Polygon* ply=NULL;
+    struct Cap bound;
+    struct Point center;
+    long double pixrad=0, cosr=0, sinr=0;
+    int64 npix=0;
+    size_t ipoly=0, i=0;
+
+    if (pixeltype != 'h' && pixeltype != 'n') {
+        wlog("HEALPix index must be 'h' (ring) or 'n' (nested), "
+             "got '%c'\n", pixeltype);
+        return 0;
+    }
+    if (!healpix_check_nside(nside, pixeltype)) {
+        wlog("HEALPix nside must be in [1,2^29], and a power of 2 for "
+             "nested ordering, got %ld\n", nside);
+        return 0;
+    }
 
-    *poly_id=-1;
-    *weight=0.0;
+    npix = healpix_npix(nside);
+    if (self->verbose) {
+        wlog("Allocating %ld in HEALPix PixelListVec\n", npix);
+    }
+    pixel_list_vec = PixelListVec_new(npix);
+    if (pixel_list_vec == NULL) {
+        status = 0;
+        goto _build_healpix_index_errout;
+    }
+    pixel_list_vec->pixeltype = pixeltype;
+    pixel_list_vec->pixelres = nside;
 
-    for (i=0; i<self->poly_vec->size; i++) {
-        ply = &self->poly_vec->data[i];
-        if (is_in_poly(ply, pt)) {
-            *poly_id=ply->poly_id;
-            *weight=ply->weight;
-            break;
+    pixels = i64stack_new(0);
+
+    pixrad = healpix_max_pixrad(nside);
+    cosr = cosl(pixrad);
+    sinr = sinl(pixrad);
+
+    // polygons are added in order, so the search order within a pixel is the
+    // same as for the unpixelized search
+    for (ipoly=0; ipoly<self->poly_vec->size; ipoly++) {
+        ply=&self->poly_vec->data[ipoly];
+
+        polygon_bounding_cap(ply, &bound);
+
+        i64stack_resize(pixels, 0);
+        healpix_query_cap(nside, pixeltype, &bound, pixels);
+
+        for (i=0; i<pixels->size; i++) {
+            pixel_center(pixeltype, nside, pixels->data[i], &center);
+            if (index_pixel_clear(ply, &center, cosr, sinr)) {
+                continue;
+            }
+            i64stack_push(pixel_list_vec->data[pixels->data[i]],
+                          (int64) ipoly);
         }
     }
-    return 1;
+
+    PixelListVec_free(self->pixel_list_vec);
+    self->pixel_list_vec = pixel_list_vec;
+
+    status = mangle_build_weight_index(self);
+
+    if (status && self->stats != NULL) {
+        status = mangle_stats_reset(self);
+    }
+
+_build_healpix_index_errout:
+    i64stack_delete(pixels);
+    return status;
 }
-int mangle_polyid_and_weight_pix(struct MangleMask *self, 
-                                 struct Point *pt, 
-                                 int64 *poly_id,
-                                 long double *weight)
+
+void mangle_index_stats_free(struct MangleIndexStats* stats)
+{
+    stats->hist = i64stack_delete(stats->hist);
+    free(stats->top_pix);
+    free(stats->top_count);
+    free(stats->top_ra);
+    free(stats->top_dec);
+    stats->top_pix=NULL;
+    stats->top_count=NULL;
+    stats->top_ra=NULL;
+    stats->top_dec=NULL;
+    stats->ntop=0;
+}
+
+int mangle_index_stats(const struct MangleMask *self,
+                       size_t ntop,
+                       struct MangleIndexStats* stats)
 {
     int status=1;
-    size_t i=0;
-    int64 pix=0, ipoly=0;
+    const struct PixelListVec* plv=self->pixel_list_vec;
+    int64 first=0, nlevel=0, pix=0, count=0, total=0;
+    size_t j=0;
+    struct Point pt;
+
+    memset(stats, 0, sizeof(struct MangleIndexStats));
+
+    if (plv == NULL) {
+        wlog("The mask has no pixel index\n");
+        return 0;
+    }
+    if (!pixel_level_range(plv->pixeltype, plv->pixelres, &first, &nlevel)) {
+        wlog("Unsupported pixelization scheme: '%c'\n", plv->pixeltype);
+        return 0;
+    }
+    stats->pixeltype = plv->pixeltype;
+    stats->pixelres = plv->pixelres;
+
+    stats->hist = i64stack_new(1);
+    stats->top_pix = calloc(ntop+1, sizeof(int64));
+    stats->top_count = calloc(ntop+1, sizeof(int64));
+    stats->top_ra = calloc(ntop+1, sizeof(long double));
+    stats->top_dec = calloc(ntop+1, sizeof(long double));
+    if (!stats->hist || !stats->top_pix || !stats->top_count
+            || !stats->top_ra || !stats->top_dec) {
+        wlog("Failed to allocate index stats\n");
+        status=0;
+        goto _index_stats_bail;
+    }
+    i64stack_resize(stats->hist, 1);
+
+    for (pix=0; pix<first+nlevel; pix++) {
+        count = (pix < (int64) plv->size) ? (int64) plv->data[pix]->size : 0;
+        if (pix < first && count == 0) {
+            // coarser levels only count when used
+            continue;
+        }
+
+        stats->npix++;
+        total += count;
+        if (count == 0) {
+            stats->nempty++;
+        }
+        if (count > stats->max) {
+            stats->max = count;
+            i64stack_resize(stats->hist, count+1);
+            if (stats->hist->allocated_size < (size_t) count+1) {
+                wlog("Failed to allocate index histogram\n");
+                status=0;
+                goto _index_stats_bail;
+            }
+        }
+        stats->hist->data[count]++;
+
+        // insert into the list of the fullest pixels
+        if (ntop > 0 && count > 0
+                && (stats->ntop < ntop
+                    || count > stats->top_count[stats->ntop-1])) {
+            j = (stats->ntop < ntop) ? stats->ntop++ : ntop-1;
+            while (j > 0 && stats->top_count[j-1] < count) {
+                stats->top_pix[j] = stats->top_pix[j-1];
+                stats->top_count[j] = stats->top_count[j-1];
+                j--;
+            }
+            stats->top_pix[j] = pix;
+            stats->top_count[j] = count;
+        }
+    }
+
+    if (stats->npix > 0) {
+        stats->mean = ((double) total)/stats->npix;
+    }
+    if (stats->npix > stats->nempty) {
+        stats->mean_nonempty = ((double) total)/(stats->npix - stats->nempty);
+    }
+
+    for (j=0; j<stats->ntop; j++) {
+        pixel_center(plv->pixeltype, plv->pixelres, stats->top_pix[j], &pt);
+        radec_from_point(&pt, &stats->top_ra[j], &stats->top_dec[j]);
+    }
+
+_index_stats_bail:
+    if (!status) {
+        mangle_index_stats_free(stats);
+    }
+    return status;
+}
+
+int mangle_build_weight_index(struct MangleMask *self)
+{
+    struct PixelListVec* plv=NULL;
+    struct PixelListVec* weight_list_vec=NULL;
     struct i64stack* pstack=NULL;
     struct Polygon* ply=NULL;
+    size_t ipoly=0, npositive=0, pix=0, i=0;
 
-    *poly_id=-1;
-    *weight=0.0;
+    self->weight_list_vec = PixelListVec_free(self->weight_list_vec);
 
-    if (self->pixeltype == 's') {
-        pix = get_pixel_simple(self->pixelres, pt);
-        if (pix < self->pixel_list_vec->size) {
-            // this is a stack holding indices into the polygon vector
-            pstack = self->pixel_list_vec->data[pix];
+    for (ipoly=0; ipoly<self->poly_vec->size; ipoly++) {
+        if (self->poly_vec->data[ipoly].weight > 0) {
+            npositive++;
+        }
+    }
+    if (npositive == self->poly_vec->size) {
+        // nothing to skip, the main index is used
+        return 1;
+    }
 
-            for (i=0; i<pstack->size; i++) {
-                ipoly = pstack->data[i];
-                ply = &self->poly_vec->data[ipoly];
+    plv = self->pixel_list_vec;
+    if (plv == NULL) {
+        // a single list holding all positive weight polygons
+        weight_list_vec = PixelListVec_new(1);
+        if (weight_list_vec == NULL) {
+            return 0;
+        }
+        weight_list_vec->pixeltype = 'u';
+        weight_list_vec->pixelres = -1;
+
+        for (ipoly=0; ipoly<self->poly_vec->size; ipoly++) {
+            if (self->poly_vec->data[ipoly].weight > 0) {
+                i64stack_push(weight_list_vec->data[0], (int64) ipoly);
+            }
+        }
+    } else {
+        weight_list_vec = PixelListVec_new(plv->size);
+        if (weight_list_vec == NULL) {
+            return 0;
+        }
+        weight_list_vec->pixeltype = plv->pixeltype;
+        weight_list_vec->pixelres = plv->pixelres;
 
-                if (is_in_poly(ply, pt)) {
-                    *poly_id=ply->poly_id;
-                    *weight=ply->weight;
-                    break;
+        for (pix=0; pix<plv->size; pix++) {
+            pstack = plv->data[pix];
+            for (i=0; i<pstack->size; i++) {
+                ply = &self->poly_vec->data[pstack->data[i]];
+                if (ply->weight > 0) {
+                    i64stack_push(weight_list_vec->data[pix], pstack->data[i]);
                 }
             }
         }
+    }
+
+    if (self->verbose) {
+        wlog("Indexed %lu of %lu polygons with positive weight\n",
+             npositive, self->poly_vec->size);
+    }
+    self->weight_list_vec = weight_list_vec;
+    return 1;
+}
+
+int mangle_stats_enable(struct MangleMask* self, int enable)
+{
+    if (!enable) {
+        if (self->stats != NULL) {
+            free(self->stats->pixel_hits);
+            free(self->stats);
+            self->stats=NULL;
+        }
+        return 1;
+    }
+
+    if (self->stats != NULL) {
+        return 1;
+    }
+
+    self->stats = calloc(1, sizeof(struct MangleStats));
+    if (self->stats == NULL) {
+        wlog("Failed to allocate MangleStats\n");
+        return 0;
+    }
+    return mangle_stats_reset(self);
+}
+
+int mangle_stats_reset(struct MangleMask* self)
+{
+    struct MangleStats* stats=self->stats;
+    size_t npix=0;
+
+    if (stats == NULL) {
+        return 1;
+    }
+
+    memset(&stats->counts, 0, sizeof(stats->counts));
+
+    npix = (self->pixel_list_vec != NULL) ? self->pixel_list_vec->size : 0;
+    if (npix != stats->npix) {
+        free(stats->pixel_hits);
+        stats->pixel_hits=NULL;
+        stats->npix=0;
+
+        if (npix > 0) {
+            stats->pixel_hits = calloc(npix, sizeof(int64));
+            if (stats->pixel_hits == NULL) {
+                wlog("Failed to allocate pixel hits for %ld pixels\n", npix);
+                return 0;
+            }
+            stats->npix=npix;
+        }
+    } else if (npix > 0) {
+        memset(stats->pixel_hits, 0, npix*sizeof(int64));
+    }
+    return 1;
+}
+
+/*
+ * start and finish the counts for a batch search.  The counts are added to
+ * the mask atomically, as other threads may be searching it
+ */
+static void mangle_stats_begin(const struct MangleMask *self,
+                               struct MangleQueryState *state)
+{
+    if (state != NULL) {
+        state->stats=self->stats;
+        memset(&state->counts, 0, sizeof(state->counts));
+    }
+}
+
+#define MANGLE_STATS_ADD(stats, counts, name)                             \
+    __atomic_fetch_add(&(stats)->counts.name, (counts)->name, __ATOMIC_RELAXED)
+
+static void mangle_stats_end(struct MangleQueryState *state)
+{
+    struct MangleStats* stats=NULL;
+    const struct MangleCounts* counts=NULL;
+
+    if (state == NULL || state->stats == NULL) {
+        return;
+    }
+    stats=state->stats;
+    counts=&state->counts;
+
+    MANGLE_STATS_ADD(stats, counts, npoints);
+    MANGLE_STATS_ADD(stats, counts, pixel_lookups);
+    MANGLE_STATS_ADD(stats, counts, last_hit_checks);
+    MANGLE_STATS_ADD(stats, counts, polys_scanned);
+    MANGLE_STATS_ADD(stats, counts, caps_tested);
+    MANGLE_STATS_ADD(stats, counts, hits);
+    MANGLE_STATS_ADD(stats, counts, misses);
+
+    state->stats=NULL;
+}
+
+void mangle_query_state_init(struct MangleQueryState* self, int use_last_hit)
+{
+    self->use_last_hit=use_last_hit;
+    self->last_ipoly=-1;
+    self->use_min_weight=0;
+    self->min_weight=0;
+    seed_random_state(self->rng);
+    self->stats=NULL;
+    memset(&self->counts, 0, sizeof(self->counts));
+    self->status=MANGLE_OK;
+    self->err[0]='\0';
+}
+
+/*
+ * record an error in the state, or write it to stderr if there is no state
+ */
+static void mangle_query_error(struct MangleQueryState *state,
+                               int status,
+                               const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    if (state != NULL) {
+        state->status=status;
+        vsnprintf(state->err, sizeof(state->err), format, args);
     } else {
-        status=0;
-        wlog("Unsupported pixelization scheme: '%c'",self->pixeltype);
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
     }
-    return status;
+    va_end(args);
+}
+
+void mangle_query_state_set_min_weight(struct MangleQueryState* self,
+                                       long double min_weight)
+{
+    self->use_min_weight=1;
+    self->min_weight=min_weight;
+}
+
+int mangle_polyid_and_weight(const struct MangleMask *self, 
+                             const struct Point *pt, 
+                             int64 *poly_id,
+                             long double *weight)
+{
+    if (self->pixel_list_vec == NULL) {
+        return mangle_polyid_and_weight_nopix(self,pt,poly_id,weight);
+    } else {
+        return mangle_polyid_and_weight_pix(self,pt,poly_id,weight);
+    }
+}
+
+/*
+ * the search routines return the index of the polygon in the polygon
+ * vector, or -1 if not found
+ */
+
+static inline int mangle_counting(const struct MangleQueryState *state)
+{
+    return (state != NULL && state->stats != NULL);
+}
+
+static inline int mangle_check_poly(struct MangleQueryState *state,
+                                    int counting,
+                                    const struct Polygon *ply,
+                                    const struct Point *pt)
+{
+    if (counting) {
+        state->counts.polys_scanned++;
+        return is_in_poly_count(ply, pt, &state->counts.caps_tested);
+    }
+    return is_in_poly(ply, pt);
+}
+
+/*
+ * polygons with weight <= min_weight can be skipped before the geometry
+ * checks only in balkanized masks.  In other masks the first polygon holding
+ * the point must still be found, and its weight checked afterward.
+ */
+static inline int mangle_prune_weight(const struct MangleMask *self,
+                                      const struct MangleQueryState *state)
+{
+    return (state != NULL && state->use_min_weight && self->balkanized);
+}
+
+/*
+ * the index to search.  The positive weight index can stand in for the main
+ * one when pruning with min_weight >= 0
+ */
+static inline const struct PixelListVec*
+mangle_search_index(const struct MangleMask *self,
+                    const struct MangleQueryState *state)
+{
+    if (self->weight_list_vec != NULL
+            && mangle_prune_weight(self, state)
+            && state->min_weight >= 0) {
+        return self->weight_list_vec;
+    }
+    return self->pixel_list_vec;
+}
+
+// search the polygons ipolys[0:n], or all polygons if ipolys is NULL
+static inline int64 mangle_search_list(const struct MangleMask *self,
+                                       struct MangleQueryState *state,
+                                       const int64 *ipolys,
+                                       size_t n,
+                                       const struct Point *pt,
+                                       int64 *poly_id,
+                                       long double *weight)
+{
+    size_t i=0;
+    int64 ipoly=0;
+    struct Polygon* ply=NULL;
+    int prune=mangle_prune_weight(self, state);
+    int counting=mangle_counting(state);
+
+    *poly_id=-1;
+    *weight=0.0;
+
+    for (i=0; i<n; i++) {
+        ipoly = ipolys ? ipolys[i] : (int64) i;
+        ply = &self->poly_vec->data[ipoly];
+
+        if (prune && ply->weight <= state->min_weight) {
+            continue;
+        }
+        if (mangle_check_poly(state, counting, ply, pt)) {
+            *poly_id=ply->poly_id;
+            *weight=ply->weight;
+            return ipoly;
+        }
+    }
+    return -1;
 }
 
+static inline int64 mangle_search_all(const struct MangleMask *self,
+                                      struct MangleQueryState *state,
+                                      const struct Point *pt,
+                                      int64 *poly_id,
+                                      long double *weight)
+{
+    const struct PixelListVec* index=mangle_search_index(self, state);
+
+    if (index != NULL && index->pixeltype == 'u') {
+        return mangle_search_list(self, state,
+                                  index->data[0]->data, index->data[0]->size,
+                                  pt, poly_id, weight);
+    }
+    return mangle_search_list(self, state, NULL, self->poly_vec->size,
+                              pt, poly_id, weight);
+}
 
+/*
+ * search the polygons listed for the pixel; pixels beyond the end of the
+ * index hold no polygons
+ */
+static inline int64 mangle_search_pixel(const struct MangleMask *self,
+                                        struct MangleQueryState *state,
+                                        int64 pix,
+                                        const struct Point *pt,
+                                        int64 *poly_id,
+                                        long double *weight)
+{
+    const struct PixelListVec* index=mangle_search_index(self, state);
+    const struct i64stack* pstack=NULL;
+    int64 ipoly=0;
+
+    if (mangle_counting(state)) {
+        state->counts.pixel_lookups++;
+    }
+
+    if (pix < 0 || pix >= (int64) index->size) {
+        *poly_id=-1;
+        *weight=0.0;
+        return -1;
+    }
+
+    // this is a stack holding indices into the polygon vector
+    pstack = index->data[pix];
+    ipoly = mangle_search_list(self, state, pstack->data, pstack->size,
+                               pt, poly_id, weight);
+
+    if (ipoly >= 0 && mangle_counting(state)
+            && pix < (int64) state->stats->npix) {
+        __atomic_fetch_add(&state->stats->pixel_hits[pix], 1,
+                           __ATOMIC_RELAXED);
+    }
+    return ipoly;
+}
+
+/*
+ * finish the search for a point.  Points in polygons with weight <=
+ * min_weight are not in the mask
+ */
+static inline void mangle_finish_point(struct MangleQueryState *state,
+                                       int64 *poly_id,
+                                       long double *weight)
+{
+    if (state != NULL && state->use_min_weight
+            && *poly_id >= 0 && *weight <= state->min_weight) {
+        *poly_id=-1;
+        *weight=0.0;
+    }
+    if (mangle_counting(state)) {
+        state->counts.npoints++;
+        if (*poly_id >= 0) {
+            state->counts.hits++;
+        } else {
+            state->counts.misses++;
+        }
+    }
+}
+
+/*
+ * check the polygon that held the last point.  Polygons in a balkanized mask
+ * do not overlap, so a hit here is the same answer the full search would
+ * give.
+ */
+static inline int mangle_search_last_hit(const struct MangleMask *self,
+                                         struct MangleQueryState *state,
+                                         const struct Point *pt,
+                                         int64 *poly_id,
+                                         long double *weight)
+{
+    struct Polygon* ply=NULL;
+    int counting=mangle_counting(state);
+
+    if (state->last_ipoly < 0) {
+        return 0;
+    }
+    if (counting) {
+        state->counts.last_hit_checks++;
+    }
+
+    ply = &self->poly_vec->data[state->last_ipoly];
+    if (mangle_check_poly(state, counting, ply, pt)) {
+        *poly_id=ply->poly_id;
+        *weight=ply->weight;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int mangle_use_last_hit(const struct MangleMask *self,
+                                      struct MangleQueryState *state)
+{
+    return (state != NULL && state->use_last_hit && self->balkanized);
+}
+
+int mangle_polyid_and_weight_nopix(const struct MangleMask *self, 
+                                   const struct Point *pt, 
+                                   int64 *poly_id,
+                                   long double *weight)
+{
+    mangle_search_all(self, NULL, pt, poly_id, weight);
+    return 1;
+}
+
+int mangle_polyid_and_weight_pix(const struct MangleMask *self, 
+                                 const struct Point *pt, 
+                                 int64 *poly_id,
+                                 long double *weight)
+{
+    int64 pix=0;
+    double z=0, phi=0;
+    struct PixelListVec* plv=self->pixel_list_vec;
+
+    if (plv->pixeltype == 's') {
+        z=pt->z;
+        phi=pt->phi;
+        get_pixel_simple_many(&self->simplepix, 1, &z, &phi, &pix);
+    } else {
+        pix = get_pixel(plv->pixeltype, plv->pixelres, pt);
+        if (pix < 0) {
+            *poly_id=-1;
+            *weight=0.0;
+            wlog("Unsupported pixelization scheme: '%c'", plv->pixeltype);
+            return 0;
+        }
+    }
+
+    mangle_search_pixel(self, NULL, pix, pt, poly_id, weight);
+    return 1;
+}
+
+/*
+ * pixel numbers in the index scheme for a block of points
+ */
+static int mangle_calc_pixels(const struct MangleMask *self,
+                              struct MangleQueryState *state,
+                              size_t n,
+                              const struct Point *pts,
+                              int64 *pix)
+{
+    size_t i=0;
+    double z[MANGLE_BATCH_SIZE], phi[MANGLE_BATCH_SIZE];
+    struct PixelListVec* plv=self->pixel_list_vec;
+
+    if (plv->pixeltype == 's') {
+        for (i=0; i<n; i++) {
+            z[i] = pts[i].z;
+            phi[i] = pts[i].phi;
+        }
+        get_pixel_simple_many(&self->simplepix, n, z, phi, pix);
+    } else {
+        for (i=0; i<n; i++) {
+            pix[i] = get_pixel(plv->pixeltype, plv->pixelres, &pts[i]);
+            if (pix[i] < 0) {
+                mangle_query_error(state, MANGLE_ERR_PIXEL_SCHEME,
+                                   "Unsupported pixelization scheme: '%c'",
+                                   plv->pixeltype);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * search a block of points one at a time, checking the last hit first and
+ * only calculating the pixel on a miss
+ */
+static int mangle_search_block_cached(const struct MangleMask *self,
+                                      struct MangleQueryState *state,
+                                      size_t n,
+                                      const struct Point *pts,
+                                      int64 *poly_id,
+                                      long double *weight)
+{
+    size_t i=0;
+    int64 pix=0, ipoly=0;
+
+    for (i=0; i<n; i++) {
+        if (!mangle_search_last_hit(self, state, &pts[i],
+                                    &poly_id[i], &weight[i])) {
+
+            if (self->pixel_list_vec == NULL) {
+                ipoly = mangle_search_all(self, state, &pts[i],
+                                          &poly_id[i], &weight[i]);
+            } else {
+                if (!mangle_calc_pixels(self, state, 1, &pts[i], &pix)) {
+                    return 0;
+                }
+                ipoly = mangle_search_pixel(self, state, pix, &pts[i],
+                                            &poly_id[i], &weight[i]);
+            }
+
+            // keep the old polygon on a miss, the stream may return to it
+            if (ipoly >= 0) {
+                state->last_ipoly = ipoly;
+            }
+        }
+        mangle_finish_point(state, &poly_id[i], &weight[i]);
+    }
+    return 1;
+}
+
+/*
+ * search a block of at most MANGLE_BATCH_SIZE points.  The points need x, y
+ * and z, and theta and phi as used by the pixel scheme of the index
+ */
+static int mangle_search_block(const struct MangleMask *self,
+                               struct MangleQueryState *state,
+                               size_t nb,
+                               const struct Point *pts,
+                               int64 *ids,
+                               long double *wts)
+{
+    size_t i=0;
+    int64 pix[MANGLE_BATCH_SIZE];
+
+    if (mangle_use_last_hit(self, state)) {
+        return mangle_search_block_cached(self, state, nb, pts, ids, wts);
+    }
+
+    if (self->pixel_list_vec == NULL) {
+        for (i=0; i<nb; i++) {
+            mangle_search_all(self, state, &pts[i], &ids[i], &wts[i]);
+            mangle_finish_point(state, &ids[i], &wts[i]);
+        }
+    } else {
+        if (!mangle_calc_pixels(self, state, nb, pts, pix)) {
+            return 0;
+        }
+        for (i=0; i<nb; i++) {
+            mangle_search_pixel(self, state, pix[i], &pts[i],
+                                &ids[i], &wts[i]);
+            mangle_finish_point(state, &ids[i], &wts[i]);
+        }
+    }
+    return 1;
+}
+
+static int mangle_search_many(const struct MangleMask *self,
+                              struct MangleQueryState *state,
+                              size_t n,
+                              const long double *ra,
+                              const long double *dec,
+                              int64 *poly_id,
+                              long double *weight)
+{
+    size_t start=0, nb=0, i=0;
+    struct Point pts[MANGLE_BATCH_SIZE];
+    int64 id_buff[MANGLE_BATCH_SIZE];
+    long double weight_buff[MANGLE_BATCH_SIZE];
+    int64 *ids=NULL;
+    long double *wts=NULL;
+
+    for (start=0; start<n; start += MANGLE_BATCH_SIZE) {
+        nb = n-start;
+        if (nb > MANGLE_BATCH_SIZE) {
+            nb = MANGLE_BATCH_SIZE;
+        }
+
+        ids = poly_id ? &poly_id[start] : id_buff;
+        wts = weight ? &weight[start] : weight_buff;
+
+        for (i=0; i<nb; i++) {
+            point_set_from_radec(&pts[i], ra[start+i], dec[start+i]);
+        }
+
+        if (!mangle_search_block(self, state, nb, pts, ids, wts)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int mangle_polyid_and_weight_many(const struct MangleMask *self,
+                                  struct MangleQueryState *state,
+                                  size_t n,
+                                  const long double *ra,
+                                  const long double *dec,
+                                  int64 *poly_id,
+                                  long double *weight)
+{
+    int status=0;
+
+    mangle_stats_begin(self, state);
+    status = mangle_search_many(self, state, n, ra, dec, poly_id, weight);
+    mangle_stats_end(state);
+    return status;
+}
+
+int mangle_polyid_and_weight_sorted(const struct MangleMask *self,
+                                    struct MangleQueryState *state,
+                                    size_t n,
+                                    const long double *ra,
+                                    const long double *dec,
+                                    int64 *poly_id,
+                                    long double *weight)
+{
+    int status=1;
+    size_t start=0, nb=0, i=0, j=0;
+    struct Point pts[MANGLE_BATCH_SIZE];
+    struct Point pt;
+    int64 *pix=NULL, id=0, ipoly=0;
+    size_t *index=NULL;
+    long double wt=0;
+    const struct PixelListVec* plv=NULL;
+    int use_last_hit=mangle_use_last_hit(self, state);
+
+    mangle_stats_begin(self, state);
+
+    if (self->pixel_list_vec == NULL) {
+        status = mangle_search_many(self, state, n, ra, dec, poly_id, weight);
+        goto _polyid_and_weight_sorted_bail;
+    }
+
+    pix = malloc(n*sizeof(int64));
+    index = malloc(n*sizeof(size_t));
+    if (pix == NULL || index == NULL) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate pixel index for %ld points", n);
+        status=0;
+        goto _polyid_and_weight_sorted_bail;
+    }
+
+    for (start=0; start<n; start += MANGLE_BATCH_SIZE) {
+        nb = n-start;
+        if (nb > MANGLE_BATCH_SIZE) {
+            nb = MANGLE_BATCH_SIZE;
+        }
+        for (i=0; i<nb; i++) {
+            point_set_from_radec(&pts[i], ra[start+i], dec[start+i]);
+        }
+        if (!mangle_calc_pixels(self, state, nb, pts, &pix[start])) {
+            status=0;
+            goto _polyid_and_weight_sorted_bail;
+        }
+    }
+
+    if (!radix_sort_int64_index(n, pix, index)) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate sort space for %ld points", n);
+        status=0;
+        goto _polyid_and_weight_sorted_bail;
+    }
+
+    // pix is now in sorted order, index holds the original positions
+    plv = mangle_search_index(self, state);
+    for (i=0; i<n; i++) {
+        j = index[i];
+
+        // no need to recalculate the point for an empty pixel; pixel
+        // numbers outside the index, as for non-finite ra or dec, hold
+        // nothing
+        if (pix[i] < 0 || pix[i] >= (int64) plv->size
+                || plv->data[pix[i]]->size == 0) {
+            id=-1;
+            wt=0.0;
+            if (mangle_counting(state)) {
+                state->counts.pixel_lookups++;
+            }
+        } else {
+            point_set_from_radec(&pt, ra[j], dec[j]);
+            if (!use_last_hit
+                    || !mangle_search_last_hit(self, state, &pt, &id, &wt)) {
+                ipoly = mangle_search_pixel(self, state, pix[i], &pt, &id, &wt);
+                if (use_last_hit && ipoly >= 0) {
+                    state->last_ipoly = ipoly;
+                }
+            }
+        }
+        mangle_finish_point(state, &id, &wt);
+
+        if (poly_id) {
+            poly_id[j] = id;
+        }
+        if (weight) {
+            weight[j] = wt;
+        }
+    }
+
+_polyid_and_weight_sorted_bail:
+    mangle_stats_end(state);
+    free(pix);
+    free(index);
+    return status;
+}
+
+int mangle_contains_many(const struct MangleMask *self,
+                         struct MangleQueryState *state,
+                         int sort,
+                         size_t n,
+                         const long double *ra,
+                         const long double *dec,
+                         unsigned char *packed,
+                         size_t *ncontained)
+{
+    int status=1;
+    int64 id_buff[MANGLE_BATCH_SIZE];
+    int64 *ids=id_buff;
+    size_t block_size=MANGLE_BATCH_SIZE, start=0, nb=0, i=0, k=0;
+
+    *ncontained=0;
+    if (packed != NULL) {
+        memset(packed, 0, (n+7)/8);
+    }
+
+    if (sort && n > MANGLE_BATCH_SIZE) {
+        block_size = (n < MANGLE_SORT_CHUNK) ? n : MANGLE_SORT_CHUNK;
+        ids = malloc(block_size*sizeof(int64));
+        if (ids == NULL) {
+            mangle_query_error(state, MANGLE_ERR_NOMEM,
+                               "Could not allocate ids for %ld points",
+                               block_size);
+            return 0;
+        }
+    }
+
+    for (start=0; start<n; start += block_size) {
+        nb = n-start;
+        if (nb > block_size) {
+            nb = block_size;
+        }
+
+        if (sort) {
+            status = mangle_polyid_and_weight_sorted(self, state, nb,
+                                                     &ra[start], &dec[start],
+                                                     ids, NULL);
+        } else {
+            status = mangle_polyid_and_weight_many(self, state, nb,
+                                                   &ra[start], &dec[start],
+                                                   ids, NULL);
+        }
+        if (!status) {
+            goto _contains_many_bail;
+        }
+
+        for (i=0; i<nb; i++) {
+            if (ids[i] >= 0) {
+                (*ncontained)++;
+                if (packed != NULL) {
+                    k = start+i;
+                    packed[k/8] |= (unsigned char) (0x80 >> (k % 8));
+                }
+            }
+        }
+    }
+
+_contains_many_bail:
+    if (ids != id_buff) {
+        free(ids);
+    }
+    return status;
+}
+
+/*
+ * masked area in regions
+ *
+ * A region is split into up to two convex parts, each the intersection of up
+ * to four caps, with a cap bounding the part for the index lookup.  Boxes
+ * wider than 180 degrees in ra are split in two.
+ */
+
+#define MANGLE_REGION_MAXPARTS 2
+#define MANGLE_REGION_MAXCAPS 4
+
+struct MangleRegionPart {
+    struct Cap bound;
+    size_t ncaps;
+    struct Cap caps[MANGLE_REGION_MAXCAPS];
+};
+
+struct MangleRegion {
+    size_t nparts;
+    struct MangleRegionPart parts[MANGLE_REGION_MAXPARTS];
+};
+
+// the cap cm for an opening angle in radians, 2 for the whole sphere
+static long double region_cap_cm(long double radius)
+{
+    if (radius >= M_PI) {
+        return 2;
+    }
+    return 1 - cosl(radius);
+}
+
+// the center and opening angle of the area covered by a cap
+static void region_cap_circle(const struct Cap* cap,
+                              long double center[3],
+                              long double *radius)
+{
+    long double cm=cap->cm;
+    long double sign=1;
+
+    if (cm < 0) {
+        sign = -1;
+        cm = 2 + cm;
+    }
+    center[0] = sign*cap->x;
+    center[1] = sign*cap->y;
+    center[2] = sign*cap->z;
+
+    if (cm >= 2) {
+        *radius = M_PI;
+    } else if (cm <= 0) {
+        *radius = 0;
+    } else {
+        *radius = acosl(1 - cm);
+    }
+}
+
+static long double region_separation(const long double a[3],
+                                     const long double b[3])
+{
+    long double cx=0, cy=0, cz=0, dot=0;
+
+    // atan2 of the cross and dot products is accurate at all separations
+    cx = a[1]*b[2] - a[2]*b[1];
+    cy = a[2]*b[0] - a[0]*b[2];
+    cz = a[0]*b[1] - a[1]*b[0];
+    dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    return atan2l(sqrtl(cx*cx + cy*cy + cz*cz), dot);
+}
+
+static void region_set_cap(struct Cap* cap,
+                           long double ra,
+                           long double dec,
+                           long double radius)
+{
+    struct Point pt;
+
+    point_set_from_radec(&pt, ra, dec);
+    cap_set(cap, pt.x, pt.y, pt.z, region_cap_cm(radius));
+}
+
+static void region_from_cap(struct MangleRegion* region,
+                            long double ra,
+                            long double dec,
+                            long double radius)
+{
+    struct MangleRegionPart* part=&region->parts[0];
+
+    region->nparts=0;
+    if (!(radius > 0)) {
+        return;
+    }
+
+    region_set_cap(&part->bound, ra, dec, radius*D2R);
+    part->caps[0] = part->bound;
+    part->ncaps = 1;
+    region->nparts = 1;
+}
+
+/*
+ * one part of a box, with 0 < width <= 180 in ra, or full ra if width is
+ * 360
+ */
+static void region_box_part(struct MangleRegionPart* part,
+                            long double ramin,
+                            long double width,
+                            long double decmin,
+                            long double decmax)
+{
+    long double ramax=ramin+width, sra=0, cra=0;
+    long double radius=0, center[3], corner[3], d=0;
+    struct Point pt;
+    int i=0, j=0;
+
+    part->ncaps=0;
+
+    // dec >= decmin and dec <= decmax; the latter is the complement of the
+    // cap with dec > decmax
+    if (decmin > -90) {
+        cap_set(&part->caps[part->ncaps++],
+                0, 0, 1, 1 - sinl(decmin*D2R));
+    }
+    if (decmax < 90) {
+        cap_set(&part->caps[part->ncaps++],
+                0, 0, 1, -(1 - sinl(decmax*D2R)));
+    }
+
+    if (width >= 360) {
+        // a band around the pole nearest the box
+        if (90 - decmin <= 90 + decmax) {
+            region_set_cap(&part->bound, 0, 90, (90 - decmin)*D2R);
+        } else {
+            region_set_cap(&part->bound, 0, -90, (90 + decmax)*D2R);
+        }
+        return;
+    }
+
+    // ra >= ramin and ra <= ramax are hemispheres
+    sra = sinl(ramin*D2R);
+    cra = cosl(ramin*D2R);
+    cap_set(&part->caps[part->ncaps++], -sra, cra, 0, 1);
+    sra = sinl(ramax*D2R);
+    cra = cosl(ramax*D2R);
+    cap_set(&part->caps[part->ncaps++], sra, -cra, 0, 1);
+
+    // for widths up to 180 the point of the box farthest from this center
+    // is a corner
+    point_set_from_radec(&pt, ramin + 0.5*width, 0.5*(decmin + decmax));
+    center[0] = pt.x;
+    center[1] = pt.y;
+    center[2] = pt.z;
+    for (i=0; i<2; i++) {
+        for (j=0; j<2; j++) {
+            point_set_from_radec(&pt,
+                                 i ? ramax : ramin,
+                                 j ? decmax : decmin);
+            corner[0] = pt.x;
+            corner[1] = pt.y;
+            corner[2] = pt.z;
+            d = region_separation(center, corner);
+            if (d > radius) {
+                radius = d;
+            }
+        }
+    }
+
+    // a little slack for roundoff
+    cap_set(&part->bound, center[0], center[1], center[2],
+            region_cap_cm(radius + 1.0e-9));
+}
+
+static void region_from_box(struct MangleRegion* region,
+                            long double ramin,
+                            long double ramax,
+                            long double decmin,
+                            long double decmax)
+{
+    long double width=ramax-ramin;
+
+    region->nparts=0;
+
+    if (decmin < -90) decmin = -90;
+    if (decmax > 90) decmax = 90;
+    if (!(decmax > decmin)) {
+        return;
+    }
+
+    // ramax < ramin wraps through ra=0
+    if (width < 360) {
+        width = fmodl(width, 360);
+        if (width < 0) {
+            width += 360;
+        }
+        if (width == 0) {
+            return;
+        }
+    } else {
+        width = 360;
+    }
+
+    if (width >= 360 || width <= 180) {
+        region_box_part(&region->parts[0], ramin, width, decmin, decmax);
+        region->nparts = 1;
+    } else {
+        region_box_part(&region->parts[0], ramin, 0.5*width,
+                        decmin, decmax);
+        region_box_part(&region->parts[1], ramin + 0.5*width, 0.5*width,
+                        decmin, decmax);
+        region->nparts = 2;
+    }
+}
+
+// sort the polygon numbers and drop duplicates
+static void region_sort_unique(struct i64stack* polys)
+{
+    size_t i=0, nuniq=0;
+
+    if (polys->size > 1) {
+        i64stack_sort(polys);
+        nuniq = 1;
+        for (i=1; i<polys->size; i++) {
+            if (polys->data[i] != polys->data[nuniq-1]) {
+                polys->data[nuniq++] = polys->data[i];
+            }
+        }
+        polys->size = nuniq;
+    }
+}
+
+/*
+ * whether two caps with cm >= 0 are clear of each other: their separation is
+ * at least the sum of their opening angles, compared by cosines so no
+ * inverse trig is needed
+ */
+static int region_caps_clear(const struct Cap* a, const struct Cap* b)
+{
+    long double ca=1-a->cm, cb=1-b->cm, sa=0, sb=0, dot=0;
+
+    if (a->cm >= 2 || b->cm >= 2) {
+        return 0;
+    }
+    sa = sqrtl(a->cm*(2 - a->cm));
+    sb = sqrtl(b->cm*(2 - b->cm));
+
+    // opening angles adding up to pi or more reach everywhere
+    if (sa*cb + ca*sb <= 0) {
+        return 0;
+    }
+    dot = a->x*b->x + a->y*b->y + a->z*b->z;
+    return dot < ca*cb - sa*sb - 1.0e-15;
+}
+
+static void region_push_list(struct i64stack* cands,
+                             const struct i64stack* plist)
+{
+    size_t j=0;
+
+    for (j=0; j<plist->size; j++) {
+        i64stack_push(cands, plist->data[j]);
+    }
+}
+
+/*
+ * push the polygons that may overlap the cap, sorted and without
+ * duplicates.  They are taken from the index where it can be searched by
+ * cap, otherwise from all polygons, and only those whose bounding caps are
+ * not clear of the cap are kept
+ */
+static void region_candidates(const struct MangleMask *self,
+                              const struct PixelListVec* plv,
+                              const struct Cap* bound,
+                              struct i64stack* pixels,
+                              struct i64stack* cands)
+{
+    struct Cap pbound;
+    size_t i=0, nkeep=0;
+    int64 level=0, minlevel=0;
+    int searched=0;
+
+    i64stack_resize(cands, 0);
+
+    if (plv != NULL && plv->pixeltype == 'u') {
+        region_push_list(cands, plv->data[0]);
+        searched = 1;
+    } else if (plv != NULL && plv->pixeltype != 'd') {
+        // polygons of simple scheme masks can be listed in coarser pixels
+        // holding them, so all levels are searched
+        searched = 1;
+        minlevel = (plv->pixeltype == 's') ? 0 : plv->pixelres;
+        for (level=minlevel; searched && level<=plv->pixelres; level++) {
+            i64stack_resize(pixels, 0);
+            searched = pixel_query_cap(plv->pixeltype, level, bound, pixels);
+            for (i=0; searched && i<pixels->size; i++) {
+                if (pixels->data[i] >= 0
+                        && pixels->data[i] < (int64) plv->size) {
+                    region_push_list(cands, plv->data[pixels->data[i]]);
+                }
+            }
+        }
+        region_sort_unique(cands);
+    }
+
+    if (!searched) {
+        i64stack_resize(cands, 0);
+        for (i=0; i<self->poly_vec->size; i++) {
+            i64stack_push(cands, (int64) i);
+        }
+    }
+
+    for (i=0; i<cands->size; i++) {
+        polygon_bounding_cap(&self->poly_vec->data[cands->data[i]], &pbound);
+        if (!region_caps_clear(&pbound, bound)) {
+            cands->data[nkeep++] = cands->data[i];
+        }
+    }
+    cands->size = nkeep;
+}
+
+/*
+ * the area of the polygon inside the part.  Polygons clear of or inside all
+ * of the part's caps are handled with their bounding caps
+ */
+static int region_polygon_area(const struct Polygon* ply,
+                               const struct MangleRegionPart* part,
+                               struct CapVec* work,
+                               long double* area)
+{
+    struct Cap pbound;
+    long double pcenter[3], pradius=0, center[3], radius=0, sep=0;
+    size_t i=0, ncaps=ply->caps->size;
+    int inside=1;
+
+    *area = 0;
+
+    polygon_bounding_cap(ply, &pbound);
+    region_cap_circle(&pbound, pcenter, &pradius);
+
+    for (i=0; i<part->ncaps; i++) {
+        region_cap_circle(&part->caps[i], center, &radius);
+        if (radius >= M_PI) {
+            continue;
+        }
+        sep = region_separation(pcenter, center);
+        if (sep >= pradius + radius) {
+            return 1;
+        }
+        if (sep + pradius > radius) {
+            inside = 0;
+        }
+    }
+
+    // computed from the caps like the clipped polygons, rather than taken
+    // from the file, which may hold a rounded area, so results do not jump
+    // as the part grows past the polygon
+    if (inside) {
+        return polygon_calc_area(ply->caps, area);
+    }
+
+    if (!capvec_resize(work, ncaps + part->ncaps)) {
+        return 0;
+    }
+    memcpy(work->data, ply->caps->data, ncaps*sizeof(struct Cap));
+    memcpy(&work->data[ncaps], part->caps, part->ncaps*sizeof(struct Cap));
+
+    return polygon_calc_area(work, area);
+}
+
+/*
+ * whether the polygon shares some area with the part.  Polygons holding the
+ * center of the part do, and those with a cap clear of the part's bounding
+ * cap do not; the rest are decided by the area of the intersection
+ */
+static int region_polygon_overlaps(const struct Polygon* ply,
+                                   const struct MangleRegionPart* part,
+                                   struct CapVec* work,
+                                   int* overlaps)
+{
+    struct Point pt;
+    long double bcenter[3], bradius=0, center[3], radius=0, area=0;
+    size_t i=0;
+    int inpart=1;
+
+    *overlaps = 0;
+
+    pt.x = part->bound.x;
+    pt.y = part->bound.y;
+    pt.z = part->bound.z;
+    for (i=0; i<part->ncaps; i++) {
+        if (!is_in_cap(&part->caps[i], &pt)) {
+            inpart = 0;
+            break;
+        }
+    }
+    if (inpart && is_in_poly(ply, &pt)) {
+        *overlaps = 1;
+        return 1;
+    }
+
+    region_cap_circle(&part->bound, bcenter, &bradius);
+    for (i=0; i<ply->caps->size; i++) {
+        region_cap_circle(&ply->caps->data[i], center, &radius);
+        if (region_separation(bcenter, center) >= bradius + radius) {
+            return 1;
+        }
+    }
+
+    if (!region_polygon_area(ply, part, work, &area)) {
+        return 0;
+    }
+    *overlaps = area > 0;
+    return 1;
+}
+
+struct MangleRegionWork {
+    const struct MangleMask* mask;
+    const struct PixelListVec* plv;
+    int use_min_weight;
+    long double min_weight;
+
+    int is_box;
+    const long double *ra, *dec, *radius;
+    const long double *ramin, *ramax, *decmin, *decmax;
+
+    long double *area, *weighted_area;
+
+    // if set, collect the overlapping polygons of each region instead
+    struct i64stack** lists;
+    int failed;
+};
+
+static void mangle_region_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleRegionWork* work=ctx;
+    const struct MangleMask* self=work->mask;
+    struct MangleRegion region;
+    struct MangleRegionPart* part=NULL;
+    const struct Polygon* ply=NULL;
+    struct i64stack *pixels=NULL, *cands=NULL;
+    struct CapVec* caps=NULL;
+    struct i64stack* list=NULL;
+    long double area=0, sum=0, wsum=0;
+    size_t i=0, ipart=0, j=0;
+    int64 ipoly=0;
+    int overlaps=0;
+
+    pixels = i64stack_new(0);
+    cands = i64stack_new(0);
+    caps = capvec_new();
+    if (pixels == NULL || cands == NULL || caps == NULL) {
+        __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+        goto _region_range_bail;
+    }
+
+    for (i=begin; i<end; i++) {
+        if (work->is_box) {
+            region_from_box(&region, work->ramin[i], work->ramax[i],
+                            work->decmin[i], work->decmax[i]);
+        } else {
+            region_from_cap(&region, work->ra[i], work->dec[i],
+                            work->radius[i]);
+        }
+
+        if (work->lists) {
+            list = i64stack_new(0);
+            if (list == NULL) {
+                __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+                goto _region_range_bail;
+            }
+            work->lists[i] = list;
+        }
+
+        sum=0;
+        wsum=0;
+        for (ipart=0; ipart<region.nparts; ipart++) {
+            part = &region.parts[ipart];
+
+            region_candidates(self, work->plv, &part->bound, pixels, cands);
+
+            for (j=0; j<cands->size; j++) {
+                ipoly = cands->data[j];
+                ply = &self->poly_vec->data[ipoly];
+
+                if (work->use_min_weight && ply->weight <= work->min_weight) {
+                    continue;
+                }
+                if (list) {
+                    if (!region_polygon_overlaps(ply, part, caps, &overlaps)) {
+                        __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+                        goto _region_range_bail;
+                    }
+                    if (overlaps) {
+                        i64stack_push(list, ipoly);
+                    }
+                    continue;
+                }
+                if (!region_polygon_area(ply, part, caps, &area)) {
+                    __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+                    goto _region_range_bail;
+                }
+                sum += area;
+                wsum += ply->weight*area;
+            }
+        }
+
+        // polygons can overlap both parts of a box
+        if (list && region.nparts > 1) {
+            region_sort_unique(list);
+        }
+        if (work->area) {
+            work->area[i] = sum;
+        }
+        if (work->weighted_area) {
+            work->weighted_area[i] = wsum;
+        }
+    }
+
+_region_range_bail:
+    i64stack_delete(pixels);
+    i64stack_delete(cands);
+    capvec_free(caps);
+}
+
+static int mangle_region_run(const struct MangleMask *self,
+                             struct MangleQueryState *state,
+                             int nthreads,
+                             size_t n,
+                             struct MangleRegionWork* work)
+{
+    work->mask = self;
+    work->plv = self->pixel_list_vec;
+    work->use_min_weight = 0;
+    work->min_weight = 0;
+    work->failed = 0;
+
+    if (state != NULL && state->use_min_weight) {
+        work->use_min_weight = 1;
+        work->min_weight = state->min_weight;
+        if (self->weight_list_vec != NULL && state->min_weight >= 0) {
+            work->plv = self->weight_list_vec;
+        }
+    }
+
+    if (self->poly_vec == NULL) {
+        if (work->area) {
+            memset(work->area, 0, n*sizeof(long double));
+        }
+        if (work->weighted_area) {
+            memset(work->weighted_area, 0, n*sizeof(long double));
+        }
+        return 1;
+    }
+
+    mangle_parallel_for(n, nthreads, 1, mangle_region_range, work);
+
+    if (work->failed) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate work space for regions");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * run the regions collecting their polygons in lists, then copy the lists
+ * into polys
+ */
+static int mangle_region_polygons(const struct MangleMask *self,
+                                  struct MangleQueryState *state,
+                                  int nthreads,
+                                  size_t n,
+                                  struct MangleRegionWork* work,
+                                  int64* offsets,
+                                  struct i64stack* polys)
+{
+    struct i64stack** lists=NULL;
+    size_t i=0, total=0;
+    int status=0;
+
+    if (n > 0) {
+        lists = calloc(n, sizeof(struct i64stack*));
+        if (lists == NULL) {
+            mangle_query_error(state, MANGLE_ERR_NOMEM,
+                               "Could not allocate lists for %lu regions", n);
+            return 0;
+        }
+    }
+    work->lists = lists;
+
+    if (!mangle_region_run(self, state, nthreads, n, work)) {
+        goto _region_polygons_bail;
+    }
+
+    // regions are empty if the mask has no polygons
+    offsets[0] = 0;
+    for (i=0; i<n; i++) {
+        if (lists[i]) {
+            total += lists[i]->size;
+        }
+        offsets[i+1] = total;
+    }
+
+    // the resize sets the size even when the reallocation fails
+    i64stack_resize(polys, total);
+    if (polys->allocated_size < total) {
+        polys->size = 0;
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate %lu polygon numbers", total);
+        goto _region_polygons_bail;
+    }
+    for (i=0; i<n; i++) {
+        if (lists[i] && lists[i]->size > 0) {
+            memcpy(&polys->data[offsets[i]], lists[i]->data,
+                   lists[i]->size*sizeof(int64));
+        }
+    }
+    status=1;
+
+_region_polygons_bail:
+    if (lists) {
+        for (i=0; i<n; i++) {
+            i64stack_delete(lists[i]);
+        }
+        free(lists);
+    }
+    return status;
+}
+
+int mangle_cap_areas(const struct MangleMask *self,
+                     struct MangleQueryState *state,
+                     int nthreads,
+                     size_t n,
+                     const long double *ra,
+                     const long double *dec,
+                     const long double *radius,
+                     long double *area,
+                     long double *weighted_area)
+{
+    struct MangleRegionWork work;
+
+    memset(&work, 0, sizeof(work));
+    work.is_box = 0;
+    work.ra = ra;
+    work.dec = dec;
+    work.radius = radius;
+    work.area = area;
+    work.weighted_area = weighted_area;
+
+    return mangle_region_run(self, state, nthreads, n, &work);
+}
+
+int mangle_box_areas(const struct MangleMask *self,
+                     struct MangleQueryState *state,
+                     int nthreads,
+                     size_t n,
+                     const long double *ramin,
+                     const long double *ramax,
+                     const long double *decmin,
+                     const long double *decmax,
+                     long double *area,
+                     long double *weighted_area)
+{
+    struct MangleRegionWork work;
+
+    memset(&work, 0, sizeof(work));
+    work.is_box = 1;
+    work.ramin = ramin;
+    work.ramax = ramax;
+    work.decmin = decmin;
+    work.decmax = decmax;
+    work.area = area;
+    work.weighted_area = weighted_area;
+
+    return mangle_region_run(self, state, nthreads, n, &work);
+}
+
+int mangle_cap_polygons(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        int nthreads,
+                        size_t n,
+                        const long double *ra,
+                        const long double *dec,
+                        const long double *radius,
+                        int64 *offsets,
+                        struct i64stack *polys)
+{
+    struct MangleRegionWork work;
+
+    memset(&work, 0, sizeof(work));
+    work.is_box = 0;
+    work.ra = ra;
+    work.dec = dec;
+    work.radius = radius;
+
+    return mangle_region_polygons(self, state, nthreads, n, &work,
+                                  offsets, polys);
+}
+
+int mangle_box_polygons(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        int nthreads,
+                        size_t n,
+                        const long double *ramin,
+                        const long double *ramax,
+                        const long double *decmin,
+                        const long double *decmax,
+                        int64 *offsets,
+                        struct i64stack *polys)
+{
+    struct MangleRegionWork work;
+
+    memset(&work, 0, sizeof(work));
+    work.is_box = 1;
+    work.ramin = ramin;
+    work.ramax = ramax;
+    work.decmin = decmin;
+    work.decmax = decmax;
+
+    return mangle_region_polygons(self, state, nthreads, n, &work,
+                                  offsets, polys);
+}
+
+/*
+ * quadrants of caps
+ *
+ * The quadrants split a cap along the meridian through its center and the
+ * great circle crossing the meridian there at right angles, numbered as for
+ * genrand_cap_radec: 1 toward higher ra and dec, 2 lower ra and higher dec,
+ * 3 lower ra and dec, 4 higher ra and lower dec.  Each is a part holding
+ * the cap and two hemispheres, with a quarter of the cap's area.
+ */
+
+static void region_quadrant_part(struct MangleRegionPart* part,
+                                 const struct Cap* cap,
+                                 long double ra,
+                                 long double dec,
+                                 int quadrant)
+{
+    long double sra=sinl(ra*D2R), cra=cosl(ra*D2R);
+    long double sdec=sinl(dec*D2R), cdec=cosl(dec*D2R);
+    long double east=0, north=0;
+
+    east = (quadrant == 1 || quadrant == 4) ? 1 : -1;
+    north = (quadrant == 1 || quadrant == 2) ? 1 : -1;
+
+    part->bound = *cap;
+    part->caps[0] = *cap;
+    cap_set(&part->caps[1], -east*sra, east*cra, 0, 1);
+    cap_set(&part->caps[2],
+            -north*sdec*cra, -north*sdec*sra, north*cdec, 1);
+    part->ncaps = 3;
+}
+
+struct MangleQuadrantWork {
+    const struct MangleMask* mask;
+    const struct PixelListVec* plv;
+
+    const long double *ra, *dec, *radius;
+    double max_masked_fraction;
+    int *flags;
+    double *frac_masked;
+    int failed;
+};
+
+static void mangle_quadrant_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleQuadrantWork* work=ctx;
+    const struct MangleMask* self=work->mask;
+    struct MangleRegionPart part;
+    const struct Polygon* ply=NULL;
+    struct Point pt;
+    struct Cap cap;
+    struct i64stack *pixels=NULL, *cands=NULL;
+    struct CapVec* caps=NULL;
+    long double area=0, sum=0, quad_area=0, weight=0;
+    double frac=0;
+    size_t i=0, j=0;
+    int64 poly_id=0;
+    int quadrant=0, flags=0;
+
+    pixels = i64stack_new(0);
+    cands = i64stack_new(0);
+    caps = capvec_new();
+    if (pixels == NULL || cands == NULL || caps == NULL) {
+        __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+        goto _quadrant_range_bail;
+    }
+
+    for (i=begin; i<end; i++) {
+        flags = 0;
+        if (work->frac_masked) {
+            for (quadrant=1; quadrant<=4; quadrant++) {
+                work->frac_masked[4*i + quadrant-1] = 1;
+            }
+        }
+
+        point_set_from_radec(&pt, work->ra[i], work->dec[i]);
+        mangle_polyid_and_weight(self, &pt, &poly_id, &weight);
+        if (poly_id < 0 || !(work->radius[i] > 0)) {
+            work->flags[i] = flags;
+            continue;
+        }
+        flags |= 1;
+
+        region_set_cap(&cap, work->ra[i], work->dec[i],
+                       work->radius[i]*D2R);
+        quad_area = 0.5*M_PI*cap.cm;
+
+        region_candidates(self, work->plv, &cap, pixels, cands);
+
+        for (quadrant=1; quadrant<=4; quadrant++) {
+            region_quadrant_part(&part, &cap, work->ra[i], work->dec[i],
+                                 quadrant);
+            sum = 0;
+            for (j=0; j<cands->size; j++) {
+                ply = &self->poly_vec->data[cands->data[j]];
+
+                // points in polygons with weight <= 0 are masked
+                if (ply->weight <= 0) {
+                    continue;
+                }
+                if (!region_polygon_area(ply, &part, caps, &area)) {
+                    __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+                    goto _quadrant_range_bail;
+                }
+                sum += area;
+            }
+
+            frac = 1 - sum/quad_area;
+            if (frac < 0) {
+                frac = 0;
+            }
+            if (frac < work->max_masked_fraction) {
+                flags |= (1<<quadrant);
+            }
+            if (work->frac_masked) {
+                work->frac_masked[4*i + quadrant-1] = frac;
+            }
+        }
+        work->flags[i] = flags;
+    }
+
+_quadrant_range_bail:
+    i64stack_delete(pixels);
+    i64stack_delete(cands);
+    capvec_free(caps);
+}
+
+int mangle_check_quadrants(const struct MangleMask *self,
+                           struct MangleQueryState *state,
+                           int nthreads,
+                           size_t n,
+                           const long double *ra,
+                           const long double *dec,
+                           const long double *radius,
+                           double max_masked_fraction,
+                           int *flags,
+                           double *frac_masked)
+{
+    struct MangleQuadrantWork work;
+    size_t i=0;
+
+    if (self->poly_vec == NULL) {
+        memset(flags, 0, n*sizeof(int));
+        if (frac_masked) {
+            for (i=0; i<4*n; i++) {
+                frac_masked[i] = 1;
+            }
+        }
+        return 1;
+    }
+
+    memset(&work, 0, sizeof(work));
+    work.mask = self;
+    work.plv = self->pixel_list_vec;
+    if (self->weight_list_vec != NULL) {
+        work.plv = self->weight_list_vec;
+    }
+    work.ra = ra;
+    work.dec = dec;
+    work.radius = radius;
+    work.max_masked_fraction = max_masked_fraction;
+    work.flags = flags;
+    work.frac_masked = frac_masked;
+
+    mangle_parallel_for(n, nthreads, 1, mangle_quadrant_range, &work);
+
+    if (work.failed) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate work space for quadrants");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * the Monte Carlo quadrant check
+ *
+ * The random points are drawn once per call as offsets from the pole: the
+ * fraction v of the cap area closer to the center than the point, and the
+ * cos and sin of its position angle, within the quadrant.  In a cap with
+ * cm = 1-cos(radius) the point is at 1-cos(rho) = v*cm from the center, so
+ * it is uniform in area, and it is rotated to the center with the matrix of
+ * the CapForRand, as in genrand_cap_radec_many.  No trig is needed for each
+ * point beyond the atan2 for phi, which the pixel schemes use.
+ *
+ * Each cap uses a window of the shared offsets starting at a point drawn
+ * from its own stream, and draws offsets past the end of the template from
+ * that stream too, so the results do not depend on the number of threads.
+ *
+ * With early stopping the points are searched in blocks that double from
+ * MANGLE_QUADRANT_FIRST_LOOK up to MANGLE_BATCH_SIZE, and a quadrant stops
+ * after a block once its masked fraction is far enough from the threshold.
+ */
+
+#define MANGLE_QUADRANT_TEMPLATE_MAX 65536
+#define MANGLE_QUADRANT_FIRST_LOOK 32
+
+struct QuadrantOffset {
+    double v;
+    double cpsi;
+    double spsi;
+};
+
+// a random offset in the quadrant, numbered from zero, uniform in area
+static void quadrant_offset_draw(unsigned short *rng,
+                                 int quadrant,
+                                 struct QuadrantOffset* off)
+{
+    double psi=0;
+
+    off->v = rand_uniform(rng);
+    psi = 0.5*M_PI*(quadrant + rand_uniform(rng));
+    off->cpsi = cos(psi);
+    off->spsi = sin(psi);
+}
+
+// number of randoms in each quadrant, for the density per square degree
+static size_t quadrant_nrand(long double radius, double density)
+{
+    double nrand=0;
+
+    if (!(radius > 0) || !(density > 0)) {
+        return 0;
+    }
+    nrand = 0.25*M_PI*radius*radius*density;
+    return nrand < (double) SIZE_MAX ? (size_t) nrand : SIZE_MAX;
+}
+
+/*
+ * the sequential test.  For a binomial with n points, the chance of a
+ * masked fraction f on the other side of the threshold t from the true one
+ * is at most exp(-n*KL(f||t)), the Chernoff-Hoeffding bound.  Testing the
+ * k-th block at error rate error_rate/(k*(k+1)), with log_limit the log of
+ * the inverse, keeps the chance of any wrong decision below error_rate.
+ */
+static int quadrant_decided(size_t nmasked,
+                            size_t n,
+                            double threshold,
+                            double log_limit)
+{
+    double f=(double) nmasked/(double) n, kl=0;
+
+    if (f == threshold) {
+        return 0;
+    }
+    if (f > 0) {
+        kl += f*log(f/threshold);
+    }
+    if (f < 1) {
+        kl += (1-f)*log((1-f)/(1-threshold));
+    }
+    return n*kl >= log_limit;
+}
+
+struct MangleRandomQuadrantWork {
+    const struct MangleMask* mask;
+
+    const long double *ra, *dec, *radius;
+    double density;
+    double max_masked_fraction;
+    double error_rate;
+    long seed;
+
+    // ntmpl offsets for each quadrant in turn
+    const struct QuadrantOffset* tmpl;
+    size_t ntmpl;
+
+    // the pixel scheme of the index needs phi, and theta for SDSS
+    int need_phi;
+    int need_theta;
+
+    int *flags;
+    double *frac_masked;
+    int failed;
+};
+
+static void quadrant_point(const struct MangleRandomQuadrantWork* work,
+                           const struct CapForRand* rcap,
+                           const struct QuadrantOffset* off,
+                           struct Point* pt)
+{
+    const double (*rot)[3]=rcap->rot;
+    double w=off->v*rcap->cm, cr=1-w, sr=sqrt(w*(2-w));
+    double lx=sr*off->cpsi, ly=sr*off->spsi;
+    double x=0, y=0, z=0, phi=0;
+
+    x = rot[0][0]*lx + rot[0][1]*ly + rot[0][2]*cr;
+    y = rot[1][0]*lx + rot[1][1]*ly + rot[1][2]*cr;
+    z = rot[2][0]*lx + rot[2][1]*ly + rot[2][2]*cr;
+
+    pt->x = x;
+    pt->y = y;
+    pt->z = z;
+    pt->theta = 0;
+    pt->phi = 0;
+    if (work->need_phi) {
+        phi = atan2(y, x);
+        pt->phi = phi < 0 ? phi + 2*M_PI : phi;
+    }
+    if (work->need_theta) {
+        pt->theta = atan2(sqrt(x*x + y*y), z);
+    }
+}
+
+static void mangle_random_quadrant_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleRandomQuadrantWork* work=ctx;
+    const struct MangleMask* self=work->mask;
+    const struct QuadrantOffset* tmpl=NULL;
+    struct MangleQueryState state;
+    struct QuadrantOffset off;
+    struct CapForRand rcap;
+    struct Point pts[MANGLE_BATCH_SIZE];
+    int64 ids[MANGLE_BATCH_SIZE];
+    long double wts[MANGLE_BATCH_SIZE];
+    struct Point pt;
+    unsigned short rng[3];
+    double frac=0;
+    size_t i=0, j=0, k=0, nb=0, nrand=0, nmasked=0, first=0, itmpl=0;
+    size_t nused=0, nlook=0;
+    long double weight=0;
+    int64 poly_id=0;
+    int quadrant=0, flags=0;
+    int early=(work->error_rate > 0 && work->max_masked_fraction > 0
+               && work->max_masked_fraction < 1);
+
+    // points in polygons with weight <= 0 are masked.  The points of a
+    // quadrant are close together, so the last hit is checked first
+    mangle_query_state_init(&state, 1);
+    mangle_query_state_set_min_weight(&state, 0);
+
+    for (i=begin; i<end; i++) {
+        flags = 0;
+        if (work->frac_masked) {
+            for (quadrant=1; quadrant<=4; quadrant++) {
+                work->frac_masked[4*i + quadrant-1] = 1;
+            }
+        }
+
+        point_set_from_radec(&pt, work->ra[i], work->dec[i]);
+        mangle_polyid_and_weight(self, &pt, &poly_id, &weight);
+        if (poly_id < 0) {
+            work->flags[i] = flags;
+            continue;
+        }
+        flags |= 1;
+
+        nrand = quadrant_nrand(work->radius[i], work->density);
+        if (nrand == 0) {
+            work->flags[i] = flags;
+            continue;
+        }
+
+        seed_random_state_stream(rng, work->seed, i+1);
+        first = (size_t) (rand_uniform(rng)*work->ntmpl);
+        CapForRand_from_radec(&rcap, work->ra[i], work->dec[i],
+                              work->radius[i]);
+
+        for (quadrant=1; quadrant<=4; quadrant++) {
+            tmpl = &work->tmpl[(quadrant-1)*work->ntmpl];
+            nmasked = 0;
+            nused = nrand;
+            nlook = 0;
+
+            for (j=0; j<nrand; j += nb) {
+                nb = MANGLE_BATCH_SIZE;
+                if (early && j < MANGLE_BATCH_SIZE) {
+                    nb = j > 0 ? j : MANGLE_QUADRANT_FIRST_LOOK;
+                }
+                if (nb > nrand-j) {
+                    nb = nrand-j;
+                }
+                for (k=0; k<nb; k++) {
+                    if (j+k < work->ntmpl) {
+                        itmpl = first + j + k;
+                        if (itmpl >= work->ntmpl) {
+                            itmpl -= work->ntmpl;
+                        }
+                        quadrant_point(work, &rcap, &tmpl[itmpl], &pts[k]);
+                    } else {
+                        quadrant_offset_draw(rng, quadrant-1, &off);
+                        quadrant_point(work, &rcap, &off, &pts[k]);
+                    }
+                }
+
+                if (!mangle_search_block(self, &state, nb, pts, ids, wts)) {
+                    __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+                    return;
+                }
+                for (k=0; k<nb; k++) {
+                    if (ids[k] < 0) {
+                        nmasked++;
+                    }
+                }
+
+                if (early && j+nb < nrand) {
+                    nlook++;
+                    if (quadrant_decided(nmasked, j+nb,
+                                         work->max_masked_fraction,
+                                         log(nlook*(nlook+1.0)
+                                             /work->error_rate))) {
+                        nused = j+nb;
+                        break;
+                    }
+                }
+            }
+
+            frac = (double) nmasked/(double) nused;
+            if (frac < work->max_masked_fraction) {
+                flags |= (1<<quadrant);
+            }
+            if (work->frac_masked) {
+                work->frac_masked[4*i + quadrant-1] = frac;
+            }
+        }
+        work->flags[i] = flags;
+    }
+}
+
+int mangle_check_quadrants_random(const struct MangleMask *self,
+                                  struct MangleQueryState *state,
+                                  int nthreads,
+                                  size_t n,
+                                  const long double *ra,
+                                  const long double *dec,
+                                  const long double *radius,
+                                  double density,
+                                  double max_masked_fraction,
+                                  double error_rate,
+                                  long seed,
+                                  int *flags,
+                                  double *frac_masked)
+{
+    struct MangleRandomQuadrantWork work;
+    struct QuadrantOffset* tmpl=NULL;
+    unsigned short rng[3];
+    size_t i=0, nrand=0, ntmpl=0;
+    int quadrant=0;
+
+    if (self->poly_vec == NULL) {
+        return mangle_check_quadrants(self, state, nthreads, n, ra, dec,
+                                      radius, max_masked_fraction,
+                                      flags, frac_masked);
+    }
+    if (seed < 0) {
+        seed = random_seed();
+    }
+
+    // room for caps to start at different points, up to a limit
+    for (i=0; i<n; i++) {
+        nrand = quadrant_nrand(radius[i], density);
+        if (nrand > ntmpl) {
+            ntmpl = nrand;
+        }
+    }
+    if (ntmpl > MANGLE_QUADRANT_TEMPLATE_MAX/4) {
+        ntmpl = MANGLE_QUADRANT_TEMPLATE_MAX;
+    } else {
+        ntmpl *= 4;
+    }
+
+    if (ntmpl > 0) {
+        tmpl = malloc(4*ntmpl*sizeof(struct QuadrantOffset));
+        if (tmpl == NULL) {
+            mangle_query_error(state, MANGLE_ERR_NOMEM,
+                               "Could not allocate %lu random offsets",
+                               (unsigned long) (4*ntmpl));
+            return 0;
+        }
+        seed_random_state_stream(rng, seed, 0);
+        for (quadrant=0; quadrant<4; quadrant++) {
+            for (i=0; i<ntmpl; i++) {
+                quadrant_offset_draw(rng, quadrant, &tmpl[quadrant*ntmpl + i]);
+            }
+        }
+    }
+
+    memset(&work, 0, sizeof(work));
+    work.mask = self;
+    work.ra = ra;
+    work.dec = dec;
+    work.radius = radius;
+    work.density = density;
+    work.max_masked_fraction = max_masked_fraction;
+    work.error_rate = error_rate;
+    work.seed = seed;
+    work.tmpl = tmpl;
+    work.ntmpl = ntmpl;
+    work.need_phi = (self->pixel_list_vec != NULL);
+    work.need_theta = (work.need_phi
+                       && self->pixel_list_vec->pixeltype == 'd');
+    work.flags = flags;
+    work.frac_masked = frac_masked;
+
+    mangle_parallel_for(n, nthreads, 8, mangle_random_quadrant_range, &work);
+    free(tmpl);
+
+    if (work.failed) {
+        mangle_query_error(state, MANGLE_ERR_PIXEL_SCHEME,
+                           "Unsupported pixelization scheme: '%c'",
+                           self->pixel_list_vec->pixeltype);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * coverage maps
+ *
+ * The sky is walked down the pixel hierarchy from a coarse level, keeping
+ * for each pixel the polygons that may overlap it, in order.  The first
+ * polygon that is not clear of a pixel decides it if it holds the whole
+ * pixel, and pixels clear of all polygons are empty; either way all output
+ * pixels within are filled directly.  Output pixels that are not decided
+ * are split further, down to maxdepth levels, where the centers decide.
+ */
+
+enum coverage_relation {
+    COVERAGE_CLEAR=0,
+    COVERAGE_INSIDE=1,
+    COVERAGE_PARTIAL=2,
+};
+
+// a pixel as the center and the cos and sin of the radius of a cap holding
+// it
+struct CoveragePixel {
+    struct Point center;
+    long double cosr;
+    long double sinr;
+};
+
+/*
+ * compare the pixel with the area covered by a cap, using cosines of the
+ * angles so no inverse trig is needed.  The pixel is clear of the cap if
+ * their separation is at least the sum of the radii, and inside if the
+ * separation plus the pixel radius is at most the cap radius
+ */
+static int coverage_cap_relation(const struct CoveragePixel* pix,
+                                 const struct Cap* cap)
+{
+    long double cm=cap->cm, sign=1, cosr=0, sinr=0, dot=0;
+
+    if (cm < 0) {
+        sign = -1;
+        cm = 2 + cm;
+    }
+    if (cm >= 2) {
+        return COVERAGE_INSIDE;
+    }
+    if (cm < 0) {
+        cm = 0;
+    }
+    cosr = 1 - cm;
+    sinr = sqrtl(cm*(2 - cm));
+
+    dot = sign*(cap->x*pix->center.x + cap->y*pix->center.y
+                + cap->z*pix->center.z);
+
+    // radius sum below pi, and separation at least the sum
+    if (sinr*pix->cosr + cosr*pix->sinr > 0
+            && dot < cosr*pix->cosr - sinr*pix->sinr - 1.0e-15) {
+        return COVERAGE_CLEAR;
+    }
+    // cap radius at least the pixel radius, and separation at most the
+    // difference
+    if (cosr <= pix->cosr
+            && dot > cosr*pix->cosr + sinr*pix->sinr + 1.0e-15) {
+        return COVERAGE_INSIDE;
+    }
+    return COVERAGE_PARTIAL;
+}
+
+static int coverage_relation(const struct Polygon* ply,
+                             const struct CoveragePixel* pix)
+{
+    struct Cap pbound;
+    size_t i=0;
+    int rel=0, inside=1;
+
+    polygon_bounding_cap(ply, &pbound);
+    if (coverage_cap_relation(pix, &pbound) == COVERAGE_CLEAR) {
+        return COVERAGE_CLEAR;
+    }
+
+    for (i=0; i<ply->caps->size; i++) {
+        rel = coverage_cap_relation(pix, &ply->caps->data[i]);
+        if (rel == COVERAGE_CLEAR) {
+            return COVERAGE_CLEAR;
+        }
+        if (rel == COVERAGE_PARTIAL) {
+            inside = 0;
+        }
+    }
+    return inside ? COVERAGE_INSIDE : COVERAGE_PARTIAL;
+}
+
+struct MangleCoverageWork {
+    const struct MangleMask* mask;
+    const struct PixelListVec* plv;
+    int use_min_weight;
+    long double min_weight;
+    int weighted;
+
+    // pixels are subdivided in scheme subtype, 'n' or 's', from startres
+    // to the output resolution outres, outdepth levels down, and at most
+    // maxdepth levels beyond
+    char subtype;
+    int64 startres;
+    int64 outres;
+    int outdepth;
+    int maxdepth;
+
+    // cos and sin of the radius of NESTED pixels at each depth
+    long double cosr[MANGLE_COVERAGE_MAXLEVELS];
+    long double sinr[MANGLE_COVERAGE_MAXLEVELS];
+
+    // the map in the order of subtype
+    double* map;
+    int failed;
+};
+
+// per thread scratch, with a list of polygons for each depth
+struct MangleCoverageScratch {
+    struct i64stack* pixels;
+    size_t nlists;
+    struct i64stack** cands;
+};
+
+static double coverage_value(const struct MangleCoverageWork* work,
+                             const struct Polygon* ply)
+{
+    if (work->use_min_weight && ply->weight <= work->min_weight) {
+        return 0;
+    }
+    return work->weighted ? (double) ply->weight : 1.0;
+}
+
+static void coverage_pixel_set(const struct MangleCoverageWork* work,
+                               int64 pixelres,
+                               int64 ipix,
+                               int depth,
+                               struct CoveragePixel* pix)
+{
+    long double radius=0;
+
+    if (work->subtype == 'n') {
+        pixel_center('n', pixelres, ipix, &pix->center);
+        pix->cosr = work->cosr[depth];
+        pix->sinr = work->sinr[depth];
+    } else {
+        pixel_bounding_cap('s', pixelres, ipix, &pix->center, &radius);
+        pix->cosr = cosl(radius);
+        pix->sinr = sinl(radius);
+    }
+}
+
+/*
+ * keep in cands[depth+1] the polygons of cands[depth] that may overlap the
+ * pixel.  Returns 1 if the pixel is decided, with its value in value
+ */
+static int coverage_classify(const struct MangleCoverageWork* work,
+                             struct MangleCoverageScratch* scratch,
+                             const struct CoveragePixel* pix,
+                             int depth,
+                             double* value)
+{
+    const struct i64stack* cands=scratch->cands[depth];
+    struct i64stack* sub=scratch->cands[depth+1];
+    const struct Polygon* ply=NULL;
+    size_t i=0;
+    int rel=0;
+
+    // polygons after one holding the whole pixel can not be first anywhere
+    // in it
+    i64stack_resize(sub, 0);
+    for (i=0; i<cands->size; i++) {
+        ply = &work->mask->poly_vec->data[cands->data[i]];
+        rel = coverage_relation(ply, pix);
+        if (rel == COVERAGE_CLEAR) {
+            continue;
+        }
+        if (rel == COVERAGE_INSIDE && sub->size == 0) {
+            *value = coverage_value(work, ply);
+            return 1;
+        }
+        i64stack_push(sub, cands->data[i]);
+        if (rel == COVERAGE_INSIDE) {
+            break;
+        }
+    }
+
+    *value = 0;
+    return (sub->size == 0);
+}
+
+/*
+ * the covered fraction of a pixel below the output resolution
+ */
+static double coverage_subpixel(const struct MangleCoverageWork* work,
+                                struct MangleCoverageScratch* scratch,
+                                int64 pixelres,
+                                int64 ipix,
+                                int depth)
+{
+    const struct i64stack* sub=scratch->cands[depth+1];
+    const struct Polygon* ply=NULL;
+    struct CoveragePixel pix;
+    int64 childres=0, children[4];
+    double value=0;
+    size_t i=0;
+    int k=0;
+
+    coverage_pixel_set(work, pixelres, ipix, depth, &pix);
+    if (coverage_classify(work, scratch, &pix, depth, &value)) {
+        return value;
+    }
+
+    if (depth >= work->outdepth + work->maxdepth) {
+        for (i=0; i<sub->size; i++) {
+            ply = &work->mask->poly_vec->data[sub->data[i]];
+            if (is_in_poly(ply, &pix.center)) {
+                return coverage_value(work, ply);
+            }
+        }
+        return 0;
+    }
+
+    // the children overwrite the lists below this depth
+    pixel_children(work->subtype, pixelres, ipix, &childres, children);
+    for (k=0; k<4; k++) {
+        value += coverage_subpixel(work, scratch, childres, children[k],
+                                   depth+1);
+    }
+    return 0.25*value;
+}
+
+// fill the output pixels within a pixel depth levels below the start
+static void coverage_fill(const struct MangleCoverageWork* work,
+                          int64 ipix,
+                          int depth,
+                          double value)
+{
+    int k = work->outdepth - depth;
+    int64 p2=0, n=0, m=0, first=0, nblock=0, i=0, j=0;
+
+    if (work->subtype == 'n') {
+        first = ipix << (2*k);
+        nblock = 1L << (2*k);
+        for (i=0; i<nblock; i++) {
+            work->map[first+i] = value;
+        }
+    } else {
+        p2 = 1L << (work->startres + depth);
+        n = (ipix/p2) << k;
+        m = (ipix % p2) << k;
+        nblock = 1L << k;
+        for (i=0; i<nblock; i++) {
+            for (j=0; j<nblock; j++) {
+                work->map[((n+i) << work->outres) + m+j] = value;
+            }
+        }
+    }
+}
+
+static void coverage_block(const struct MangleCoverageWork* work,
+                           struct MangleCoverageScratch* scratch,
+                           int64 pixelres,
+                           int64 ipix,
+                           int depth)
+{
+    struct CoveragePixel pix;
+    int64 childres=0, children[4];
+    double value=0;
+    int k=0;
+
+    if (depth == work->outdepth) {
+        work->map[ipix] = coverage_subpixel(work, scratch, pixelres, ipix,
+                                            depth);
+        return;
+    }
+
+    coverage_pixel_set(work, pixelres, ipix, depth, &pix);
+    if (coverage_classify(work, scratch, &pix, depth, &value)) {
+        coverage_fill(work, ipix, depth, value);
+        return;
+    }
+
+    pixel_children(work->subtype, pixelres, ipix, &childres, children);
+    for (k=0; k<4; k++) {
+        coverage_block(work, scratch, childres, children[k], depth+1);
+    }
+}
+
+static void mangle_coverage_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleCoverageWork* work=ctx;
+    const struct MangleMask* self=work->mask;
+    struct MangleCoverageScratch scratch;
+    struct i64stack* top=NULL;
+    struct Point pt;
+    struct Cap bound;
+    long double radius=0;
+    size_t i=0, j=0;
+    int ok=1;
+
+    scratch.nlists = work->outdepth + work->maxdepth + 2;
+    scratch.pixels = i64stack_new(0);
+    scratch.cands = calloc(scratch.nlists, sizeof(struct i64stack*));
+    ok = (scratch.pixels != NULL && scratch.cands != NULL);
+    for (j=0; ok && j<scratch.nlists; j++) {
+        scratch.cands[j] = i64stack_new(0);
+        ok = (scratch.cands[j] != NULL);
+    }
+    if (!ok) {
+        __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+        goto _coverage_range_bail;
+    }
+    top = scratch.cands[0];
+
+    for (i=begin; i<end; i++) {
+        pixel_bounding_cap(work->subtype, work->startres, (int64) i,
+                           &pt, &radius);
+        cap_set(&bound, pt.x, pt.y, pt.z, region_cap_cm(radius));
+        region_candidates(self, work->plv, &bound, scratch.pixels, top);
+
+        coverage_block(work, &scratch, work->startres, (int64) i, 0);
+    }
+
+_coverage_range_bail:
+    i64stack_delete(scratch.pixels);
+    if (scratch.cands != NULL) {
+        for (j=0; j<scratch.nlists; j++) {
+            i64stack_delete(scratch.cands[j]);
+        }
+        free(scratch.cands);
+    }
+}
+
+struct MangleRingWork {
+    int64 nside;
+    const double* nestmap;
+    double* map;
+};
+
+static void mangle_ring_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleRingWork* work=ctx;
+    size_t i=0;
+
+    for (i=begin; i<end; i++) {
+        work->map[i] = work->nestmap[healpix_ring2nest(work->nside, i)];
+    }
+}
+
+int mangle_coverage_check(struct MangleQueryState *state,
+                          char pixeltype,
+                          int64 pixelres)
+{
+    if (pixeltype == 'h' || pixeltype == 'n') {
+        if (!healpix_check_nside(pixelres, 'n')) {
+            mangle_query_error(state, MANGLE_ERR_PIXEL_SCHEME,
+                               "Coverage maps need nside a power of 2 in "
+                               "[1,2^29], got %ld", pixelres);
+            return 0;
+        }
+    } else if (pixeltype == 's') {
+        if (pixelres < 0 || pixelres > 30) {
+            mangle_query_error(state, MANGLE_ERR_PIXEL_SCHEME,
+                               "Bad resolution for simple pixels: %ld",
+                               pixelres);
+            return 0;
+        }
+    } else {
+        mangle_query_error(state, MANGLE_ERR_PIXEL_SCHEME,
+                           "Unsupported pixelization scheme for coverage: "
+                           "'%c'", pixeltype);
+        return 0;
+    }
+    return 1;
+}
+
+int mangle_coverage_map(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        char pixeltype,
+                        int64 pixelres,
+                        int weighted,
+                        int maxdepth,
+                        int nthreads,
+                        double* map)
+{
+    struct MangleCoverageWork work;
+    struct MangleRingWork ring;
+    struct Point pt;
+    long double radius=0;
+    double* nestmap=NULL;
+    int64 first=0, npix=0, nstart=0, maxres=0, res=0;
+    int depth=0;
+
+    memset(&work, 0, sizeof(work));
+
+    if (!mangle_coverage_check(state, pixeltype, pixelres)) {
+        return 0;
+    }
+    if (pixeltype == 'h' || pixeltype == 'n') {
+        work.subtype = 'n';
+        work.startres = (pixelres < 16) ? pixelres : 16;
+        maxres = 1L<<29;
+    } else {
+        work.subtype = 's';
+        work.startres = (pixelres < 5) ? pixelres : 5;
+        maxres = 30;
+    }
+    pixel_level_range(pixeltype, pixelres, &first, &npix);
+    pixel_level_range(work.subtype, work.startres, &first, &nstart);
+
+    work.outres = pixelres;
+    for (res=work.startres; res<pixelres; ) {
+        res = (work.subtype == 'n') ? 2*res : res+1;
+        work.outdepth++;
+    }
+
+    if (maxdepth < 0) {
+        maxdepth = 0;
+    }
+    if (maxdepth > MANGLE_COVERAGE_MAXDEPTH) {
+        maxdepth = MANGLE_COVERAGE_MAXDEPTH;
+    }
+
+    // stay within the finest resolution of the scheme
+    for (res=pixelres; work.maxdepth < maxdepth; work.maxdepth++) {
+        res = (work.subtype == 'n') ? 2*res : res+1;
+        if (res > maxres) {
+            break;
+        }
+    }
+
+    if (work.subtype == 'n') {
+        for (depth=0, res=work.startres;
+             depth <= work.outdepth + work.maxdepth;
+             depth++, res *= 2) {
+            pixel_bounding_cap('n', res, 0, &pt, &radius);
+            work.cosr[depth] = cosl(radius);
+            work.sinr[depth] = sinl(radius);
+        }
+    }
+
+    work.mask = self;
+    work.plv = self->pixel_list_vec;
+    work.weighted = weighted;
+
+    if (state != NULL && state->use_min_weight) {
+        work.use_min_weight = 1;
+        work.min_weight = state->min_weight;
+        if (self->weight_list_vec != NULL && state->min_weight >= 0) {
+            work.plv = self->weight_list_vec;
+        }
+    }
+
+    if (self->poly_vec == NULL) {
+        memset(map, 0, npix*sizeof(double));
+        return 1;
+    }
+
+    // RING maps are made in NESTED order then reordered
+    if (pixeltype == 'h') {
+        nestmap = malloc(npix*sizeof(double));
+        if (nestmap == NULL) {
+            mangle_query_error(state, MANGLE_ERR_NOMEM,
+                               "Could not allocate %ld pixel map", npix);
+            return 0;
+        }
+        work.map = nestmap;
+    } else {
+        work.map = map;
+    }
+
+    mangle_parallel_for(nstart, nthreads, 1, mangle_coverage_range, &work);
+
+    if (!work.failed && pixeltype == 'h') {
+        ring.nside = pixelres;
+        ring.nestmap = nestmap;
+        ring.map = map;
+        mangle_parallel_for(npix, nthreads, 4096, mangle_ring_range, &ring);
+    }
+    free(nestmap);
+
+    if (work.failed) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate work space for coverage map");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * distance to the mask boundary
+ *
+ * The boundary of the mask is made of arcs of polygon edges.  The point of
+ * an arc nearest a given point is either the foot of the perpendicular from
+ * the point to the edge's circle, or an end of the arc, which is a vertex.
+ * These candidates are collected from the polygons near the point, nearest
+ * first, and the first with points both in and out of the mask around it
+ * is on the boundary.  The points are stepped off across the edges, since
+ * points on an edge are in neither polygon it divides.  Edges shared by two
+ * polygons of the mask, as in balkanized masks, have the mask on both sides
+ * and are passed over.
+ */
+
+// offset in radians of the points around a candidate
+#define MANGLE_BOUNDARY_EPS 1.0e-10
+
+// slack in 1-cos for points on the edges of a polygon
+#define MANGLE_BOUNDARY_TOL 1.0e-15
+
+// a point on one edge, or a vertex of two, with the edge normals there
+struct BoundaryCandidate {
+    long double dist;
+    long double q[3];
+    int nnormal;
+    long double normal[2][3];
+};
+
+struct BoundaryScratch {
+    struct i64stack* pixels;
+    // the polygons near the point
+    struct i64stack* cands;
+    size_t size;
+    size_t allocated_size;
+    struct BoundaryCandidate* data;
+};
+
+struct MangleBoundaryWork {
+    const struct MangleMask* mask;
+    int use_min_weight;
+    long double min_weight;
+
+    const long double *ra, *dec;
+    // in radians, and the value in degrees given for no boundary within it
+    long double max_radius;
+    long double max_radius_deg;
+    long double *distance;
+    int failed;
+};
+
+// the unit vector at q, tangent to the sphere, toward the center a
+static void boundary_normal(const long double q[3],
+                            const long double a[3],
+                            long double normal[3])
+{
+    long double dot=0, norm=0;
+    int k=0;
+
+    dot = a[0]*q[0] + a[1]*q[1] + a[2]*q[2];
+    for (k=0; k<3; k++) {
+        normal[k] = a[k] - dot*q[k];
+    }
+    norm = sqrtl(normal[0]*normal[0] + normal[1]*normal[1]
+                 + normal[2]*normal[2]);
+    for (k=0; k<3; k++) {
+        normal[k] /= norm;
+    }
+}
+
+// push q, on the circle with center a1 and, for a vertex, that with a2
+static int boundary_push(struct BoundaryScratch* scratch,
+                         long double dist,
+                         const long double q[3],
+                         const long double a1[3],
+                         const long double a2[3])
+{
+    struct BoundaryCandidate* data=NULL;
+    struct BoundaryCandidate* cand=NULL;
+    size_t newsize=0;
+
+    if (scratch->size == scratch->allocated_size) {
+        newsize = scratch->allocated_size ? 2*scratch->allocated_size : 64;
+        data = realloc(scratch->data, newsize*sizeof(*data));
+        if (data == NULL) {
+            return 0;
+        }
+        scratch->data = data;
+        scratch->allocated_size = newsize;
+    }
+    cand = &scratch->data[scratch->size++];
+    cand->dist = dist;
+    memcpy(cand->q, q, 3*sizeof(long double));
+    boundary_normal(q, a1, cand->normal[0]);
+    cand->nnormal = 1;
+    if (a2 != NULL) {
+        boundary_normal(q, a2, cand->normal[1]);
+        cand->nnormal = 2;
+    }
+    return 1;
+}
+
+static int boundary_compare(const void *a, const void *b)
+{
+    long double da = ((const struct BoundaryCandidate*) a)->dist;
+    long double db = ((const struct BoundaryCandidate*) b)->dist;
+    return (da > db) - (da < db);
+}
+
+// whether q is on or in all caps of the polygon except skip1 and skip2
+static int boundary_on_polygon(const struct Polygon* ply,
+                               const long double q[3],
+                               size_t skip1,
+                               size_t skip2)
+{
+    const struct Cap* cap=NULL;
+    long double cdotm=0;
+    size_t k=0;
+
+    for (k=0; k<ply->caps->size; k++) {
+        if (k == skip1 || k == skip2) {
+            continue;
+        }
+        cap = &ply->caps->data[k];
+        cdotm = 1 - cap->x*q[0] - cap->y*q[1] - cap->z*q[2];
+        if (cap->cm < 0) {
+            if (cdotm < -cap->cm - MANGLE_BOUNDARY_TOL) {
+                return 0;
+            }
+        } else if (cdotm > cap->cm + MANGLE_BOUNDARY_TOL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * whether the point is in the mask: the first of the candidate polygons
+ * holding it decides, as for the point queries
+ */
+static int boundary_in_mask(const struct MangleBoundaryWork* work,
+                            const struct i64stack* cands,
+                            const long double x[3])
+{
+    const struct Polygon* ply=NULL;
+    struct Point pt;
+    size_t i=0;
+
+    pt.x = x[0];
+    pt.y = x[1];
+    pt.z = x[2];
+    for (i=0; i<cands->size; i++) {
+        ply = &work->mask->poly_vec->data[cands->data[i]];
+        if (is_in_poly(ply, &pt)) {
+            return !(work->use_min_weight && ply->weight <= work->min_weight);
+        }
+    }
+    return 0;
+}
+
+/*
+ * whether points stepped off the candidate are found both in and out of the
+ * mask: to either side of an edge, or into each of the four corners between
+ * the edges at a vertex
+ */
+static int boundary_is_edge(const struct MangleBoundaryWork* work,
+                            const struct i64stack* cands,
+                            const struct BoundaryCandidate* cand)
+{
+    long double dir[3], x[3], norm=0;
+    long double ceps=cosl(MANGLE_BOUNDARY_EPS), seps=sinl(MANGLE_BOUNDARY_EPS);
+    int i=0, k=0, nin=0, nout=0, ndir=0;
+    int sign1=0, sign2=0;
+
+    ndir = (cand->nnormal == 1) ? 2 : 4;
+    for (i=0; i<ndir; i++) {
+        sign1 = (i & 1) ? -1 : 1;
+        sign2 = (i & 2) ? -1 : 1;
+        for (k=0; k<3; k++) {
+            dir[k] = sign1*cand->normal[0][k];
+            if (cand->nnormal == 2) {
+                dir[k] += sign2*cand->normal[1][k];
+            }
+        }
+        norm = sqrtl(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+        for (k=0; k<3; k++) {
+            x[k] = ceps*cand->q[k] + seps*dir[k]/norm;
+        }
+
+        if (boundary_in_mask(work, cands, x)) {
+            nin++;
+        } else {
+            nout++;
+        }
+        if (nin > 0 && nout > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a unit vector perpendicular to a, from its cross product with the
+// coordinate axis least aligned with it
+static void boundary_perpendicular(const long double a[3], long double u[3])
+{
+    long double norm=0;
+    int k=0, kmin=0;
+
+    for (k=1; k<3; k++) {
+        if (fabsl(a[k]) < fabsl(a[kmin])) {
+            kmin = k;
+        }
+    }
+    // a cross the unit vector along axis kmin
+    u[kmin] = 0;
+    u[(kmin+1) % 3] = a[(kmin+2) % 3];
+    u[(kmin+2) % 3] = -a[(kmin+1) % 3];
+
+    norm = sqrtl(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+    for (k=0; k<3; k++) {
+        u[k] /= norm;
+    }
+}
+
+/*
+ * push the feet and vertices of the polygon's edges within the current
+ * maximum distance of p
+ */
+static int boundary_polygon_candidates(const struct Polygon* ply,
+                                       const long double p[3],
+                                       long double max_radius,
+                                       struct BoundaryScratch* scratch)
+{
+    const struct Cap* caps=ply->caps->data;
+    size_t ncaps=ply->caps->size, i=0, j=0, k=0;
+    long double ai[3], aj[3], ri=0, rj=0, ci=0, cj=0, si=0;
+    long double u[3], q[3], cross[3];
+    long double dot=0, norm=0, dist=0, g=0, det=0;
+    long double alpha=0, beta=0, w=0, gamma=0;
+
+    for (i=0; i<ncaps; i++) {
+        region_cap_circle(&caps[i], ai, &ri);
+        if (ri <= 0 || ri >= M_PI) {
+            continue;
+        }
+        ci = cosl(ri);
+        si = sinl(ri);
+
+        // the foot, along the great circle through the center and p
+        dist = fabsl(region_separation(p, ai) - ri);
+        if (dist < max_radius) {
+            dot = p[0]*ai[0] + p[1]*ai[1] + p[2]*ai[2];
+            for (k=0; k<3; k++) {
+                u[k] = p[k] - dot*ai[k];
+            }
+            norm = sqrtl(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+            if (norm < 1.0e-12) {
+                // p is on the axis, p and ai being unit vectors, so the
+                // whole circle is equally near; take the direction
+                // perpendicular to ai and the axis least aligned with it
+                boundary_perpendicular(ai, u);
+            }
+            // remove what rounding left along ai, which would move the foot
+            // off the circle when p is near the axis
+            dot = u[0]*ai[0] + u[1]*ai[1] + u[2]*ai[2];
+            for (k=0; k<3; k++) {
+                u[k] -= dot*ai[k];
+            }
+            norm = sqrtl(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+            for (k=0; k<3; k++) {
+                q[k] = ci*ai[k] + si*u[k]/norm;
+            }
+            if (boundary_on_polygon(ply, q, i, i)
+                    && !boundary_push(scratch, dist, q, ai, NULL)) {
+                return 0;
+            }
+        }
+
+        // the vertices on this circle and a later one
+        for (j=i+1; j<ncaps; j++) {
+            region_cap_circle(&caps[j], aj, &rj);
+            if (rj <= 0 || rj >= M_PI) {
+                continue;
+            }
+            cj = cosl(rj);
+
+            g = ai[0]*aj[0] + ai[1]*aj[1] + ai[2]*aj[2];
+            det = 1 - g*g;
+            if (det < 1.0e-24) {
+                continue;
+            }
+            alpha = (ci - g*cj)/det;
+            beta = (cj - g*ci)/det;
+            w = 1 - (alpha*ci + beta*cj);
+            if (w < 0) {
+                continue;
+            }
+            gamma = sqrtl(w/det);
+
+            cross[0] = ai[1]*aj[2] - ai[2]*aj[1];
+            cross[1] = ai[2]*aj[0] - ai[0]*aj[2];
+            cross[2] = ai[0]*aj[1] - ai[1]*aj[0];
+            for (k=0; k<3; k++) {
+                q[k] = alpha*ai[k] + beta*aj[k] + gamma*cross[k];
+            }
+            dist = region_separation(p, q);
+            if (dist < max_radius && boundary_on_polygon(ply, q, i, j)
+                    && !boundary_push(scratch, dist, q, ai, aj)) {
+                return 0;
+            }
+            for (k=0; k<3; k++) {
+                q[k] -= 2*gamma*cross[k];
+            }
+            dist = region_separation(p, q);
+            if (dist < max_radius && boundary_on_polygon(ply, q, i, j)
+                    && !boundary_push(scratch, dist, q, ai, aj)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int boundary_point_distance(const struct MangleBoundaryWork* work,
+                                   struct BoundaryScratch* scratch,
+                                   long double ra,
+                                   long double dec,
+                                   long double* distance)
+{
+    const struct MangleMask* self=work->mask;
+    const struct Polygon* ply=NULL;
+    struct Point pt;
+    struct Cap search;
+    long double p[3], radius=0;
+    size_t i=0;
+
+    *distance = work->max_radius_deg;
+
+    point_set_from_radec(&pt, ra, dec);
+    p[0] = pt.x;
+    p[1] = pt.y;
+    p[2] = pt.z;
+
+    // polygons holding points near the candidates are needed too
+    radius = work->max_radius + 2*MANGLE_BOUNDARY_EPS;
+    cap_set(&search, pt.x, pt.y, pt.z, region_cap_cm(radius));
+    region_candidates(self, self->pixel_list_vec, &search,
+                      scratch->pixels, scratch->cands);
+
+    scratch->size = 0;
+    for (i=0; i<scratch->cands->size; i++) {
+        ply = &self->poly_vec->data[scratch->cands->data[i]];
+        if (!boundary_polygon_candidates(ply, p, work->max_radius, scratch)) {
+            return 0;
+        }
+    }
+
+    if (scratch->size > 1) {
+        qsort(scratch->data, scratch->size, sizeof(struct BoundaryCandidate),
+              boundary_compare);
+    }
+    for (i=0; i<scratch->size; i++) {
+        if (boundary_is_edge(work, scratch->cands, &scratch->data[i])) {
+            *distance = scratch->data[i].dist*R2D;
+            break;
+        }
+    }
+    return 1;
+}
+
+static void mangle_boundary_range(void* ctx, size_t begin, size_t end)
+{
+    struct MangleBoundaryWork* work=ctx;
+    struct BoundaryScratch scratch;
+    long double distance=0;
+    size_t i=0;
+
+    memset(&scratch, 0, sizeof(scratch));
+    scratch.pixels = i64stack_new(0);
+    scratch.cands = i64stack_new(0);
+    if (scratch.pixels == NULL || scratch.cands == NULL) {
+        __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+        goto _boundary_range_bail;
+    }
+
+    for (i=begin; i<end; i++) {
+        if (!boundary_point_distance(work, &scratch, work->ra[i],
+                                     work->dec[i], &distance)) {
+            __atomic_store_n(&work->failed, 1, __ATOMIC_RELAXED);
+            goto _boundary_range_bail;
+        }
+        work->distance[i] = distance;
+    }
+
+_boundary_range_bail:
+    i64stack_delete(scratch.pixels);
+    i64stack_delete(scratch.cands);
+    free(scratch.data);
+}
+
+int mangle_boundary_distance(const struct MangleMask *self,
+                             struct MangleQueryState *state,
+                             int nthreads,
+                             size_t n,
+                             const long double *ra,
+                             const long double *dec,
+                             long double max_radius,
+                             long double *distance)
+{
+    struct MangleBoundaryWork work;
+    size_t i=0;
+
+    if (!(max_radius > 0)) {
+        max_radius = 0;
+    }
+    if (max_radius > 180) {
+        max_radius = 180;
+    }
+    if (self->poly_vec == NULL || max_radius == 0) {
+        for (i=0; i<n; i++) {
+            distance[i] = max_radius;
+        }
+        return 1;
+    }
+
+    memset(&work, 0, sizeof(work));
+    work.mask = self;
+    work.ra = ra;
+    work.dec = dec;
+    work.max_radius = max_radius*D2R;
+    work.max_radius_deg = max_radius;
+    work.distance = distance;
+    if (state != NULL && state->use_min_weight) {
+        work.use_min_weight = 1;
+        work.min_weight = state->min_weight;
+    }
+
+    mangle_parallel_for(n, nthreads, 16, mangle_boundary_range, &work);
+
+    if (work.failed) {
+        mangle_query_error(state, MANGLE_ERR_NOMEM,
+                           "Could not allocate work space for boundary "
+                           "distances");
+        return 0;
+    }
+    return 1;
+}
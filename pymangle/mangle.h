@@ -5,6 +5,49 @@
 #include "pixel.h"
 #include "polygon.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * load report
+ * -----------
+ *
+ * mangle_read records the wall time and the bytes allocated in each phase.
+ * The area phase only fills in the polygons, so it has no bytes of its own.
+ * With verbose set the report is printed when the read is done.
+ */
+enum mangle_load_phase {
+    MANGLE_LOAD_HEADER=0,
+    MANGLE_LOAD_POLYGONS,
+    MANGLE_LOAD_AREA,
+    MANGLE_LOAD_PIXEL_MAP,
+    MANGLE_LOAD_WEIGHT_INDEX,
+    MANGLE_LOAD_NPHASE
+};
+
+struct MangleLoadReport {
+    double seconds[MANGLE_LOAD_NPHASE];
+    size_t nbytes[MANGLE_LOAD_NPHASE];
+};
+
+// the name of the phase, e.g. "polygons"
+const char* mangle_load_phase_name(int phase);
+
+// 1 if the phase allocates memory and records nbytes
+int mangle_load_phase_has_nbytes(int phase);
+
+// bytes held by the parts of a mask, including unused capacity
+struct MangleMemory {
+    size_t mask;          // the MangleMask and file name
+    size_t polygons;      // the PolyVec and its polygons
+    size_t caps;          // the caps of all polygons
+    size_t pixel_index;   // pixel_list_vec
+    size_t weight_index;  // weight_list_vec
+    size_t stats;
+    size_t total;
+};
 
 struct MangleMask {
     int64 npoly;
@@ -16,6 +59,20 @@ struct MangleMask {
     char pixeltype;
     struct PixelListVec* pixel_list_vec;
 
+    // the pixel index without the polygons of weight <= 0, with the same
+    // scheme as pixel_list_vec.  For masks without a pixel index this is a
+    // single list.  NULL if all weights are positive.
+    struct PixelListVec* weight_list_vec;
+
+    // simple scheme constants for pixelres, set with the pixel map
+    struct SimplePixel simplepix;
+
+    // search statistics, NULL unless enabled with mangle_stats_enable
+    struct MangleStats* stats;
+
+    // timing and allocations of the phases of mangle_read
+    struct MangleLoadReport load_report;
+
     int snapped;
     int balkanized;
     int real;
@@ -29,10 +86,6 @@ struct MangleMask {
     //int has_weightfile;
     //char* weightfile;
 
-
-    // for error messages
-    char err[_MANGLE_LARGE_BUFFSIZE];
-
 };
 
 struct MangleMask* mangle_new(void);
@@ -42,6 +95,12 @@ void mangle_set_verbosity(struct MangleMask* self, int verbosity);
 
 void mangle_print(FILE* fptr, struct MangleMask* self, int verbosity);
 
+// the current memory footprint, which changes when the index is rebuilt
+void mangle_memory(const struct MangleMask* self, struct MangleMemory* mem);
+
+// print the load report and the current footprint
+void mangle_print_load_report(FILE* fptr, const struct MangleMask* self);
+
 int mangle_read(struct MangleMask* self, const char* filename);
 int mangle_read_header(struct MangleMask* self, FILE *fptr);
 
@@ -51,8 +110,75 @@ int mangle_set_weights(struct MangleMask* self, long double *weights);
 // sum the areas for all polygons and store in ->total_area
 void mangle_calc_area_and_maxpix(struct MangleMask* self);
 
+/*
+ * compute the polygon areas from their caps with polygon_calc_area, for the
+ * polygons without an area in the file, or all of them if all is set, and
+ * update total_area.  The polygons are split over nthreads threads, <= 0 for
+ * the number of online cpus.  mangle_read calls this for polygons without
+ * areas.
+ */
+int mangle_compute_areas(struct MangleMask* self, int all, int nthreads);
+
 int set_pixel_map(struct MangleMask* self);
 
+/*
+ * replace the pixel index with one keyed by HEALPix pixel, pixeltype 'h' for
+ * RING and 'n' for NESTED ordering.  Each polygon is listed in all pixels
+ * that overlap its bounding cap, so this can be used to speed up searches
+ * for any mask, pixelized or not.
+ *
+ * The pixeltype and pixelres of the mask, which describe the file, are not
+ * changed; the index scheme is held in the pixel_list_vec
+ */
+int mangle_build_healpix_index(struct MangleMask *self,
+                               int64 nside,
+                               char pixeltype);
+
+/*
+ * statistics of the pixel index, computed in one pass.  The pixels counted
+ * are all those at the resolution of the index, and any coarser pixels of
+ * the simple and SDSS schemes that list polygons
+ */
+struct MangleIndexStats {
+    char pixeltype;
+    int64 pixelres;
+
+    int64 npix;           // pixels counted
+    int64 nempty;         // pixels listing no polygons
+    int64 max;            // most polygons listed for a pixel
+    double mean;          // mean polygons listed per pixel
+    double mean_nonempty; // the same for pixels listing any
+
+    // hist->data[k] is the number of pixels listing k polygons; the size
+    // is max+1
+    struct i64stack* hist;
+
+    // up to ntop non-empty pixels listing the most polygons, most first,
+    // with the ra,dec of their centers in degrees
+    size_t ntop;
+    int64* top_pix;
+    int64* top_count;
+    long double* top_ra;
+    long double* top_dec;
+};
+
+/*
+ * fill stats for the current pixel index, with up to ntop of the fullest
+ * pixels.  Returns 0 if there is no index or on allocation failure.  Free
+ * with mangle_index_stats_free
+ */
+int mangle_index_stats(const struct MangleMask *self,
+                       size_t ntop,
+                       struct MangleIndexStats* stats);
+void mangle_index_stats_free(struct MangleIndexStats* stats);
+
+/*
+ * rebuild weight_list_vec, the index of polygons with positive weight.  This
+ * is done when the mask is read, the weights are changed or the pixel index
+ * is replaced
+ */
+int mangle_build_weight_index(struct MangleMask *self);
+
 
 
 /*
@@ -61,31 +187,379 @@ int set_pixel_map(struct MangleMask* self);
  *
  * this version does not use pixelization
  */
-int mangle_polyid_and_weight_nopix(struct MangleMask *self, 
-                                   struct Point *pt, 
+int mangle_polyid_and_weight_nopix(const struct MangleMask *self, 
+                                   const struct Point *pt, 
                                    int64 *poly_id,
                                    long double *weight);
 
 /*
- * check the point against a pixelized mask.  If found, will return the id and
- * weight.  These default to -1 and 0
+ * check the point against a pixelized mask, using the pixel index.  If found,
+ * will return the id and weight.  These default to -1 and 0
  */
 
-int mangle_polyid_and_weight_pix(struct MangleMask *self, 
-                                 struct Point *pt, 
+int mangle_polyid_and_weight_pix(const struct MangleMask *self, 
+                                 const struct Point *pt, 
                                  int64 *poly_id,
                                  long double *weight);
 
 
 /*
- * this chooses the right function based on pixeltype
+ * this chooses the right function based on whether there is a pixel index
  */
 
-int mangle_polyid_and_weight(struct MangleMask *self, 
-                             struct Point *pt, 
+int mangle_polyid_and_weight(const struct MangleMask *self, 
+                             const struct Point *pt, 
                              int64 *poly_id,
                              long double *weight);
 
+/*
+ * Reentrant queries
+ * -----------------
+ *
+ * Once read, and with the index and weights no longer being changed, a mask
+ * can be searched from many threads at once.  The search functions take a
+ * const mask and do not touch global state; each caller owns a
+ * MangleQueryState holding its options, cache, random number state and
+ * errors.  The search functions return 1 on success and 0 on failure, in
+ * which case state->status is set to one of the codes below and state->err
+ * holds a message.  With a NULL state, messages go to stderr.
+ *
+ * The MangleMask buff field is scratch space for reading only.
+ */
+
+enum mangle_status {
+    MANGLE_OK=0,
+    MANGLE_ERR_NOMEM=1,
+    MANGLE_ERR_PIXEL_SCHEME=2,
+};
+
+/*
+ * search statistics
+ * -----------------
+ *
+ * With stats enabled, the batch searches count their work.  Each call keeps
+ * counts in its query state and adds them to the mask when it finishes, so
+ * a mask can be searched from several threads with stats enabled.  The
+ * single point functions are not counted.  Disabled, the cost is a few
+ * pointer tests per point.
+ */
+struct MangleCounts {
+    int64 npoints;          // points searched
+    int64 pixel_lookups;    // polygon lists looked up in the pixel index
+    int64 last_hit_checks;  // checks of the last polygon hit
+    int64 polys_scanned;    // polygons tested against a point
+    int64 caps_tested;      // cap tests, is_in_cap evaluations
+    int64 hits;             // points found in the mask
+    int64 misses;           // points not found
+};
+
+struct MangleStats {
+    struct MangleCounts counts;
+
+    // points found in each pixel of the index, npix long.  NULL for masks
+    // without a pixel index
+    size_t npix;
+    int64* pixel_hits;
+};
+
+/*
+ * enable or disable the stats.  Enabling when already enabled leaves the
+ * counts as they are
+ */
+int mangle_stats_enable(struct MangleMask* self, int enable);
+
+/*
+ * zero the counts, sizing the pixel hits for the current index.  This is
+ * done when the index is rebuilt
+ */
+int mangle_stats_reset(struct MangleMask* self);
+
+/*
+ * per-caller state for the batch searches.
+ *
+ * With use_last_hit set, the polygon that held the previous point is checked
+ * before the pixel lookup, which is fast for points ordered by position.
+ * This is only used for balkanized masks; polygons in other masks can
+ * overlap, and the first one in the file must win.
+ *
+ * With use_min_weight set, points in polygons with weight <= min_weight are
+ * treated as outside the mask.  For balkanized masks these polygons are
+ * skipped before any geometry checks, using weight_list_vec when min_weight
+ * is not negative.
+ */
+struct MangleQueryState {
+    int use_last_hit;
+    int64 last_ipoly;
+
+    int use_min_weight;
+    long double min_weight;
+
+    // erand48 state for generating randoms, seeded by init
+    unsigned short rng[3];
+
+    // the stats of the mask being searched, if enabled, and the counts for
+    // the current call; set by the batch searches
+    struct MangleStats* stats;
+    struct MangleCounts counts;
+
+    // status of the last failed call, MANGLE_OK if none
+    int status;
+    char err[_MANGLE_LARGE_BUFFSIZE];
+};
+
+void mangle_query_state_init(struct MangleQueryState* self, int use_last_hit);
+void mangle_query_state_set_min_weight(struct MangleQueryState* self,
+                                       long double min_weight);
+
+/*
+ * check n ra,dec points, in degrees, against the mask, filling poly_id and
+ * weight.  Points are processed in blocks of MANGLE_BATCH_SIZE, with the
+ * pixel numbers for a block calculated together before the polygon search.
+ *
+ * Either of poly_id and weight can be NULL if not needed.  The state can be
+ * NULL.
+ */
+
+#define MANGLE_BATCH_SIZE 256
+
+int mangle_polyid_and_weight_many(const struct MangleMask *self,
+                                  struct MangleQueryState *state,
+                                  size_t n,
+                                  const long double *ra,
+                                  const long double *dec,
+                                  int64 *poly_id,
+                                  long double *weight);
+
+/*
+ * the same as mangle_polyid_and_weight_many, but the points are searched in
+ * order of pixel number, so the polygons for each pixel are checked against
+ * all of the pixel's points together.  This is faster for large, randomly
+ * ordered catalogs, at the cost of a pixel number and index for each point.
+ *
+ * Results are in the original order.  Masks without a pixel index are
+ * searched in the original order.
+ */
+int mangle_polyid_and_weight_sorted(const struct MangleMask *self,
+                                    struct MangleQueryState *state,
+                                    size_t n,
+                                    const long double *ra,
+                                    const long double *dec,
+                                    int64 *poly_id,
+                                    long double *weight);
+
+/*
+ * count the n points that are in the mask, without output per point.  If
+ * packed is not NULL, the bits for contained points are also set, in the
+ * order of numpy.packbits: point i is bit 7-i%8 of packed[i/8].  packed must
+ * hold (n+7)/8 bytes, and is zeroed first.
+ *
+ * With sort set, the points are searched in pixel order in chunks of
+ * MANGLE_SORT_CHUNK, so memory use does not grow with n.
+ */
+
+#define MANGLE_SORT_CHUNK 65536
+
+int mangle_contains_many(const struct MangleMask *self,
+                         struct MangleQueryState *state,
+                         int sort,
+                         size_t n,
+                         const long double *ra,
+                         const long double *dec,
+                         unsigned char *packed,
+                         size_t *ncontained);
+
+/*
+ * the masked area, in steradians, inside n caps or ra,dec boxes, all in
+ * degrees.  area gets the area of the mask in each region and weighted_area
+ * the sum of weight times area; either can be NULL.  The polygons that may
+ * overlap a region are found with the pixel index, and their overlap is
+ * computed exactly with polygon_calc_area.
+ *
+ * Overlapping polygons in masks that are not balkanized are each counted.
+ * With min_weight set in the state, polygons with weight <= min_weight are
+ * skipped.
+ *
+ * Boxes span ramin to ramax, wrapping through ra=0 when ramax < ramin, and
+ * cover all ra when ramax-ramin >= 360.  The regions are split over nthreads
+ * threads, <= 0 for the number of online cpus; the state is only read.
+ */
+int mangle_cap_areas(const struct MangleMask *self,
+                     struct MangleQueryState *state,
+                     int nthreads,
+                     size_t n,
+                     const long double *ra,
+                     const long double *dec,
+                     const long double *radius,
+                     long double *area,
+                     long double *weighted_area);
+
+int mangle_box_areas(const struct MangleMask *self,
+                     struct MangleQueryState *state,
+                     int nthreads,
+                     size_t n,
+                     const long double *ramin,
+                     const long double *ramax,
+                     const long double *decmin,
+                     const long double *decmax,
+                     long double *area,
+                     long double *weighted_area);
+
+/*
+ * the polygons sharing some area with each of n caps or ra,dec boxes, given
+ * as for mangle_cap_areas.  The polygons of region i are numbered by their
+ * place in poly_vec, in increasing order, in polys->data[offsets[i]] to
+ * polys->data[offsets[i+1]-1]; offsets must hold n+1 values and polys is
+ * resized to hold them all.
+ *
+ * The candidates from the pixel index are kept if they hold the center of
+ * the region, dropped if one of their caps is clear of the region, and
+ * otherwise kept if the area of their intersection with the region is
+ * positive.  min_weight and threads are as for mangle_cap_areas.
+ */
+int mangle_cap_polygons(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        int nthreads,
+                        size_t n,
+                        const long double *ra,
+                        const long double *dec,
+                        const long double *radius,
+                        int64 *offsets,
+                        struct i64stack *polys);
+
+int mangle_box_polygons(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        int nthreads,
+                        size_t n,
+                        const long double *ramin,
+                        const long double *ramax,
+                        const long double *decmin,
+                        const long double *decmax,
+                        int64 *offsets,
+                        struct i64stack *polys);
+
+/*
+ * the exact version of the quadrant check in the python module.  flags[i]
+ * has bit 0 set if point i, the center of a cap with the given radius, is
+ * in a polygon, and then bit q set if the masked fraction of quadrant q is
+ * below max_masked_fraction, with quadrants numbered as for
+ * genrand_cap_radec.  Points in polygons with weight <= 0 are masked.
+ *
+ * The unmasked area of each quadrant is the sum of its exact overlaps with
+ * the polygons from the pixel index, as for mangle_cap_areas, so overlapping
+ * polygons in masks that are not balkanized are each counted.  If
+ * frac_masked is not NULL it gets the four masked fractions for each cap,
+ * or 1 when the center is not in the mask.  The caps are split over
+ * nthreads threads, <= 0 for the number of online cpus.
+ */
+int mangle_check_quadrants(const struct MangleMask *self,
+                           struct MangleQueryState *state,
+                           int nthreads,
+                           size_t n,
+                           const long double *ra,
+                           const long double *dec,
+                           const long double *radius,
+                           double max_masked_fraction,
+                           int *flags,
+                           double *frac_masked);
+
+/*
+ * the Monte Carlo version of mangle_check_quadrants, with the same flags and
+ * masked fractions.  Each quadrant of a cap gets density*pi*radius^2/4
+ * random points, with density per square degree, uniform in area, and its
+ * masked fraction is the fraction not in a polygon with weight > 0.  Caps
+ * too small for one point have only the center bit.
+ *
+ * The random offsets from the center are drawn once from the seed, and
+ * rotated to each cap.  Each cap starts at its own point in them, and any
+ * more it needs are drawn from a stream seeded from the seed and the cap
+ * number, so the results depend only on the seed and not on nthreads.  A
+ * negative seed is taken from the time.
+ *
+ * With error_rate > 0, each quadrant stops drawing points once a sequential
+ * test decides, with at most that chance of being wrong, which side of
+ * max_masked_fraction its masked fraction is on.  Its fraction is then that
+ * of the points so far.  Quadrants far from the threshold, such as those
+ * fully in or out of the mask, need only a few blocks of points.  With
+ * error_rate <= 0 all points are used.
+ */
+int mangle_check_quadrants_random(const struct MangleMask *self,
+                                  struct MangleQueryState *state,
+                                  int nthreads,
+                                  size_t n,
+                                  const long double *ra,
+                                  const long double *dec,
+                                  const long double *radius,
+                                  double density,
+                                  double max_masked_fraction,
+                                  double error_rate,
+                                  long seed,
+                                  int *flags,
+                                  double *frac_masked);
+
+/*
+ * the angular distance in degrees from each of n points to the nearest
+ * boundary between the mask and masked sky, where the mask is the polygons
+ * with weight > min_weight if set in the state.  Distances of max_radius
+ * degrees or more are given as max_radius.
+ *
+ * The polygons near each point come from the pixel index and are pruned
+ * with their bounding caps.  The feet of the perpendiculars to their edges
+ * and their vertices are candidates for the nearest boundary point, and are
+ * checked nearest first for the mask on one side only; edges shared by two
+ * polygons of the mask are not boundaries.  The distance is exact when the
+ * ends of boundary arcs are polygon vertices, as in balkanized masks.
+ *
+ * The points are split over nthreads threads, <= 0 for the number of online
+ * cpus; the state is only read, except for errors.
+ */
+int mangle_boundary_distance(const struct MangleMask *self,
+                             struct MangleQueryState *state,
+                             int nthreads,
+                             size_t n,
+                             const long double *ra,
+                             const long double *dec,
+                             long double max_radius,
+                             long double *distance);
+
+/*
+ * fill map with the fraction of each pixel covered by the mask, weighted by
+ * the polygon weights if weighted is set.  The map is in the order of the
+ * scheme: 'h' for HEALPix RING and 'n' for NESTED at nside pixelres, which
+ * must be a power of 2, or 's' for simple pixels at level pixelres, numbered
+ * from zero within the level.  map must hold all pixels of the level.
+ *
+ * The pixel hierarchy is walked down from a coarse level.  Pixels clear of
+ * the polygons, or inside the polygon found first for their points, are
+ * filled directly along with all the output pixels they hold.  Output
+ * pixels on polygon edges are split into their four children, down to
+ * maxdepth levels, and the smallest pieces take the value at their centers,
+ * so the error is confined to the pieces crossed by an edge.  maxdepth is
+ * limited to MANGLE_COVERAGE_MAXDEPTH.  With min_weight set in the state,
+ * polygons with weight <= min_weight do not count.
+ *
+ * The coarse pixels are split over nthreads threads, <= 0 for the number of
+ * online cpus; the state is only read, except for errors.
+ */
+
+#define MANGLE_COVERAGE_MAXDEPTH 12
+#define MANGLE_COVERAGE_MAXLEVELS 64
+
+// check the scheme and resolution are supported by mangle_coverage_map,
+// setting the error in the state if not.  The map can then be sized with
+// pixel_level_range
+int mangle_coverage_check(struct MangleQueryState *state,
+                          char pixeltype,
+                          int64 pixelres);
+
+int mangle_coverage_map(const struct MangleMask *self,
+                        struct MangleQueryState *state,
+                        char pixeltype,
+                        int64 pixelres,
+                        int weighted,
+                        int maxdepth,
+                        int nthreads,
+                        double* map);
+
 /*
  * inline version
  *
@@ -94,7 +568,7 @@ int mangle_polyid_and_weight(struct MangleMask *self,
  */
 #define MANGLE_POLYID_AND_WEIGHT(self, pt, poly_id, weight) ({            \
     int ret=0;                                                            \
-    if ( (self)->pixeltype == 'u') {                                      \
+    if ( (self)->pixel_list_vec == NULL) {                                \
         ret=mangle_polyid_and_weight_nopix(self,pt,poly_id,weight);       \
     } else {                                                              \
         ret=mangle_polyid_and_weight_pix(self,pt,poly_id,weight);         \
@@ -102,4 +576,8 @@ int mangle_polyid_and_weight(struct MangleMask *self,
     ret;                                                                  \
 })
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -18,14 +18,27 @@ functions:
 
 from __future__ import print_function, absolute_import
 
+import numpy
 from numpy import array, longdouble
 from . import _mangle
+from . import stream
 
+# copy=False means "never copy" in numpy 2, and raises if a conversion is
+# needed; None gives the old behavior of copying only when required
+if numpy.lib.NumpyVersion(numpy.__version__) >= '2.0.0':
+    _COPY = None
+else:
+    _COPY = False
 
-def genrand_cap(nrand, ra, dec, angle_degrees, quadrant=-1):
+
+def genrand_cap(nrand, ra, dec, angle_degrees, quadrant=-1, dtype=None):
     """
     generate random points in a spherical cap
 
+    The points are uniform in area.  They are generated in double precision,
+    in blocks, by placing them about the pole and rotating them to the cap
+    center.
+
     parameters
     ----------
     nrand: scalar
@@ -40,13 +53,27 @@ def genrand_cap(nrand, ra, dec, angle_degrees, quadrant=-1):
         Quadrant in which to generate the points.  Set to
         1,2,3,4 to specify a quadrant, anything else to
         generate the full cap.  Default -1 (full cap)
+    dtype: numpy dtype, optional
+        Data type of the output, longdouble (the default) or float64.
+        float64 avoids the conversion and takes half the memory
 
     returns
     -------
     ra,dec: arrays
         the random points
     """
-    return _mangle.genrand_cap(nrand, ra, dec, angle_degrees, quadrant)
+    if dtype is None:
+        dtype = longdouble
+    dtype = numpy.dtype(dtype)
+    if dtype not in (numpy.dtype(longdouble), numpy.dtype(numpy.float64)):
+        raise ValueError(
+            'dtype should be longdouble or float64, got %s' % dtype
+        )
+
+    return _mangle.genrand_cap(
+        nrand, ra, dec, angle_degrees, quadrant,
+        int(dtype == numpy.float64),
+    )
 
 
 class Mangle(_mangle.Mangle):
@@ -76,7 +103,7 @@ class Mangle(_mangle.Mangle):
 
         super(Mangle, self).read_weights(weightfile)
 
-    def polyid_and_weight(self, ra, dec):
+    def polyid_and_weight(self, ra, dec, sort=False, cache=False):
         """
         Check points against mask, returning (poly_id,weight).
 
@@ -86,16 +113,29 @@ class Mangle(_mangle.Mangle):
             Right ascension in degrees.  Can be an array.
         dec: scalar or array
             Declination in degrees.  Can be an array.
+        sort: bool, optional
+            If True, search the points in order of pixel number, so the
+            polygons in each pixel are checked against all of its points
+            together.  This is faster for large, randomly ordered arrays
+            but needs extra memory for each point.  Default False.
+        cache: bool, optional
+            If True, check the polygon that held the previous point before
+            searching the pixel.  This is faster for points ordered by
+            position, for example tile by tile.  It is only used for
+            balkanized masks, where polygons do not overlap, so results are
+            unchanged.  Default False.
 
         output
         ------
         polyd,weight tuple of arrays
         """
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False, order='C')
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False, order='C')
-        return super(Mangle, self).polyid_and_weight(ra, dec)
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        return super(Mangle, self).polyid_and_weight(
+            ra, dec, int(sort), int(cache),
+        )
 
-    def polyid(self, ra, dec):
+    def polyid(self, ra, dec, sort=False, cache=False):
         """
         Check points against mask, returning the polygon id or -1.
 
@@ -105,16 +145,24 @@ class Mangle(_mangle.Mangle):
             Right ascension in degrees.  Can be an array.
         dec: scalar or array
             Declination in degrees.  Can be an array.
+        sort: bool, optional
+            If True, search the points in order of pixel number.  See
+            polyid_and_weight.  Default False.
+        cache: bool, optional
+            If True, check the polygon that held the previous point first.
+            See polyid_and_weight.  Default False.
 
         output
         ------
         Array of poly ids
         """
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False, order='C')
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False, order='C')
-        return super(Mangle, self).polyid(ra, dec)
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        return super(Mangle, self).polyid(
+            ra, dec, int(sort), int(cache),
+        )
 
-    def weight(self, ra, dec):
+    def weight(self, ra, dec, sort=False, cache=False):
         """
         Check points against mask, returning the weight or 0.
 
@@ -124,16 +172,25 @@ class Mangle(_mangle.Mangle):
             Right ascension in degrees.  Can be an array.
         dec: scalar or array
             Declination in degrees.  Can be an array.
+        sort: bool, optional
+            If True, search the points in order of pixel number.  See
+            polyid_and_weight.  Default False.
+        cache: bool, optional
+            If True, check the polygon that held the previous point first.
+            See polyid_and_weight.  Default False.
 
         output
         ------
         Array of weights
         """
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False, order='C')
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False, order='C')
-        return super(Mangle, self).weight(ra, dec)
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        return super(Mangle, self).weight(
+            ra, dec, int(sort), int(cache),
+        )
 
-    def contains(self, ra, dec):
+    def contains(self, ra, dec, sort=False, cache=False, min_weight=None,
+                 packed=False):
         """
         Check points against mask, returning 1 if contained 0 if not
 
@@ -143,30 +200,154 @@ class Mangle(_mangle.Mangle):
             Right ascension in degrees.  Can be an array.
         dec: scalar or array
             Declination in degrees.  Can be an array.
+        sort: bool, optional
+            If True, search the points in order of pixel number.  See
+            polyid_and_weight.  Default False.
+        cache: bool, optional
+            If True, check the polygon that held the previous point first.
+            See polyid_and_weight.  Default False.
+        min_weight: scalar, optional
+            If sent, points in polygons with weight <= min_weight are not
+            contained.  For balkanized masks these polygons are skipped
+            before any geometry checks.  Use min_weight=0 to treat zero
+            weight polygons as masked.  Default None.
+        packed: bool, optional
+            If True, return the results packed 8 to a byte, in the order of
+            numpy.packbits, so numpy.unpackbits(res, count=ra.size) gives
+            the unpacked results.  Default False.
 
         output
         ------
-        Array of zeros or ones
+        Array of zeros or ones, or a uint8 array of (n+7)//8 bytes if packed
         """
         # we specify order to force contiguous
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False, order='C')
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False, order='C')
-        return super(Mangle, self).contains(ra, dec)
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        if packed:
+            _, bits = super(Mangle, self).contains_packed(
+                ra, dec, int(sort), int(cache), min_weight,
+            )
+            return bits
+
+        return super(Mangle, self).contains(
+            ra, dec, int(sort), int(cache), min_weight,
+        )
+
+    def count_contained(self, ra, dec, sort=False, cache=False,
+                        min_weight=None):
+        """
+        Count the points contained in the mask
+
+        This is the same as contains(ra, dec).sum(), without making the array
+        of results.  The parameters are the same as for contains.
+
+        output
+        ------
+        The number of points contained
+        """
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        return super(Mangle, self).count_contained(
+            ra, dec, int(sort), int(cache), min_weight,
+        )
+
+    def query_chunks(self, chunks, what='polyid', sort=False, cache=False,
+                     min_weight=None):
+        """
+        Query an iterable of (ra, dec) chunks, for catalogs too large to
+        hold in memory.  The next chunk is read while the current one is
+        searched
+
+        parameters
+        ----------
+        chunks: iterable
+            Yields (ra, dec) pairs of arrays, for example from
+            pymangle.stream.read_chunks
+        what: str, optional
+            'polyid', 'weight', 'polyid_and_weight', 'contains' or
+            'count_contained'.  Default 'polyid'
+        sort, cache, min_weight:
+            As for contains; min_weight applies to contains and
+            count_contained only
+
+        output
+        ------
+        Yields the result for each chunk, in order
+        """
+        return stream.query_chunks(
+            self, chunks, what=what, sort=sort, cache=cache,
+            min_weight=min_weight,
+        )
+
+    def query_files(self, ra_file, dec_file,
+                    polyid=None, weight=None, contains=None,
+                    chunksize=stream.DEFAULT_CHUNKSIZE, dtype='f8',
+                    sort=False, cache=False, min_weight=None):
+        """
+        Query ra, dec read from files, writing the results to files, with
+        memory use that does not depend on the number of points
+
+        parameters
+        ----------
+        ra_file, dec_file: str
+            Files holding ra and dec in degrees.  Files ending in .npy are
+            read with numpy.load, others as raw binary of the given dtype
+        polyid, weight, contains: str, optional
+            Files for the results.  Files ending in .npy are written in that
+            format, others as raw binary.  polyid is written as int64,
+            weight as float64 and contains as one byte per point
+        chunksize: int, optional
+            Number of points to search at a time, default 2**20
+        dtype: numpy dtype, optional
+            Data type of raw binary input files, default 'f8'
+        sort, cache, min_weight:
+            As for contains; min_weight applies to contains only
+
+        output
+        ------
+        The number of points processed
+        """
+        return stream.query_files(
+            self, ra_file, dec_file,
+            polyid=polyid, weight=weight, contains=contains,
+            chunksize=chunksize, dtype=dtype,
+            sort=sort, cache=cache, min_weight=min_weight,
+        )
 
     def check_quadrants(self,
                         ra,
                         dec,
                         angle_degrees,
                         density=10.0*60.0**2,
-                        max_masked_fraction=0.05):
+                        max_masked_fraction=0.05,
+                        exact=False,
+                        nthreads=None,
+                        seed=None,
+                        error_rate=0.0):
         """
         Check points quadrants of the spherical cap against the mask
-        using random points
+        using random points, or exactly
 
         If more than a certain fraction of the random points is masked, the
         quadrant is considered masked.  The sensitivity can be adjusted
         by using a higher density of random points.
 
+        The random offsets from the center are drawn once and rotated to
+        each cap, which starts at its own point in them, and the caps are
+        split over threads.  The results depend only on the seed.
+
+        With error_rate > 0 each quadrant stops early once a sequential test
+        shows which side of max_masked_fraction it is on, with at most that
+        chance of being wrong.  Quadrants well inside or outside the mask
+        then need only a small part of the points.
+
+        With exact=True the masked fraction of each quadrant is instead
+        computed exactly from the polygon areas inside it, as in area_in_cap,
+        with the caps split over threads.  This is much faster than the
+        random points for all but the smallest caps and has no sampling
+        noise.  In masks that are not balkanized overlapping polygons are
+        each counted.
+
         parameters
         ----------
         ra: scalar or array
@@ -183,6 +364,16 @@ class Mangle(_mangle.Mangle):
         max_masked_fraction: scalar
             If more than this fraction of random points in the
             quadrant are masked, the quadrant is considered bad
+        exact: bool, optional
+            Compute the masked fractions exactly, ignoring density.
+            Default False
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+        seed: int, optional
+            Seed for the random points, default from the time
+        error_rate: float, optional
+            Chance of a wrong flag allowed for each quadrant stopped early,
+            e.g. 0.01.  Default 0, using all the points
 
         output
         ------
@@ -194,19 +385,23 @@ class Mangle(_mangle.Mangle):
             2**4 is set if fourth quadrant is OK
         """
         # we specify order to force contiguous
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False, order='C')
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False, order='C')
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY, order='C')
         angle_degrees = array(
-            angle_degrees, ndmin=1, dtype=longdouble, copy=False, order='C'
+            angle_degrees, ndmin=1, dtype=longdouble, copy=_COPY, order='C'
         )
         return super(Mangle, self).check_quadrants(
             ra, dec, angle_degrees,
             density, max_masked_fraction,
+            int(exact), _nthreads(nthreads),
+            -1 if seed is None else int(seed),
+            float(error_rate),
         )
 
     def calc_simplepix(self, ra, dec):
         """
-        Calculate simple pixel numbers for list of ra, dec
+        Calculate simple pixel numbers for list of ra, dec, at the
+        resolution of the mask.  The mask must use the simple 's' scheme
 
         parameters
         ----------
@@ -217,12 +412,371 @@ class Mangle(_mangle.Mangle):
 
         output
         ------
-        Array of zeros or ones
+        Array of pixel numbers
         """
-        ra = array(ra, ndmin=1, dtype=longdouble, copy=False)
-        dec = array(dec, ndmin=1, dtype=longdouble, copy=False)
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY)
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY)
         return super(Mangle, self).calc_simplepix(ra, dec)
 
+    def calc_healpix(self, ra, dec):
+        """
+        Calculate HEALPix pixel numbers for list of ra, dec, using the nside
+        and ordering of the mask's HEALPix index
+
+        parameters
+        ----------
+        ra: scalar or array
+            Right ascension in degrees.  Can be an array.
+        dec: scalar or array
+            Declination in degrees.  Can be an array.
+
+        output
+        ------
+        Array of pixel numbers
+        """
+        ra = array(ra, ndmin=1, dtype=longdouble, copy=_COPY)
+        dec = array(dec, ndmin=1, dtype=longdouble, copy=_COPY)
+        return super(Mangle, self).calc_healpix(ra, dec)
+
+    def build_healpix_index(self, nside, nest=True):
+        """
+        Replace the pixel index with one keyed by HEALPix pixel
+
+        Each polygon is listed in every pixel that overlaps its bounding cap,
+        so this speeds up searches for unpixelized masks as well.  The same
+        pixel numbers can be calculated for a catalog with calc_healpix.
+
+        The index holds one list per pixel, so memory usage grows as
+        12*nside**2
+
+        parameters
+        ----------
+        nside: int
+            The HEALPix resolution parameter
+        nest: bool, optional
+            If True use NESTED ordering, otherwise RING.  Default True
+        """
+        if nest:
+            nest = 1
+        else:
+            nest = 0
+
+        super(Mangle, self).build_healpix_index(nside, nest)
+
+    def compute_areas(self, all=True, nthreads=None):
+        """
+        Compute the polygon areas exactly from their caps
+
+        Areas missing from the file, or not positive there, are computed
+        when it is read; this replaces the areas from the file as well, and
+        updates the total area.
+        The new areas are available from get_areas()
+
+        parameters
+        ----------
+        all: bool, optional
+            If True compute the areas of all polygons, otherwise only those
+            without a positive area in the file.  Default True
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+        """
+        if nthreads is None:
+            nthreads = 0
+        super(Mangle, self).compute_areas(int(all), int(nthreads))
+
+    def area_in_cap(self, ra, dec, radius, weighted=False, min_weight=None,
+                    nthreads=None):
+        """
+        Get the masked area inside caps
+
+        The polygons that may overlap each cap are found with the pixel
+        index, and the overlap is computed exactly from the caps.  Polygons
+        that overlap each other, in masks that are not balkanized, are each
+        counted.
+
+        parameters
+        ----------
+        ra, dec: scalars or arrays
+            Centers of the caps in degrees
+        radius: scalar or array
+            Opening angles of the caps in degrees.  The inputs are broadcast
+            against each other
+        weighted: bool, optional
+            If True also return the sum of weight times area
+        min_weight: float, optional
+            Only count polygons with weight > min_weight
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+
+        output
+        ------
+        area, or (area, weighted_area) if weighted is set, in square degrees
+        """
+        args = _region_arrays(ra, dec, radius)
+        res = super(Mangle, self).cap_areas(
+            *args, min_weight, _nthreads(nthreads)
+        )
+        return _region_result(res, weighted)
+
+    def area_in_box(self, ramin, ramax, decmin, decmax, weighted=False,
+                    min_weight=None, nthreads=None):
+        """
+        Get the masked area inside ra,dec boxes
+
+        The same as area_in_cap, for boxes bounded by lines of constant ra
+        and dec.  A box with ramax < ramin wraps through ra=0, and one with
+        ramax-ramin >= 360 covers all ra.
+
+        parameters
+        ----------
+        ramin, ramax, decmin, decmax: scalars or arrays
+            Limits of the boxes in degrees, broadcast against each other
+        weighted, min_weight, nthreads:
+            As for area_in_cap
+
+        output
+        ------
+        area, or (area, weighted_area) if weighted is set, in square degrees
+        """
+        args = _region_arrays(ramin, ramax, decmin, decmax)
+        res = super(Mangle, self).box_areas(
+            *args, min_weight, _nthreads(nthreads)
+        )
+        return _region_result(res, weighted)
+
+    def polygons_in_cap(self, ra, dec, radius, min_weight=None,
+                        nthreads=None):
+        """
+        Find the polygons overlapping caps
+
+        The polygons that may overlap each cap are found with the pixel
+        index, and only those sharing some area with the cap are kept.
+
+        parameters
+        ----------
+        ra, dec: scalars or arrays
+            Centers of the caps in degrees
+        radius: scalar or array
+            Opening angles of the caps in degrees.  The inputs are broadcast
+            against each other
+        min_weight: float, optional
+            Only include polygons with weight > min_weight
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+
+        output
+        ------
+        (polys, offsets): the polygons overlapping cap i are
+        polys[offsets[i]:offsets[i+1]], in increasing order, numbered by
+        their position in the mask as for get_areas()
+        """
+        args = _region_arrays(ra, dec, radius)
+        return super(Mangle, self).cap_polygons(
+            *args, min_weight, _nthreads(nthreads)
+        )
+
+    def polygons_in_box(self, ramin, ramax, decmin, decmax, min_weight=None,
+                        nthreads=None):
+        """
+        Find the polygons overlapping ra,dec boxes
+
+        The same as polygons_in_cap, for boxes as in area_in_box
+
+        parameters
+        ----------
+        ramin, ramax, decmin, decmax: scalars or arrays
+            Limits of the boxes in degrees, broadcast against each other
+        min_weight, nthreads:
+            As for polygons_in_cap
+
+        output
+        ------
+        (polys, offsets): the polygons overlapping box i are
+        polys[offsets[i]:offsets[i+1]]
+        """
+        args = _region_arrays(ramin, ramax, decmin, decmax)
+        return super(Mangle, self).box_polygons(
+            *args, min_weight, _nthreads(nthreads)
+        )
+
+    def boundary_distance(self, ra, dec, max_radius, min_weight=None,
+                          nthreads=None):
+        """
+        Get the angular distance from points to the nearest mask boundary
+
+        The boundary is between the mask and masked sky, whether the point
+        is in the mask or not; edges shared by two polygons of the mask are
+        not boundaries.  Candidates for the nearest boundary point are taken
+        from the edges and vertices of the polygons near each point, so the
+        distance is exact for balkanized masks.
+
+        parameters
+        ----------
+        ra, dec: scalars or arrays
+            Positions in degrees
+        max_radius: float
+            The largest distance of interest in degrees.  Points with no
+            boundary within max_radius get max_radius.  Smaller values are
+            faster
+        min_weight: float, optional
+            Only count polygons with weight > min_weight as the mask
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+
+        output
+        ------
+        distance: array
+            The distances in degrees
+        """
+        ra, dec = _region_arrays(ra, dec)
+        return super(Mangle, self).boundary_distance(
+            ra, dec, float(max_radius), min_weight, _nthreads(nthreads),
+        )
+
+    def coverage_map(self, nside, scheme='ring', weighted=True, depth=5,
+                     min_weight=None, nthreads=None):
+        """
+        Get the fraction of each pixel of a map covered by the mask
+
+        Pixels clear of the mask or inside a polygon are filled directly.
+        Pixels on polygon edges are split into four, recursively, down to
+        depth levels, and the smallest pieces take the value at their
+        centers, so boundary pixels are accurate to about 4**-depth of the
+        pixel area times the number of pieces on edges.
+
+        parameters
+        ----------
+        nside: int
+            The HEALPix nside, a power of 2, or for the simple scheme the
+            resolution as in the pixelization of mask files, e.g. 9 for 9s
+        scheme: str, optional
+            'ring' or 'nest' for HEALPix, or 'simple'.  Default 'ring'.  Maps
+            for the simple scheme are ordered by pixel number less that of
+            the first pixel at the resolution
+        weighted: bool, optional
+            If True the fraction is weighted by the polygon weights, otherwise
+            it is the unmasked fraction.  Default True
+        depth: int, optional
+            Maximum levels of subdivision of boundary pixels, default 5
+        min_weight: float, optional
+            Only count polygons with weight > min_weight
+        nthreads: int, optional
+            Number of threads to use, default the number of cpus
+
+        output
+        ------
+        map: array
+            The covered fraction of each pixel, float64
+        """
+        pixeltypes = {'ring': 'h', 'nest': 'n', 'simple': 's'}
+        if scheme not in pixeltypes:
+            raise ValueError(
+                "scheme should be one of %s, got '%s'" % (
+                    list(pixeltypes), scheme,
+                )
+            )
+        return super(Mangle, self).coverage_map(
+            int(nside), pixeltypes[scheme], int(weighted), int(depth),
+            min_weight, _nthreads(nthreads),
+        )
+
+    def pixel_stats(self, ntop=10):
+        """
+        Get the distribution of polygons per pixel of the index
+
+        Every point in a pixel is checked against the polygons listed for
+        it, so pixels listing many polygons are slow to search; a finer
+        pixelization or HEALPix index may help.  The pixels counted are all
+        those at the resolution of the index, computed in one pass.
+
+        parameters
+        ----------
+        ntop: int, optional
+            Number of the fullest pixels to return.  Default 10
+
+        returns
+        -------
+        stats: dict
+            pixeltype, pixelres: the scheme of the index
+            npix: number of pixels counted
+            nempty: number listing no polygons
+            max: most polygons listed for a pixel
+            mean: mean polygons listed per pixel
+            mean_nonempty: the same for pixels listing any polygons
+            hist: array, hist[k] is the number of pixels listing k polygons
+            top_pixels, top_counts: the fullest pixels and their counts,
+                fullest first
+            top_ra, top_dec: the centers of those pixels in degrees
+        """
+        return super(Mangle, self).get_pixel_stats(int(ntop))
+
+    def load_report(self):
+        """
+        Get the time and memory used to read the mask, and the memory held now
+
+        returns
+        -------
+        report: dict
+            phases: dict
+                For each phase of the read, in order header, polygons, area,
+                pixel_map and weight_index, a dict with the wall time in
+                'seconds' and the bytes allocated in 'nbytes'.  The area
+                phase only fills in the polygons and has no 'nbytes'
+            seconds: float
+                The total time for the read
+            memory: dict
+                Bytes held by the mask, polygons, caps, pixel_index,
+                weight_index and stats, and the total.  The index entries
+                change when a HEALPix index is built
+        """
+        report = super(Mangle, self).get_load_report()
+        report['seconds'] = sum(
+            phase['seconds'] for phase in report['phases'].values()
+        )
+        return report
+
+    def enable_stats(self, enable=True):
+        """
+        Enable or disable counting the work done in searches
+
+        With stats enabled, calls to polyid_and_weight, polyid, weight and
+        contains count the pixel lookups, polygons and caps tested, and the
+        hits per pixel of the index; see stats().  Enabling when already
+        enabled keeps the counts.
+
+        parameters
+        ----------
+        enable: bool, optional
+            Default True
+        """
+        super(Mangle, self).set_stats(int(bool(enable)))
+
+    def stats(self):
+        """
+        Get the search counts collected since stats were enabled or reset
+
+        returns
+        -------
+        stats: dict or None
+            None if stats are not enabled, otherwise a dict with entries
+
+            npoints: points searched
+            pixel_lookups: polygon lists looked up in the pixel index
+            last_hit_checks: checks of the last polygon hit, with cache=True
+            polys_scanned: polygons tested against a point
+            caps_tested: caps tested, each is one is_in_cap evaluation
+            hits, misses: points found and not found in the mask
+            polys_per_point, caps_per_point: the averages per point
+            pixel_hits: array of the points found in each pixel of the
+                index, empty for masks without an index
+        """
+        stats = super(Mangle, self).get_stats()
+        if stats is not None:
+            npoints = max(stats['npoints'], 1)
+            stats['polys_per_point'] = stats['polys_scanned']/npoints
+            stats['caps_per_point'] = stats['caps_tested']/npoints
+        return stats
+
     def _set_weights(self, weights):
         # check length of array...
         npoly = _mangle.Mangle.get_npoly(self)
@@ -232,7 +786,7 @@ class Mangle(_mangle.Mangle):
             )
 
         # make long doubles
-        weights = array(weights, ndmin=1, dtype=longdouble, copy=False)
+        weights = array(weights, ndmin=1, dtype=longdouble, copy=_COPY)
 
         super(Mangle, self).set_weights(weights)
 
@@ -255,6 +809,15 @@ class Mangle(_mangle.Mangle):
         _mangle.Mangle.get_pixelres,
         doc="The pixel resolution, -1 if unpixelized",
     )
+    index_pixeltype = property(
+        _mangle.Mangle.get_index_pixeltype,
+        doc=("The pixel type of the index, 'u' if none, 'h' or 'n' for "
+             "HEALPix RING or NESTED")
+    )
+    index_pixelres = property(
+        _mangle.Mangle.get_index_pixelres,
+        doc="The resolution of the index (nside for HEALPix), -1 if none",
+    )
     maxpix = property(
         _mangle.Mangle.get_pixelres, doc="The maximum pixel value"
     )
@@ -271,6 +834,36 @@ class Mangle(_mangle.Mangle):
     )
 
 
+_STR2DEG2 = (180.0/numpy.pi)**2
+
+
+def _nthreads(nthreads):
+    if nthreads is None:
+        return 0
+    return int(nthreads)
+
+
+def _region_arrays(*args):
+    """
+    broadcast the region parameters to contiguous long double arrays
+    """
+    args = numpy.broadcast_arrays(
+        *[array(a, ndmin=1, dtype=longdouble) for a in args]
+    )
+    return [
+        numpy.ascontiguousarray(a, dtype=longdouble).ravel() for a in args
+    ]
+
+
+def _region_result(res, weighted):
+    area, weighted_area = res
+    area *= _STR2DEG2
+    if weighted:
+        weighted_area *= _STR2DEG2
+        return area, weighted_area
+    return area
+
+
 class Cap(_mangle.Cap):
     """
     Class to represent a mangle Cap
@@ -299,7 +892,7 @@ class Cap(_mangle.Cap):
         data: array or sequence
             An length 4 array of 128 bit floats, or convertable to that.
         """
-        data = array(data, ndmin=1, dtype=longdouble, copy=False)
+        data = array(data, ndmin=1, dtype=longdouble, copy=_COPY)
         if data.size != 4:
             raise ValueError(
                 "capdata must be an array of length 4, got %d" % data.size
@@ -414,7 +1007,7 @@ class Polygon(_mangle.Polygon):
             raise ValueError("cap_vec must be of "
                              "type CapVec, got %s" % type(cap_vec))
 
-        wtarr = array(weight, ndmin=1, dtype=longdouble, copy=False)
+        wtarr = array(weight, ndmin=1, dtype=longdouble, copy=_COPY)
 
         super(Polygon, self).__init__(
             poly_id,
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "parallel.h"
+
+struct ParallelLoop {
+    size_t n;
+    size_t chunk;
+    size_t next;
+    mangle_range_func func;
+    void* ctx;
+};
+
+static void* parallel_worker(void* arg)
+{
+    struct ParallelLoop* loop=arg;
+    size_t begin=0, end=0;
+
+    while (1) {
+        begin = __atomic_fetch_add(&loop->next, loop->chunk, __ATOMIC_RELAXED);
+        if (begin >= loop->n) {
+            break;
+        }
+        end = begin + loop->chunk;
+        if (end > loop->n) {
+            end = loop->n;
+        }
+        loop->func(loop->ctx, begin, end);
+    }
+    return NULL;
+}
+
+int mangle_default_nthreads(void)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return ncpu > 0 ? (int) ncpu : 1;
+}
+
+void mangle_parallel_for(size_t n,
+                         int nthreads,
+                         size_t min_chunk,
+                         mangle_range_func func,
+                         void* ctx)
+{
+    struct ParallelLoop loop;
+    pthread_t* threads=NULL;
+    size_t nchunk=0;
+    int i=0, nstarted=0;
+
+    if (n == 0) {
+        return;
+    }
+    if (nthreads <= 0) {
+        nthreads = mangle_default_nthreads();
+    }
+    if (min_chunk < 1) {
+        min_chunk = 1;
+    }
+
+    // several chunks per thread to balance uneven work
+    loop.n = n;
+    loop.chunk = n/(8*(size_t) nthreads);
+    if (loop.chunk < min_chunk) {
+        loop.chunk = min_chunk;
+    }
+    loop.next = 0;
+    loop.func = func;
+    loop.ctx = ctx;
+
+    nchunk = (n + loop.chunk - 1)/loop.chunk;
+    if ((size_t) nthreads > nchunk) {
+        nthreads = (int) nchunk;
+    }
+
+    if (nthreads > 1) {
+        threads = calloc(nthreads-1, sizeof(pthread_t));
+    }
+    if (threads) {
+        for (i=0; i<nthreads-1; i++) {
+            if (pthread_create(&threads[i], NULL, parallel_worker, &loop) != 0) {
+                break;
+            }
+            nstarted++;
+        }
+    }
+
+    parallel_worker(&loop);
+
+    for (i=0; i<nstarted; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
@@ -0,0 +1,37 @@
+#ifndef _MANGLE_PARALLEL_H
+#define _MANGLE_PARALLEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A minimal parallel loop over pthreads, for work split across polygons,
+ * regions or pixels.  The range [0, n) is handed out in chunks of at least
+ * min_chunk items, to nthreads threads including the calling one; nthreads
+ * <= 0 means the number of online cpus.
+ *
+ * func is called as func(ctx, begin, end) for each chunk, and must be safe
+ * to call from several threads at once.  If threads can not be started the
+ * calling thread does the remaining work, so the whole range is always
+ * processed.
+ */
+
+typedef void (*mangle_range_func)(void* ctx, size_t begin, size_t end);
+
+void mangle_parallel_for(size_t n,
+                         int nthreads,
+                         size_t min_chunk,
+                         mangle_range_func func,
+                         void* ctx);
+
+// the number of threads used for nthreads <= 0
+int mangle_default_nthreads(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -55,11 +55,27 @@ PixelListVec_free(struct PixelListVec* self)
         }
 
         free(self);
+        self=NULL;
     }
 
     return self;
 }
 
+size_t PixelListVec_nbytes(const struct PixelListVec* self)
+{
+    size_t i=0, nbytes=0;
+
+    if (self == NULL) {
+        return 0;
+    }
+
+    nbytes = sizeof(struct PixelListVec) + self->size*sizeof(struct i64stack*);
+    for (i=0; i<self->size; i++) {
+        nbytes += i64stack_nbytes(self->data[i]);
+    }
+    return nbytes;
+}
+
 
 
 
@@ -70,13 +86,17 @@ int pixel_parse_scheme(char buff[_MANGLE_SMALL_BUFFSIZE],
     char* ptr=NULL;
     ssize_t res_bytes=0;
 
-    ptr = strchr(buff, 's');
-    if (ptr == NULL) {
+    // the scheme is the first character after the numerical prefactor
+    ptr = buff;
+    while (*ptr == '-' || (*ptr >= '0' && *ptr <= '9')) {
+        ptr++;
+    }
+    if (*ptr != 's' && *ptr != 'd' && *ptr != 'h' && *ptr != 'n') {
         status=0;
-        wlog("Only support pix scheme s, got: '%s'", buff);
+        wlog("Only support pix schemes s, d, h, n, got: '%s'", buff);
         goto _get_pix_scheme_errout;
     }
-    *pixeltype = 's';
+    *pixeltype = *ptr;
 
     // extract the numerical prefactor, which is the resolution
     res_bytes = (ptr-buff);
@@ -96,14 +116,44 @@ int pixel_parse_scheme(char buff[_MANGLE_SMALL_BUFFSIZE],
     // negative resolution is equivalent to 'u' or unpixelized
     if (*res < 0) {
         *pixeltype='u';
+    } else if (*pixeltype == 'h' || *pixeltype == 'n') {
+        if (!healpix_check_nside(*res, *pixeltype)) {
+            status=0;
+            wlog("HEALPix nside must be in [1,2^29], and a power of 2 for "
+                 "nested ordering, got: '%s'", buff);
+            goto _get_pix_scheme_errout;
+        }
     }
 
 _get_pix_scheme_errout:
     return status;
 }
 
+int64 get_pixel(char pixeltype, int64 pixelres, const struct Point* pt)
+{
+    int64 pix=-1;
+
+    switch (pixeltype) {
+        case 's':
+            pix = get_pixel_simple(pixelres, pt);
+            break;
+        case 'd':
+            pix = get_pixel_sdss(pixelres, pt);
+            break;
+        case 'h':
+            pix = get_pixel_healpix_ring(pixelres, pt);
+            break;
+        case 'n':
+            pix = get_pixel_healpix_nest(pixelres, pt);
+            break;
+        default:
+            break;
+    }
+    return pix;
+}
+
 int64
-get_pixel_simple(int64 pixelres, struct Point* pt)
+get_pixel_simple(int64 pixelres, const struct Point* pt)
 {
     int64 pix=0;
 
@@ -119,11 +169,887 @@ get_pixel_simple(int64 pixelres, struct Point* pt)
       cth = cosl(pt->theta);
       n   = (cth==1.0) ? 0: (int64) ( ceill( (1.0-cth)/2 * p2 )-1 );
       m   = (int64) ( floorl( (pt->phi/2./M_PI)*p2 ) );
+      m   = ((m % p2) + p2) % p2; // ra outside [0,360)
       pix = p2*n+m + ps;
 
     }
     return pix;
 }
+void simplepix_init(struct SimplePixel* self, int64 pixelres)
+{
+    int64 i=0;
+
+    self->pixelres = pixelres;
+    self->p2 = 1;
+    self->ps = 0;
+    for (i=0; i<pixelres; i++) { // Work out # pixels/dim and start pix.
+        self->p2 = self->p2<<1;
+        self->ps += (self->p2/2)*(self->p2/2);
+    }
+    self->zfac = 0.5*self->p2;
+    self->phifac = self->p2/(2*M_PI);
+}
+
+void get_pixel_simple_many(const struct SimplePixel* self,
+                           size_t n,
+                           const double* restrict z,
+                           const double* restrict phi,
+                           int64* restrict pix)
+{
+    size_t i=0;
+    int64 p2=self->p2, ps=self->ps;
+    double zfac=self->zfac, phifac=self->phifac, nrow=0, mcol=0;
+
+    if (self->pixelres <= 0) {
+        for (i=0; i<n; i++) {
+            pix[i] = 0;
+        }
+        return;
+    }
+
+    for (i=0; i<n; i++) {
+        // the row is -1 only for z == 1, which belongs in the first row
+        nrow = fmax(ceil( (1.0-z[i])*zfac ) - 1.0, 0.0);
+        mcol = floor( phi[i]*phifac );
+        mcol -= p2*floor( mcol/p2 ); // ra outside [0,360)
+        pix[i] = p2*(int64) nrow + (int64) mcol + ps;
+    }
+}
+
+
+/*
+   The SDSS pixelization, in survey coordinates lambda,eta.  At resolution
+   level res the sky is divided into SDSS_PIX_NX0*r by SDSS_PIX_NY0*r pixels,
+   with r=2^(res-1), equal area stripes in lambda and equal width in eta.
 
+   As for the simple scheme, pixel numbers for each level start after those of
+   all coarser levels, with level 0 being the whole sky
+*/
 
+#define SDSS_PIX_NX0 36
+#define SDSS_PIX_NY0 13
+#define SDSS_SURVEY_CENTER_RA 185.0L
+#define SDSS_SURVEY_CENTER_DEC 32.5L
+#define SDSS_ETA_OFFSET 91.25L
 
+// the survey great circles cross the equator 90 degrees before the center
+#define SDSS_NODE_RA (SDSS_SURVEY_CENTER_RA - 90.0L)
+
+int64
+get_pixel_sdss(int64 pixelres, const struct Point* pt)
+{
+    int64 pix=0;
+
+    int64 i=0, r=1, ps=1;
+    int64 nx=0, ny=0, ix=0, iy=0;
+    long double ra=0, dec=0, x=0, y=0, z=0, lambda=0, eta=0;
+
+    if (pixelres > 0) {
+        for (i=1; i<pixelres; i++) { // Work out resolution and start pix.
+            ps += SDSS_PIX_NX0*SDSS_PIX_NY0*r*r;
+            r = r<<1;
+        }
+        nx = SDSS_PIX_NX0*r;
+        ny = SDSS_PIX_NY0*r;
+
+        // survey coordinates in degrees
+        radec_from_point(pt, &ra, &dec);
+        x = cosl((ra-SDSS_NODE_RA)*D2R)*cosl(dec*D2R);
+        y = sinl((ra-SDSS_NODE_RA)*D2R)*cosl(dec*D2R);
+        z = sinl(dec*D2R);
+
+        lambda = -asinl(x)*R2D;
+        eta = atan2l(z, y)*R2D - SDSS_SURVEY_CENTER_DEC;
+
+        // eta is offset so the stripes are centered on the survey
+        eta = (eta - SDSS_ETA_OFFSET)*D2R;
+        eta = fmodl(eta, 2*M_PI);
+        if (eta <= 0.0) {
+            eta += 2*M_PI;
+        }
+        ix = (int64) ( nx*eta/(2*M_PI) );
+        if (ix >= nx) {
+            ix = nx-1;
+        }
+
+        lambda = (90.0 - lambda)*D2R;
+        if (lambda >= M_PI) {
+            iy = ny-1;
+        } else {
+            iy = (int64) ( ny*(1.0-cosl(lambda))/2.0 );
+        }
+
+        pix = nx*iy + ix + ps;
+    }
+    return pix;
+}
+
+
+/*
+   HEALPix code
+
+   This is adapted from the healpix_base routines of Gorski et al.
+*/
+
+int64 healpix_npix(int64 nside)
+{
+    return 12*nside*nside;
+}
+
+int healpix_check_nside(int64 nside, char pixeltype)
+{
+    // nside up to 2^29 keeps 12*nside^2 within 64 bits
+    if (nside < 1 || nside > (1L<<29)) {
+        return 0;
+    }
+    if (pixeltype == 'n' && (nside & (nside-1)) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+static inline int64 healpix_imod(int64 v, int64 n)
+{
+    v = v % n;
+    return (v < 0) ? v+n : v;
+}
+
+// phi in units of pi/2, in the range [0,4)
+static inline long double healpix_phi_quad(long double phi)
+{
+    long double tt=0;
+
+    tt = fmodl(phi, 2*M_PI);
+    if (tt < 0) {
+        tt += 2*M_PI;
+    }
+    tt *= 2/M_PI;
+    if (tt >= 4) {
+        tt = 0;
+    }
+    return tt;
+}
+
+// nside*sqrt(3*(1-|z|)) for the polar caps, using sin(theta) near
+// the poles to avoid loss of precision
+static inline long double healpix_polar_tmp(int64 nside, const struct Point* pt)
+{
+    long double za=fabsl(pt->z), sth=0;
+
+    if (za < 0.99) {
+        return nside*sqrtl(3*(1-za));
+    }
+    sth = sqrtl(pt->x*pt->x + pt->y*pt->y);
+    return nside*sth/sqrtl((1+za)/3);
+}
+
+// interleave the bits of v with zeros
+static inline int64 healpix_spread_bits(int64 v)
+{
+    int64 res=0;
+    int i=0;
+    for (i=0; i<32; i++) {
+        res |= ((v >> i) & 1L) << (2*i);
+    }
+    return res;
+}
+
+int64 get_pixel_healpix_ring(int64 nside, const struct Point* pt)
+{
+    int64 jp=0, jm=0, ir=0, ip=0, kshift=0;
+    long double z=pt->z, tt=0, tp=0, tmp=0, temp1=0, temp2=0;
+
+    tt = healpix_phi_quad(pt->phi);
+
+    if (fabsl(z) <= 2./3.) {
+        // equatorial region
+        temp1 = nside*(0.5+tt);
+        temp2 = nside*z*0.75;
+        jp = (int64) (temp1-temp2);
+        jm = (int64) (temp1+temp2);
+
+        // ring number counted from z=2/3, in [1,2*nside+1]
+        ir = nside + 1 + jp - jm;
+        kshift = 1 - (ir & 1);
+
+        ip = (jp + jm - nside + kshift + 1)/2;
+        ip = healpix_imod(ip, 4*nside);
+
+        return 2*nside*(nside-1) + (ir-1)*4*nside + ip;
+    } else {
+        // polar caps
+        tp = tt - (int64) tt;
+        tmp = healpix_polar_tmp(nside, pt);
+
+        jp = (int64) (tp*tmp);
+        jm = (int64) ((1.0-tp)*tmp);
+
+        // ring number counted from the closest pole
+        ir = jp + jm + 1;
+        ip = (int64) (tt*ir);
+        ip = healpix_imod(ip, 4*ir);
+
+        if (z > 0) {
+            return 2*ir*(ir-1) + ip;
+        } else {
+            return healpix_npix(nside) - 2*ir*(ir+1) + ip;
+        }
+    }
+}
+
+int64 get_pixel_healpix_nest(int64 nside, const struct Point* pt)
+{
+    int64 jp=0, jm=0, ifp=0, ifm=0, face=0, ix=0, iy=0, ntt=0;
+    long double z=pt->z, tt=0, tp=0, tmp=0, temp1=0, temp2=0;
+
+    tt = healpix_phi_quad(pt->phi);
+
+    if (fabsl(z) <= 2./3.) {
+        // equatorial region
+        temp1 = nside*(0.5+tt);
+        temp2 = nside*z*0.75;
+        jp = (int64) (temp1-temp2);
+        jm = (int64) (temp1+temp2);
+
+        ifp = jp/nside;
+        ifm = jm/nside;
+        if (ifp == ifm) {
+            face = ifp | 4;
+        } else if (ifp < ifm) {
+            face = ifp;
+        } else {
+            face = ifm + 8;
+        }
+
+        ix = jm & (nside-1);
+        iy = nside - (jp & (nside-1)) - 1;
+    } else {
+        // polar caps
+        ntt = (int64) tt;
+        if (ntt >= 4) {
+            ntt = 3;
+        }
+        tp = tt - ntt;
+        tmp = healpix_polar_tmp(nside, pt);
+
+        jp = (int64) (tp*tmp);
+        jm = (int64) ((1.0-tp)*tmp);
+        if (jp >= nside) jp = nside-1;
+        if (jm >= nside) jm = nside-1;
+
+        if (z >= 0) {
+            face = ntt;
+            ix = nside - jm - 1;
+            iy = nside - jp - 1;
+        } else {
+            face = ntt + 8;
+            ix = jp;
+            iy = jm;
+        }
+    }
+
+    return face*nside*nside
+        + healpix_spread_bits(ix) + (healpix_spread_bits(iy) << 1);
+}
+
+long double healpix_max_pixrad(int64 nside)
+{
+    // the largest pixels are at the transition between the polar
+    // caps and the equatorial region
+    long double za=2./3., pa=M_PI/(4*nside);
+    long double t1=0, zb=0, sa=0, sb=0, cosang=0;
+
+    t1 = 1.0L - 1.0L/nside;
+    t1 *= t1;
+    zb = 1.0L - t1/3;
+
+    sa = sqrtl(1-za*za);
+    sb = sqrtl(1-zb*zb);
+
+    // phi of the second point is zero
+    cosang = sa*sb*cosl(pa) + za*zb;
+    if (cosang > 1) cosang=1;
+    if (cosang < -1) cosang=-1;
+    return acosl(cosang);
+}
+
+/*
+   get information for the ring iring, in [1,4*nside-1]
+
+   startpix is the first pixel in the ring, ringpix the number of pixels, z
+   is the cos(theta) of the pixel centers, and shifted is 1 if the first
+   pixel center is at phi = pi/ringpix rather than 0
+*/
+static void healpix_ring_info(int64 nside,
+                              int64 iring,
+                              int64* startpix,
+                              int64* ringpix,
+                              long double* z,
+                              int* shifted)
+{
+    int64 northring=0;
+
+    northring = (iring > 2*nside) ? 4*nside - iring : iring;
+    if (northring < nside) {
+        *z = 1 - northring*northring/(3.0L*nside*nside);
+        *ringpix = 4*northring;
+        *shifted = 1;
+        *startpix = 2*northring*(northring-1);
+    } else {
+        *z = (2*nside - northring)*2.0L/(3.0L*nside);
+        *ringpix = 4*nside;
+        *shifted = ((northring - nside) & 1) == 0;
+        *startpix = 2*nside*(nside-1) + (northring-nside)*4*nside;
+    }
+
+    if (northring != iring) {
+        // southern hemisphere
+        *z = -(*z);
+        *startpix = healpix_npix(nside) - *startpix - *ringpix;
+    }
+}
+
+/*
+   the ring number as a continuous function of z, equal to the ring number
+   at the ring centers and increasing to the south
+*/
+static long double healpix_ring_coord(int64 nside, long double z)
+{
+    if (z > 2.0L/3) {
+        return nside*sqrtl(3*(1-z));
+    } else if (z < -2.0L/3) {
+        return 4*nside - nside*sqrtl(3*(1+z));
+    } else {
+        return nside*(2 - 1.5L*z);
+    }
+}
+
+static void healpix_push_ring_pixel(int64 nside,
+                                    char pixeltype,
+                                    int64 startpix,
+                                    int64 ipix,
+                                    struct i64stack* pixels)
+{
+    if (pixeltype == 'n') {
+        i64stack_push(pixels, healpix_ring2nest(nside, startpix + ipix));
+    } else {
+        i64stack_push(pixels, startpix + ipix);
+    }
+}
+
+void healpix_query_cap(int64 nside,
+                       char pixeltype,
+                       const struct Cap* cap,
+                       struct i64stack* pixels)
+{
+    int64 iring=0, startpix=0, ringpix=0, j=0, jmin=0, jmax=0, npix=0;
+    int64 rmin=0, rmax=0;
+    int shifted=0, full=0;
+    long double radius=0, cosrad=0, theta_c=0, phi_c=0, sth_c=0,
+                z=0, zmin=0, zmax=0, sth=0, cosdphi=0, dphi=0, dp=0, off=0;
+
+    npix = healpix_npix(nside);
+
+    // all pixels with centers within the cap radius plus the pixel radius
+    radius = (cap->cm >= 2) ? M_PI : acosl(1-cap->cm);
+    radius += 1.01*healpix_max_pixrad(nside);
+
+    if (radius >= M_PI) {
+        for (j=0; j<npix; j++) {
+            i64stack_push(pixels, j);
+        }
+        return;
+    }
+    cosrad = cosl(radius);
+
+    z = cap->z;
+    if (z > 1) z=1;
+    if (z < -1) z=-1;
+    theta_c = acosl(z);
+    phi_c = atan2l(cap->y, cap->x);
+    sth_c = sinl(theta_c);
+
+    // only the rings within the z range of the cap, with one extra on each
+    // side
+    zmax = (theta_c - radius > 0) ? cosl(theta_c - radius) : 1;
+    zmin = (theta_c + radius < M_PI) ? cosl(theta_c + radius) : -1;
+    rmin = (int64) floorl(healpix_ring_coord(nside, zmax)) - 1;
+    rmax = (int64) ceill(healpix_ring_coord(nside, zmin)) + 1;
+    if (rmin < 1) rmin=1;
+    if (rmax > 4*nside-1) rmax=4*nside-1;
+
+    for (iring=rmin; iring<=rmax; iring++) {
+        healpix_ring_info(nside, iring, &startpix, &ringpix, &z, &shifted);
+
+        if (z > zmax || z < zmin) {
+            continue;
+        }
+
+        sth = sqrtl(1 - z*z);
+        full = 0;
+        if (sth*sth_c < 1.0e-15) {
+            full = 1;
+        } else {
+            // half width in phi of the cap at this ring
+            cosdphi = (cosrad - z*cap->z)/(sth*sth_c);
+            if (cosdphi <= -1) {
+                full = 1;
+            } else {
+                dphi = (cosdphi >= 1) ? 0 : acosl(cosdphi);
+            }
+        }
+
+        dp = 2*M_PI/ringpix;
+        off = 0.5*shifted;
+        if (!full) {
+            // one extra pixel on each side for safety
+            jmin = (int64) floorl((phi_c - dphi)/dp - off);
+            jmax = (int64) ceill((phi_c + dphi)/dp - off);
+            if (jmax - jmin + 1 >= ringpix) {
+                full = 1;
+            }
+        }
+        if (full) {
+            jmin = 0;
+            jmax = ringpix-1;
+        }
+
+        for (j=jmin; j<=jmax; j++) {
+            healpix_push_ring_pixel(nside, pixeltype, startpix,
+                                    healpix_imod(j, ringpix), pixels);
+        }
+    }
+}
+
+void simple_query_cap(int64 pixelres,
+                      const struct Cap* cap,
+                      struct i64stack* pixels)
+{
+    struct SimplePixel sp;
+    int64 n=0, m=0, nmin=0, nmax=0, mmin=0, mmax=0;
+    long double radius=0, z=0, theta_c=0, phi_c=0, thmin=0, thmax=0,
+                zmin=0, zmax=0, sdphi=0, dphi=0;
+    int full=0;
+
+    simplepix_init(&sp, pixelres);
+
+    radius = (cap->cm >= 2) ? M_PI : acosl(1-cap->cm);
+    z = cap->z;
+    if (z > 1) z=1;
+    if (z < -1) z=-1;
+    theta_c = acosl(z);
+    phi_c = atan2l(cap->y, cap->x);
+
+    // rows are equal bins in cos(theta), n = ceil((1-z)/2*p2) - 1; one extra
+    // row and column on each side for safety
+    thmin = theta_c - radius;
+    thmax = theta_c + radius;
+    zmax = (thmin <= 0) ? 1 : cosl(thmin);
+    zmin = (thmax >= M_PI) ? -1 : cosl(thmax);
+    nmin = (int64) floorl((1-zmax)/2*sp.p2) - 1;
+    nmax = (int64) ceill((1-zmin)/2*sp.p2);
+    if (nmin < 0) nmin=0;
+    if (nmax > sp.p2-1) nmax=sp.p2-1;
+
+    // the half width in phi of a cap not containing a pole is
+    // asin(sin(radius)/sin(theta_c))
+    full = (thmin <= 0 || thmax >= M_PI);
+    if (!full) {
+        sdphi = sinl(radius)/sinl(theta_c);
+        if (sdphi >= 1) {
+            full = 1;
+        } else {
+            dphi = asinl(sdphi);
+            mmin = (int64) floorl((phi_c - dphi)/(2*M_PI)*sp.p2) - 1;
+            mmax = (int64) floorl((phi_c + dphi)/(2*M_PI)*sp.p2) + 1;
+            if (mmax - mmin + 1 >= sp.p2) {
+                full = 1;
+            }
+        }
+    }
+    if (full) {
+        mmin = 0;
+        mmax = sp.p2-1;
+    }
+
+    for (n=nmin; n<=nmax; n++) {
+        for (m=mmin; m<=mmax; m++) {
+            i64stack_push(pixels,
+                          sp.p2*n + healpix_imod(m, sp.p2) + sp.ps);
+        }
+    }
+}
+
+int pixel_query_cap(char pixeltype,
+                    int64 pixelres,
+                    const struct Cap* cap,
+                    struct i64stack* pixels)
+{
+    switch (pixeltype) {
+        case 's':
+            simple_query_cap(pixelres, cap, pixels);
+            return 1;
+        case 'h':
+        case 'n':
+            healpix_query_cap(pixelres, pixeltype, cap, pixels);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+   pixel centers, the inverse of the pixel functions
+*/
+
+// gather every other bit of v, the inverse of healpix_spread_bits
+static inline int64 healpix_compress_bits(int64 v)
+{
+    int64 res=0;
+    int i=0;
+    for (i=0; i<32; i++) {
+        res |= ((v >> (2*i)) & 1L) << i;
+    }
+    return res;
+}
+
+static int64 healpix_isqrt(int64 v)
+{
+    int64 res = (int64) sqrtl((long double) v);
+    while (res*res > v) res--;
+    while ((res+1)*(res+1) <= v) res++;
+    return res;
+}
+
+static void healpix_center_ring(int64 nside, int64 pix, struct Point* pt)
+{
+    int64 npix=healpix_npix(nside), ncap=2*nside*(nside-1);
+    int64 iring=0, startpix=0, ringpix=0;
+    long double z=0, phi=0;
+    int shifted=0;
+
+    if (pix < ncap) {
+        iring = (1 + healpix_isqrt(1 + 2*pix))/2;
+    } else if (pix < npix - ncap) {
+        iring = (pix - ncap)/(4*nside) + nside;
+    } else {
+        iring = 4*nside - (1 + healpix_isqrt(2*(npix - pix) - 1))/2;
+    }
+
+    healpix_ring_info(nside, iring, &startpix, &ringpix, &z, &shifted);
+    phi = (pix - startpix + 0.5L*shifted)*2*M_PI/ringpix;
+    point_set_from_thetaphi(pt, acosl(z), phi);
+}
+
+static void healpix_center_nest(int64 nside, int64 pix, struct Point* pt)
+{
+    // ring number of the southern corner and longitude index of each face
+    static const int64 jrll[12] = {2,2,2,2,3,3,3,3,4,4,4,4};
+    static const int64 jpll[12] = {1,3,5,7,0,2,4,6,1,3,5,7};
+    int64 npface=nside*nside, face=0, ipf=0, ix=0, iy=0;
+    int64 jr=0, jp=0, nr=0, kshift=0;
+    long double z=0, phi=0;
+
+    face = pix/npface;
+    ipf = pix % npface;
+    ix = healpix_compress_bits(ipf);
+    iy = healpix_compress_bits(ipf >> 1);
+
+    jr = jrll[face]*nside - ix - iy - 1;
+    if (jr < nside) {
+        nr = jr;
+        z = 1 - nr*nr/(3.0L*npface);
+    } else if (jr > 3*nside) {
+        nr = 4*nside - jr;
+        z = -(1 - nr*nr/(3.0L*npface));
+    } else {
+        nr = nside;
+        z = (2*nside - jr)*2.0L/(3.0L*nside);
+        kshift = (jr - nside) & 1;
+    }
+
+    jp = (jpll[face]*nr + ix - iy + 1 + kshift)/2;
+    if (jp > 4*nside) jp -= 4*nside;
+    if (jp < 1) jp += 4*nside;
+
+    phi = (jp - (kshift+1)*0.5L)*(M_PI/2)/nr;
+    point_set_from_thetaphi(pt, acosl(z), phi);
+}
+
+int64 healpix_ring2nest(int64 nside, int64 pix)
+{
+    // ring number of the southern corner and longitude index of each face
+    static const int64 jrll[12] = {2,2,2,2,3,3,3,3,4,4,4,4};
+    static const int64 jpll[12] = {1,3,5,7,0,2,4,6,1,3,5,7};
+    int64 npix=healpix_npix(nside), ncap=2*nside*(nside-1), nl2=2*nside;
+    int64 iring=0, iphi=0, kshift=0, nr=0, face=0, ip=0, tmp=0;
+    int64 ire=0, irm=0, ifm=0, ifp=0, irt=0, ipt=0, ix=0, iy=0;
+
+    if (pix < ncap) {
+        // north polar cap
+        iring = (1 + healpix_isqrt(1 + 2*pix))/2;
+        iphi = (pix+1) - 2*iring*(iring-1);
+        nr = iring;
+        face = (iphi-1)/nr;
+    } else if (pix < npix - ncap) {
+        // equatorial region
+        ip = pix - ncap;
+        tmp = ip/(4*nside);
+        iring = tmp + nside;
+        iphi = ip - tmp*4*nside + 1;
+        kshift = (iring + nside) & 1;
+        nr = nside;
+        ire = tmp + 1;
+        irm = nl2 + 1 - tmp;
+        ifm = (iphi - ire/2 + nside - 1)/nside;
+        ifp = (iphi - irm/2 + nside - 1)/nside;
+        if (ifp == ifm) {
+            face = ifp | 4;
+        } else if (ifp < ifm) {
+            face = ifp;
+        } else {
+            face = ifm + 8;
+        }
+    } else {
+        // south polar cap
+        ip = npix - pix;
+        iring = (1 + healpix_isqrt(2*ip - 1))/2;
+        iphi = 4*iring + 1 - (ip - 2*iring*(iring-1));
+        nr = iring;
+        iring = 2*nl2 - iring;
+        face = (iphi-1)/nr + 8;
+    }
+
+    irt = iring - jrll[face]*nside + 1;
+    ipt = 2*iphi - jpll[face]*nr - kshift - 1;
+    if (ipt >= nl2) {
+        ipt -= 8*nside;
+    }
+
+    // both differences are even
+    ix = (ipt - irt)/2;
+    iy = (-ipt - irt)/2;
+
+    return face*nside*nside
+        + healpix_spread_bits(ix) + (healpix_spread_bits(iy) << 1);
+}
+
+int pixel_level_range(char pixeltype,
+                      int64 pixelres,
+                      int64* first,
+                      int64* npix)
+{
+    int64 i=0, p2=1, r=1;
+
+    *first=0;
+    *npix=0;
+    switch (pixeltype) {
+        case 's':
+            for (i=0; i<pixelres; i++) {
+                p2 = p2<<1;
+                *first += (p2/2)*(p2/2);
+            }
+            *npix = p2*p2;
+            break;
+        case 'd':
+            *npix = 1;
+            if (pixelres > 0) {
+                *first = 1;
+                for (i=1; i<pixelres; i++) {
+                    *first += SDSS_PIX_NX0*SDSS_PIX_NY0*r*r;
+                    r = r<<1;
+                }
+                *npix = SDSS_PIX_NX0*SDSS_PIX_NY0*r*r;
+            }
+            break;
+        case 'h':
+        case 'n':
+            *npix = healpix_npix(pixelres);
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * the level and the pixel number within the level, for the simple and SDSS
+ * schemes; level 0 is the whole sky
+ */
+static int64 pixel_find_level(char pixeltype, int64 pix, int64* level)
+{
+    int64 first=0, npix=0;
+
+    // beyond level 30 the pixel numbers overflow
+    for (*level=0; *level<=30; (*level)++) {
+        pixel_level_range(pixeltype, *level, &first, &npix);
+        if (pix < first+npix) {
+            return pix-first;
+        }
+    }
+    return -1;
+}
+
+static void pixel_center_simple(int64 level, int64 ipix, struct Point* pt)
+{
+    int64 p2=1L<<level, n=0, m=0;
+    long double z=0;
+
+    n = ipix/p2;
+    m = ipix % p2;
+    z = 1.0L - 2.0L*(n+0.5L)/p2;
+    point_set_from_thetaphi(pt, acosl(z), 2*M_PI*(m+0.5L)/p2);
+}
+
+static void pixel_center_sdss(int64 level, int64 ipix, struct Point* pt)
+{
+    int64 r=1, nx=1, ny=1, ix=0, iy=0;
+    long double lambda=0, eta=0, x=0, y=0, z=0, ra=0, dec=0;
+
+    if (level == 0) {
+        point_set_from_radec(pt, 0, 0);
+        return;
+    }
+    r = 1L<<(level-1);
+    nx = SDSS_PIX_NX0*r;
+    ny = SDSS_PIX_NY0*r;
+    ix = ipix % nx;
+    iy = ipix/nx;
+
+    // the inverse of get_pixel_sdss, at the center in eta and in the
+    // equal area lambda coordinate
+    eta = (ix+0.5L)*2*M_PI/nx;
+    eta = eta*R2D + SDSS_ETA_OFFSET + SDSS_SURVEY_CENTER_DEC;
+    lambda = 90.0L - acosl(1.0L - 2.0L*(iy+0.5L)/ny)*R2D;
+
+    x = -sinl(lambda*D2R);
+    y = cosl(lambda*D2R)*cosl(eta*D2R);
+    z = cosl(lambda*D2R)*sinl(eta*D2R);
+
+    dec = asinl(z)*R2D;
+    ra = atan2l(y, x)*R2D + SDSS_NODE_RA;
+    ra = fmodl(ra, 360.0L);
+    if (ra < 0) {
+        ra += 360.0L;
+    }
+    point_set_from_radec(pt, ra, dec);
+}
+
+int pixel_bounding_cap(char pixeltype,
+                       int64 pixelres,
+                       int64 ipix,
+                       struct Point* center,
+                       long double* radius)
+{
+    int64 p2=0, n=0, m=0, i=0, j=0;
+    long double z=0, phi=0, c=0, s=0, cmin=0;
+
+    switch (pixeltype) {
+        case 'n':
+            healpix_center_nest(pixelres, ipix, center);
+            *radius = healpix_max_pixrad(pixelres);
+            break;
+        case 's':
+            pixel_center_simple(pixelres, ipix, center);
+            if (pixelres == 0) {
+                *radius = M_PI;
+                break;
+            }
+
+            // for pixels up to 180 degrees wide the farthest point from the
+            // center is a corner
+            p2 = 1L<<pixelres;
+            n = ipix/p2;
+            m = ipix % p2;
+            cmin = 1;
+            for (i=0; i<2; i++) {
+                z = 1.0L - 2.0L*(n+i)/p2;
+                s = sqrtl(1-z*z);
+                for (j=0; j<2; j++) {
+                    phi = 2*M_PI*(m+j)/p2;
+                    c = s*cosl(phi)*center->x + s*sinl(phi)*center->y
+                        + z*center->z;
+                    if (c < cmin) {
+                        cmin = c;
+                    }
+                }
+            }
+            if (cmin < -1) cmin=-1;
+            *radius = acosl(cmin);
+            break;
+        default:
+            return 0;
+    }
+
+    // a little slack for roundoff
+    *radius += 1.0e-9;
+    return 1;
+}
+
+int pixel_children(char pixeltype,
+                   int64 pixelres,
+                   int64 ipix,
+                   int64* childres,
+                   int64 children[4])
+{
+    int64 p2=0, n=0, m=0, k=0;
+
+    switch (pixeltype) {
+        case 'n':
+            *childres = 2*pixelres;
+            for (k=0; k<4; k++) {
+                children[k] = 4*ipix + k;
+            }
+            break;
+        case 's':
+            *childres = pixelres+1;
+            p2 = 1L<<pixelres;
+            n = ipix/p2;
+            m = ipix % p2;
+            for (k=0; k<4; k++) {
+                children[k] = (2*n + k/2)*2*p2 + 2*m + k%2;
+            }
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+int pixel_center(char pixeltype, int64 pixelres, int64 pix, struct Point* pt)
+{
+    int64 level=0, ipix=0;
+
+    if (pix < 0) {
+        return 0;
+    }
+    switch (pixeltype) {
+        case 's':
+            if ((ipix = pixel_find_level(pixeltype, pix, &level)) < 0) {
+                return 0;
+            }
+            pixel_center_simple(level, ipix, pt);
+            break;
+        case 'd':
+            if ((ipix = pixel_find_level(pixeltype, pix, &level)) < 0) {
+                return 0;
+            }
+            pixel_center_sdss(level, ipix, pt);
+            break;
+        case 'h':
+            if (pix >= healpix_npix(pixelres)) {
+                return 0;
+            }
+            healpix_center_ring(pixelres, pix, pt);
+            break;
+        case 'n':
+            if (pix >= healpix_npix(pixelres)) {
+                return 0;
+            }
+            healpix_center_nest(pixelres, pix, pt);
+            break;
+        default:
+            return 0;
+    }
+    return 1;
+}
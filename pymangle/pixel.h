@@ -3,8 +3,23 @@
 
 #include "mangle.h"
 #include "point.h"
+#include "cap.h"
 #include "stack.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// constants for the simple scheme at a given resolution, computed once
+// rather than for each point
+struct SimplePixel {
+    int64 pixelres;
+    int64 p2;      // number of pixels in each dimension, 2^pixelres
+    int64 ps;      // first pixel number at this resolution
+    double zfac;   // p2/2, multiplies 1-cos(theta)
+    double phifac; // p2/(2 pi), multiplies phi
+};
+
 struct PixelListVec {
     char pixeltype;
     int64 pixelres;
@@ -19,15 +34,124 @@ struct PixelListVec*
 PixelListVec_new(size_t n);
 struct PixelListVec* PixelListVec_free(struct PixelListVec* self);
 
+// bytes allocated for the vector and all of its lists
+size_t PixelListVec_nbytes(const struct PixelListVec* self);
+
 // extract the pixel scheme and resolution from the input string
 // which sould be [res][scheme] e.g. 9s
+//
+// supported schemes are
+//     s: the mangle simple scheme, res is the resolution level
+//     d: the SDSS survey coordinate scheme, res is the resolution level
+//     h: HEALPix with RING ordering, res is nside
+//     n: HEALPix with NESTED ordering, res is nside (a power of 2)
 int pixel_parse_scheme(char buff[_MANGLE_SMALL_BUFFSIZE], 
                        int64* res, char* pixeltype);
 
+// choose the pixel function based on pixeltype.  Returns -1 for
+// an unsupported scheme
+int64 get_pixel(char pixeltype, int64 pixelres, const struct Point* pt);
+
+int64 get_pixel_simple(int64 pixelres, const struct Point* pt);
+
+/*
+ * the pixel numbers at resolution pixelres are first to first+npix-1; for
+ * the simple and SDSS schemes those of coarser levels come before.  Returns
+ * 0 for an unsupported scheme
+ */
+int pixel_level_range(char pixeltype,
+                      int64 pixelres,
+                      int64* first,
+                      int64* npix);
+
+/*
+ * set pt to the center of the pixel.  The pixel can be at any level of the
+ * simple and SDSS schemes.  Returns 0 for an unsupported scheme or a pixel
+ * number out of range
+ */
+int pixel_center(char pixeltype, int64 pixelres, int64 pix, struct Point* pt);
+
+/*
+ * pixels for hierarchical subdivision, numbered within their level: NESTED
+ * HEALPix pixels at nside pixelres ('n'), or simple pixels at level pixelres
+ * without the offset of the level ('s').  Both return 0 for other schemes.
+ */
+
+// the center of the pixel and the radius of a cap around it holding the
+// whole pixel, in radians
+int pixel_bounding_cap(char pixeltype,
+                       int64 pixelres,
+                       int64 ipix,
+                       struct Point* center,
+                       long double* radius);
+
+// the four equal area children of the pixel, at resolution childres
+int pixel_children(char pixeltype,
+                   int64 pixelres,
+                   int64 ipix,
+                   int64* childres,
+                   int64 children[4]);
 
-int64 get_pixel_simple(int64 pixelres, struct Point* pt);
+void simplepix_init(struct SimplePixel* self, int64 pixelres);
 
+// simple scheme pixel numbers for n points, from z=cos(theta) and phi in
+// radians.  This is done in double precision so the loop can be vectorized
+void get_pixel_simple_many(const struct SimplePixel* self,
+                           size_t n,
+                           const double* z,
+                           const double* phi,
+                           int64* pix);
 
+int64 get_pixel_sdss(int64 pixelres, const struct Point* pt);
 
+/*
+   HEALPix pixels, following the conventions of Gorski et al. 2005
+*/
+
+// total number of pixels, 12*nside^2
+int64 healpix_npix(int64 nside);
+
+// check nside is valid for the ordering, 'h' for RING and 'n' for NESTED:
+// in [1,2^29], and a power of 2 for NESTED.  Nothing is printed; callers
+// report the error
+int healpix_check_nside(int64 nside, char pixeltype);
+
+int64 get_pixel_healpix_ring(int64 nside, const struct Point* pt);
+int64 get_pixel_healpix_nest(int64 nside, const struct Point* pt);
+
+// the NESTED number of a RING pixel
+int64 healpix_ring2nest(int64 nside, int64 pix);
+
+// maximum angular distance in radians between a pixel center and
+// any point in the pixel
+long double healpix_max_pixrad(int64 nside);
+
+/*
+   push onto pixels all pixels that might overlap the input cap.  This is
+   conservative: some pixels in the list might not actually overlap the cap,
+   but all that do are included.
+
+   The cap must have cm >= 0, e.g. as returned by polygon_bounding_cap
+*/
+void healpix_query_cap(int64 nside,
+                       char pixeltype,
+                       const struct Cap* cap,
+                       struct i64stack* pixels);
+
+// the same for the simple scheme, pushing the pixels at level pixelres
+void simple_query_cap(int64 pixelres,
+                      const struct Cap* cap,
+                      struct i64stack* pixels);
+
+// dispatch to the query for the scheme.  Returns 0 for schemes without a cap
+// query, currently SDSS
+int pixel_query_cap(char pixeltype,
+                    int64 pixelres,
+                    const struct Cap* cap,
+                    struct i64stack* pixels);
+
+#ifdef __cplusplus
+}
 #endif
 
+#endif
@@ -35,7 +35,7 @@ point_set_from_thetaphi(struct Point* pt, long double theta, long double phi) {
     }
 }
 void 
-radec_from_point(struct Point* pt, long double *ra, long double *dec) {
+radec_from_point(const struct Point* pt, long double *ra, long double *dec) {
     *ra = pt->phi*R2D;
     *dec = 90.0 - pt->theta*R2D;
 }
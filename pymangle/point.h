@@ -1,6 +1,10 @@
 #ifndef _MANGLE_POINT_H
 #define _MANGLE_POINT_H
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct Point {
     long double theta; // theta in radians (=dec-pi/2)
     long double phi;   // phi in radians (=ra)
@@ -11,7 +15,7 @@ struct Point {
 
 void point_set_from_radec(struct Point* pt, long double ra, long double dec);
 void point_set_from_thetaphi(struct Point* pt, long double theta, long double phi);
-void radec_from_point(struct Point* pt, long double *ra, long double *dec);
+void radec_from_point(const struct Point* pt, long double *ra, long double *dec);
 
 /*
     ra = phi*R2D;
@@ -30,4 +34,8 @@ void thetaphi_from_radec(long double ra,
                          long double *theta,
                          long double *phi);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include "polygon.h"
 #include "cap.h"
 #include "point.h"
@@ -161,10 +162,223 @@ int polygon_has_zero_area(const struct Polygon* self) {
     return has_zero_area;
 }
 
-int is_in_poly(struct Polygon* ply, struct Point* pt)
+/*
+ * the boundary circle of a cap, as a center and the cosine of the opening
+ * angle, with caps with cm < 0 replaced by their complement.  Returns 0 if the
+ * cap has no boundary, i.e. it holds the full sphere or is empty
+ */
+static int bound_circle(const struct Cap* cap, long double a[3], long double *h)
 {
-    size_t i=0;
+    long double cm=cap->cm, sign=1;
+
+    if (cm < 0) {
+        sign = -1;
+        cm = 2 + cm;
+    }
+    if (cm <= 0 || cm >= 2) {
+        return 0;
+    }
+    a[0] = sign*cap->x;
+    a[1] = sign*cap->y;
+    a[2] = sign*cap->z;
+    *h = 1 - cm;
+    return 1;
+}
+
+// whether q is within all caps but i and j, with some slack for points
+// computed on their boundaries
+static int bound_on_polygon(const struct Polygon* self,
+                            const long double q[3],
+                            size_t i,
+                            size_t j)
+{
+    long double a[3], h=0;
+    size_t k=0;
+
+    for (k=0; k<self->caps->size; k++) {
+        if (k == i || k == j) {
+            continue;
+        }
+        if (!bound_circle(&self->caps->data[k], a, &h)) {
+            if (self->caps->data[k].cm == 0 || self->caps->data[k].cm <= -2) {
+                return 0;
+            }
+            continue;
+        }
+        if (q[0]*a[0] + q[1]*a[1] + q[2]*a[2] < h - 1.0e-12) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * the polygon vertices where the circles of caps i and j cross, returning the
+ * number found
+ */
+static int bound_vertices(const struct Polygon* self,
+                          size_t i,
+                          size_t j,
+                          long double q[2][3])
+{
+    long double ai[3], aj[3], hi=0, hj=0, cross[3];
+    long double g=0, det=0, alpha=0, beta=0, w=0, gamma=0;
+    int k=0, nq=0;
+
+    if (!bound_circle(&self->caps->data[i], ai, &hi)
+            || !bound_circle(&self->caps->data[j], aj, &hj)) {
+        return 0;
+    }
+
+    g = ai[0]*aj[0] + ai[1]*aj[1] + ai[2]*aj[2];
+    det = 1 - g*g;
+    if (det < 1.0e-24) {
+        return 0;
+    }
+    alpha = (hi - g*hj)/det;
+    beta = (hj - g*hi)/det;
+    w = 1 - (alpha*hi + beta*hj);
+    if (w < 0) {
+        return 0;
+    }
+    gamma = sqrtl(w/det);
+
+    cross[0] = ai[1]*aj[2] - ai[2]*aj[1];
+    cross[1] = ai[2]*aj[0] - ai[0]*aj[2];
+    cross[2] = ai[0]*aj[1] - ai[1]*aj[0];
+    for (k=0; k<3; k++) {
+        q[nq][k] = alpha*ai[k] + beta*aj[k] + gamma*cross[k];
+    }
+    if (bound_on_polygon(self, q[nq], i, j)) {
+        nq++;
+    }
+    for (k=0; k<3; k++) {
+        q[nq][k] = alpha*ai[k] + beta*aj[k] - gamma*cross[k];
+    }
+    if (bound_on_polygon(self, q[nq], i, j)) {
+        nq++;
+    }
+    return nq;
+}
+
+/*
+ * the cap about the centroid of the vertices that holds the boundary.  The
+ * boundary distance from the center is largest at a vertex, or at the point
+ * of an edge's circle farthest from the center.  With the boundary in the cap
+ * the polygon is either inside it or holds everything outside it, which is
+ * told by the antipode of the center.  Returns 0 if there is no such cap
+ */
+static int bound_from_vertices(const struct Polygon* self, struct Cap* bound)
+{
+    size_t ncaps=self->caps->size, i=0, j=0;
+    long double q[2][3], c[3]={0}, a[3], u[3], far[3];
+    long double h=0, s=0, dot=0, norm=0, mindot=1;
+    struct Point anti;
+    int k=0, l=0, nq=0, nvert=0;
+
+    for (i=0; i<ncaps; i++) {
+        for (j=i+1; j<ncaps; j++) {
+            nq = bound_vertices(self, i, j, q);
+            for (l=0; l<nq; l++) {
+                for (k=0; k<3; k++) {
+                    c[k] += q[l][k];
+                }
+            }
+            nvert += nq;
+        }
+    }
+    norm = sqrtl(c[0]*c[0] + c[1]*c[1] + c[2]*c[2]);
+    if (nvert == 0 || norm < 1.0e-12) {
+        return 0;
+    }
+    for (k=0; k<3; k++) {
+        c[k] /= norm;
+    }
+
+    for (i=0; i<ncaps; i++) {
+        for (j=i+1; j<ncaps; j++) {
+            nq = bound_vertices(self, i, j, q);
+            for (l=0; l<nq; l++) {
+                dot = q[l][0]*c[0] + q[l][1]*c[1] + q[l][2]*c[2];
+                if (dot < mindot) {
+                    mindot = dot;
+                }
+            }
+        }
+
+        if (!bound_circle(&self->caps->data[i], a, &h)) {
+            continue;
+        }
+        s = sqrtl(1 - h*h);
+        dot = c[0]*a[0] + c[1]*a[1] + c[2]*a[2];
+        for (k=0; k<3; k++) {
+            u[k] = c[k] - dot*a[k];
+        }
+        norm = sqrtl(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+        if (norm < 1.0e-12) {
+            // all of the circle is equally far; take any point on it
+            if (fabsl(a[0]) < 0.9) {
+                u[0] = 0; u[1] = a[2]; u[2] = -a[1];
+            } else {
+                u[0] = a[2]; u[1] = 0; u[2] = -a[0];
+            }
+            norm = sqrtl(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]);
+        }
+        for (k=0; k<3; k++) {
+            far[k] = h*a[k] - s*u[k]/norm;
+        }
+        if (bound_on_polygon(self, far, i, i)) {
+            dot = far[0]*c[0] + far[1]*c[1] + far[2]*c[2];
+            if (dot < mindot) {
+                mindot = dot;
+            }
+        }
+    }
+
+    anti.x = -c[0];
+    anti.y = -c[1];
+    anti.z = -c[2];
+    if (mindot <= -1 || is_in_poly(self, &anti)) {
+        return 0;
+    }
+
+    cap_set(bound, c[0], c[1], c[2], 1 - mindot + 1.0e-12);
+    return 1;
+}
+
+void polygon_bounding_cap(const struct Polygon* self, struct Cap* bound)
+{
+    size_t index=0;
+    long double cm_min=0;
     struct Cap* cap=NULL;
+    struct Cap vbound;
+
+    if (self->caps == NULL || self->caps->size == 0) {
+        cap_set(bound, 0.0, 0.0, 1.0, 2.0);
+        return;
+    }
+
+    capvec_min_cm(self->caps, &index, &cm_min);
+    cap = &self->caps->data[index];
+
+    // the complement of a cap is a cap centered on the antipode
+    if (cap->cm >= 0.0) {
+        cap_set(bound, cap->x, cap->y, cap->z, cm_min);
+    } else {
+        cap_set(bound, -cap->x, -cap->y, -cap->z, cm_min);
+    }
+
+    // stripes and other polygons cut from large caps are bounded much more
+    // tightly by their vertices
+    if (bound_from_vertices(self, &vbound) && vbound.cm < bound->cm) {
+        *bound = vbound;
+    }
+}
+
+int is_in_poly(const struct Polygon* ply, const struct Point* pt)
+{
+    size_t i=0;
+    const struct Cap* cap=NULL;
 
     int inpoly=1;
 
@@ -179,23 +393,450 @@ int is_in_poly(struct Polygon* ply, struct Point* pt)
     return inpoly;
 }
 
+int is_in_poly_count(const struct Polygon* ply,
+                     const struct Point* pt,
+                     int64* ncaps)
+{
+    size_t i=0;
+
+    for (i=0; i<ply->caps->size; i++) {
+        if (!is_in_cap(&ply->caps->data[i], pt)) {
+            *ncaps += i+1;
+            return 0;
+        }
+    }
+    *ncaps += ply->caps->size;
+    return 1;
+}
+
 
 /*
-long double polygon_calc_area(const struct CapVec* self, long double *tol)
+ * Exact polygon areas, in the spirit of garea (A J S Hamilton).
+ *
+ * The area form on the sphere is the exterior derivative of
+ * w = (1-cos(theta)) dphi, which is smooth everywhere but at the pole
+ * theta=pi.  By Stokes' theorem the area of a region not containing that pole
+ * is the integral of w around its boundary, and of a region containing it
+ * 4pi plus that integral.
+ *
+ * The boundary of a polygon is made of arcs of its cap circles: the parts of
+ * each circle that lie in all the other caps, directed with the cap on the
+ * left.  The pole is chosen as far as possible from the circles, so w is
+ * smooth along the arcs and Gauss-Legendre quadrature converges to machine
+ * precision.
+ */
+
+// a cap as the region a.p > s, with (u, v, a) a right handed frame; the
+// circle is s*a + r*(cos(t)*u + sin(t)*v)
+struct AreaCircle {
+    long double a[3];
+    long double u[3];
+    long double v[3];
+    long double s;
+    long double r;
+
+    // a, u, v in the frame of the pole, and the angle to the pole
+    long double pa[3];
+    long double pu[3];
+    long double pv[3];
+    long double dist;
+
+    int skip;
+};
+
+#define AREA_PI 3.141592653589793238462643383279502884L
+#define AREA_NGAUSS 8
+#define AREA_MAX_SEGMENT (AREA_PI/8)
+#define AREA_MAX_NSEGMENT 16384
+#define AREA_SAME_TOL 1.0e-15L
+
+// nodes and weights of 16 point Gauss-Legendre quadrature, for the positive
+// half of [-1, 1]
+static const long double area_gauss_x[AREA_NGAUSS] = {
+    0.0950125098376374401853193L, 0.2816035507792589132304605L,
+    0.4580167776572273863424194L, 0.6178762444026437484466718L,
+    0.7554044083550030338951012L, 0.8656312023878317438804679L,
+    0.9445750230732325760779884L, 0.9894009349916499325961542L,
+};
+static const long double area_gauss_w[AREA_NGAUSS] = {
+    0.1894506104550684962853967L, 0.1826034150449235888667637L,
+    0.1691565193950025381893121L, 0.1495959888165767320815017L,
+    0.1246289712555338720524763L, 0.0951585116824927848099251L,
+    0.0622535239386478928628438L, 0.0271524594117540948517806L,
+};
+
+static inline long double area_dot(const long double* a, const long double* b)
 {
-    long double area=0;
-    // static work structure
-    static struct CapVec* dcaps=NULL;
-    size_t index=0;
-    long double cm_min=0;
-    long double darea=0;
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
 
-    capvec_min_cm(self, &index, &cm_min);
+static inline void area_cross(const long double* a,
+                              const long double* b,
+                              long double* c)
+{
+    c[0] = a[1]*b[2] - a[2]*b[1];
+    c[1] = a[2]*b[0] - a[0]*b[2];
+    c[2] = a[0]*b[1] - a[1]*b[0];
+}
 
+static inline void area_normalize(long double* a)
+{
+    long double norm = sqrtl(area_dot(a, a));
+    a[0] /= norm;
+    a[1] /= norm;
+    a[2] /= norm;
+}
 
-    return area;
+// a unit vector perpendicular to a
+static void area_perpendicular(const long double* a, long double* u)
+{
+    long double e[3] = {0, 0, 0};
+
+    if (fabsl(a[0]) <= fabsl(a[1]) && fabsl(a[0]) <= fabsl(a[2])) {
+        e[0] = 1;
+    } else if (fabsl(a[1]) <= fabsl(a[2])) {
+        e[1] = 1;
+    } else {
+        e[2] = 1;
+    }
+    area_cross(a, e, u);
+    area_normalize(u);
+}
+
+static inline long double area_acos(long double x)
+{
+    return acosl(x > 1 ? 1 : (x < -1 ? -1 : x));
+}
+
+static int area_same_circle(const struct AreaCircle* c1,
+                            const struct AreaCircle* c2,
+                            long double sign)
+{
+    return fabsl(c1->a[0] - sign*c2->a[0]) < AREA_SAME_TOL
+        && fabsl(c1->a[1] - sign*c2->a[1]) < AREA_SAME_TOL
+        && fabsl(c1->a[2] - sign*c2->a[2]) < AREA_SAME_TOL
+        && fabsl(c1->s - sign*c2->s) < AREA_SAME_TOL;
+}
+
+/*
+ * cosine of the angle from the point d to the circle: with d at angle x from
+ * the axis and the circle at angle y, this is cos(x-y)
+ */
+static inline long double area_cos_dist(const struct AreaCircle* c,
+                                        const long double* d)
+{
+    long double ad = area_dot(c->a, d);
+    long double sin_ad = 1 - ad*ad;
+
+    sin_ad = sin_ad > 0 ? sqrtl(sin_ad) : 0;
+    return ad*c->s + sin_ad*c->r;
+}
+
+/*
+ * the pole for the integration: the one of the 26 directions to the faces,
+ * edges and corners of a cube that is farthest from all the circles
+ */
+static void area_choose_pole(const struct AreaCircle* circles,
+                             size_t n,
+                             long double* pole)
+{
+    long double d[3], cos_dist=0, cos_best=2, ci=0;
+    size_t i=0;
+    int ix=0, iy=0, iz=0;
+
+    pole[0] = 0; pole[1] = 0; pole[2] = -1;
+    for (ix=-1; ix<=1; ix++) {
+        for (iy=-1; iy<=1; iy++) {
+            for (iz=-1; iz<=1; iz++) {
+                if (ix == 0 && iy == 0 && iz == 0) {
+                    continue;
+                }
+                d[0] = ix; d[1] = iy; d[2] = iz;
+                area_normalize(d);
+
+                // the largest cosine is the nearest circle
+                cos_dist = -2;
+                for (i=0; i<n; i++) {
+                    if (circles[i].skip) {
+                        continue;
+                    }
+                    ci = area_cos_dist(&circles[i], d);
+                    if (ci > cos_dist) {
+                        cos_dist = ci;
+                    }
+                }
+                if (cos_dist < cos_best) {
+                    cos_best = cos_dist;
+                    memcpy(pole, d, sizeof(d));
+                }
+            }
+        }
+    }
+}
+
+/*
+ * integral of w along the circle from t1 to t2, in the frame where the pole
+ * is z=-1: w = (x dy - y dx)/(1+z)
+ */
+static long double area_integrate_arc(const struct AreaCircle* c,
+                                      long double t1,
+                                      long double t2)
+{
+    long double h=0, mid=0, half=0, sum=0, ct=0, st=0, cmid=0, smid=0;
+    long double p[3], dp[3];
+    long double cx[AREA_NGAUSS], sx[AREA_NGAUSS];
+    size_t nseg=0, iseg=0;
+    int i=0, sign=0, k=0;
+
+    h = AREA_MAX_SEGMENT;
+    if (c->dist < h) {
+        h = c->dist;
+    }
+    nseg = (size_t) ceill((t2 - t1)/h);
+    if (nseg < 1) {
+        nseg = 1;
+    } else if (nseg > AREA_MAX_NSEGMENT) {
+        nseg = AREA_MAX_NSEGMENT;
+    }
+    half = 0.5L*(t2 - t1)/nseg;
+
+    // the nodes are at mid +/- half*x; use the angle sum formulas
+    for (i=0; i<AREA_NGAUSS; i++) {
+        cx[i] = cosl(half*area_gauss_x[i]);
+        sx[i] = sinl(half*area_gauss_x[i]);
+    }
+
+    for (iseg=0; iseg<nseg; iseg++) {
+        mid = t1 + (2*iseg + 1)*half;
+        cmid = cosl(mid);
+        smid = sinl(mid);
+        for (i=0; i<AREA_NGAUSS; i++) {
+            for (sign=-1; sign<=1; sign+=2) {
+                ct = cmid*cx[i] - sign*smid*sx[i];
+                st = smid*cx[i] + sign*cmid*sx[i];
+                for (k=0; k<3; k++) {
+                    p[k] = c->s*c->pa[k] + c->r*(ct*c->pu[k] + st*c->pv[k]);
+                    dp[k] = c->r*(-st*c->pu[k] + ct*c->pv[k]);
+                }
+                sum += area_gauss_w[i]*(p[0]*dp[1] - p[1]*dp[0])/(1 + p[2]);
+            }
+        }
+    }
+    return sum*half;
+}
+
+static int area_compare(const void* a, const void* b)
+{
+    long double x = *(const long double*) a;
+    long double y = *(const long double*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * add the integral along the arcs of circle i that are inside all the other
+ * caps.  Returns 0 if the polygon is found to have zero area
+ */
+static int area_add_circle(const struct AreaCircle* circles,
+                           size_t n,
+                           size_t i,
+                           long double* tbreak,
+                           long double* sum)
+{
+    const struct AreaCircle* ci=&circles[i];
+    const struct AreaCircle* cj=NULL;
+    long double ab=0, ub=0, vb=0, amp=0, q=0, w=0, t0=0, t1=0, t2=0, mid=0;
+    long double p[3];
+    size_t j=0, nbreak=0, k=0;
+    int inside=0;
+
+    for (j=0; j<n; j++) {
+        cj = &circles[j];
+        if (j == i || cj->skip) {
+            continue;
+        }
+        if (area_same_circle(ci, cj, 1)) {
+            // only the first of a set of identical caps has a boundary
+            if (j < i) {
+                return 1;
+            }
+            continue;
+        }
+        if (area_same_circle(ci, cj, -1)) {
+            // a cap and its complement
+            return 0;
+        }
+
+        ab = area_dot(ci->a, cj->a);
+        ub = area_dot(ci->u, cj->a);
+        vb = area_dot(ci->v, cj->a);
+        amp = ci->r*sqrtl(ub*ub + vb*vb);
+
+        // along the circle, cj->a . p = ci->s*ab + amp*cos(t - t0)
+        if (amp <= 0) {
+            if (ci->s*ab <= cj->s) {
+                return 1;
+            }
+            continue;
+        }
+        q = (cj->s - ci->s*ab)/amp;
+        if (q <= -1) {
+            continue;
+        } else if (q >= 1) {
+            return 1;
+        }
+
+        w = acosl(q);
+        t0 = atan2l(vb, ub);
+        tbreak[nbreak++] = fmodl(t0 - w + 4*AREA_PI, 2*AREA_PI);
+        tbreak[nbreak++] = fmodl(t0 + w + 4*AREA_PI, 2*AREA_PI);
+    }
+
+    if (nbreak == 0) {
+        *sum += area_integrate_arc(ci, 0, 2*AREA_PI);
+        return 1;
+    }
+
+    qsort(tbreak, nbreak, sizeof(long double), area_compare);
+    for (k=0; k<nbreak; k++) {
+        t1 = tbreak[k];
+        t2 = (k+1 < nbreak) ? tbreak[k+1] : tbreak[0] + 2*AREA_PI;
+        if (t2 <= t1) {
+            continue;
+        }
+
+        // the arc is in or out as a whole; check its middle
+        mid = 0.5L*(t1 + t2);
+        p[0] = ci->s*ci->a[0] + ci->r*(cosl(mid)*ci->u[0] + sinl(mid)*ci->v[0]);
+        p[1] = ci->s*ci->a[1] + ci->r*(cosl(mid)*ci->u[1] + sinl(mid)*ci->v[1]);
+        p[2] = ci->s*ci->a[2] + ci->r*(cosl(mid)*ci->u[2] + sinl(mid)*ci->v[2]);
+
+        inside=1;
+        for (j=0; j<n; j++) {
+            cj = &circles[j];
+            if (j == i || cj->skip || area_same_circle(ci, cj, 1)) {
+                continue;
+            }
+            if (area_dot(cj->a, p) <= cj->s) {
+                inside=0;
+                break;
+            }
+        }
+        if (inside) {
+            *sum += area_integrate_arc(ci, t1, t2);
+        }
+    }
+    return 1;
+}
+
+int polygon_calc_area(const struct CapVec* caps, long double* area)
+{
+    struct AreaCircle* circles=NULL;
+    struct AreaCircle* c=NULL;
+    long double* tbreak=NULL;
+    long double pole[3], e1[3], e2[3], e3[3];
+    long double sum=0, cm=0;
+    size_t i=0, n=caps->size, nactive=0;
+    int status=1, pole_inside=1;
+
+    *area = 0;
+
+    circles = calloc(n > 0 ? n : 1, sizeof(struct AreaCircle));
+    tbreak = calloc(2*n + 1, sizeof(long double));
+    if (!circles || !tbreak) {
+        wlog("could not allocate area workspace for %lu caps\n", n);
+        status=0;
+        goto _polygon_calc_area_bail;
+    }
+
+    for (i=0; i<n; i++) {
+        c = &circles[i];
+        cm = caps->data[i].cm;
+        if (cm == 0 || cm <= -2) {
+            // an empty cap
+            goto _polygon_calc_area_bail;
+        }
+        if (cm >= 2) {
+            // the whole sphere
+            c->skip=1;
+            continue;
+        }
+
+        c->a[0] = caps->data[i].x;
+        c->a[1] = caps->data[i].y;
+        c->a[2] = caps->data[i].z;
+        area_normalize(c->a);
+        if (cm > 0) {
+            c->s = 1 - cm;
+        } else {
+            c->a[0] = -c->a[0];
+            c->a[1] = -c->a[1];
+            c->a[2] = -c->a[2];
+            c->s = -1 - cm;
+        }
+        c->r = sqrtl(1 - c->s*c->s);
+        area_perpendicular(c->a, c->u);
+        area_cross(c->a, c->u, c->v);
+        nactive++;
+    }
+
+    if (nactive == 0) {
+        *area = 4*AREA_PI;
+        goto _polygon_calc_area_bail;
+    }
+
+    area_choose_pole(circles, n, pole);
+
+    // the frame with the pole at z=-1
+    e3[0] = -pole[0]; e3[1] = -pole[1]; e3[2] = -pole[2];
+    area_perpendicular(e3, e1);
+    area_cross(e3, e1, e2);
+
+    for (i=0; i<n; i++) {
+        c = &circles[i];
+        if (c->skip) {
+            continue;
+        }
+        c->pa[0] = area_dot(c->a, e1);
+        c->pa[1] = area_dot(c->a, e2);
+        c->pa[2] = area_dot(c->a, e3);
+        c->pu[0] = area_dot(c->u, e1);
+        c->pu[1] = area_dot(c->u, e2);
+        c->pu[2] = area_dot(c->u, e3);
+        c->pv[0] = area_dot(c->v, e1);
+        c->pv[1] = area_dot(c->v, e2);
+        c->pv[2] = area_dot(c->v, e3);
+        c->dist = fabsl(area_acos(area_dot(c->a, pole)) - area_acos(c->s));
+
+        if (area_dot(c->a, pole) <= c->s) {
+            pole_inside=0;
+        }
+    }
+
+    for (i=0; i<n; i++) {
+        if (circles[i].skip) {
+            continue;
+        }
+        if (!area_add_circle(circles, n, i, tbreak, &sum)) {
+            // zero area
+            goto _polygon_calc_area_bail;
+        }
+    }
+
+    if (pole_inside) {
+        sum += 4*AREA_PI;
+    }
+    if (sum < 0) {
+        sum = 0;
+    } else if (sum > 4*AREA_PI) {
+        sum = 4*AREA_PI;
+    }
+    *area = sum;
+
+_polygon_calc_area_bail:
+    free(circles);
+    free(tbreak);
+    return status;
 }
-*/
 
 int read_into_polygon(FILE* fptr, struct Polygon* ply)
 {
@@ -413,7 +1054,8 @@ int read_polygon_header(FILE* fptr, struct Polygon* ply, size_t* ncaps)
                     wlog("Failed to read area for polygon id %ld", ply->poly_id);
                     goto _read_polygon_header_errout;
                 }
-                ply->area_set=1;
+                // files written without areas hold 0 str; those are computed
+                ply->area_set = (ply->area > 0);
             }
 
             i = get_next_blank(linebuf, nread, i);
@@ -515,7 +1157,7 @@ int read_polygon_header(FILE* fptr, struct Polygon* ply, size_t* ncaps)
             goto _read_polygon_header_errout;
         }
         sscanf(valbuff, "%Lf", &ply->area);
-        ply->area_set=1;
+        ply->area_set = (ply->area > 0);
     }
     if (got_pixel) {
         if (1 != fscanf(fptr,"%Lf",&ply->area)) {
@@ -524,7 +1166,7 @@ int read_polygon_header(FILE* fptr, struct Polygon* ply, size_t* ncaps)
                  ply->poly_id);
             goto _read_polygon_header_errout;
         }
-        ply->area_set=1;
+        ply->area_set = (ply->area > 0);
         if (!scan_expected_value(fptr, kwbuff, "str):")) {
             status=0;
             goto _read_polygon_header_errout;
@@ -600,6 +1242,26 @@ struct PolyVec* polyvec_free(struct PolyVec* self)
     return self;
 }
 
+size_t polyvec_nbytes(const struct PolyVec* self)
+{
+    if (self == NULL) {
+        return 0;
+    }
+    return sizeof(struct PolyVec) + self->size*sizeof(struct Polygon);
+}
+
+size_t polyvec_caps_nbytes(const struct PolyVec* self)
+{
+    size_t i=0, nbytes=0;
+
+    if (self != NULL) {
+        for (i=0; i<self->size; i++) {
+            nbytes += capvec_nbytes(self->data[i].caps);
+        }
+    }
+    return nbytes;
+}
+
 struct PolyVec *read_polygons(FILE* fptr, size_t npoly)
 {
     int status=1;
@@ -6,6 +6,10 @@
 #include "point.h"
 #include "cap.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct Polygon {
 
     // these considered exposed
@@ -58,10 +62,26 @@ struct Cap polygon_pop_cap(struct Polygon* self);
 // adapted from gzeroar, A J S Hamilton
 int polygon_has_zero_area(const struct Polygon* self);
 
+// get a cap that contains the whole polygon, with cm >= 0.  This is the
+// smaller of the polygon's smallest cap, where caps with cm < 0 are replaced
+// by their complement, and a cap about the polygon's vertices holding its
+// boundary.  A polygon with no caps is bounded by the full sphere, cm=2
+void polygon_bounding_cap(const struct Polygon* self, struct Cap* bound);
+
+// compute the area in str of the intersection of the caps, integrating along
+// the boundary arcs in the spirit of garea, A J S Hamilton.  Returns 0 if the
+// work space could not be allocated
+int polygon_calc_area(const struct CapVec* caps, long double* area);
+
 int read_into_polygon(FILE* fptr, struct Polygon* ply);
 int read_polygon_header(FILE* fptr, struct Polygon* ply, size_t* ncaps);
 
-int is_in_poly(struct Polygon* ply, struct Point* pt);
+int is_in_poly(const struct Polygon* ply, const struct Point* pt);
+
+// the same as is_in_poly, adding the number of caps tested to ncaps
+int is_in_poly_count(const struct Polygon* ply,
+                     const struct Point* pt,
+                     int64* ncaps);
 
 int scan_expected_value(FILE* fptr, char* buff, const char* expected_value);
 
@@ -75,7 +95,16 @@ struct PolyVec {
 
 struct PolyVec* polyvec_new(size_t n);
 struct PolyVec* polyvec_free(struct PolyVec* self);
+
+// bytes allocated for the vector and polygons, not including the caps
+size_t polyvec_nbytes(const struct PolyVec* self);
+// bytes allocated for the caps of all polygons
+size_t polyvec_caps_nbytes(const struct PolyVec* self);
 struct PolyVec *read_polygons(FILE* fptr, size_t npoly);
 void print_polygons(FILE* fptr, struct PolyVec *self);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include <math.h>
 #include "rand.h"
@@ -13,6 +14,54 @@ seed_random(void) {
     srand48((long) (tm.tv_sec * 1000000 + tm.tv_usec));
 }
 
+long
+random_seed(void) {
+    static long counter=0;
+    struct timeval tm;
+    long count=0;
+
+    count = __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+    gettimeofday(&tm, NULL); 
+    return (long) (tm.tv_sec * 1000000 + tm.tv_usec) + count*7919;
+}
+
+void
+seed_random_state(unsigned short rng[3]) {
+    seed_random_state_from(rng, random_seed());
+}
+
+void
+seed_random_state_from(unsigned short rng[3], long seed) {
+    // same layout srand48 uses
+    rng[0] = 0x330E;
+    rng[1] = (unsigned short) (seed & 0xFFFF);
+    rng[2] = (unsigned short) ((seed >> 16) & 0xFFFF);
+}
+
+void
+seed_random_state_stream(unsigned short rng[3], long seed, size_t stream) {
+    // the splitmix64 finalizer, so all 48 bits of the state differ between
+    // nearby streams
+    uint64_t z = (uint64_t) seed + 0x9E3779B97F4A7C15ULL*((uint64_t) stream+1);
+
+    z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    rng[0] = (unsigned short) (z & 0xFFFF);
+    rng[1] = (unsigned short) ((z >> 16) & 0xFFFF);
+    rng[2] = (unsigned short) ((z >> 32) & 0xFFFF);
+}
+
+double
+rand_uniform(unsigned short *rng) {
+    if (rng) {
+        return erand48(rng);
+    } else {
+        return drand48();
+    }
+}
+
 
 void genrand_allsky(struct Point *pt)
 {
@@ -64,9 +113,15 @@ radec_range_to_costhetaphi(long double ramin, long double ramax,
 void
 genrand_theta_phi_allsky(long double* theta, long double* phi)
 {
-    *phi = (long double) drand48()*2*M_PI;
+    genrand_theta_phi_allsky_r(NULL, theta, phi);
+}
+void
+genrand_theta_phi_allsky_r(unsigned short *rng,
+                           long double* theta, long double* phi)
+{
+    *phi = (long double) rand_uniform(rng)*2*M_PI;
     // this is actually cos(theta) for now
-    *theta = 2*(long double) drand48()-1;
+    *theta = 2*(long double) rand_uniform(rng)-1;
     
     if (*theta > 1) *theta=1;
     if (*theta < -1) *theta=-1;
@@ -84,12 +139,20 @@ void
 genrand_theta_phi(long double cthmin, long double cthmax, long double phimin, long double phimax,
                   long double* theta, long double* phi)
 {
+    genrand_theta_phi_r(NULL, cthmin, cthmax, phimin, phimax, theta, phi);
+}
+void
+genrand_theta_phi_r(unsigned short *rng,
+                    long double cthmin, long double cthmax,
+                    long double phimin, long double phimax,
+                    long double* theta, long double* phi)
+{
 
     // at first, theta is cos(theta)
-    *phi = phimin + (phimax - phimin)*(long double) drand48();
+    *phi = phimin + (phimax - phimin)*(long double) rand_uniform(rng);
 
     // this is actually cos(theta) for now
-    *theta = cthmin + (cthmax-cthmin)*(long double) drand48();
+    *theta = cthmin + (cthmax-cthmin)*(long double) rand_uniform(rng);
     
     if (*theta > 1) *theta=1;
     if (*theta < -1) *theta=-1;
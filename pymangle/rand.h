@@ -1,19 +1,51 @@
 #ifndef _MANGLE_RAND_H
 #define _MANGLE_RAND_H
 
+#include <stddef.h>
 #include "point.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The functions below use the global drand48 state, which is not thread
+ * safe.  The _r versions take a caller-owned erand48 state instead, an array
+ * of three unsigned shorts; sending NULL for it uses the global state.
+ */
+
 void seed_random(void);
 
+// a seed from the time and a counter, so calls in the same microsecond differ
+long random_seed(void);
+
+// seed from random_seed()
+void seed_random_state(unsigned short rng[3]);
+void seed_random_state_from(unsigned short rng[3], long seed);
+
+// seed one of many streams from a single seed, e.g. one per object.  The seed
+// and stream number are mixed, so nearby streams are not correlated
+void seed_random_state_stream(unsigned short rng[3], long seed, size_t stream);
+
+// uniform in [0,1)
+double rand_uniform(unsigned short *rng);
+
 void genrand_allsky(struct Point *pt);
 void genrand_range(long double cthmin, long double cthmax, 
                    long double phimin, long double phimax,
                    struct Point *pt);
 
 void genrand_theta_phi_allsky(long double* theta, long double* phi);
+void genrand_theta_phi_allsky_r(unsigned short *rng,
+                                long double* theta, long double* phi);
 
 void genrand_theta_phi(long double cthmin, long double cthmax, 
                        long double phimin, long double phimax,
                        long double* theta, long double* phi);
+void genrand_theta_phi_r(unsigned short *rng,
+                         long double cthmin, long double cthmax,
+                         long double phimin, long double phimax,
+                         long double* theta, long double* phi);
 
 /*
  * convert an ra/dec range to cos(theta) and phi range
@@ -26,4 +58,8 @@ radec_range_to_costhetaphi(long double ramin, long double ramax,
                            long double* cthmin, long double* cthmax, 
                            long double* phimin, long double* phimax);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sort.h"
+#include "defs.h"
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1<<RADIX_BITS)
+#define RADIX_MASK (RADIX_SIZE-1)
+
+int radix_sort_int64_index(size_t n, int64* keys, size_t* index)
+{
+    size_t i=0, count[RADIX_SIZE], sum=0, tmp=0;
+    uint64_t maxkey=0, digit=0;
+    int64 *keys_in=keys, *keys_out=NULL, *keys_tmp=NULL, *kswap=NULL;
+    size_t *index_in=index, *index_out=NULL, *index_tmp=NULL, *iswap=NULL;
+    int shift=0;
+
+    for (i=0; i<n; i++) {
+        index[i] = i;
+        if ((uint64_t) keys[i] > maxkey) {
+            maxkey = (uint64_t) keys[i];
+        }
+    }
+    if (n < 2 || maxkey == 0) {
+        return 1;
+    }
+
+    keys_tmp = malloc(n*sizeof(int64));
+    index_tmp = malloc(n*sizeof(size_t));
+    if (keys_tmp == NULL || index_tmp == NULL) {
+        free(keys_tmp);
+        free(index_tmp);
+        return 0;
+    }
+    keys_out = keys_tmp;
+    index_out = index_tmp;
+
+    for (shift=0; shift < 64 && (maxkey >> shift) != 0; shift += RADIX_BITS) {
+
+        memset(count, 0, sizeof(count));
+        for (i=0; i<n; i++) {
+            digit = ((uint64_t) keys_in[i] >> shift) & RADIX_MASK;
+            count[digit]++;
+        }
+
+        // convert counts to starting positions
+        sum=0;
+        for (i=0; i<RADIX_SIZE; i++) {
+            tmp = count[i];
+            count[i] = sum;
+            sum += tmp;
+        }
+
+        for (i=0; i<n; i++) {
+            digit = ((uint64_t) keys_in[i] >> shift) & RADIX_MASK;
+            keys_out[count[digit]] = keys_in[i];
+            index_out[count[digit]] = index_in[i];
+            count[digit]++;
+        }
+
+        kswap=keys_in; keys_in=keys_out; keys_out=kswap;
+        iswap=index_in; index_in=index_out; index_out=iswap;
+    }
+
+    // after an odd number of passes the result is in the work space
+    if (keys_in != keys) {
+        memcpy(keys, keys_in, n*sizeof(int64));
+        memcpy(index, index_in, n*sizeof(size_t));
+    }
+
+    free(keys_tmp);
+    free(index_tmp);
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef _MANGLE_SORT_H
+#define _MANGLE_SORT_H
+
+#include <stdlib.h>
+#include "defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * sort the non-negative keys in place, in increasing order, filling index
+ * with the original position of each sorted key.
+ *
+ * This is a stable least significant digit radix sort, 8 bits per pass.
+ * Passes for high bytes that are zero for all keys are skipped, so sorting
+ * pixel numbers usually takes only two or three passes.
+ *
+ * returns 0 if the work space could not be allocated
+ */
+int radix_sort_int64_index(size_t n, int64* keys, size_t* index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -87,6 +87,13 @@ struct i64stack* i64stack_delete(struct i64stack* stack) {
     return NULL;
 }
 
+size_t i64stack_nbytes(const struct i64stack* stack) {
+    if (stack == NULL) {
+        return 0;
+    }
+    return sizeof(struct i64stack) + stack->allocated_size*sizeof(int64_t);
+}
+
 void i64stack_push(struct i64stack* stack, int64_t val) {
     // see if we have already filled the available data vector
     // if so, reallocate to larger storage
@@ -3,6 +3,10 @@
 #define _STACK_H
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define STACK_PUSH_REALLOC_MULT 1
 #define STACK_PUSH_REALLOC_MULTVAL 2
 #define STACK_PUSH_INITSIZE 1
@@ -39,6 +43,9 @@ void i64stack_clear(struct i64stack* stack);
 // usage: stack=i64stack_delete(stack);
 struct i64stack* i64stack_delete(struct i64stack* stack);
 
+// bytes allocated for the stack, including unused space
+size_t i64stack_nbytes(const struct i64stack* stack);
+
 // if reallocation is needed, size is increased by 50 percent
 // unless size is zero, when it 100 are allocated
 void i64stack_push(struct i64stack* stack, int64_t val);
@@ -50,4 +57,8 @@ int __i64stack_compare_el(const void *a, const void *b);
 void i64stack_sort(struct i64stack* stack);
 int64_t* i64stack_find(struct i64stack* stack, int64_t el);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // header guard
@@ -0,0 +1,363 @@
+"""
+Streaming queries for catalogs too large to hold in memory
+
+functions:
+    query_chunks:
+        Query an iterable of (ra, dec) chunks, yielding results per chunk
+    query_files:
+        Query ra and dec read from files, writing results to files
+    read_chunks:
+        Yield (ra, dec) chunks from a pair of .npy or raw binary files
+
+The next chunk is read and converted to long double in a background thread
+while the current one is searched, and query_files writes the results of
+the previous chunk in another; the searches release the GIL.  Only a few
+chunks are held in memory at a time.
+"""
+from __future__ import print_function, absolute_import
+
+import os
+from concurrent.futures import ThreadPoolExecutor
+from contextlib import ExitStack
+
+import numpy
+from numpy import longdouble
+from numpy.lib import format as npy_format
+
+DEFAULT_CHUNKSIZE = 1024*1024
+
+# result name -> dtype of the data written by query_files
+OUTPUT_DTYPES = {
+    'polyid': numpy.int64,
+    'weight': numpy.float64,
+    'contains': numpy.bool_,
+}
+
+
+def read_chunks(ra_file, dec_file, chunksize=DEFAULT_CHUNKSIZE,
+                dtype='f8'):
+    """
+    Yield (ra, dec) chunks read from a pair of files
+
+    parameters
+    ----------
+    ra_file, dec_file: str
+        Files holding ra and dec in degrees.  Files ending in .npy are read
+        as numpy .npy files, others as raw binary of the given dtype
+    chunksize: int, optional
+        Number of points in each chunk
+    dtype: numpy dtype, optional
+        Data type of raw binary files, default 'f8'
+
+    output
+    ------
+    Yields (ra, dec) arrays of up to chunksize points
+    """
+    ra_info, dec_info = _open_inputs(ra_file, dec_file, dtype)
+    return _read_chunks(ra_info, dec_info, _check_chunksize(chunksize))
+
+
+def query_chunks(mask, chunks, what='polyid', sort=False, cache=False,
+                 min_weight=None):
+    """
+    Query an iterable of (ra, dec) chunks against the mask
+
+    parameters
+    ----------
+    mask: Mangle
+        The mask to query
+    chunks: iterable
+        Yields (ra, dec) pairs of arrays.  The next chunk is taken and
+        converted while the current one is searched
+    what: str, optional
+        'polyid', 'weight', 'polyid_and_weight', 'contains' or
+        'count_contained'.  Default 'polyid'
+    sort, cache, min_weight:
+        As for the Mangle methods; min_weight applies to contains and
+        count_contained only
+
+    output
+    ------
+    Yields the result of the method for each chunk, in order
+    """
+    search = _get_search(mask, what, sort, cache, min_weight)
+
+    for ra, dec in _prefetch(chunks):
+        yield search(ra, dec)
+
+
+def query_files(mask, ra_file, dec_file,
+                polyid=None, weight=None, contains=None,
+                chunksize=DEFAULT_CHUNKSIZE, dtype='f8',
+                sort=False, cache=False, min_weight=None):
+    """
+    Query points read from files, writing the results to files
+
+    The points are read, searched and written a chunk at a time, with the
+    next chunk read and the previous results written while the current
+    chunk is searched, so the memory used does not depend on the number of
+    points.
+
+    parameters
+    ----------
+    mask: Mangle
+        The mask to query
+    ra_file, dec_file: str
+        Files holding ra and dec in degrees.  Files ending in .npy are read
+        as numpy .npy files, others as raw binary of the given dtype
+    polyid, weight, contains: str, optional
+        Files for the results.  Files ending in .npy are written in that
+        format, others as raw binary.  polyid is written as int64, weight as
+        float64 and contains as one byte per point
+    chunksize: int, optional
+        Number of points to search at a time
+    dtype: numpy dtype, optional
+        Data type of raw binary input files, default 'f8'
+    sort, cache, min_weight:
+        As for the Mangle methods; min_weight applies to contains only
+
+    output
+    ------
+    The number of points processed
+    """
+    outfiles = {
+        'polyid': polyid,
+        'weight': weight,
+        'contains': contains,
+    }
+    outfiles = {k: v for k, v in outfiles.items() if v is not None}
+    if not outfiles:
+        raise ValueError("send at least one of polyid, weight, contains")
+
+    ra_info, dec_info = _open_inputs(ra_file, dec_file, dtype)
+    chunks = _read_chunks(ra_info, dec_info, _check_chunksize(chunksize))
+    npoints = ra_info['size']
+
+    need_id = 'polyid' in outfiles or 'weight' in outfiles
+    if need_id:
+        search_id = _get_search(mask, 'polyid_and_weight', sort, cache, None)
+
+    # without min_weight, contained is just polyid >= 0
+    need_contains = 'contains' in outfiles and (
+        min_weight is not None or not need_id
+    )
+    if need_contains:
+        search_contains = _get_search(
+            mask, 'contains', sort, cache, min_weight,
+        )
+
+    with ExitStack() as stack:
+        outputs = {
+            name: stack.enter_context(
+                _open_output(fname, OUTPUT_DTYPES[name], npoints)
+            )
+            for name, fname in outfiles.items()
+        }
+        writer = stack.enter_context(ThreadPoolExecutor(max_workers=1))
+
+        pending = None
+        for ra, dec in _prefetch(chunks):
+            results = {}
+            if need_id:
+                results['polyid'], results['weight'] = search_id(ra, dec)
+
+            if need_contains:
+                results['contains'] = search_contains(ra, dec)
+            elif 'contains' in outfiles:
+                results['contains'] = results['polyid'] >= 0
+
+            # keep at most one chunk of results waiting to be written
+            if pending is not None:
+                pending.result()
+            pending = writer.submit(_write_results, outputs, results)
+
+        if pending is not None:
+            pending.result()
+
+    return npoints
+
+
+def _get_search(mask, what, sort, cache, min_weight):
+    """
+    get a function searching one chunk of long double ra, dec
+    """
+    if what in ('contains', 'count_contained'):
+        kw = {'min_weight': min_weight}
+    elif what in ('polyid', 'weight', 'polyid_and_weight'):
+        kw = {}
+    else:
+        raise ValueError("bad query type: '%s'" % what)
+
+    method = getattr(mask, what)
+
+    def search(ra, dec):
+        if ra.size == 0:
+            return _empty_result(what)
+        return method(ra, dec, sort=sort, cache=cache, **kw)
+
+    return search
+
+
+def _empty_result(what):
+    """
+    the result of a search of no points, which the C code does not accept
+    """
+    if what == 'count_contained':
+        return 0
+    elif what == 'polyid':
+        return numpy.zeros(0, dtype=numpy.int64)
+    elif what == 'weight':
+        return numpy.zeros(0, dtype=longdouble)
+    elif what == 'contains':
+        return numpy.zeros(0, dtype=numpy.bool_)
+    else:
+        return (
+            numpy.zeros(0, dtype=numpy.int64),
+            numpy.zeros(0, dtype=longdouble),
+        )
+
+
+def _prefetch(chunks):
+    """
+    yield the chunks as contiguous long double arrays, converting the next
+    chunk in a thread while the caller works on the current one
+    """
+    it = iter(chunks)
+    with ThreadPoolExecutor(max_workers=1) as pool:
+        future = pool.submit(_next_chunk, it)
+        while True:
+            chunk = future.result()
+            if chunk is None:
+                break
+            future = pool.submit(_next_chunk, it)
+            yield chunk
+
+
+def _next_chunk(it):
+    """
+    get the next chunk as contiguous long double arrays, or None at the end
+    """
+    try:
+        ra, dec = next(it)
+    except StopIteration:
+        return None
+
+    ra = numpy.ascontiguousarray(ra, dtype=longdouble).ravel()
+    dec = numpy.ascontiguousarray(dec, dtype=longdouble).ravel()
+    if ra.size != dec.size:
+        raise ValueError(
+            "ra and dec chunks have different sizes: %d %d" % (
+                ra.size, dec.size,
+            )
+        )
+    return ra, dec
+
+
+def _read_chunks(ra_info, dec_info, chunksize):
+    """
+    read matching chunks from the ra and dec files
+    """
+    with open(ra_info['fname'], 'rb') as ra_fobj, \
+            open(dec_info['fname'], 'rb') as dec_fobj:
+
+        ra_fobj.seek(ra_info['offset'])
+        dec_fobj.seek(dec_info['offset'])
+
+        nleft = ra_info['size']
+        while nleft > 0:
+            nread = min(nleft, chunksize)
+            ra = _read_values(ra_fobj, ra_info, nread)
+            dec = _read_values(dec_fobj, dec_info, nread)
+            nleft -= nread
+            yield ra, dec
+
+
+def _read_values(fobj, info, n):
+    data = numpy.fromfile(fobj, dtype=info['dtype'], count=n)
+    if data.size != n:
+        raise IOError(
+            "expected %d values from %s, got %d" % (
+                n, info['fname'], data.size,
+            )
+        )
+    return data
+
+
+def _write_results(outputs, results):
+    for name, fobj in outputs.items():
+        numpy.asarray(results[name], dtype=OUTPUT_DTYPES[name]).tofile(fobj)
+
+
+def _check_chunksize(chunksize):
+    chunksize = int(chunksize)
+    if chunksize < 1:
+        raise ValueError("chunksize must be > 0, got %d" % chunksize)
+    return chunksize
+
+
+def _open_inputs(ra_file, dec_file, dtype):
+    """
+    get the layout of the ra and dec files, checking they match
+    """
+    ra_info = _input_info(ra_file, dtype)
+    dec_info = _input_info(dec_file, dtype)
+    if ra_info['size'] != dec_info['size']:
+        raise ValueError(
+            "ra and dec files have different sizes: %d %d" % (
+                ra_info['size'], dec_info['size'],
+            )
+        )
+    return ra_info, dec_info
+
+
+def _input_info(fname, dtype):
+    """
+    get the offset to the data, the dtype and number of values in a .npy
+    or raw binary file
+    """
+    if str(fname).endswith('.npy'):
+        with open(fname, 'rb') as fobj:
+            version = npy_format.read_magic(fobj)
+            if version == (1, 0):
+                header = npy_format.read_array_header_1_0(fobj)
+            elif version == (2, 0):
+                header = npy_format.read_array_header_2_0(fobj)
+            else:
+                raise ValueError(
+                    "unsupported .npy version %s in %s" % (version, fname)
+                )
+            offset = fobj.tell()
+
+        shape, _, dtype = header
+        if len(shape) != 1:
+            raise ValueError(
+                "expected 1-d data in %s, got shape %s" % (fname, shape)
+            )
+        size = shape[0]
+    else:
+        dtype = numpy.dtype(dtype)
+        offset = 0
+        nbytes = os.path.getsize(fname)
+        if nbytes % dtype.itemsize != 0:
+            raise ValueError(
+                "size of %s is not a multiple of %d bytes" % (
+                    fname, dtype.itemsize,
+                )
+            )
+        size = nbytes // dtype.itemsize
+
+    return {'fname': fname, 'offset': offset, 'dtype': dtype, 'size': size}
+
+
+def _open_output(fname, dtype, n):
+    """
+    open a .npy or raw binary file for n values, writing the .npy header
+    """
+    fobj = open(fname, 'wb')
+    if str(fname).endswith('.npy'):
+        npy_format.write_array_header_1_0(fobj, {
+            'descr': npy_format.dtype_to_descr(numpy.dtype(dtype)),
+            'fortran_order': False,
+            'shape': (n,),
+        })
+    return fobj
@@ -12,7 +12,11 @@ ext = Extension("pymangle._mangle", ["pymangle/_mangle.c",
                                      "pymangle/pixel.c",
                                      "pymangle/point.c",
                                      "pymangle/stack.c",
-                                     "pymangle/rand.c"])
+                                     "pymangle/sort.c",
+                                     "pymangle/rand.c",
+                                     "pymangle/parallel.c"],
+                extra_compile_args=["-pthread", "-fno-math-errno"],
+                extra_link_args=["-pthread"])
 
 
 class BuildExt(build_ext.build_ext):
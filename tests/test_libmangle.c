@@ -0,0 +1,307 @@
+/*
+ * check that a program can read and search a mask through libmangle alone
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "mangle.h"
+
+// a cap of radius 60 degrees around the north pole, and its complement, so
+// every point is in exactly one polygon
+static const char* MASK_TEXT =
+    "2 polygons\n"
+    "balkanized\n"
+    "polygon 0 ( 1 caps, 1 weight, 0 pixel, 3.14159265358979 str):\n"
+    " 0 0 1 0.5\n"
+    "polygon 1 ( 1 caps, 0.5 weight, 0 pixel, 9.42477796076938 str):\n"
+    " 0 0 1 -0.5\n";
+
+#define CHECK(cond) do {                                             \
+    if (!(cond)) {                                                   \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                 \
+                __FILE__, __LINE__, #cond);                          \
+        nfail++;                                                     \
+    }                                                                \
+} while (0)
+
+/*
+ * the center of every pixel at a level lies in that pixel, and RING pixels
+ * convert to the NESTED pixel holding their center
+ */
+static int check_pixel_centers(char pixeltype, int64 pixelres)
+{
+    int nbad=0;
+    int64 first=0, npix=0, pix=0;
+    struct Point pt;
+
+    if (!pixel_level_range(pixeltype, pixelres, &first, &npix)) {
+        return 1;
+    }
+    for (pix=first; pix<first+npix; pix++) {
+        if (!pixel_center(pixeltype, pixelres, pix, &pt)
+                || get_pixel(pixeltype, pixelres, &pt) != pix) {
+            nbad++;
+        }
+        if (pixeltype == 'h' && (pixelres & (pixelres-1)) == 0
+                && healpix_ring2nest(pixelres, pix)
+                   != get_pixel('n', pixelres, &pt)) {
+            nbad++;
+        }
+    }
+    if (nbad > 0) {
+        fprintf(stderr, "%d bad pixel centers for '%c' %ld\n",
+                nbad, pixeltype, pixelres);
+    }
+    return nbad;
+}
+
+int main(void)
+{
+    int nfail=0;
+    char fname[] = "/tmp/test_libmangle_XXXXXX";
+    FILE* fptr=NULL;
+    int fd=0;
+    struct MangleMask* mask=NULL;
+    struct MangleQueryState state;
+
+    long double ra[4] = {10.0, 200.0, 45.0, 300.0};
+    long double dec[4] = {80.0, 45.0, 0.0, -60.0};
+    int64 expected_id[4] = {0, 0, 1, 1};
+    int64 poly_id[4];
+    long double weight[4];
+    int i=0;
+
+    fd = mkstemp(fname);
+    CHECK(fd >= 0);
+    fptr = fdopen(fd, "w");
+    fputs(MASK_TEXT, fptr);
+    fclose(fptr);
+
+    mask = mangle_new();
+    CHECK(mask != NULL);
+    CHECK(mangle_read(mask, fname));
+    CHECK(mask->npoly == 2);
+
+    // the exact areas agree with those in the file
+    CHECK(mangle_compute_areas(mask, 1, 2));
+    CHECK(fabsl(mask->poly_vec->data[0].area - M_PI) < 1.0e-14);
+    CHECK(fabsl(mask->poly_vec->data[1].area - 3*M_PI) < 1.0e-14);
+    CHECK(fabsl(mask->total_area - 4*M_PI) < 1.0e-14);
+
+    mangle_query_state_init(&state, 1);
+    CHECK(mangle_polyid_and_weight_many(mask, &state, 4, ra, dec,
+                                        poly_id, weight));
+    for (i=0; i<4; i++) {
+        CHECK(poly_id[i] == expected_id[i]);
+        CHECK(weight[i] == (expected_id[i] == 0 ? 1.0 : 0.5));
+    }
+
+    // points in the 0.5 weight polygon are dropped by min_weight
+    {
+        unsigned char packed[1];
+        size_t ncontained=0;
+
+        mangle_query_state_set_min_weight(&state, 0.5);
+        CHECK(mangle_contains_many(mask, &state, 0, 4, ra, dec,
+                                   packed, &ncontained));
+        CHECK(ncontained == 2);
+        CHECK(packed[0] == 0xc0);
+        mangle_query_state_init(&state, 1);
+    }
+
+    // same answers through a HEALPix index, in pixel order
+    CHECK(mangle_build_healpix_index(mask, 8, 'n'));
+    CHECK(mangle_polyid_and_weight_sorted(mask, &state, 4, ra, dec,
+                                          poly_id, NULL));
+    for (i=0; i<4; i++) {
+        CHECK(poly_id[i] == expected_id[i]);
+    }
+
+    // the index has every pixel, each listing the polygons over it
+    {
+        struct MangleIndexStats stats;
+        CHECK(mangle_index_stats(mask, 3, &stats));
+        CHECK(stats.npix == 12*8*8);
+        CHECK(stats.nempty == 0);
+        CHECK(stats.max <= 2);
+        CHECK(stats.ntop == 3 && stats.top_count[0] == stats.max);
+        mangle_index_stats_free(&stats);
+    }
+
+    // the northern hemisphere holds all of polygon 0 and the z < 0.5 part
+    // of polygon 1, as a cap, a band over all ra and two quarter boxes
+    {
+        long double cra[1] = {0.0}, cdec[1] = {90.0}, crad[1] = {90.0};
+        long double ramin[2] = {0.0, 270.0}, ramax[2] = {360.0, 90.0};
+        long double decmin[2] = {0.0, 0.0}, decmax[2] = {90.0, 90.0};
+        long double area[2], warea[2];
+
+        CHECK(mangle_cap_areas(mask, &state, 2, 1, cra, cdec, crad,
+                               area, warea));
+        CHECK(fabsl(area[0] - 2*M_PI) < 1.0e-12);
+        CHECK(fabsl(warea[0] - 1.5*M_PI) < 1.0e-12);
+
+        CHECK(mangle_box_areas(mask, &state, 2, 2, ramin, ramax,
+                               decmin, decmax, area, warea));
+        CHECK(fabsl(area[0] - 2*M_PI) < 1.0e-12);
+        CHECK(fabsl(area[1] - M_PI) < 1.0e-12);
+
+        mangle_query_state_set_min_weight(&state, 0.5);
+        CHECK(mangle_cap_areas(mask, &state, 1, 1, cra, cdec, crad,
+                               area, NULL));
+        CHECK(fabsl(area[0] - M_PI) < 1.0e-12);
+        mangle_query_state_init(&state, 1);
+    }
+
+    // the hemisphere reaches both polygons, and a box above dec=30 only
+    // the first
+    {
+        long double cra[1] = {0.0}, cdec[1] = {90.0}, crad[1] = {90.0};
+        long double ramin[1] = {10.0}, ramax[1] = {20.0};
+        long double decmin[1] = {70.0}, decmax[1] = {80.0};
+        int64 offsets[2];
+        struct i64stack* polys=i64stack_new(0);
+
+        CHECK(mangle_cap_polygons(mask, &state, 2, 1, cra, cdec, crad,
+                                  offsets, polys));
+        CHECK(offsets[0] == 0 && offsets[1] == 2);
+        CHECK(polys->data[0] == 0 && polys->data[1] == 1);
+
+        CHECK(mangle_box_polygons(mask, &state, 1, 1, ramin, ramax,
+                                  decmin, decmax, offsets, polys));
+        CHECK(offsets[1] == 1 && polys->size == 1 && polys->data[0] == 0);
+        i64stack_delete(polys);
+    }
+
+    // the mask covers the sky, with no boundary; without the 0.5 weight
+    // polygon the boundary is at dec=30
+    {
+        long double dist[4];
+
+        CHECK(mangle_boundary_distance(mask, &state, 2, 4, ra, dec, 70,
+                                       dist));
+        for (i=0; i<4; i++) {
+            CHECK(dist[i] == 70);
+        }
+
+        mangle_query_state_set_min_weight(&state, 0.5);
+        CHECK(mangle_boundary_distance(mask, &state, 1, 4, ra, dec, 70,
+                                       dist));
+        CHECK(fabsl(dist[0] - 50) < 1.0e-9);
+        CHECK(fabsl(dist[1] - 15) < 1.0e-9);
+        CHECK(fabsl(dist[2] - 30) < 1.0e-9);
+        CHECK(dist[3] == 70);
+        mangle_query_state_init(&state, 1);
+    }
+
+    // with the second polygon masked by a zero weight, a cap just north of
+    // dec=30 has masked area in its two southern quadrants only, which adds
+    // up with the unmasked area of the cap
+    {
+        long double zero_weights[2] = {0.0, 0.0};
+        long double weights[2] = {1.0, 0.0};
+        long double cra[2] = {0.0, 120.0}, cdec[2] = {31.0, 20.0};
+        long double crad[2] = {5.0, 5.0}, area[1];
+        double frac[8];
+        int flags[2];
+
+        CHECK(mangle_set_weights(mask, weights));
+        CHECK(mangle_check_quadrants(mask, &state, 2, 2, cra, cdec, crad,
+                                     0.5, flags, frac));
+        CHECK(flags[0] == (1 | 2 | 4));
+        CHECK(flags[1] == 1);
+        CHECK(frac[0] == 0 && frac[1] == 0);
+        CHECK(frac[2] > 0.5 && fabs(frac[2] - frac[3]) < 1.0e-12);
+        CHECK(frac[4] == 1 && frac[7] == 1);
+
+        mangle_query_state_set_min_weight(&state, 0);
+        CHECK(mangle_cap_areas(mask, &state, 1, 1, cra, cdec, crad,
+                               area, NULL));
+        CHECK(fabsl(area[0] - 0.5*M_PI*(1 - cosl(5*D2R))
+                              *(4 - frac[2] - frac[3])) < 1.0e-12);
+        mangle_query_state_init(&state, 1);
+
+        // about 2000 random points per quadrant agree, for any threads
+        {
+            double rfrac[8];
+            int rflags[2];
+
+            CHECK(mangle_check_quadrants_random(mask, &state, 1, 2, cra, cdec,
+                                                crad, 100, 0.5, 0, 42,
+                                                rflags, rfrac));
+            CHECK(rflags[0] == flags[0] && rflags[1] == flags[1]);
+            for (i=0; i<8; i++) {
+                CHECK(fabs(rfrac[i] - frac[i]) < 0.05);
+            }
+            CHECK(mangle_check_quadrants_random(mask, &state, 2, 2, cra, cdec,
+                                                crad, 100, 0.5, 0, 42,
+                                                rflags, frac));
+            CHECK(memcmp(rfrac, frac, sizeof(rfrac)) == 0);
+
+            // stopping early decides the same, the unmasked quadrants
+            // without finding any masked points
+            CHECK(mangle_check_quadrants_random(mask, &state, 1, 2, cra, cdec,
+                                                crad, 100, 0.5, 0.01, 42,
+                                                rflags, rfrac));
+            CHECK(rflags[0] == flags[0] && rflags[1] == flags[1]);
+            CHECK(rfrac[0] == 0 && rfrac[1] == 0);
+        }
+
+        // no polygon has weight > 0
+        CHECK(mangle_set_weights(mask, zero_weights));
+        CHECK(mangle_check_quadrants(mask, &state, 1, 1, cra, cdec, crad,
+                                     1.0, flags, NULL));
+        CHECK(flags[0] == 1);
+
+        weights[1] = 0.5;
+        CHECK(mangle_set_weights(mask, weights));
+    }
+
+    // every HEALPix pixel is covered, with the polygon weights, except along
+    // the edge at z=0.5 where pixels are split between the two.  Pixel
+    // centers fall on that edge, which belongs to neither polygon, so a line
+    // of the smallest pieces, 2^-6 of each edge pixel, is not counted
+    {
+        int64 nside=8, npix=12*8*8, ipix=0;
+        double map[12*8*8], sum=0;
+        long double pixarea=4*M_PI/npix;
+
+        CHECK(mangle_coverage_map(mask, &state, 'h', nside, 1, 6, 2, map));
+        for (ipix=0; ipix<npix; ipix++) {
+            CHECK(map[ipix] >= 0.5 - 1.0/64 && map[ipix] <= 1);
+            sum += map[ipix];
+        }
+        CHECK(fabsl(sum*pixarea - 2.5*M_PI) < 1.0e-2);
+
+        CHECK(mangle_coverage_map(mask, &state, 'n', nside, 0, 6, 1, map));
+        for (ipix=0; ipix<npix; ipix++) {
+            CHECK(map[ipix] >= 1 - 1.0/64 && map[ipix] <= 1);
+        }
+        CHECK(!mangle_coverage_map(mask, &state, 'n', 12, 0, 6, 1, map));
+        CHECK(!mangle_coverage_map(mask, &state, 'd', 2, 0, 6, 1, map));
+    }
+
+    mask = mangle_free(mask);
+    unlink(fname);
+
+    for (i=0; i<=5; i++) {
+        CHECK(check_pixel_centers('s', i) == 0);
+    }
+    for (i=0; i<=3; i++) {
+        CHECK(check_pixel_centers('d', i) == 0);
+    }
+    for (i=1; i<=32; i*=2) {
+        CHECK(check_pixel_centers('h', i) == 0);
+        CHECK(check_pixel_centers('n', i) == 0);
+    }
+    CHECK(check_pixel_centers('h', 7) == 0);
+
+    if (nfail > 0) {
+        fprintf(stderr, "%d checks failed\n", nfail);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# check the mangle_query tool against a mask of two polygons, a cap of
+# radius 60 degrees around the north pole and its complement
+#
+# usage: test_mangle_query.sh /path/to/mangle_query
+
+set -e
+
+query="$1"
+tmpdir=$(mktemp -d)
+trap 'rm -rf "$tmpdir"' EXIT
+
+cat > "$tmpdir/mask.ply" <<MASK
+2 polygons
+balkanized
+polygon 0 ( 1 caps, 1 weight, 0 pixel, 3.14159265358979 str):
+ 0 0 1 0.5
+polygon 1 ( 1 caps, 0.5 weight, 0 pixel, 9.42477796076938 str):
+ 0 0 1 -0.5
+MASK
+
+cat > "$tmpdir/points.csv" <<POINTS
+ra,dec
+10.0,80.0
+# a comment
+200.0 45.0
+
+45.0, 0.0
+300.0,-60.0
+POINTS
+
+cat > "$tmpdir/expected.csv" <<EXPECTED
+0,1
+0,1
+1,0.5
+1,0.5
+EXPECTED
+
+# from stdin, with the default threads and block
+"$query" -q "$tmpdir/mask.ply" < "$tmpdir/points.csv" > "$tmpdir/out.csv"
+cmp "$tmpdir/out.csv" "$tmpdir/expected.csv"
+
+# blocks of one point on several threads come out in order
+"$query" -q -t 3 -b 1 -n 4 -s -o "$tmpdir/out.csv" \
+    "$tmpdir/mask.ply" "$tmpdir/points.csv"
+cmp "$tmpdir/out.csv" "$tmpdir/expected.csv"
+
+# min weight masks the second polygon
+"$query" -q -m 0.5 "$tmpdir/mask.ply" "$tmpdir/points.csv" \
+    > "$tmpdir/out.csv"
+printf '0,1\n0,1\n-1,0\n-1,0\n' | cmp "$tmpdir/out.csv" -
+
+# binary output is 16 bytes a point
+"$query" -q --output-format binary "$tmpdir/mask.ply" "$tmpdir/points.csv" \
+    > "$tmpdir/out.bin"
+test "$(wc -c < "$tmpdir/out.bin")" -eq 64
+
+# a bad line is an error
+printf '1,2\nbad\n' > "$tmpdir/bad.csv"
+if "$query" -q "$tmpdir/mask.ply" "$tmpdir/bad.csv" > /dev/null 2>&1; then
+    echo "bad input was accepted"
+    exit 1
+fi
+
+echo "mangle_query ok"
@@ -1,8 +1,38 @@
 import os
+import re
 import tempfile
 import numpy as np
+import pytest
 
-from pymangle import Mangle
+from pymangle import Mangle, genrand_cap
+
+# a small unpixelized mask used by several tests
+NOPIXEL_TEXT = """3 polygons
+polygon                      0 ( 4 caps,            1.0000000 weight,   0.0074088006084970 str):
+-0.06081623141086969775  -0.00532073080682029988   0.99813479842186692004  -1.00000000000000000000
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000  -0.21198924639327809682
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000   1.90996127087654299359
+-0.06515425057767830486  -0.00570025830607420042   0.99785892323860347908   1.00000000000000000000
+polygon                      1 ( 4 caps,            1.0000000 weight,   0.0116826109771030 str):
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000   1.88539361956466899883
+-0.06081623141086969775  -0.00532073080682029988   0.99813479842186692004   1.00000000000000000000
+-0.05387300028307989708  -0.00471327679489840033   0.99853667176641747183  -1.00000000000000000000
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000  -0.21198924639327809682
+polygon                      2 ( 4 caps,            1.0000000 weight,   0.0022611252679780 str):
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000   1.50753836296070398149
+-0.05387300028307989708  -0.00471327679489840033   0.99853667176641747183   1.00000000000000000000
+-0.05213680212878300108  -0.00456137913876279982   0.99862953475457394426  -1.00000000000000000000
+0.08715574274765790219  -0.99619469809174554520   0.00000000000000010000  -0.21198924639327809682\n"""  # noqa
+
+
+def _random_points(n, ramin=110.0, ramax=250.0, decmin=-5.0, decmax=0.0):
+    """
+    uniform points in the box, as long doubles
+    """
+    rng = np.random.RandomState(8812)
+    ra = rng.uniform(ramin, ramax, n).astype(np.longdouble)
+    dec = rng.uniform(decmin, decmax, n).astype(np.longdouble)
+    return ra, dec
 
 
 def test_standard_unpixelized():
@@ -113,6 +143,10 @@ polygon                      2 ( 4 caps,            1.0000000 weight,   0.002261
         ra, dec = m.genrand_range(n, 100, 250, -4, 0)
         assert np.all(m.contains(ra, dec))
 
+        # inputs that need conversion, float64 arrays and scalars
+        assert np.all(m.contains(ra.astype('f8'), dec.astype('f8')))
+        assert m.contains(float(ra[0]), float(dec[0]))[0]
+
 
 def test_weight_only():
     """
@@ -257,3 +291,986 @@ polygon 4 4
 
         m = Mangle(fname)
         ra, dec = m.genrand(3)
+
+
+def test_healpix_index():
+    """
+    a HEALPix index must not change search results
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        assert m.index_pixeltype == 'u'
+
+        ra, dec = _random_points(10000)
+        ids, weights = m.polyid_and_weight(ra, dec)
+        assert np.any(ids >= 0)
+
+        for nest, pixeltype in [(True, 'n'), (False, 'h')]:
+            m.build_healpix_index(64, nest=nest)
+            assert m.index_pixeltype == pixeltype
+            assert m.index_pixelres == 64
+
+            # the long thin polygons only land in pixels near them
+            assert m.pixel_stats()['nempty'] > 0.95*12*64**2
+
+            tids, tweights = m.polyid_and_weight(ra, dec)
+            assert np.all(tids == ids)
+            assert np.all(tweights == weights)
+
+            tids, tweights = m.polyid_and_weight(ra, dec, sort=True)
+            assert np.all(tids == ids)
+            assert np.all(tweights == weights)
+
+            pix = m.calc_healpix(ra, dec)
+            assert np.all((pix >= 0) & (pix < 12*64**2))
+
+            # simple pixel numbers need a simple 's' pixelized mask
+            with pytest.raises(ValueError):
+                m.calc_simplepix(ra, dec)
+
+        # both orderings agree for nside 1
+        m.build_healpix_index(1, nest=True)
+        pix_nest = m.calc_healpix(ra, dec)
+        m.build_healpix_index(1, nest=False)
+        pix_ring = m.calc_healpix(ra, dec)
+        assert np.all(pix_nest == pix_ring)
+
+
+def test_pixelization_header(capfd):
+    """
+    valid pixelization schemes are read, including RING HEALPix with any
+    nside, while a NESTED nside that is not a power of two, or an unknown
+    scheme, is rejected
+    """
+
+    # all polygons in pixel 0, which exists in every scheme
+    text = NOPIXEL_TEXT.replace('weight,', 'weight, 0 pixel,')
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+
+        for res, pixeltype in [(8, 'n'), (6, 'h'), (4, 's')]:
+            with open(fname, 'w') as fobj:
+                fobj.write(text.replace(
+                    '3 polygons',
+                    '3 polygons\npixelization %d%s' % (res, pixeltype),
+                ))
+
+            m = Mangle(fname)
+            assert m.pixeltype == pixeltype
+            assert m.pixelres == res
+
+        for scheme, message in [('3n', 'HEALPix nside must be'),
+                                ('3x', 'Only support pix schemes')]:
+            with open(fname, 'w') as fobj:
+                fobj.write(text.replace(
+                    '3 polygons', '3 polygons\npixelization %s' % scheme,
+                ))
+
+            capfd.readouterr()
+            with pytest.raises(IOError):
+                Mangle(fname)
+            assert message in capfd.readouterr().err
+
+
+# points with SDSS 'd' pixel numbers worked out by hand.  In survey
+# coordinates, with ra rotated by -95 so the survey center ra=185, dec=32.5 is
+# at lambda=0, eta=0, lambda = -asin(x) and eta = atan2(z, y) - 32.5.  At
+# level 1 the 36 x 13 pixels start at 1, the column counting eta - 91.25 in 10
+# degree steps and the row counting (1 - sin(lambda))/2 in steps of 1/13;
+# level 2 starts at 1 + 36*13 = 469 and has 72 x 26 pixels
+SDSS_PIXELS = [
+    # ra, dec, level 1, level 2
+    (155.0, 0.0, 348, 1884),  # lambda=-30, eta=-32.5
+    (215.0, 0.0, 132, 948),  # lambda=30, eta=-32.5
+    (275.0, 60.0, 141, 966),  # lambda=30, eta=57.5
+    (275.0, -60.0, 123, 930),  # lambda=30, eta=-122.5
+    (35.0, 0.0, 330, 1848),  # lambda=-30, eta=147.5
+    (95.0, 60.0, 357, 1902),  # lambda=-30, eta=57.5
+]
+
+
+def _pixelized_mask(scheme, res, ra, dec, pix, weight=1, header=()):
+    """
+    read a mask with small polygons about the points, in the given pixels, and
+    check each point is found in its polygon, also with ra wrapped below 0 and
+    above 360, by one turn or many
+    """
+    cm = 1.0 - np.cos(np.deg2rad(0.01))
+    lines = ['%d polygons' % ra.size, 'pixelization %d%s' % (res, scheme)]
+    lines += list(header)
+    for i in range(ra.size):
+        theta, phi = np.deg2rad(90.0 - dec[i]), np.deg2rad(ra[i])
+        lines += [
+            'polygon %d ( 1 caps, %g weight, %d pixel):' % (
+                i, weight, pix[i],
+            ),
+            '%.16g %.16g %.16g %.16g' % (
+                np.sin(theta)*np.cos(phi), np.sin(theta)*np.sin(phi),
+                np.cos(theta), cm,
+            ),
+        ]
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write('\n'.join(lines) + '\n')
+
+        m = Mangle(fname)
+
+    assert m.pixeltype == scheme
+    assert m.pixelres == res
+
+    dec = dec.astype(np.longdouble)
+    for shift in [0, -360, 360, -556*360, 28*360]:
+        tra = (ra + shift).astype(np.longdouble)
+        for sort in [False, True]:
+            ids = m.polyid(tra, dec, sort=sort)
+            assert np.all(ids == np.arange(ra.size))
+
+    return m
+
+
+def test_sdss_pixelized():
+    """
+    polygons in an SDSS 'd' pixelized mask are found in their pixels, at
+    points with known pixel numbers
+    """
+    ra = np.array([p[0] for p in SDSS_PIXELS])
+    dec = np.array([p[1] for p in SDSS_PIXELS])
+
+    for res, col in [(1, 2), (2, 3)]:
+        pix = [p[col] for p in SDSS_PIXELS]
+        _pixelized_mask('d', res, ra, dec, pix)
+
+
+def _simple_pixel(ra, dec, res):
+    """
+    reference implementation of the simple 's' scheme pixel number
+    """
+    p2 = 2**res
+    start = sum(4**i for i in range(res))
+    cth = np.cos(np.deg2rad(90.0 - dec))
+    n = np.maximum(np.ceil((1.0 - cth)/2*p2) - 1, 0).astype('i8')
+    m = np.floor(np.deg2rad(ra)/(2*np.pi)*p2).astype('i8')
+    return p2*n + m + start
+
+
+def test_simple_pixelized():
+    """
+    batched simple pixel numbers and searches in a simple 's' pixelized mask
+    """
+    res = 4
+    rng = np.random.RandomState(9174)
+    ra = rng.uniform(0, 360, 100)
+    dec = np.rad2deg(np.arcsin(rng.uniform(-1, 1, 100)))
+
+    pix = _simple_pixel(ra, dec, res)
+    keep = np.ones(ra.size, dtype=bool)
+    for dra, ddec in [(0.3, 0), (-0.3, 0), (0, 0.3), (0, -0.3)]:
+        keep &= _simple_pixel(ra + dra, dec + ddec, res) == pix
+    ra, dec, pix = ra[keep], dec[keep], pix[keep]
+    assert ra.size > 10
+
+    m = _pixelized_mask('s', res, ra, dec, pix, weight=2,
+                        header=['balkanized'])
+
+    # enough points to span several blocks, including a partial one
+    tra = np.tile(ra, 20).astype(np.longdouble)
+    tdec = np.tile(dec, 20).astype(np.longdouble)
+    assert np.all(m.calc_simplepix(tra, tdec) == np.tile(pix, 20))
+
+    ids, weights = m.polyid_and_weight(tra, tdec)
+    assert np.all(ids == np.tile(np.arange(ra.size), 20))
+    assert np.all(weights == 2)
+    assert np.all(m.polyid(tra, tdec) == ids)
+    assert np.all(m.weight(tra, tdec) == weights)
+    assert np.all(m.contains(tra, tdec))
+
+    assert not np.any(m.contains(tra + 1, tdec))
+
+    # sorted searches return results in the original order
+    order = np.random.RandomState(13).permutation(tra.size)
+    sids, sweights = m.polyid_and_weight(tra[order], tdec[order],
+                                         sort=True)
+    assert np.all(sids == ids[order])
+    assert np.all(sweights == weights[order])
+    assert np.all(m.polyid(tra[order], tdec[order], sort=True)
+                  == ids[order])
+    assert np.all(m.weight(tra[order], tdec[order], sort=True)
+                  == weights[order])
+    assert np.all(m.contains(tra[order], tdec[order], sort=True))
+
+    # caps a little larger than the polygons hold all of them.  The areas
+    # are computed when reading, as the file has none
+    expected = 2*np.pi*(1.0 - np.cos(np.deg2rad(0.01)))*np.rad2deg(1.0)**2
+    assert np.allclose(m.get_areas(), expected, rtol=1.0e-9)
+    assert np.allclose(m.area_in_cap(ra, dec, 0.02), expected, rtol=1.0e-9)
+
+    # the last hit cache does not change results for a balkanized mask,
+    # whether points repeat or not
+    assert m.is_balkanized
+    for sort in [False, True]:
+        for tr, td in [(tra, tdec), (tra[order], tdec[order]),
+                       (tra + 1, tdec)]:
+            cids, cweights = m.polyid_and_weight(tr, td, sort=sort,
+                                                 cache=True)
+            tids, tweights = m.polyid_and_weight(tr, td, sort=sort)
+            assert np.all(cids == tids)
+            assert np.all(cweights == tweights)
+
+
+def test_nonfinite_pixelized():
+    """
+    non-finite coordinates give pixel numbers outside the index, which hold
+    no polygons, in sorted searches as in unsorted ones
+    """
+    lines = ['1 polygons', 'pixelization 1s', 'balkanized',
+             'polygon 0 ( 1 caps, 1 weight, 3 pixel):',
+             '0 0 -1 0.5']
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write('\n'.join(lines) + '\n')
+
+        m = Mangle(fname)
+
+    ra = np.array([np.nan, np.inf, -np.inf, 160.0], dtype=np.longdouble)
+    dec = np.zeros(ra.size, dtype=np.longdouble) - 80
+    for sort in [False, True]:
+        assert np.all(m.polyid(ra, dec, sort=sort) == [-1, -1, -1, 0])
+        assert np.all(m.weight(ra, dec, sort=sort) == [0, 0, 0, 1])
+
+
+def test_min_weight():
+    """
+    contains with min_weight masks points in low weight polygons, with and
+    without the pixel index
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        for header in ['', 'balkanized\n']:
+            with open(fname, 'w') as fobj:
+                fobj.write(NOPIXEL_TEXT.replace(
+                    'polygons\n', 'polygons\n' + header, 1,
+                ))
+
+            m = Mangle(fname)
+            ra, dec = _random_points(10000)
+            for nside in [None, 64]:
+                if nside is not None:
+                    m.build_healpix_index(nside)
+
+                m.set_weights(np.array([1.0, 0.0, 0.5], dtype=np.longdouble))
+                weights = m.weight(ra, dec)
+
+                cont = m.contains(ra, dec, min_weight=0)
+                assert np.any(cont)
+                assert np.all(cont == (weights > 0))
+                assert np.all(m.contains(ra, dec, min_weight=0.5)
+                              == (weights > 0.5))
+                assert np.all(m.contains(ra, dec, min_weight=0, cache=True)
+                              == cont)
+                assert np.all(m.contains(ra, dec, min_weight=0, sort=True)
+                              == cont)
+
+                # all positive, the main index is used
+                m.set_weights(np.ones(3, dtype=np.longdouble))
+                assert np.all(m.contains(ra, dec, min_weight=0)
+                              == m.contains(ra, dec))
+
+
+def test_compute_areas():
+    """
+    areas computed from the caps match those in the file, and are filled in
+    for files without them
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        file_areas = m.get_areas().copy()
+        file_total = m.get_area()
+
+        m.compute_areas(nthreads=2)
+        assert np.allclose(m.get_areas(), file_areas, rtol=1.0e-12)
+        assert np.allclose(m.get_area(), file_total, rtol=1.0e-12)
+
+        with open(fname, 'w') as fobj:
+            fobj.write(re.sub(r',\s*[0-9.]+ str\)', ')', NOPIXEL_TEXT))
+
+        m = Mangle(fname)
+        assert np.allclose(m.get_areas(), file_areas, rtol=1.0e-12)
+        assert np.allclose(m.get_area(), file_total, rtol=1.0e-12)
+
+        # files written without areas hold 0 str
+        with open(fname, 'w') as fobj:
+            fobj.write(re.sub(r'[0-9.]+ str\)', '0 str)', NOPIXEL_TEXT))
+
+        m = Mangle(fname)
+        assert np.allclose(m.get_areas(), file_areas, rtol=1.0e-12)
+        assert np.allclose(m.get_area(), file_total, rtol=1.0e-12)
+
+
+def test_area_in_cap_header_area():
+    """
+    areas inside caps come from the polygon caps, not the area in the file,
+    so they grow smoothly as the cap passes the polygon
+    """
+    cm = 1.0 - np.cos(np.deg2rad(1.0))
+    text = '\n'.join([
+        '1 polygons',
+        'polygon 0 ( 1 caps, 1 weight, 0 pixel, 1e-9 str):',
+        '0 0 1 %.16g' % cm,
+    ]) + '\n'
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(text)
+
+        m = Mangle(fname)
+
+    expected = 2*np.pi*cm*np.rad2deg(1.0)**2
+    area = m.area_in_cap(np.zeros(4), np.full(4, 90.0),
+                         np.array([0.5, 0.99, 1.01, 2.0]))
+    assert np.all(np.diff(area) >= 0)
+    assert area[0] < area[1] < expected
+    assert np.allclose(area[2:], expected, rtol=1.0e-12)
+
+
+def test_region_areas():
+    """
+    masked areas in caps and boxes, with and without an index, agree with
+    the polygon areas and with random points
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        total = m.get_area()
+
+        # uniform points in a box around the mask
+        rng = np.random.RandomState(3318)
+        sdec = np.sin(np.deg2rad([-6.0, 1.0]))
+        ra = rng.uniform(100.0, 260.0, 1000000)
+        dec = np.rad2deg(np.arcsin(rng.uniform(sdec[0], sdec[1], ra.size)))
+        box_area = 160*np.rad2deg(sdec[1] - sdec[0])
+        cont = m.contains(ra.astype(np.longdouble), dec.astype(np.longdouble))
+
+        cosd = (
+            np.sin(np.deg2rad(dec))*np.sin(np.deg2rad(-3.0))
+            + np.cos(np.deg2rad(dec))*np.cos(np.deg2rad(-3.0))
+            * np.cos(np.deg2rad(ra - 160.0))
+        )
+        in_cap = cont & (cosd >= np.cos(np.deg2rad(20.0)))
+        in_box = cont & (ra >= 150) & (ra <= 200) & (dec >= -4) & (dec <= -1)
+
+        for nside in [None, 16]:
+            if nside is not None:
+                m.build_healpix_index(nside)
+
+            assert np.allclose(m.area_in_cap(0, 90, 180), total)
+            assert np.allclose(m.area_in_box(0, 360, -90, 90), total)
+            assert np.allclose(m.area_in_box(100, 260, -10, 10), total)
+
+            # boxes split in ra, wrapping or not, add up
+            parts = m.area_in_box([100, 180], [180, 100], -10, 10)
+            assert np.allclose(parts.sum(), total)
+            assert np.allclose(m.area_in_box(200, 100, -5, 0),
+                               m.area_in_box(200, 360, -5, 0))
+            assert m.area_in_cap(0, 0, 10)[0] == 0
+            assert m.area_in_box(150, 200, -1, -4)[0] == 0
+
+            area = m.area_in_cap(160, -3, 20)[0]
+            assert abs(area - box_area*in_cap.mean()) < 0.3
+            area = m.area_in_box(150, 200, -4, -1, nthreads=2)[0]
+            assert abs(area - box_area*in_box.mean()) < 0.3
+
+            m.set_weights(np.array([1.0, 0.0, 0.5], dtype=np.longdouble))
+            areas = m.get_areas()
+            area, warea = m.area_in_cap(0, 90, 180, weighted=True)
+            assert np.allclose(warea, (areas*m.weights).sum())
+            assert np.allclose(m.area_in_cap(0, 90, 180, min_weight=0),
+                               areas[0] + areas[2])
+            m.set_weights(np.ones(3, dtype=np.longdouble))
+
+
+def test_region_polygons():
+    """
+    the polygons found in caps and boxes are those with some area inside
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+
+        rng = np.random.RandomState(771)
+        n = 300
+        ra = rng.uniform(90, 270, n)
+        dec = rng.uniform(-10, 5, n)
+        radius = 10**rng.uniform(-2, 1, n)
+        ramin = rng.uniform(0, 360, n)
+        ramax = (ramin + 10**rng.uniform(-2, 2.5, n)) % 360
+        decmin = rng.uniform(-10, 5, n)
+        decmax = decmin + 10**rng.uniform(-2, 1, n)
+
+        # the area of each polygon inside the regions, from one-hot weights
+        cap_areas = np.zeros((n, 3))
+        box_areas = np.zeros((n, 3))
+        for i in range(3):
+            weights = np.zeros(3, dtype=np.longdouble)
+            weights[i] = 1
+            m.set_weights(weights)
+            cap_areas[:, i] = m.area_in_cap(ra, dec, radius, weighted=True)[1]
+            box_areas[:, i] = m.area_in_box(
+                ramin, ramax, decmin, decmax, weighted=True,
+            )[1]
+        m.set_weights(np.ones(3, dtype=np.longdouble))
+
+        for nside in [None, 16]:
+            if nside is not None:
+                m.build_healpix_index(nside)
+
+            polys, offsets = m.polygons_in_cap(ra, dec, radius, nthreads=2)
+            assert offsets.size == n + 1
+            for i in range(n):
+                expected = np.flatnonzero(cap_areas[i] > 0)
+                assert np.all(polys[offsets[i]:offsets[i+1]] == expected)
+
+            polys, offsets = m.polygons_in_box(ramin, ramax, decmin, decmax)
+            for i in range(n):
+                expected = np.flatnonzero(box_areas[i] > 0)
+                assert np.all(polys[offsets[i]:offsets[i+1]] == expected)
+
+            polys, offsets = m.polygons_in_cap([0, 180], [90, -3], 180)
+            assert np.all(polys == [0, 1, 2, 0, 1, 2])
+            assert np.all(offsets == [0, 3, 6])
+
+            polys, offsets = m.polygons_in_box(0, 360, -90, 90, min_weight=2)
+            assert polys.size == 0 and np.all(offsets == 0)
+
+
+def test_genrand_cap():
+    """
+    random points are in the cap and its quadrants, uniform in area
+    """
+
+    ra0, dec0, radius = 200.0, 10.0, 2.0
+    ra, dec = genrand_cap(100000, ra0, dec0, radius)
+    assert ra.dtype == np.longdouble
+
+    ra, dec = np.deg2rad(ra.astype('f8')), np.deg2rad(dec.astype('f8'))
+    cosd = (np.sin(dec)*np.sin(np.deg2rad(dec0))
+            + np.cos(dec)*np.cos(np.deg2rad(dec0))
+            * np.cos(ra - np.deg2rad(ra0)))
+    assert np.all(cosd >= np.cos(np.deg2rad(radius)) - 1.0e-12)
+
+    # a quarter of the area is within half the radius, near enough
+    inner = (1 - np.cos(np.deg2rad(radius/2)))
+    inner /= (1 - np.cos(np.deg2rad(radius)))
+    frac = (cosd > np.cos(np.deg2rad(radius/2))).mean()
+    assert abs(frac - inner) < 0.01
+
+    for quadrant, east, north in [(1, 1, 1), (2, -1, 1),
+                                  (3, -1, -1), (4, 1, -1)]:
+        ra, dec = genrand_cap(1000, ra0, dec0, 0.5,
+                              quadrant=quadrant, dtype='f8')
+        assert ra.dtype == np.float64
+        assert np.all(np.sign(ra - ra0) == east)
+        assert (np.sign(dec - dec0) == north).mean() > 0.99
+
+    with pytest.raises(ValueError):
+        genrand_cap(10, ra0, dec0, radius, dtype='f4')
+
+
+def test_check_quadrants_exact():
+    """
+    exact quadrant flags are consistent with the centers and thresholds,
+    and the same with threads or an index
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+
+        rng = np.random.RandomState(4410)
+        ra = rng.uniform(100, 260, 500)
+        dec = rng.uniform(-8, 3, 500)
+        angle = rng.uniform(0.05, 3, ra.size)
+        inside = m.contains(ra, dec)
+        assert inside.sum() > 10
+
+        flags = m.check_quadrants(ra, dec, angle, exact=True,
+                                  max_masked_fraction=0.5)
+        assert np.all((flags & 1) == inside)
+        assert np.all(flags[~inside] == 0)
+        assert np.any(flags[inside] > 1) and np.any(flags[inside] < 31)
+
+        # a larger threshold only adds quadrants
+        more = m.check_quadrants(ra, dec, angle, exact=True,
+                                 max_masked_fraction=0.8)
+        assert np.all((more & flags) == flags)
+
+        assert np.all(m.check_quadrants(ra, dec, angle, exact=True,
+                                        max_masked_fraction=1.01)
+                      == np.where(inside, 31, 0))
+        assert np.all(m.check_quadrants(ra, dec, angle, exact=True,
+                                        max_masked_fraction=0)
+                      == inside)
+
+        m.build_healpix_index(32)
+        assert np.all(m.check_quadrants(ra, dec, angle, exact=True,
+                                        max_masked_fraction=0.5,
+                                        nthreads=2) == flags)
+
+
+def test_check_quadrants_seed():
+    """
+    random quadrant flags depend only on the seed, and mostly agree with the
+    exact ones
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+
+        rng = np.random.RandomState(4810)
+        ra = rng.uniform(100, 260, 300)
+        dec = rng.uniform(-8, 3, 300)
+        angle = rng.uniform(0.05, 1, ra.size)
+        inside = m.contains(ra, dec)
+
+        flags = m.check_quadrants(ra, dec, angle, density=3000,
+                                  max_masked_fraction=0.5, seed=11)
+        assert np.all((flags & 1) == inside)
+        assert np.all(m.check_quadrants(ra, dec, angle, density=3000,
+                                        max_masked_fraction=0.5, seed=11,
+                                        nthreads=3) == flags)
+
+        exact = m.check_quadrants(ra, dec, angle, exact=True,
+                                  max_masked_fraction=0.5)
+        assert (flags == exact).mean() > 0.9
+
+        # stopping early rarely changes a flag
+        early = m.check_quadrants(ra, dec, angle, density=3000,
+                                  max_masked_fraction=0.5, seed=11,
+                                  error_rate=0.01)
+        assert (early == flags).mean() > 0.9
+        assert np.all(m.check_quadrants(ra, dec, angle, density=3000,
+                                        max_masked_fraction=0.5, seed=11,
+                                        error_rate=0.01, nthreads=3) == early)
+
+        m.build_healpix_index(32)
+        assert np.all(m.check_quadrants(ra, dec, angle, density=3000,
+                                        max_masked_fraction=0.5,
+                                        seed=11) == flags)
+
+
+def _circle_points(ra, dec, radius, n):
+    """
+    n points at angular distance radius around ra,dec, all in degrees
+    """
+    phi = np.linspace(0, 2*np.pi, n, endpoint=False)
+    theta, ra, radius = np.deg2rad([90 - dec, ra, radius])
+    center = np.array([np.sin(theta)*np.cos(ra), np.sin(theta)*np.sin(ra),
+                       np.cos(theta)])
+    east = np.array([-np.sin(ra), np.cos(ra), 0.0])
+    north = np.cross(center, east)
+    vec = (np.cos(radius)*center[:, None]
+           + np.sin(radius)*(np.cos(phi)*east[:, None]
+                             + np.sin(phi)*north[:, None]))
+    return (np.rad2deg(np.arctan2(vec[1], vec[0])) % 360,
+            np.rad2deg(np.arcsin(vec[2])))
+
+
+def test_boundary_distance():
+    """
+    points closer than the boundary distance are all in or all out of the
+    mask, like the point itself, and some just beyond differ
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+
+        rng = np.random.RandomState(5301)
+        n = 20
+        ra = rng.uniform(100, 260, n)
+        dec = rng.uniform(-8, 3, n)
+        max_radius = 5.0
+
+        for min_weight in [None, 0.5]:
+            if min_weight is not None:
+                m.set_weights(np.array([1.0, 0.0, 1.0], dtype=np.longdouble))
+                m.build_healpix_index(16)
+
+            dist = m.boundary_distance(ra, dec, max_radius,
+                                       min_weight=min_weight, nthreads=2)
+            assert dist.size == n and np.all(dist > 0)
+            assert np.all(dist <= max_radius)
+
+            inside = m.contains(ra, dec, min_weight=min_weight)
+            for i in range(n):
+                for frac in [0.5, 0.999]:
+                    cra, cdec = _circle_points(ra[i], dec[i],
+                                               frac*dist[i], 2000)
+                    cont = m.contains(cra, cdec, min_weight=min_weight)
+                    assert np.all(cont == inside[i])
+                if dist[i] < max_radius:
+                    cra, cdec = _circle_points(ra[i], dec[i],
+                                               1.001*dist[i], 4000)
+                    cont = m.contains(cra, cdec, min_weight=min_weight)
+                    assert np.any(cont != inside[i])
+
+        # no boundary within reach
+        dist = m.boundary_distance(0.0, 60.0, 10.0)
+        assert dist[0] == 10.0
+
+    # points on or next to the axis of a circular mask, such as a star at
+    # the center of its own mask, and at the antipode
+    theta, phi = np.deg2rad(60.0), np.deg2rad(40.0)
+    text = '\n'.join([
+        '1 polygons',
+        'polygon 0 ( 1 caps, 1 weight, 0 pixel):',
+        '%.16g %.16g %.16g %.16g' % (
+            np.sin(theta)*np.cos(phi), np.sin(theta)*np.sin(phi),
+            np.cos(theta), 1.0 - np.cos(np.deg2rad(3.0)),
+        ),
+    ]) + '\n'
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(text)
+
+        m = Mangle(fname)
+
+        for offset in [0.0, 1.0e-12, 1.0e-7]:
+            dist = m.boundary_distance(40.0 + offset, 30.0, 10.0)
+            assert np.allclose(dist, 3.0, atol=1.0e-6)
+
+        dist = m.boundary_distance(220.0, -30.0, 180.0)
+        assert np.allclose(dist, 177.0)
+
+
+def test_coverage_map():
+    """
+    covered fractions of simple pixels agree with the exact areas in the
+    pixel boxes, and HEALPix maps add up to the mask area in either order
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        m.set_weights(np.array([1.0, 0.5, 0.25], dtype=np.longdouble))
+        areas = m.get_areas()
+        total = areas.sum()
+        wtotal = (areas*m.weights).sum()
+
+        res = 7
+        p2 = 2**res
+        cmap = m.coverage_map(res, 'simple', weighted=False, depth=6)
+        assert cmap.size == p2*p2
+        assert cmap.min() >= 0 and cmap.max() <= 1
+
+        pixarea = 4*np.pi*np.rad2deg(1)**2/p2**2
+        assert abs(cmap.sum()*pixarea - total) < 0.01*total
+
+        ipix = np.flatnonzero(cmap)
+        n, j = ipix//p2, ipix % p2
+        decmin = np.rad2deg(np.arcsin(1 - 2*(n + 1)/p2))
+        decmax = np.rad2deg(np.arcsin(1 - 2*n/p2))
+        exact = m.area_in_box(360*j/p2, 360*(j + 1)/p2, decmin, decmax)
+        assert np.abs(cmap[ipix] - exact/pixarea).max() < 0.01
+
+        nside = 32
+        pixarea = 4*np.pi*np.rad2deg(1)**2/(12*nside**2)
+        ring = m.coverage_map(nside, depth=6, nthreads=2)
+        nest = m.coverage_map(nside, 'nest', depth=6)
+        assert abs(ring.sum()*pixarea - wtotal) < 0.01*wtotal
+        assert np.allclose(np.sort(ring), np.sort(nest))
+
+        cmap = m.coverage_map(nside, 'nest', weighted=False, depth=6,
+                              min_weight=0.3)
+        expected = areas[0] + areas[1]
+        assert abs(cmap.sum()*pixarea - expected) < 0.01*expected
+
+        # the same map with an index
+        m.build_healpix_index(16)
+        assert np.allclose(m.coverage_map(nside, 'nest', depth=6), nest)
+
+        with pytest.raises(ValueError):
+            m.coverage_map(nside, 'galactic')
+        with pytest.raises(ValueError):
+            m.coverage_map(12, 'nest')
+        # resolutions whose maps could not be sized
+        with pytest.raises(ValueError):
+            m.coverage_map(2**30, 'nest')
+        with pytest.raises(ValueError):
+            m.coverage_map(31, 'simple')
+
+
+def test_count_contained():
+    """
+    count_contained and packed contains agree with contains
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        m.set_weights(np.array([1.0, 0.0, 0.5], dtype=np.longdouble))
+        empty = np.zeros(0)
+        assert m.count_contained(empty, empty) == 0
+        assert m.contains(empty, empty, packed=True).size == 0
+
+        for n in [1, 8, 1001]:
+            ra, dec = _random_points(n)
+            for nside in [None, 64]:
+                if nside is not None:
+                    m.build_healpix_index(nside)
+
+                for kw in [{}, {'sort': True}, {'min_weight': 0.5}]:
+                    cont = m.contains(ra, dec, **kw)
+                    assert m.count_contained(ra, dec, **kw) == cont.sum()
+
+                    bits = m.contains(ra, dec, packed=True, **kw)
+                    assert bits.dtype == np.uint8
+                    assert bits.size == (n + 7) // 8
+                    assert np.all(np.unpackbits(bits, count=n) == cont)
+
+
+def test_stream():
+    """
+    chunked queries from iterables and files match the in-memory results
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        m.set_weights(np.array([1.0, 0.0, 0.5], dtype=np.longdouble))
+        ra, dec = _random_points(1001)
+        poly_id, weight = m.polyid_and_weight(ra, dec)
+        cont = m.contains(ra, dec, min_weight=0)
+
+        chunks = [(ra[i:i+100], dec[i:i+100]) for i in range(0, 1001, 100)]
+        chunks.insert(1, (ra[:0], dec[:0]))
+        res = list(m.query_chunks(chunks, what='polyid'))
+        assert len(res) == len(chunks)
+        assert np.all(np.concatenate(res) == poly_id)
+
+        counts = m.query_chunks(chunks, what='count_contained', min_weight=0)
+        assert sum(counts) == cont.sum()
+
+        ra_file = os.path.join(tmpdir, 'ra.npy')
+        dec_file = os.path.join(tmpdir, 'dec.bin')
+        np.save(ra_file, ra)
+        dec.astype('f4').tofile(dec_file)
+
+        out = {
+            'polyid': os.path.join(tmpdir, 'polyid.npy'),
+            'weight': os.path.join(tmpdir, 'weight.bin'),
+            'contains': os.path.join(tmpdir, 'contains.npy'),
+        }
+        n = m.query_files(ra_file, dec_file, chunksize=128, dtype='f4',
+                          **out)
+        assert n == ra.size
+
+        # dec was truncated to float32 on the way
+        poly_id32 = m.polyid(ra, dec.astype('f4'))
+        assert np.all(np.load(out['polyid']) == poly_id32)
+        assert np.all(np.load(out['contains']) == (poly_id32 >= 0))
+        weight32 = np.fromfile(out['weight'], dtype='f8')
+        assert np.all(weight32 == m.weight(ra, dec.astype('f4')))
+
+        np.save(ra_file, ra[:10])
+        with pytest.raises(ValueError):
+            m.query_files(ra_file, dec_file, **out)
+
+
+def test_threads():
+    """
+    searches and randoms from several threads at once give the same results
+    as serial calls
+    """
+    from concurrent.futures import ThreadPoolExecutor
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        m.build_healpix_index(64)
+
+        ra, dec = _random_points(20000)
+        ids = m.polyid(ra, dec)
+
+        def search(sort):
+            return m.polyid(ra, dec, sort=sort)
+
+        with ThreadPoolExecutor(max_workers=4) as pool:
+            results = list(pool.map(search, [False, True]*4))
+            randoms = list(pool.map(m.genrand, [1000]*4))
+
+        for tids in results:
+            assert np.all(tids == ids)
+
+        for rra, rdec in randoms:
+            assert np.all(m.contains(rra, rdec))
+
+
+def test_stats():
+    """
+    search counts are collected only when enabled, and the pixel hits follow
+    the index
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        ra, dec = _random_points(1000)
+
+        assert m.stats() is None
+        m.enable_stats()
+
+        ids = m.polyid(ra, dec)
+        nhit = np.sum(ids >= 0)
+
+        stats = m.stats()
+        assert stats['npoints'] == ra.size
+        assert stats['hits'] == nhit
+        assert stats['misses'] == ra.size - nhit
+        assert stats['pixel_lookups'] == 0
+        assert stats['pixel_hits'].size == 0
+        # every polygon is checked for a miss
+        assert stats['polys_scanned'] >= 3*stats['misses']
+        assert stats['caps_tested'] >= stats['polys_scanned']
+
+        m.build_healpix_index(64)
+        stats = m.stats()
+        assert stats['npoints'] == 0
+        assert stats['pixel_hits'].size == 12*64**2
+
+        m.polyid(ra, dec, sort=True)
+        stats = m.stats()
+        assert stats['pixel_lookups'] == ra.size
+        assert stats['pixel_hits'].sum() == nhit
+        assert stats['polys_per_point'] < 3
+
+        m.reset_stats()
+        assert m.stats()['npoints'] == 0
+
+        m.enable_stats(False)
+        assert m.stats() is None
+
+
+def test_load_report():
+    """
+    the load report has every phase, and the memory follows the index
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        report = m.load_report()
+
+        phases = report['phases']
+        assert list(phases) == [
+            'header', 'polygons', 'area', 'pixel_map', 'weight_index',
+        ]
+        assert all(phase['seconds'] >= 0 for phase in phases.values())
+        assert 'nbytes' not in phases['area']
+        assert phases['header']['nbytes'] == len(fname) + 1
+        assert report['seconds'] > 0
+
+        memory = report['memory']
+        assert phases['polygons']['nbytes'] == (
+            memory['polygons'] + memory['caps']
+        )
+        assert memory['pixel_index'] == 0
+        assert memory['total'] == sum(
+            memory[key] for key in memory if key != 'total'
+        )
+
+        m.build_healpix_index(16)
+        memory = m.load_report()['memory']
+        assert memory['pixel_index'] > 12*16**2*8
+
+
+def test_pixel_stats():
+    """
+    the pixel stats are consistent, and the top pixel centers are in the
+    top pixels
+    """
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+        fname = os.path.join(tmpdir, 'test.ply')
+        with open(fname, 'w') as fobj:
+            fobj.write(NOPIXEL_TEXT)
+
+        m = Mangle(fname)
+        with pytest.raises(ValueError):
+            m.pixel_stats()
+
+        for nest in [True, False]:
+            m.build_healpix_index(64, nest=nest)
+            stats = m.pixel_stats(ntop=5)
+
+            assert stats['pixeltype'] == ('n' if nest else 'h')
+            assert stats['npix'] == 12*64**2
+            hist = stats['hist']
+            assert hist.sum() == stats['npix']
+            assert hist.size == stats['max'] + 1
+            assert hist[0] == stats['nempty']
+            assert np.isclose(
+                stats['mean'],
+                np.sum(np.arange(hist.size)*hist)/stats['npix'],
+            )
+
+            counts = stats['top_counts']
+            assert counts.size == 5
+            assert counts[0] == stats['max']
+            assert np.all(np.diff(counts) <= 0)
+            pix = m.calc_healpix(stats['top_ra'], stats['top_dec'])
+            assert np.all(pix == stats['top_pixels'])
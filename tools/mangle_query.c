@@ -0,0 +1,849 @@
+/*
+ * Query a mangle mask for points read from a file or stdin, without python.
+ *
+ * The main thread reads the points in blocks, a pool of worker threads
+ * searches them with mangle_polyid_and_weight_many, and a writer thread
+ * writes the results in input order, so reading, searching and writing
+ * overlap.  The blocks move through a ring of 2*threads+2 slots
+ *
+ *     FREE -> READ -> QUERYING -> QUERIED -> FREE
+ *
+ * so at most that many blocks are held in memory whatever the input size.
+ *
+ * Input is ra,dec in degrees, either CSV text with ra and dec in the first
+ * two columns, separated by commas or white space, or binary native float64
+ * ra,dec pairs.  In CSV input blank lines and lines starting with # are
+ * skipped, as is a first line that is not numbers, taken to be a header.
+ *
+ * Output is CSV "polyid,weight" lines, or binary records of an int64 polyid
+ * and a float64 weight, one for each input point.  Points outside the mask
+ * have polyid -1 and weight 0.
+ *
+ * The number of points, times and throughput are written to stderr at the
+ * end, unless --quiet.  The read, query and write times overlap, and the
+ * query time is summed over the threads.
+ *
+ * usage
+ *   mangle_query [options] mask.ply [input]
+ *
+ *   input                  file to read, default or - for stdin
+ *   -o, --output=FILE      file to write, default stdout
+ *   -f, --format=FMT       csv or binary for input and output, default csv
+ *   --input-format=FMT     format of the input only
+ *   --output-format=FMT    format of the output only
+ *   -w, --weights=FILE     read the polygon weights from FILE
+ *   -t, --threads=N        number of worker threads, default the number of
+ *                          online cpus
+ *   -b, --block=N          points in each block, default 65536
+ *   -n, --nside=N          search with a NESTED HEALPix index of this nside
+ *   -s, --sort             search each block in pixel order
+ *   -c, --cache            check the last polygon hit first
+ *   -m, --min-weight=W     treat polygons with weight <= W as masked
+ *   -q, --quiet            do not print the summary
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "mangle.h"
+
+#define QUERY_DEFAULT_BLOCK 65536
+
+enum query_format {
+    QUERY_CSV,
+    QUERY_BINARY
+};
+
+enum query_slot_state {
+    SLOT_FREE,
+    SLOT_READ,
+    SLOT_QUERYING,
+    SLOT_QUERIED
+};
+
+struct QueryConfig {
+    const char* maskfile;
+    const char* input;
+    const char* output;
+    const char* weightfile;
+    int input_format;
+    int output_format;
+    long nthreads;
+    long block;
+    long nside;
+    int sort;
+    int cache;
+    int use_min_weight;
+    long double min_weight;
+    int quiet;
+};
+
+struct QuerySlot {
+    int state;
+    size_t n;
+    long double* ra;
+    long double* dec;
+    int64* poly_id;
+    long double* weight;
+};
+
+// binary output record
+struct QueryRecord {
+    int64 poly_id;
+    double weight;
+};
+
+struct QueryPipeline {
+    const struct QueryConfig* config;
+    const struct MangleMask* mask;
+    FILE* fout;
+
+    // protects everything below, and the states of the slots
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t nslots;
+    struct QuerySlot* slots;
+
+    // sequence numbers of the next blocks to read, query and write; block
+    // seq is held in slot seq % nslots
+    size_t nread;
+    size_t nqueried;
+    size_t nwritten;
+    int eof;
+
+    // set on the first error, which stops all threads
+    int failed;
+    char err[_MANGLE_LARGE_BUFFSIZE];
+
+    size_t npoints;
+    double read_seconds;
+    double query_seconds;
+    double write_seconds;
+};
+
+static double query_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9*ts.tv_nsec;
+}
+
+static void usage(FILE* fptr)
+{
+    fprintf(fptr,
+        "usage: mangle_query [options] mask.ply [input]\n"
+        "\n"
+        "Find the polygon id and weight for ra,dec points in degrees.\n"
+        "\n"
+        "  input                  file to read, default or - for stdin\n"
+        "  -o, --output=FILE      file to write, default stdout\n"
+        "  -f, --format=FMT       csv or binary for input and output,\n"
+        "                         default csv\n"
+        "  --input-format=FMT     format of the input only\n"
+        "  --output-format=FMT    format of the output only\n"
+        "  -w, --weights=FILE     read the polygon weights from FILE\n"
+        "  -t, --threads=N        number of worker threads, default the\n"
+        "                         number of online cpus\n"
+        "  -b, --block=N          points in each block, default %d\n"
+        "  -n, --nside=N          search with a NESTED HEALPix index\n"
+        "  -s, --sort             search each block in pixel order\n"
+        "  -c, --cache            check the last polygon hit first\n"
+        "  -m, --min-weight=W     treat polygons with weight <= W as masked\n"
+        "  -q, --quiet            do not print the summary\n"
+        "\n"
+        "CSV input has ra,dec in the first two columns; binary input is\n"
+        "float64 ra,dec pairs.  CSV output is polyid,weight lines; binary\n"
+        "output is int64 polyid, float64 weight records.\n",
+        QUERY_DEFAULT_BLOCK);
+}
+
+static int parse_format(const char* arg, int* format)
+{
+    if (0 == strcmp(arg, "csv")) {
+        *format = QUERY_CSV;
+    } else if (0 == strcmp(arg, "binary")) {
+        *format = QUERY_BINARY;
+    } else {
+        fprintf(stderr, "mangle_query: format must be csv or binary, "
+                        "got '%s'\n", arg);
+        return 0;
+    }
+    return 1;
+}
+
+static int parse_long(const char* name, const char* arg, long min, long* val)
+{
+    char* end=NULL;
+
+    errno = 0;
+    *val = strtol(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || *val < min) {
+        fprintf(stderr, "mangle_query: %s must be an integer >= %ld, "
+                        "got '%s'\n", name, min, arg);
+        return 0;
+    }
+    return 1;
+}
+
+enum {
+    OPT_INPUT_FORMAT=256,
+    OPT_OUTPUT_FORMAT
+};
+
+/*
+ * returns 1 to run, 0 on error and -1 if help was printed
+ */
+static int parse_args(int argc, char** argv, struct QueryConfig* config)
+{
+    static struct option long_options[] = {
+        {"output",        required_argument, NULL, 'o'},
+        {"format",        required_argument, NULL, 'f'},
+        {"input-format",  required_argument, NULL, OPT_INPUT_FORMAT},
+        {"output-format", required_argument, NULL, OPT_OUTPUT_FORMAT},
+        {"weights",       required_argument, NULL, 'w'},
+        {"threads",       required_argument, NULL, 't'},
+        {"block",         required_argument, NULL, 'b'},
+        {"nside",         required_argument, NULL, 'n'},
+        {"sort",          no_argument,       NULL, 's'},
+        {"cache",         no_argument,       NULL, 'c'},
+        {"min-weight",    required_argument, NULL, 'm'},
+        {"quiet",         no_argument,       NULL, 'q'},
+        {"help",          no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt=0;
+    char* end=NULL;
+
+    memset(config, 0, sizeof(struct QueryConfig));
+    config->input_format = QUERY_CSV;
+    config->output_format = QUERY_CSV;
+    config->nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (config->nthreads < 1) {
+        config->nthreads = 1;
+    }
+    config->block = QUERY_DEFAULT_BLOCK;
+
+    while ((opt = getopt_long(argc, argv, "o:f:w:t:b:n:scm:qh",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'o':
+                config->output = optarg;
+                break;
+            case 'f':
+                if (!parse_format(optarg, &config->input_format)) {
+                    return 0;
+                }
+                config->output_format = config->input_format;
+                break;
+            case OPT_INPUT_FORMAT:
+                if (!parse_format(optarg, &config->input_format)) {
+                    return 0;
+                }
+                break;
+            case OPT_OUTPUT_FORMAT:
+                if (!parse_format(optarg, &config->output_format)) {
+                    return 0;
+                }
+                break;
+            case 'w':
+                config->weightfile = optarg;
+                break;
+            case 't':
+                if (!parse_long("threads", optarg, 1, &config->nthreads)) {
+                    return 0;
+                }
+                break;
+            case 'b':
+                if (!parse_long("block", optarg, 1, &config->block)) {
+                    return 0;
+                }
+                break;
+            case 'n':
+                if (!parse_long("nside", optarg, 1, &config->nside)) {
+                    return 0;
+                }
+                break;
+            case 's':
+                config->sort = 1;
+                break;
+            case 'c':
+                config->cache = 1;
+                break;
+            case 'm':
+                config->min_weight = strtold(optarg, &end);
+                if (end == optarg || *end != '\0') {
+                    fprintf(stderr, "mangle_query: bad min-weight '%s'\n",
+                            optarg);
+                    return 0;
+                }
+                config->use_min_weight = 1;
+                break;
+            case 'q':
+                config->quiet = 1;
+                break;
+            case 'h':
+                usage(stdout);
+                return -1;
+            default:
+                usage(stderr);
+                return 0;
+        }
+    }
+
+    if (optind >= argc || argc - optind > 2) {
+        usage(stderr);
+        return 0;
+    }
+    config->maskfile = argv[optind];
+    if (argc - optind == 2 && 0 != strcmp(argv[optind+1], "-")) {
+        config->input = argv[optind+1];
+    }
+    return 1;
+}
+
+/*
+ * parse ra and dec from the start of a CSV line.  Returns 1 for a point, 0
+ * for a line to skip and -1 for a bad line
+ */
+static int parse_csv_line(const char* line, long double* ra, long double* dec)
+{
+    const char* ptr=line;
+    char* end=NULL;
+
+    while (*ptr == ' ' || *ptr == '\t') {
+        ptr++;
+    }
+    if (*ptr == '\0' || *ptr == '\n' || *ptr == '\r' || *ptr == '#') {
+        return 0;
+    }
+
+    *ra = strtold(ptr, &end);
+    if (end == ptr) {
+        return -1;
+    }
+    ptr = end;
+    while (*ptr == ' ' || *ptr == '\t') {
+        ptr++;
+    }
+    if (*ptr == ',') {
+        ptr++;
+    }
+
+    *dec = strtold(ptr, &end);
+    if (end == ptr || (*end != '\0' && strchr(" \t\r\n,", *end) == NULL)) {
+        return -1;
+    }
+    return 1;
+}
+
+struct QueryReader {
+    FILE* fptr;
+    int format;
+
+    // for CSV
+    char* line;
+    size_t linecap;
+    size_t lineno;
+
+    // for binary
+    double* buff;
+};
+
+/*
+ * read up to max points into ra and dec.  Returns the number read, fewer
+ * than max only at the end of the input, or -1 on error
+ */
+static long read_csv_block(struct QueryReader* self,
+                           size_t max,
+                           long double* ra,
+                           long double* dec,
+                           char* err)
+{
+    size_t n=0;
+    int status=0;
+
+    while (n < max) {
+        if (getline(&self->line, &self->linecap, self->fptr) < 0) {
+            if (ferror(self->fptr)) {
+                snprintf(err, _MANGLE_LARGE_BUFFSIZE,
+                         "error reading input: %s", strerror(errno));
+                return -1;
+            }
+            break;
+        }
+        self->lineno++;
+
+        status = parse_csv_line(self->line, &ra[n], &dec[n]);
+        if (status < 0) {
+            if (self->lineno == 1) {
+                // a header
+                continue;
+            }
+            snprintf(err, _MANGLE_LARGE_BUFFSIZE,
+                     "could not read ra,dec from line %zu", self->lineno);
+            return -1;
+        }
+        if (status > 0) {
+            n++;
+        }
+    }
+    return (long) n;
+}
+
+static long read_binary_block(struct QueryReader* self,
+                              size_t max,
+                              long double* ra,
+                              long double* dec,
+                              char* err)
+{
+    size_t nitems=0, i=0;
+
+    nitems = fread(self->buff, sizeof(double), 2*max, self->fptr);
+    if (nitems < 2*max && ferror(self->fptr)) {
+        snprintf(err, _MANGLE_LARGE_BUFFSIZE,
+                 "error reading input: %s", strerror(errno));
+        return -1;
+    }
+    if (nitems % 2 != 0) {
+        snprintf(err, _MANGLE_LARGE_BUFFSIZE,
+                 "binary input ends part way through a ra,dec pair");
+        return -1;
+    }
+
+    for (i=0; i<nitems/2; i++) {
+        ra[i] = self->buff[2*i];
+        dec[i] = self->buff[2*i+1];
+    }
+    return (long) (nitems/2);
+}
+
+/*
+ * call with the lock held
+ */
+static void pipeline_fail(struct QueryPipeline* self, const char* err)
+{
+    if (!self->failed) {
+        self->failed = 1;
+        snprintf(self->err, _MANGLE_LARGE_BUFFSIZE, "%s", err);
+    }
+    pthread_cond_broadcast(&self->cond);
+}
+
+/*
+ * read blocks into free slots until the end of the input
+ */
+static void pipeline_read(struct QueryPipeline* self, struct QueryReader* reader)
+{
+    const struct QueryConfig* config=self->config;
+    struct QuerySlot* slot=NULL;
+    char err[_MANGLE_LARGE_BUFFSIZE];
+    long n=0;
+    int failed=0;
+    double tm=0;
+
+    while (1) {
+        pthread_mutex_lock(&self->lock);
+        slot = &self->slots[self->nread % self->nslots];
+        while (!self->failed && slot->state != SLOT_FREE) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        failed = self->failed;
+        pthread_mutex_unlock(&self->lock);
+        if (failed) {
+            break;
+        }
+
+        // the slot is ours until marked read
+        tm = query_now();
+        if (reader->format == QUERY_CSV) {
+            n = read_csv_block(reader, config->block, slot->ra, slot->dec, err);
+        } else {
+            n = read_binary_block(reader, config->block,
+                                  slot->ra, slot->dec, err);
+        }
+        tm = query_now() - tm;
+
+        pthread_mutex_lock(&self->lock);
+        self->read_seconds += tm;
+        if (n < 0) {
+            pipeline_fail(self, err);
+        } else if (n > 0) {
+            slot->n = n;
+            slot->state = SLOT_READ;
+            self->nread++;
+            pthread_cond_broadcast(&self->cond);
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        if (n < config->block) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&self->lock);
+    self->eof = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+}
+
+static void* pipeline_worker(void* arg)
+{
+    struct QueryPipeline* self=arg;
+    const struct QueryConfig* config=self->config;
+    struct MangleQueryState state;
+    struct QuerySlot* slot=NULL;
+    int status=0;
+    double tm=0;
+
+    mangle_query_state_init(&state, config->cache);
+    if (config->use_min_weight) {
+        mangle_query_state_set_min_weight(&state, config->min_weight);
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (1) {
+        while (!self->failed
+                && self->nqueried == self->nread
+                && !self->eof) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        if (self->failed || self->nqueried == self->nread) {
+            break;
+        }
+
+        slot = &self->slots[self->nqueried % self->nslots];
+        slot->state = SLOT_QUERYING;
+        self->nqueried++;
+        pthread_mutex_unlock(&self->lock);
+
+        tm = query_now();
+        if (config->sort) {
+            status = mangle_polyid_and_weight_sorted(
+                self->mask, &state, slot->n, slot->ra, slot->dec,
+                slot->poly_id, slot->weight);
+        } else {
+            status = mangle_polyid_and_weight_many(
+                self->mask, &state, slot->n, slot->ra, slot->dec,
+                slot->poly_id, slot->weight);
+        }
+        tm = query_now() - tm;
+
+        pthread_mutex_lock(&self->lock);
+        self->query_seconds += tm;
+        if (!status) {
+            pipeline_fail(self, state.err);
+            break;
+        }
+        slot->state = SLOT_QUERIED;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    return NULL;
+}
+
+static int write_block(struct QueryPipeline* self,
+                       const struct QuerySlot* slot,
+                       struct QueryRecord* records)
+{
+    size_t i=0;
+
+    if (self->config->output_format == QUERY_CSV) {
+        for (i=0; i<slot->n; i++) {
+            fprintf(self->fout, "%ld,%.17g\n",
+                    slot->poly_id[i], (double) slot->weight[i]);
+        }
+    } else {
+        for (i=0; i<slot->n; i++) {
+            records[i].poly_id = slot->poly_id[i];
+            records[i].weight = slot->weight[i];
+        }
+        fwrite(records, sizeof(struct QueryRecord), slot->n, self->fout);
+    }
+    return !ferror(self->fout);
+}
+
+/*
+ * write the queried blocks in order
+ */
+static void* pipeline_writer(void* arg)
+{
+    struct QueryPipeline* self=arg;
+    struct QuerySlot* slot=NULL;
+    struct QueryRecord* records=NULL;
+    int status=0;
+    double tm=0;
+
+    if (self->config->output_format == QUERY_BINARY) {
+        records = calloc(self->config->block, sizeof(struct QueryRecord));
+        if (!records) {
+            pthread_mutex_lock(&self->lock);
+            pipeline_fail(self, "could not allocate output records");
+            pthread_mutex_unlock(&self->lock);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (1) {
+        slot = &self->slots[self->nwritten % self->nslots];
+        while (!self->failed
+                && !(self->nwritten < self->nread
+                     && slot->state == SLOT_QUERIED)
+                && !(self->eof && self->nwritten == self->nread)) {
+            pthread_cond_wait(&self->cond, &self->lock);
+        }
+        if (self->failed || self->nwritten == self->nread) {
+            break;
+        }
+        pthread_mutex_unlock(&self->lock);
+
+        tm = query_now();
+        status = write_block(self, slot, records);
+        tm = query_now() - tm;
+
+        pthread_mutex_lock(&self->lock);
+        self->write_seconds += tm;
+        if (!status) {
+            pipeline_fail(self, "error writing output");
+            break;
+        }
+        self->npoints += slot->n;
+        slot->state = SLOT_FREE;
+        self->nwritten++;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->lock);
+
+    free(records);
+    return NULL;
+}
+
+static void pipeline_free_slots(struct QueryPipeline* self)
+{
+    size_t i=0;
+
+    if (self->slots) {
+        for (i=0; i<self->nslots; i++) {
+            free(self->slots[i].ra);
+            free(self->slots[i].dec);
+            free(self->slots[i].poly_id);
+            free(self->slots[i].weight);
+        }
+        free(self->slots);
+        self->slots=NULL;
+    }
+}
+
+static int pipeline_alloc_slots(struct QueryPipeline* self)
+{
+    size_t i=0, block=self->config->block;
+    struct QuerySlot* slot=NULL;
+
+    self->nslots = 2*self->config->nthreads + 2;
+    self->slots = calloc(self->nslots, sizeof(struct QuerySlot));
+    if (!self->slots) {
+        return 0;
+    }
+    for (i=0; i<self->nslots; i++) {
+        slot = &self->slots[i];
+        slot->ra = calloc(block, sizeof(long double));
+        slot->dec = calloc(block, sizeof(long double));
+        slot->poly_id = calloc(block, sizeof(int64));
+        slot->weight = calloc(block, sizeof(long double));
+        if (!slot->ra || !slot->dec || !slot->poly_id || !slot->weight) {
+            pipeline_free_slots(self);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * run the pipeline over the input; returns 1 on success
+ */
+static int run_query(const struct QueryConfig* config,
+                     const struct MangleMask* mask,
+                     FILE* fin,
+                     FILE* fout,
+                     struct QueryPipeline* self)
+{
+    struct QueryReader reader;
+    pthread_t* workers=NULL;
+    pthread_t writer;
+    long i=0, nstarted=0;
+    int writer_started=0;
+
+    memset(self, 0, sizeof(struct QueryPipeline));
+    memset(&reader, 0, sizeof(struct QueryReader));
+    self->config = config;
+    self->mask = mask;
+    self->fout = fout;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+
+    reader.fptr = fin;
+    reader.format = config->input_format;
+
+    workers = calloc(config->nthreads, sizeof(pthread_t));
+    if (!workers || !pipeline_alloc_slots(self)) {
+        snprintf(self->err, _MANGLE_LARGE_BUFFSIZE,
+                 "could not allocate %ld blocks of %ld points",
+                 2*config->nthreads + 2, config->block);
+        self->failed = 1;
+        goto _run_query_bail;
+    }
+    if (config->input_format == QUERY_BINARY) {
+        reader.buff = calloc(2*config->block, sizeof(double));
+        if (!reader.buff) {
+            snprintf(self->err, _MANGLE_LARGE_BUFFSIZE,
+                     "could not allocate the input buffer");
+            self->failed = 1;
+            goto _run_query_bail;
+        }
+    }
+
+    for (i=0; i<config->nthreads; i++) {
+        if (pthread_create(&workers[i], NULL, pipeline_worker, self) != 0) {
+            break;
+        }
+        nstarted++;
+    }
+    if (pthread_create(&writer, NULL, pipeline_writer, self) == 0) {
+        writer_started=1;
+    }
+
+    if (nstarted < config->nthreads || !writer_started) {
+        pthread_mutex_lock(&self->lock);
+        pipeline_fail(self, "could not start the threads");
+        pthread_mutex_unlock(&self->lock);
+    } else {
+        pipeline_read(self, &reader);
+    }
+
+    for (i=0; i<nstarted; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    if (writer_started) {
+        pthread_join(writer, NULL);
+    }
+
+_run_query_bail:
+    free(reader.line);
+    free(reader.buff);
+    free(workers);
+    pipeline_free_slots(self);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+
+    return !self->failed;
+}
+
+static struct MangleMask* load_mask(const struct QueryConfig* config)
+{
+    struct MangleMask* mask=NULL;
+
+    mask = mangle_new();
+    if (!mask) {
+        fprintf(stderr, "mangle_query: could not allocate the mask\n");
+        return NULL;
+    }
+    if (!mangle_read(mask, config->maskfile)) {
+        fprintf(stderr, "mangle_query: could not read mask %s\n",
+                config->maskfile);
+        return mangle_free(mask);
+    }
+    if (config->weightfile
+            && !mangle_read_weights(mask, config->weightfile)) {
+        fprintf(stderr, "mangle_query: could not read weights %s\n",
+                config->weightfile);
+        return mangle_free(mask);
+    }
+    if (config->nside > 0
+            && !mangle_build_healpix_index(mask, config->nside, 'n')) {
+        fprintf(stderr, "mangle_query: could not build the HEALPix index\n");
+        return mangle_free(mask);
+    }
+    return mask;
+}
+
+int main(int argc, char** argv)
+{
+    int status=0, ok=0;
+    struct QueryConfig config;
+    struct QueryPipeline pipeline;
+    struct MangleMask* mask=NULL;
+    FILE* fin=stdin;
+    FILE* fout=stdout;
+    double tm_start=0, tm_load=0, tm_query=0;
+
+    status = parse_args(argc, argv, &config);
+    if (status <= 0) {
+        return status < 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    tm_start = query_now();
+    mask = load_mask(&config);
+    if (!mask) {
+        return EXIT_FAILURE;
+    }
+    tm_load = query_now() - tm_start;
+
+    if (config.input) {
+        fin = fopen(config.input, "r");
+        if (!fin) {
+            fprintf(stderr, "mangle_query: could not open %s: %s\n",
+                    config.input, strerror(errno));
+            goto _main_bail;
+        }
+    }
+    if (config.output) {
+        fout = fopen(config.output, "w");
+        if (!fout) {
+            fprintf(stderr, "mangle_query: could not open %s: %s\n",
+                    config.output, strerror(errno));
+            goto _main_bail;
+        }
+    }
+
+    tm_query = query_now();
+    ok = run_query(&config, mask, fin, fout, &pipeline);
+    if (fflush(fout) != 0 && ok) {
+        ok = 0;
+        snprintf(pipeline.err, _MANGLE_LARGE_BUFFSIZE,
+                 "error writing output: %s", strerror(errno));
+    }
+    tm_query = query_now() - tm_query;
+
+    if (!ok) {
+        fprintf(stderr, "mangle_query: %s\n", pipeline.err);
+    } else if (!config.quiet) {
+        fprintf(stderr,
+                "mangle_query: %zu points in %.3f s, %.4g points/s\n"
+                "  load %.3f s, read %.3f s, query %.3f s over %ld threads, "
+                "write %.3f s\n",
+                pipeline.npoints, tm_query,
+                tm_query > 0 ? pipeline.npoints/tm_query : 0.0,
+                tm_load, pipeline.read_seconds, pipeline.query_seconds,
+                config.nthreads, pipeline.write_seconds);
+    }
+
+_main_bail:
+    if (fin && fin != stdin) {
+        fclose(fin);
+    }
+    if (fout && fout != stdout && fclose(fout) != 0 && ok) {
+        fprintf(stderr, "mangle_query: error closing %s\n", config.output);
+        ok = 0;
+    }
+    mangle_free(mask);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}